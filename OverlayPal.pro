@@ -1,4 +1,4 @@
-QT += core qml quickcontrols2
+QT += core qml quick quickcontrols2
 CONFIG += qmltypes
 CONFIG += console
 #CONFIG += qml_debug
@@ -7,6 +7,18 @@ CONFIG += c++17
 # enable this to have a sane debugging experience.
 OVERLAYPAL_FEATURES += copy_cmpl
 
+# enable this to solve in-process with the CBC library (found via pkg-config) instead of running the CMPL executable.
+#OVERLAYPAL_FEATURES += cbc_lib
+
+contains(OVERLAYPAL_FEATURES, cbc_lib) {
+    DEFINES += OVERLAYPAL_CBC_LIB
+    CONFIG += link_pkgconfig
+    PKGCONFIG += cbc
+}
+
+# GetProcessMemoryInfo, for the peak memory in conversion reports
+win32: LIBS += -lpsapi
+
 QML_IMPORT_NAME = nes.overlay.optimiser
 QML_IMPORT_MAJOR_VERSION = 1
 
@@ -22,15 +34,28 @@ DEFINES += QT_DEPRECATED_WARNINGS
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
 SOURCES += \
+    src/cpp/ColorLookup.cpp \
+    src/cpp/ConversionArena.cpp \
+    src/cpp/ConversionReport.cpp \
+    src/cpp/ConversionCache.cpp \
     src/cpp/Export.cpp \
     src/cpp/HardwareColorsModel.cpp \
     src/cpp/OverlayPalApp.cpp \
     src/cpp/Sprite.cpp \
+    src/cpp/SpritePlacement.cpp \
     src/cpp/main.cpp \
     src/cpp/GridLayer.cpp \
+    src/cpp/HeuristicSolver.cpp \
     src/cpp/ImageUtils.cpp \
+    src/cpp/LatestJobQueue.cpp \
+    src/cpp/MilpModel.cpp \
     src/cpp/OverlayPalGuiBackend.cpp \
+    src/cpp/OverlayPalImageProvider.cpp \
+    src/cpp/OverlayModel.cpp \
     src/cpp/OverlayOptimiser.cpp \
+    src/cpp/QImageUtils.cpp \
+    src/cpp/ScratchDirectory.cpp \
+    src/cpp/SolutionReader.cpp \
     src/cpp/SubProcess.cpp \
     src/cpp/SimplePaletteModel.cpp
 
@@ -50,13 +75,27 @@ else: unix:!android: target.path = /opt/$${TARGET}/bin
 HEADERS += \
     src/cpp/Export.h \
     src/cpp/GridLayer.h \
+    src/cpp/HeuristicSolver.h \
     src/cpp/Array2D.h \
+    src/cpp/ColorLookup.h \
+    src/cpp/ColorSet.h \
+    src/cpp/ConversionArena.h \
+    src/cpp/ConversionReport.h \
+    src/cpp/ConversionCache.h \
     src/cpp/HardwareColorsModel.h \
     src/cpp/ImageUtils.h \
+    src/cpp/LatestJobQueue.h \
+    src/cpp/MilpModel.h \
     src/cpp/OverlayPalApp.h \
     src/cpp/OverlayPalGuiBackend.h \
+    src/cpp/OverlayPalImageProvider.h \
+    src/cpp/OverlayModel.h \
     src/cpp/OverlayOptimiser.h \
+    src/cpp/QImageUtils.h \
+    src/cpp/ScratchDirectory.h \
+    src/cpp/SolutionReader.h \
     src/cpp/Sprite.h \
+    src/cpp/SpritePlacement.h \
     src/cpp/SubProcess.h \
     src/cpp/SimplePaletteModel.h
 
@@ -0,0 +1,89 @@
+# Headless batch converter, sharing the conversion code with OverlayPal.pro.
+# Build into the same directory as OverlayPal to share its Cmpl/ and nespalettes/ folders,
+# or point --data-path at an existing OverlayPal installation.
+QT += core gui concurrent
+QT -= qml
+CONFIG += console
+CONFIG -= app_bundle
+CONFIG += c++17
+
+TARGET = OverlayPalBatch
+
+# enable this to solve in-process with the CBC library (found via pkg-config) instead of running the CMPL executable.
+#OVERLAYPAL_FEATURES += cbc_lib
+
+contains(OVERLAYPAL_FEATURES, cbc_lib) {
+    DEFINES += OVERLAYPAL_CBC_LIB
+    CONFIG += link_pkgconfig
+    PKGCONFIG += cbc
+}
+
+# GetProcessMemoryInfo, for the peak memory in conversion reports
+win32: LIBS += -lpsapi
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+SOURCES += \
+    src/cpp/BatchConverter.cpp \
+    src/cpp/ColorLookup.cpp \
+    src/cpp/ConversionArena.cpp \
+    src/cpp/ConversionReport.cpp \
+    src/cpp/ConversionCache.cpp \
+    src/cpp/Export.cpp \
+    src/cpp/GridLayer.cpp \
+    src/cpp/HeuristicSolver.cpp \
+    src/cpp/ImageUtils.cpp \
+    src/cpp/MilpModel.cpp \
+    src/cpp/OverlayModel.cpp \
+    src/cpp/OverlayOptimiser.cpp \
+    src/cpp/QImageUtils.cpp \
+    src/cpp/ScratchDirectory.cpp \
+    src/cpp/SolutionReader.cpp \
+    src/cpp/Sprite.cpp \
+    src/cpp/SpritePlacement.cpp \
+    src/cpp/SubProcess.cpp \
+    src/cpp/batch_main.cpp
+
+HEADERS += \
+    src/cpp/Array2D.h \
+    src/cpp/ColorLookup.h \
+    src/cpp/ColorSet.h \
+    src/cpp/ConversionArena.h \
+    src/cpp/ConversionReport.h \
+    src/cpp/ConversionCache.h \
+    src/cpp/BatchConverter.h \
+    src/cpp/Export.h \
+    src/cpp/GridLayer.h \
+    src/cpp/HeuristicSolver.h \
+    src/cpp/ImageUtils.h \
+    src/cpp/MilpModel.h \
+    src/cpp/OverlayModel.h \
+    src/cpp/OverlayOptimiser.h \
+    src/cpp/QImageUtils.h \
+    src/cpp/ScratchDirectory.h \
+    src/cpp/SolutionReader.h \
+    src/cpp/Sprite.h \
+    src/cpp/SpritePlacement.h \
+    src/cpp/SubProcess.h
+
+unix {
+    # Copy .cmpl files to $OUT_PWD/
+    QMAKE_POST_LINK += $$QMAKE_COPY_FILE $$shell_quote($$PWD/src/cmpl/FirstPass.cmpl) $$shell_quote($$OUT_PWD/FirstPass.cmpl) $$escape_expand(\\n\\t)
+    QMAKE_POST_LINK += $$QMAKE_COPY_FILE $$shell_quote($$PWD/src/cmpl/SecondPass.cmpl) $$shell_quote($$OUT_PWD/SecondPass.cmpl) $$escape_expand(\\n\\t)
+}
+
+win32 {
+    build_pass: CONFIG(debug, debug|release) {
+        OUT_PWD_WIN = $$OUT_PWD/debug
+    }
+    else: build_pass {
+        OUT_PWD_WIN = $$OUT_PWD/release
+    }
+    # Replace / with \ to make QMAKE_COPY_* work
+    PWD_WIN=$$PWD
+    PWD_WIN ~= s?/?\\?g
+    OUT_PWD_WIN ~= s?/?\\?g
+    # Copy .cmpl files to $OUT_PWD_WIN/
+    QMAKE_POST_LINK += $$QMAKE_COPY_FILE $$shell_quote($$PWD_WIN\\src\\cmpl\\FirstPass.cmpl) $$shell_quote($$OUT_PWD_WIN\\FirstPass.cmpl) $$escape_expand(\\n\\t)
+    QMAKE_POST_LINK += $$QMAKE_COPY_FILE $$shell_quote($$PWD_WIN\\src\\cmpl\\SecondPass.cmpl) $$shell_quote($$OUT_PWD_WIN\\SecondPass.cmpl) $$escape_expand(\\n\\t)
+}
@@ -0,0 +1,69 @@
+# Benchmark for the conversion pipeline over a corpus of screens: simple, color-heavy and sprite-limited
+# synthetic screens plus testimages/Bernie.png (or the images given), each with 16x16 and 8x8 cells.
+# Times color mapping, GridLayer construction, optimal shifting, both passes, sprite extraction and export,
+# and records quality metrics. Write a baseline with --write-baseline file.csv before a change, and
+# compare with --baseline file.csv after it.
+TEMPLATE = app
+QT += core gui
+QT -= qml
+CONFIG += console c++17
+CONFIG -= app_bundle
+
+TARGET = ConversionBenchmark
+
+# enable this to benchmark the in-process CBC library solver
+#OVERLAYPAL_FEATURES += cbc_lib
+
+contains(OVERLAYPAL_FEATURES, cbc_lib) {
+    DEFINES += OVERLAYPAL_CBC_LIB
+    CONFIG += link_pkgconfig
+    PKGCONFIG += cbc
+}
+
+win32: LIBS += -lpsapi
+
+# Default location of nespalettes/ and testimages/
+DEFINES += OVERLAYPAL_SOURCE_PATH=\\\"$$PWD/..\\\"
+
+SOURCES += \
+    conversion_benchmark.cpp \
+    ../src/cpp/ColorLookup.cpp \
+    ../src/cpp/ConversionArena.cpp \
+    ../src/cpp/ConversionReport.cpp \
+    ../src/cpp/ConversionCache.cpp \
+    ../src/cpp/Export.cpp \
+    ../src/cpp/GridLayer.cpp \
+    ../src/cpp/HeuristicSolver.cpp \
+    ../src/cpp/ImageUtils.cpp \
+    ../src/cpp/MilpModel.cpp \
+    ../src/cpp/OverlayModel.cpp \
+    ../src/cpp/OverlayOptimiser.cpp \
+    ../src/cpp/QImageUtils.cpp \
+    ../src/cpp/ScratchDirectory.cpp \
+    ../src/cpp/SolutionReader.cpp \
+    ../src/cpp/Sprite.cpp \
+    ../src/cpp/SpritePlacement.cpp \
+    ../src/cpp/SubProcess.cpp
+
+HEADERS += \
+    ../src/cpp/Array2D.h \
+    ../src/cpp/ColorLookup.h \
+    ../src/cpp/ColorSet.h \
+    ../src/cpp/ConversionArena.h \
+    ../src/cpp/ConversionReport.h \
+    ../src/cpp/ConversionCache.h \
+    ../src/cpp/Export.h \
+    ../src/cpp/GridLayer.h \
+    ../src/cpp/HeuristicSolver.h \
+    ../src/cpp/ImageUtils.h \
+    ../src/cpp/MilpModel.h \
+    ../src/cpp/OverlayModel.h \
+    ../src/cpp/OverlayOptimiser.h \
+    ../src/cpp/QImageUtils.h \
+    ../src/cpp/ScratchDirectory.h \
+    ../src/cpp/SolutionReader.h \
+    ../src/cpp/Sprite.h \
+    ../src/cpp/SpritePlacement.h \
+    ../src/cpp/SubProcess.h
+
+INCLUDEPATH += ../src/cpp
@@ -0,0 +1,17 @@
+# Benchmark for the CMPL solution file reader.
+# Run with a recorded solution file, e.g. secondpass_output.csv kept by "OverlayPalBatch --keep-work-files",
+# or without arguments to time a synthetic full-screen second pass solution.
+TEMPLATE = app
+CONFIG += console c++17
+CONFIG -= app_bundle qt
+
+TARGET = SolutionReaderBenchmark
+
+SOURCES += \
+    solution_reader_benchmark.cpp \
+    ../src/cpp/SolutionReader.cpp
+
+HEADERS += \
+    ../src/cpp/SolutionReader.h
+
+INCLUDEPATH += ../src/cpp
@@ -0,0 +1,481 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QImage>
+#include <QTextStream>
+
+#include "OverlayOptimiser.h"
+#include "GridLayer.h"
+#include "ImageUtils.h"
+#include "QImageUtils.h"
+#include "MilpModel.h"
+#include "Export.h"
+
+static const int ScreenWidth = 256;
+static const int ScreenHeight = 240;
+static const int GridCellColorLimit = 3;
+static const int MaxBackgroundPalettes = 4;
+static const int MaxSpritePalettes = 4;
+static const int MaxSpritesPerScanline = 8;
+
+//
+// One screen of the corpus
+//
+struct Screen
+{
+    std::string name;
+    QImage image;       // RGB, before color mapping
+};
+
+//
+// Stage times in milliseconds and quality metrics of one conversion
+//
+struct CaseResult
+{
+    std::string name;
+    int cellSize = 0;
+    std::map<std::string, double> milliseconds;
+    bool success = false;
+    int spritesPerScanline = 0;
+    int palettesUsed = 0;
+    int numSprites = 0;
+    int numBackgroundTiles = 0;
+};
+
+static const char* const StageNames[] = {"remap", "gridlayer", "shift", "firstpass", "secondpass", "sprites", "export", "convert"};
+
+//---------------------------------------------------------------------------------------------------------------------
+
+static QRgb hardwareColor(const QVector<QRgb>& hwColorTable, uint8_t c)
+{
+    return hwColorTable[c % hwColorTable.size()];
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+// Few colors in large areas - converts with background palettes alone
+static QImage simpleScreen(const QVector<QRgb>& hw)
+{
+    QImage image(ScreenWidth, ScreenHeight, QImage::Format_RGB32);
+    for(int y = 0; y < ScreenHeight; y++)
+    {
+        for(int x = 0; x < ScreenWidth; x++)
+        {
+            uint8_t c = y < 160 ? 0x21 : 0x19;
+            if(y >= 96 && y < 160 && (x / 64) % 2 == 0 && y >= 160 - (x % 64))
+                c = 0x00;
+            if(y >= 160 && (x + y) % 32 < 4)
+                c = 0x29;
+            image.setPixel(x, y, hardwareColor(hw, c));
+        }
+    }
+    return image;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+// Many colors per cell from gradients and overlapping patterns, with off-palette RGB values to remap
+static QImage colorHeavyScreen(const QVector<QRgb>& hw)
+{
+    QImage image(ScreenWidth, ScreenHeight, QImage::Format_RGB32);
+    static const uint8_t hues[] = {0x01, 0x12, 0x14, 0x16, 0x17, 0x19, 0x1B, 0x1C, 0x24, 0x26, 0x28, 0x2A, 0x30};
+    for(int y = 0; y < ScreenHeight; y++)
+    {
+        for(int x = 0; x < ScreenWidth; x++)
+        {
+            uint8_t c = hues[(y / 24 + x / 48) % sizeof(hues)];
+            if((x / 3 + y / 5) % 7 == 0)
+                c = 0x16;
+            else if((x / 8 + y / 2) % 5 == 0 && y < 120)
+                c = 0x30;
+            else if((x + y) % 13 == 0)
+                c = 0x11;
+            QRgb rgb = hardwareColor(hw, c);
+            // Slight noise, so that colors have to be matched rather than looked up
+            const int noise = ((x * 7 + y * 13) % 5) - 2;
+            rgb = qRgb(std::clamp(qRed(rgb) + noise, 0, 255), std::clamp(qGreen(rgb) - noise, 0, 255), qBlue(rgb));
+            image.setPixel(x, y, rgb);
+        }
+    }
+    return image;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+// Simple background with rows of small details that need more overlay sprites than a scanline can hold
+static QImage spriteLimitedScreen(const QVector<QRgb>& hw)
+{
+    QImage image = simpleScreen(hw);
+    static const uint8_t details[] = {0x16, 0x27, 0x2A, 0x12, 0x05, 0x38};
+    for(int row = 0; row < 4; row++)
+    {
+        const int y0 = 24 + 56 * row;
+        for(int i = 0; i < 14; i++)
+        {
+            const int x0 = 6 + 18 * i + 3 * row;
+            for(int y = 0; y < 10; y++)
+            {
+                for(int x = 0; x < 6; x++)
+                {
+                    const uint8_t c = details[(i + row + (x + y) / 3) % sizeof(details)];
+                    if((x + y) % 3 != 0 && x0 + x < ScreenWidth)
+                        image.setPixel(x0 + x, y0 + y, hardwareColor(hw, c));
+                }
+            }
+        }
+    }
+    return image;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+template<typename Function>
+static double timeMilliseconds(Function&& function)
+{
+    const auto start = std::chrono::steady_clock::now();
+    function();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+static CaseResult runCase(const Screen& screen,
+                          int cellSize,
+                          const QVector<QRgb>& hwColorTable,
+                          const QString& dataPath,
+                          const QString& workPath,
+                          OverlayOptimiser::SolverBackend solverBackend,
+                          int timeOut)
+{
+    CaseResult result;
+    result.name = screen.name;
+    result.cellSize = cellSize;
+    QImage indexedImage;
+    result.milliseconds["remap"] = timeMilliseconds([&]()
+    {
+        indexedImage = remapColorsToNES(screen.image, hwColorTable, false, true);
+    });
+    const uint8_t backgroundColor = detectBackgroundColor(indexedImage);
+    indexedImage = cropOrExtendImage(indexedImage, backgroundColor, ScreenWidth, ScreenHeight);
+    Image2D image = qImageToImage2D(indexedImage);
+    result.milliseconds["gridlayer"] = timeMilliseconds([&]()
+    {
+        GridLayer layer(backgroundColor, cellSize, cellSize, image);
+    });
+    result.milliseconds["shift"] = timeMilliseconds([&]()
+    {
+        int shiftX = 0;
+        int shiftY = 0;
+        image = shiftImageOptimal(image, backgroundColor, cellSize, cellSize, 0, cellSize - 1, 0, cellSize - 1, shiftX, shiftY);
+    });
+    // A fresh optimiser, so that no warm start carries over between repetitions
+    OverlayOptimiser optimiser;
+    optimiser.setExecutablePath(dataPath.toStdString());
+    optimiser.setWorkPath(workPath.toStdString());
+    optimiser.setSolverBackend(solverBackend);
+    std::string conversionError;
+    try
+    {
+        conversionError = optimiser.convert(image,
+                                            backgroundColor,
+                                            cellSize,
+                                            cellSize,
+                                            16,
+                                            GridCellColorLimit,
+                                            MaxBackgroundPalettes,
+                                            MaxSpritePalettes,
+                                            MaxSpritesPerScanline,
+                                            timeOut);
+    }
+    catch(const std::runtime_error& error)
+    {
+        conversionError = error.what();
+    }
+    const ConversionReport& report = optimiser.report();
+    result.milliseconds["convert"] = 1000.0 * report.totalSeconds();
+    const std::map<std::string, std::string> reportStages = {{"first pass", "firstpass"},
+                                                             {"second pass", "secondpass"},
+                                                             {"sprite extraction", "sprites"}};
+    for(const ConversionReport::Stage& stage : report.stages())
+    {
+        auto it = reportStages.find(stage.name);
+        if(it != reportStages.end())
+            result.milliseconds[it->second] += 1000.0 * stage.seconds;
+    }
+    ExportDataNES exportData;
+    result.milliseconds["export"] = timeMilliseconds([&]()
+    {
+        exportData = buildExportData(optimiser, 0xFF);
+    });
+    result.success = optimiser.conversionSuccessful() && conversionError.empty();
+    result.spritesPerScanline = optimiser.getMaxSpritesPerScanline(optimiser.spritesOverlay());
+    result.numSprites = static_cast<int>(optimiser.spritesOverlay().size());
+    result.numBackgroundTiles = static_cast<int>(exportData.bgCHR.size() / ExportDataNES::TileSize);
+    for(const Colors& palette : optimiser.palettes())
+        result.palettesUsed += palette.size() > 0;
+    return result;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+static std::string caseKey(const std::string& name, int cellSize)
+{
+    return name + " " + std::to_string(cellSize) + "x" + std::to_string(cellSize);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+// Baseline files are CSV with a header row naming the columns written by writeBaseline
+static bool writeBaseline(const QString& filename, const std::vector<CaseResult>& results)
+{
+    QFile file(filename);
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Text))
+        return false;
+    QTextStream out(&file);
+    out << "name;cells";
+    for(const char* stage : StageNames)
+        out << ";" << stage << "_ms";
+    out << ";success;spritesPerScanline;palettesUsed;sprites;bgTiles\n";
+    for(const CaseResult& result : results)
+    {
+        out << QString::fromStdString(result.name) << ";" << result.cellSize;
+        for(const char* stage : StageNames)
+        {
+            auto it = result.milliseconds.find(stage);
+            out << ";" << QString::number(it != result.milliseconds.end() ? it->second : 0.0, 'f', 3);
+        }
+        out << ";" << int(result.success) << ";" << result.spritesPerScanline << ";" << result.palettesUsed
+            << ";" << result.numSprites << ";" << result.numBackgroundTiles << "\n";
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+static std::map<std::string, CaseResult> readBaseline(const QString& filename)
+{
+    QFile file(filename);
+    if(!file.open(QIODevice::ReadOnly | QIODevice::Text))
+        throw std::runtime_error("Failed to read baseline '" + filename.toStdString() + "'");
+    QTextStream in(&file);
+    const QStringList header = in.readLine().split(';');
+    std::map<std::string, CaseResult> baseline;
+    while(!in.atEnd())
+    {
+        const QStringList fields = in.readLine().split(';');
+        if(fields.size() != header.size())
+            continue;
+        CaseResult result;
+        for(int i = 0; i < header.size(); i++)
+        {
+            const QString& column = header[i];
+            if(column == "name")
+                result.name = fields[i].toStdString();
+            else if(column == "cells")
+                result.cellSize = fields[i].toInt();
+            else if(column.endsWith("_ms"))
+                result.milliseconds[column.chopped(3).toStdString()] = fields[i].toDouble();
+            else if(column == "success")
+                result.success = fields[i].toInt() != 0;
+            else if(column == "spritesPerScanline")
+                result.spritesPerScanline = fields[i].toInt();
+            else if(column == "palettesUsed")
+                result.palettesUsed = fields[i].toInt();
+            else if(column == "sprites")
+                result.numSprites = fields[i].toInt();
+            else if(column == "bgTiles")
+                result.numBackgroundTiles = fields[i].toInt();
+        }
+        baseline[caseKey(result.name, result.cellSize)] = result;
+    }
+    return baseline;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+// Prints each case's change against the baseline, and returns the number of regressions
+static int compareToBaseline(const std::vector<CaseResult>& results, const std::map<std::string, CaseResult>& baseline, double tolerance)
+{
+    int numRegressions = 0;
+    std::printf("\n%-28s %10s %10s %7s  %s\n", "vs. baseline", "convert", "baseline", "ratio", "quality");
+    for(const CaseResult& result : results)
+    {
+        const std::string key = caseKey(result.name, result.cellSize);
+        auto it = baseline.find(key);
+        if(it == baseline.end())
+        {
+            std::printf("%-28s not in baseline\n", key.c_str());
+            continue;
+        }
+        const CaseResult& base = it->second;
+        const double ms = result.milliseconds.at("convert");
+        const double baseMs = base.milliseconds.count("convert") ? base.milliseconds.at("convert") : 0.0;
+        const double ratio = baseMs > 0.0 ? ms / baseMs : 1.0;
+        std::string quality;
+        if(base.success && !result.success)
+            quality += " FAILS";
+        if(result.spritesPerScanline > base.spritesPerScanline)
+            quality += " +" + std::to_string(result.spritesPerScanline - base.spritesPerScanline) + " sprites/scanline";
+        if(result.palettesUsed > base.palettesUsed)
+            quality += " +" + std::to_string(result.palettesUsed - base.palettesUsed) + " palettes";
+        const bool slower = ratio > tolerance;
+        if(slower || !quality.empty())
+            numRegressions++;
+        std::printf("%-28s %8.1fms %8.1fms %6.2fx %s%s\n",
+                    key.c_str(),
+                    ms,
+                    baseMs,
+                    ratio,
+                    slower ? "SLOWER" : "",
+                    quality.empty() ? (slower ? "" : "ok") : quality.c_str());
+    }
+    return numRegressions;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("ConversionBenchmark");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Times each conversion stage over a corpus of screens, records quality metrics and compares both to a baseline.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("images", "Extra images to add to the built-in corpus. Defaults to the repository's testimages/Bernie.png.", "[images...]");
+    QCommandLineOption dataPathOption("data-path", "Directory containing Cmpl/ and nespalettes/.", "dir", OVERLAYPAL_SOURCE_PATH);
+    QCommandLineOption workPathOption("work-path", "Directory for temporary solver files.", "dir", QDir::tempPath() + "/ConversionBenchmark");
+    QCommandLineOption solverOption("solver", "Solver backend: 'cmpl', 'cbc' or 'heuristic'.", "solver", cbcLibraryAvailable() ? "cbc" : "heuristic");
+    QCommandLineOption timeOutOption("timeout", "Solver timeout in seconds per pass.", "seconds", "30");
+    QCommandLineOption repetitionsOption({"r", "repetitions"}, "Convert each case this many times, keeping the fastest time of each stage.", "n", "3");
+    QCommandLineOption baselineOption("baseline", "Compare against this baseline, failing on slower or worse conversions.", "file");
+    QCommandLineOption writeBaselineOption("write-baseline", "Write the results as a new baseline.", "file");
+    QCommandLineOption toleranceOption("tolerance", "Time ratio to the baseline above which a case counts as slower.", "ratio", "1.25");
+    parser.addOptions({dataPathOption,
+                       workPathOption,
+                       solverOption,
+                       timeOutOption,
+                       repetitionsOption,
+                       baselineOption,
+                       writeBaselineOption,
+                       toleranceOption});
+    parser.process(app);
+
+    const QString dataPath = parser.value(dataPathOption);
+    const QVector<QRgb> hwColorTable = readHardwarePaletteFile(dataPath + "/nespalettes/palgen.pal");
+    if(hwColorTable.size() != 64)
+    {
+        std::cerr << "Failed to load " << (dataPath + "/nespalettes/palgen.pal").toStdString() << std::endl;
+        return 1;
+    }
+    OverlayOptimiser::SolverBackend solverBackend = OverlayOptimiser::SolverBackend::Heuristic;
+    if(parser.value(solverOption) == "cmpl")
+        solverBackend = OverlayOptimiser::SolverBackend::CmplProcess;
+    else if(parser.value(solverOption) == "cbc")
+        solverBackend = OverlayOptimiser::SolverBackend::CbcLibrary;
+    else if(parser.value(solverOption) != "heuristic")
+        parser.showHelp(1);
+    const int timeOut = parser.value(timeOutOption).toInt();
+    const int repetitions = std::max(1, parser.value(repetitionsOption).toInt());
+    QDir().mkpath(parser.value(workPathOption));
+
+    std::vector<Screen> corpus = {{"simple", simpleScreen(hwColorTable)},
+                                  {"color-heavy", colorHeavyScreen(hwColorTable)},
+                                  {"sprite-limited", spriteLimitedScreen(hwColorTable)}};
+    QStringList imageFilenames = parser.positionalArguments();
+    if(imageFilenames.isEmpty())
+        imageFilenames.append(QString(OVERLAYPAL_SOURCE_PATH) + "/testimages/Bernie.png");
+    for(const QString& filename : imageFilenames)
+    {
+        QImage image(filename);
+        if(image.isNull())
+        {
+            std::cerr << "Failed to load " << filename.toStdString() << std::endl;
+            return 1;
+        }
+        corpus.push_back({QFileInfo(filename).completeBaseName().toStdString(), image});
+    }
+
+    std::vector<CaseResult> results;
+    std::printf("%-28s", "case (ms)");
+    for(const char* stage : StageNames)
+        std::printf(" %10s", stage);
+    std::printf("  ok spr/line palettes sprites bgtiles\n");
+    for(const Screen& screen : corpus)
+    {
+        for(int cellSize : {16, 8})
+        {
+            CaseResult best;
+            for(int i = 0; i < repetitions; i++)
+            {
+                CaseResult result = runCase(screen, cellSize, hwColorTable, dataPath, parser.value(workPathOption), solverBackend, timeOut);
+                if(i == 0)
+                {
+                    best = result;
+                    continue;
+                }
+                for(auto& [stage, ms] : result.milliseconds)
+                    best.milliseconds[stage] = std::min(best.milliseconds[stage], ms);
+            }
+            std::printf("%-28s", caseKey(best.name, best.cellSize).c_str());
+            for(const char* stage : StageNames)
+                std::printf(" %10.2f", best.milliseconds[stage]);
+            std::printf("  %2s %8d %8d %7d %7d\n",
+                        best.success ? "y" : "n",
+                        best.spritesPerScanline,
+                        best.palettesUsed,
+                        best.numSprites,
+                        best.numBackgroundTiles);
+            results.push_back(best);
+        }
+    }
+
+    int numRegressions = 0;
+    try
+    {
+        if(parser.isSet(baselineOption))
+            numRegressions = compareToBaseline(results, readBaseline(parser.value(baselineOption)), parser.value(toleranceOption).toDouble());
+    }
+    catch(const std::runtime_error& error)
+    {
+        std::cerr << error.what() << std::endl;
+        return 1;
+    }
+    if(parser.isSet(writeBaselineOption) && !writeBaseline(parser.value(writeBaselineOption), results))
+    {
+        std::cerr << "Failed to write baseline " << parser.value(writeBaselineOption).toStdString() << std::endl;
+        return 1;
+    }
+    if(numRegressions > 0)
+        std::printf("%d regression(s)\n", numRegressions);
+    return numRegressions > 0 ? 1 : 0;
+}
@@ -0,0 +1,119 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <sstream>
+#include <string>
+
+#include "SolutionReader.h"
+
+//
+// Synthesize a second pass solution in CMPL's CSV layout for an image of gridWidth x gridHeight cells,
+// with every color variable present for numColors colors.
+//
+static std::string syntheticSolution(int gridWidth, int gridHeight, int numColors, int numPalettes)
+{
+    std::ostringstream ss;
+    ss << "Problem;SecondPass_withTimeOut.cmpl\n";
+    ss << "Objective status;optimal\n";
+    ss << "Variables;\n";
+    ss << "Name;Type;Activity;LowerBound;UpperBound\n";
+    for(const char* name : {"colorsOverlayGrid", "colorsOverlayFree"})
+    {
+        for(int y = 0; y < gridHeight; y++)
+            for(int x = 0; x < gridWidth; x++)
+                for(int c = 0; c < numColors; c++)
+                    ss << name << "[" << x << "," << y << "," << c << "];B;" << ((x + y + c) & 1) << ";0;1\n";
+    }
+    for(int y = 0; y < gridHeight; y++)
+        for(int x = 0; x < gridWidth; x++)
+            for(int p = 0; p < numPalettes; p++)
+                ss << "usesPaletteOverlay[" << x << "," << y << "," << p << "];B;" << (p == 0) << ";0;1\n";
+    for(int p = 0; p < numPalettes; p++)
+        for(int c = 0; c < numColors; c++)
+            ss << "palettesOverlay[" << p << "," << c << "];B;" << (c % numPalettes == p) << ";0;1\n";
+    ss << "Constraints;\n";
+    return ss.str();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+int main(int argc, char* argv[])
+{
+    std::string data;
+    std::string source;
+    int repetitions = 20;
+    if(argc > 1)
+    {
+        // Recorded solution file, mapped and parsed on every repetition
+        source = argv[1];
+    }
+    else
+    {
+        // 256x240 screen with 8x8 grid cells
+        data = syntheticSolution(32, 30, 13, 4);
+    }
+    if(argc > 2)
+        repetitions = std::max(1, std::atoi(argv[2]));
+    size_t sinkCount = 0;
+    long long sinkSum = 0;
+    CmplSolutionReader reader;
+    auto handler = [&](const int* indices, int value)
+    {
+        sinkCount++;
+        sinkSum += indices[0] + value;
+    };
+    for(const char* name : {"colorsBG", "colorsOverlay", "colorsOverlayGrid", "colorsOverlayFree", "usesPaletteBG", "usesPaletteOverlay"})
+        reader.addVariable(name, 3, handler);
+    reader.addVariable("palettesBG", 2, handler);
+    reader.addVariable("palettesOverlay", 2, handler);
+    size_t numRows = 0;
+    size_t numBytes = 0;
+    auto start = std::chrono::steady_clock::now();
+    try
+    {
+        numBytes = source.empty() ? data.size() : MappedFile(source).size();
+        start = std::chrono::steady_clock::now();
+        for(int i = 0; i < repetitions; i++)
+        {
+            if(source.empty())
+                numRows = reader.read(data.data(), data.data() + data.size());
+            else
+                numRows = reader.read(source);
+        }
+    }
+    catch(const std::runtime_error& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    auto end = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(end - start).count() / repetitions;
+    std::printf("%s: %zu bytes, %zu variable rows\n", source.empty() ? "synthetic 32x30 second pass" : source.c_str(), numBytes, numRows);
+    std::printf("%.3f ms per parse, %.1f MB/s, %.2f Mrows/s (checksum %lld)\n",
+                seconds * 1000.0,
+                numBytes / seconds / 1.0e6,
+                numRows / seconds / 1.0e6,
+                sinkSum / repetitions);
+    return sinkCount > 0 ? 0 : 1;
+}
@@ -23,14 +23,66 @@
 #include <cstdint>
 #include <cassert>
 #include <cstring>
+#include <algorithm>
+#include <type_traits>
+#include <memory>
+#include <new>
+#include <utility>
 
 //
-// Simple class for representing a 2d array
+// Default allocator for Array2D: cache line aligned, so that rows of byte images start on predictable boundaries
 //
-template<typename T>
+template<typename T, size_t Alignment = 64>
+struct AlignedAllocator
+{
+    using value_type = T;
+
+    template<typename U>
+    struct rebind
+    {
+        using other = AlignedAllocator<U, Alignment>;
+    };
+
+    AlignedAllocator() = default;
+
+    template<typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&)
+    {}
+
+    T* allocate(size_t n)
+    {
+        return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(std::max(Alignment, alignof(T)))));
+    }
+
+    void deallocate(T* p, size_t)
+    {
+        ::operator delete(p, std::align_val_t(std::max(Alignment, alignof(T))));
+    }
+
+    template<typename U>
+    bool operator==(const AlignedAllocator<U, Alignment>&) const
+    {
+        return true;
+    }
+
+    template<typename U>
+    bool operator!=(const AlignedAllocator<U, Alignment>&) const
+    {
+        return false;
+    }
+};
+
+//
+// Simple class for representing a 2d array, stored contiguously row by row.
+//
+// Moves only transfer the buffer, and assigning an array of the same size re-uses the existing buffer.
+//
+template<typename T, typename Allocator = AlignedAllocator<T>>
 class Array2D
 {
 public:
+    using allocator_type = Allocator;
+
     Array2D():
         mWidth(0),
         mHeight(0),
@@ -38,64 +90,99 @@ public:
     {
     }
 
-    Array2D(int width, int height, T initValue = T()):
-        mWidth(width),
-        mHeight(height),
+    explicit Array2D(const Allocator& allocator):
+        mAllocator(allocator),
+        mWidth(0),
+        mHeight(0),
         mData(nullptr)
     {
-        if(mWidth > 0 && mHeight > 0)
-        {
-            mData = new T[mWidth * mHeight];
-            for(size_t y = 0; y < mHeight; y++)
-            {
-                for(size_t x = 0; x < mWidth; x++)
-                {
-                    (*this)(x, y) = initValue;
-                }
-            }
-        }
+    }
+
+    Array2D(int width, int height, T initValue = T(), const Allocator& allocator = Allocator()):
+        mAllocator(allocator),
+        mWidth(0),
+        mHeight(0),
+        mData(nullptr)
+    {
+        allocate(width, height, initValue);
     }
 
     Array2D(const Array2D& other):
-        mWidth(other.width()),
-        mHeight(other.height()),
+        mAllocator(AllocatorTraits::select_on_container_copy_construction(other.mAllocator)),
+        mWidth(0),
+        mHeight(0),
         mData(nullptr)
     {
-        if(mWidth > 0 && mHeight > 0)
-        {
-            mData = new T[mWidth * mHeight];
-        }
-        initialiseFromOther(other);
+        allocateCopy(other);
+    }
+
+    // Copies into memory from the given allocator, e.g. to keep an array beyond the lifetime of its arena
+    Array2D(const Array2D& other, const Allocator& allocator):
+        mAllocator(allocator),
+        mWidth(0),
+        mHeight(0),
+        mData(nullptr)
+    {
+        allocateCopy(other);
+    }
+
+    Array2D(Array2D&& other) noexcept:
+        mAllocator(std::move(other.mAllocator)),
+        mWidth(other.mWidth),
+        mHeight(other.mHeight),
+        mData(other.mData)
+    {
+        other.mWidth = 0;
+        other.mHeight = 0;
+        other.mData = nullptr;
     }
 
     Array2D& operator=(const Array2D& other)
     {
-        if(mData != nullptr)
+        if(this == &other)
+            return *this;
+        if(mWidth == other.width() && mHeight == other.height())
         {
-            delete[] mData;
-            mData = nullptr;
-            mWidth = 0;
-            mHeight = 0;
+            std::copy(other.mData, other.mData + size(), mData);
         }
-        mWidth = other.width();
-        mHeight = other.height();
-        if(mWidth > 0 && mHeight > 0)
+        else
         {
-            mData = new T[mWidth * mHeight];
+            release();
+            allocateCopy(other);
         }
-        initialiseFromOther(other);
         return *this;
     }
 
-    virtual ~Array2D()
+    Array2D& operator=(Array2D&& other) noexcept(AllocatorTraits::is_always_equal::value ||
+                                                 AllocatorTraits::propagate_on_container_move_assignment::value)
     {
-        if(mData != nullptr)
+        if(this == &other)
+            return *this;
+        if(AllocatorTraits::propagate_on_container_move_assignment::value || mAllocator == other.mAllocator)
         {
-            delete[] mData;
-            mData = nullptr;
-            mWidth = 0;
-            mHeight = 0;
+            release();
+            if constexpr(AllocatorTraits::propagate_on_container_move_assignment::value)
+                mAllocator = std::move(other.mAllocator);
+            std::swap(mWidth, other.mWidth);
+            std::swap(mHeight, other.mHeight);
+            std::swap(mData, other.mData);
+        }
+        else
+        {
+            // Buffers from different allocators can't change hands
+            *this = static_cast<const Array2D&>(other);
         }
+        return *this;
+    }
+
+    virtual ~Array2D()
+    {
+        release();
+    }
+
+    const Allocator& allocator() const
+    {
+        return mAllocator;
     }
 
     size_t width() const
@@ -108,6 +195,33 @@ public:
         return mHeight;
     }
 
+    size_t size() const
+    {
+        return mWidth * mHeight;
+    }
+
+    T* data()
+    {
+        return mData;
+    }
+
+    const T* data() const
+    {
+        return mData;
+    }
+
+    T* row(size_t y)
+    {
+        assert(y < mHeight);
+        return mData + mWidth * y;
+    }
+
+    const T* row(size_t y) const
+    {
+        assert(y < mHeight);
+        return mData + mWidth * y;
+    }
+
     T& operator[](int index)
     {
         assert(index >= 0 && index < mWidth * mHeight);
@@ -134,6 +248,25 @@ public:
         return mData[mWidth * y + x];
     }
 
+    void fill(const T& value)
+    {
+        std::fill(mData, mData + size(), value);
+    }
+
+    // Resize to width x height filled with value, only re-allocating when the size changes
+    void assign(int width, int height, const T& value)
+    {
+        if(mWidth == static_cast<size_t>(std::max(width, 0)) && mHeight == static_cast<size_t>(std::max(height, 0)))
+        {
+            fill(value);
+        }
+        else
+        {
+            release();
+            allocate(width, height, value);
+        }
+    }
+
     bool empty(T emptyValue = T()) const
     {
         if(mWidth > 0 && mHeight > 0)
@@ -163,28 +296,124 @@ public:
         return true;
     }
 
-protected:
+private:
+    using AllocatorTraits = std::allocator_traits<Allocator>;
 
-    void initialiseFromOther(const Array2D& other)
+    void allocate(int width, int height, const T& initValue)
     {
-        assert(mWidth == other.width());
-        assert(mHeight == other.height());
-        for(int y = 0; y < mHeight; y++)
+        assert(mData == nullptr);
+        if(width > 0 && height > 0)
         {
-            for(int x = 0; x < mWidth; x++)
-            {
-                mData[mWidth * y + x] = other.mData[mWidth * y + x];
-            }
+            T* data = AllocatorTraits::allocate(mAllocator, size_t(width) * height);
+            std::uninitialized_fill_n(data, size_t(width) * height, initValue);
+            mData = data;
+            mWidth = width;
+            mHeight = height;
         }
     }
 
-private:
+    void allocateCopy(const Array2D& other)
+    {
+        assert(mData == nullptr);
+        if(other.mData != nullptr)
+        {
+            T* data = AllocatorTraits::allocate(mAllocator, other.size());
+            std::uninitialized_copy_n(other.mData, other.size(), data);
+            mData = data;
+            mWidth = other.mWidth;
+            mHeight = other.mHeight;
+        }
+    }
+
+    void release()
+    {
+        if(mData != nullptr)
+        {
+            std::destroy_n(mData, size());
+            AllocatorTraits::deallocate(mAllocator, mData, size());
+            mData = nullptr;
+        }
+        mWidth = 0;
+        mHeight = 0;
+    }
+
+    Allocator mAllocator;
     size_t mWidth;
     size_t mHeight;
     T* mData;
 };
 
+//
+// Non-owning view of a 2d array with any row stride, e.g. the pixels of an image owned by another library.
+// Use a const T for read-only views.
+//
+template<typename T>
+class Array2DView
+{
+public:
+    Array2DView(T* data, size_t width, size_t height, size_t stride):
+        mData(data),
+        mWidth(width),
+        mHeight(height),
+        mStride(stride)
+    {
+        assert(mStride >= mWidth);
+    }
+
+    Array2DView(Array2D<std::remove_const_t<T>>& array):
+        Array2DView(array.height() > 0 ? array.row(0) : nullptr, array.width(), array.height(), array.width())
+    {}
+
+    // Only for const T
+    Array2DView(const Array2D<std::remove_const_t<T>>& array):
+        Array2DView(array.height() > 0 ? array.row(0) : nullptr, array.width(), array.height(), array.width())
+    {}
+
+    size_t width() const
+    {
+        return mWidth;
+    }
+
+    size_t height() const
+    {
+        return mHeight;
+    }
+
+    T* row(size_t y) const
+    {
+        assert(y < mHeight);
+        return mData + mStride * y;
+    }
+
+    T& operator()(size_t x, size_t y) const
+    {
+        assert(x < mWidth);
+        return row(y)[x];
+    }
+
+private:
+    T* mData;
+    size_t mWidth;
+    size_t mHeight;
+    size_t mStride;     // In elements
+};
+
 // Specialization for indexed color images
 using Image2D = Array2D<uint8_t>;
+using Image2DView = Array2DView<uint8_t>;
+using ConstImage2DView = Array2DView<const uint8_t>;
+
+//
+// Row-wise copy between arrays / views of the same size
+//
+template<typename Dst, typename Src>
+void copyArray2D(Dst&& dst, const Src& src)
+{
+    assert(dst.width() == src.width() && dst.height() == src.height());
+    for(size_t y = 0; y < src.height(); y++)
+    {
+        std::copy(src.row(y), src.row(y) + src.width(), dst.row(y));
+    }
+}
 
 #endif // ARRAY_2D_H
@@ -0,0 +1,477 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <QtConcurrent/QtConcurrentRun>
+#include <QThreadPool>
+#include <QFuture>
+#include <QFileInfo>
+#include <QFile>
+#include <QDir>
+#include <QTextStream>
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "Export.h"
+#include "ImageUtils.h"
+#include "QImageUtils.h"
+
+#include "BatchConverter.h"
+
+//---------------------------------------------------------------------------------------------------------------------
+
+BatchConverter::BatchConverter(const BatchSettings& settings):
+    mSettings(settings)
+{
+    if(!mSettings.cachePath.isEmpty())
+        mConversionCache = std::make_shared<ConversionCache>(mSettings.cachePath.toStdString());
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool BatchConverter::loadHardwarePalette()
+{
+    QString palFilename = mSettings.dataPath + "/nespalettes/" + mSettings.hardwarePaletteName + ".pal";
+    mHardwarePalette = readHardwarePaletteFile(palFilename);
+    return mHardwarePalette.size() == HardwarePaletteSize;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+QStringList BatchConverter::collectInputFilenames(const QString& directoryOrManifest)
+{
+    QStringList filenames;
+    QFileInfo fileInfo(directoryOrManifest);
+    if(fileInfo.isDir())
+    {
+        // Convert every image in directory
+        QDir dir(directoryOrManifest);
+        QStringList nameFilters = {"*.png", "*.bmp", "*.gif"};
+        for(const QFileInfo& imageFileInfo : dir.entryInfoList(nameFilters, QDir::Files, QDir::Name))
+        {
+            filenames.append(imageFileInfo.absoluteFilePath());
+        }
+    }
+    else
+    {
+        // Manifest with one image filename per line - relative to the manifest's directory
+        QFile manifestFile(directoryOrManifest);
+        if(!manifestFile.open(QIODevice::ReadOnly | QIODevice::Text))
+            return filenames;
+        QTextStream stream(&manifestFile);
+        while(!stream.atEnd())
+        {
+            QString line = stream.readLine().trimmed();
+            if(line.isEmpty() || line.startsWith("#"))
+                continue;
+            filenames.append(QFileInfo(fileInfo.dir(), line).absoluteFilePath());
+        }
+    }
+    return filenames;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+std::vector<BatchResult> BatchConverter::run(const QStringList& inputFilenames,
+                                             int numJobs,
+                                             const std::function<void(const BatchResult&)>& resultCallback) const
+{
+    QDir().mkpath(mSettings.workPath);
+    QDir().mkpath(mSettings.outputPath);
+    QThreadPool pool;
+    pool.setMaxThreadCount(std::max(1, numJobs));
+    std::vector<QFuture<BatchResult>> futures;
+    for(const QString& inputFilename : inputFilenames)
+    {
+        futures.push_back(QtConcurrent::run(&pool, [this, inputFilename]()
+        {
+            return convertFile(inputFilename);
+        }));
+    }
+    // Collect results in input order
+    std::vector<BatchResult> results;
+    for(QFuture<BatchResult>& future : futures)
+    {
+        results.push_back(future.result());
+        if(resultCallback)
+            resultCallback(results.back());
+    }
+    return results;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+std::vector<BatchResult> BatchConverter::runSequence(const QStringList& inputFilenames,
+                                                     const std::function<void(const BatchResult&)>& resultCallback) const
+{
+    QDir().mkpath(mSettings.workPath);
+    QDir().mkpath(mSettings.outputPath);
+    std::vector<BatchResult> results(inputFilenames.size());
+    std::vector<Image2D> frames;
+    QString sequenceError;
+    // All frames share the first frame's background color
+    int backgroundColor = mSettings.backgroundColor;
+    for(int i = 0; i < inputFilenames.size(); i++)
+    {
+        results[i].inputFilename = inputFilenames[i];
+        results[i].converted = false;
+        QImage inputImage(inputFilenames[i]);
+        if(inputImage.isNull())
+        {
+            results[i].conversionError = "Invalid image";
+            sequenceError = "Invalid image in sequence";
+            continue;
+        }
+        QImage indexedImage = quantizeInputImage(inputImage);
+        if(backgroundColor < 0)
+            backgroundColor = detectBackgroundColor(indexedImage);
+        indexedImage = cropOrExtendImage(indexedImage, static_cast<uint8_t>(backgroundColor), ScreenWidth, ScreenHeight);
+        frames.push_back(qImageToImage2D(indexedImage));
+    }
+    if(sequenceError.isEmpty())
+    {
+        OverlayOptimiser optimiser;
+        configureOptimiser(optimiser);
+        optimiser.setSolverBackend(mSettings.solverBackend);
+        std::vector<std::unique_ptr<OverlayOptimiser>> frameOptimisers;
+        try
+        {
+            std::vector<std::string> conversionErrors = optimiser.convertSequence(frames,
+                                                                                  static_cast<uint8_t>(backgroundColor),
+                                                                                  mSettings.gridCellWidth,
+                                                                                  mSettings.gridCellHeight,
+                                                                                  mSettings.spriteHeight,
+                                                                                  GridCellColorLimit,
+                                                                                  mSettings.maxBackgroundPalettes,
+                                                                                  mSettings.maxSpritePalettes,
+                                                                                  mSettings.maxSpritesPerScanline,
+                                                                                  mSettings.timeOut,
+                                                                                  frameOptimisers);
+            const bool converted = writeSequenceOutputFiles(frameOptimisers, inputFilenames);
+            for(size_t i = 0; i < results.size(); i++)
+            {
+                results[i].converted = converted;
+                results[i].conversionError = converted ? QString(conversionErrors[i].c_str()) : "Failed to write output files";
+                results[i].report = frameOptimisers[i]->report();
+            }
+        }
+        catch(const std::runtime_error& error)
+        {
+            sequenceError = error.what();
+        }
+    }
+    for(BatchResult& result : results)
+    {
+        if(!sequenceError.isEmpty() && result.conversionError.isEmpty())
+            result.conversionError = sequenceError;
+        if(resultCallback)
+            resultCallback(result);
+    }
+    return results;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+std::vector<BatchResult> BatchConverter::runMaps(const QStringList& inputFilenames,
+                                                 const std::function<void(const BatchResult&)>& resultCallback) const
+{
+    QDir().mkpath(mSettings.workPath);
+    QDir().mkpath(mSettings.outputPath);
+    std::vector<BatchResult> results;
+    for(const QString& inputFilename : inputFilenames)
+    {
+        results.push_back(convertMapFile(inputFilename));
+        if(resultCallback)
+            resultCallback(results.back());
+    }
+    return results;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void BatchConverter::configureOptimiser(OverlayOptimiser& optimiser) const
+{
+    optimiser.setExecutablePath(mSettings.dataPath.toStdString());
+    // Each conversion creates its own directory below the shared work path
+    optimiser.setWorkPath(mSettings.workPath.toStdString());
+    optimiser.setKeepWorkFiles(mSettings.keepWorkFiles);
+    optimiser.setDecompositionBandHeight(mSettings.decompositionBandHeight);
+    optimiser.setPresolve(mSettings.presolve);
+    optimiser.setConversionCache(mConversionCache);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+QImage BatchConverter::quantizeInputImage(const QImage& inputImage) const
+{
+    if(!mSettings.mapInputColors && potentialHardwarePaletteIndexedImage(inputImage, HardwarePaletteSize))
+    {
+        // Input is hardware palette values - just use as-is
+        QImage indexedImage = inputImage;
+        indexedImage.setColorTable(mHardwarePalette);
+        return indexedImage;
+    }
+    // Input image is either RGB or unrelated indexed-colors - need to remap
+    return remapColorsToNES(inputImage, mHardwarePalette, mSettings.uniqueColors, true);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+BatchResult BatchConverter::convertFile(const QString& inputFilename) const
+{
+    BatchResult result;
+    result.inputFilename = inputFilename;
+    result.converted = false;
+    QImage inputImage(inputFilename);
+    if(inputImage.isNull())
+    {
+        result.conversionError = "Invalid image";
+        return result;
+    }
+    QImage indexedImage = quantizeInputImage(inputImage);
+    uint8_t backgroundColor = mSettings.backgroundColor >= 0 ? static_cast<uint8_t>(mSettings.backgroundColor)
+                                                             : detectBackgroundColor(indexedImage);
+    indexedImage = cropOrExtendImage(indexedImage, backgroundColor, ScreenWidth, ScreenHeight);
+    Image2D image = qImageToImage2D(indexedImage);
+    const bool portfolio = mSettings.portfolioBackgroundColors > 1 || mSettings.portfolioShifts > 1 || mSettings.portfolioSeeds > 1;
+    if(mSettings.autoShift && !portfolio)
+    {
+        int shiftX = 0;
+        int shiftY = 0;
+        image = shiftImageOptimal(image,
+                                  backgroundColor,
+                                  mSettings.gridCellWidth,
+                                  mSettings.gridCellHeight,
+                                  0,
+                                  mSettings.gridCellWidth - 1,
+                                  0,
+                                  mSettings.gridCellHeight - 1,
+                                  shiftX,
+                                  shiftY);
+    }
+    OverlayOptimiser optimiser;
+    configureOptimiser(optimiser);
+    auto convertWith = [&](OverlayOptimiser::SolverBackend solverBackend)
+    {
+        optimiser.setSolverBackend(solverBackend);
+        return optimiser.convert(image,
+                                 backgroundColor,
+                                 mSettings.gridCellWidth,
+                                 mSettings.gridCellHeight,
+                                 mSettings.spriteHeight,
+                                 GridCellColorLimit,
+                                 mSettings.maxBackgroundPalettes,
+                                 mSettings.maxSpritePalettes,
+                                 mSettings.maxSpritesPerScanline,
+                                 mSettings.timeOut);
+    };
+    try
+    {
+        std::string conversionError;
+        bool resultAccepted = false;
+        if(portfolio)
+        {
+            // Shifts are applied by each variant instead
+            std::vector<uint8_t> backgroundColors = {backgroundColor};
+            if(mSettings.backgroundColor < 0)
+                backgroundColors = mostCommonColors(image, mSettings.portfolioBackgroundColors);
+            std::vector<OverlayOptimiser::PortfolioVariant> variants = OverlayOptimiser::makePortfolio(image,
+                                                                                                      backgroundColors,
+                                                                                                      mSettings.gridCellWidth,
+                                                                                                      mSettings.gridCellHeight,
+                                                                                                      mSettings.autoShift ? mSettings.portfolioShifts : 0,
+                                                                                                      mSettings.portfolioSeeds);
+            optimiser.setSolverBackend(mSettings.solverBackend);
+            size_t chosenVariant = 0;
+            conversionError = optimiser.convertPortfolio(image,
+                                                         variants,
+                                                         mSettings.gridCellWidth,
+                                                         mSettings.gridCellHeight,
+                                                         mSettings.spriteHeight,
+                                                         GridCellColorLimit,
+                                                         mSettings.maxBackgroundPalettes,
+                                                         mSettings.maxSpritePalettes,
+                                                         mSettings.maxSpritesPerScanline,
+                                                         mSettings.timeOut,
+                                                         chosenVariant);
+            resultAccepted = true;
+        }
+        else if(mSettings.heuristicFirst && mSettings.solverBackend != OverlayOptimiser::SolverBackend::Heuristic)
+        {
+            // An error-free heuristic result meets all constraints, so the exact solver can be skipped
+            conversionError = convertWith(OverlayOptimiser::SolverBackend::Heuristic);
+            resultAccepted = conversionError.empty();
+        }
+        if(!resultAccepted)
+            conversionError = convertWith(mSettings.solverBackend);
+        result.conversionError = QString(conversionError.c_str());
+        result.report = optimiser.report();
+        result.converted = writeOutputFiles(optimiser, inputFilename);
+        if(!result.converted)
+            result.conversionError = "Failed to write output files";
+    }
+    catch(const std::runtime_error& error)
+    {
+        result.conversionError = error.what();
+    }
+    return result;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+BatchResult BatchConverter::convertMapFile(const QString& inputFilename) const
+{
+    BatchResult result;
+    result.inputFilename = inputFilename;
+    result.converted = false;
+    QImage inputImage(inputFilename);
+    if(inputImage.isNull())
+    {
+        result.conversionError = "Invalid image";
+        return result;
+    }
+    QImage indexedImage = quantizeInputImage(inputImage);
+    uint8_t backgroundColor = mSettings.backgroundColor >= 0 ? static_cast<uint8_t>(mSettings.backgroundColor)
+                                                             : detectBackgroundColor(indexedImage);
+    Image2D map = qImageToImage2D(indexedImage);
+    OverlayOptimiser optimiser;
+    configureOptimiser(optimiser);
+    optimiser.setSolverBackend(mSettings.solverBackend);
+    try
+    {
+        size_t screensWide = 0;
+        std::vector<std::unique_ptr<OverlayOptimiser>> screenOptimisers;
+        std::vector<std::string> conversionErrors = optimiser.convertMap(map,
+                                                                         backgroundColor,
+                                                                         mSettings.gridCellWidth,
+                                                                         mSettings.gridCellHeight,
+                                                                         mSettings.spriteHeight,
+                                                                         GridCellColorLimit,
+                                                                         mSettings.maxBackgroundPalettes,
+                                                                         mSettings.maxSpritePalettes,
+                                                                         mSettings.maxSpritesPerScanline,
+                                                                         mSettings.timeOut,
+                                                                         screensWide,
+                                                                         screenOptimisers);
+        // First screen error, as the map is only usable when all screens meet the constraints
+        for(size_t i = 0; i < conversionErrors.size() && result.conversionError.isEmpty(); i++)
+        {
+            if(!conversionErrors[i].empty())
+                result.conversionError = QString("Screen %1: %2").arg(i).arg(conversionErrors[i].c_str());
+        }
+        result.report = optimiser.report();
+        result.converted = writeMapOutputFiles(screenOptimisers, screensWide, inputFilename);
+        if(!result.converted)
+            result.conversionError = "Failed to write output files";
+    }
+    catch(const std::runtime_error& error)
+    {
+        result.conversionError = error.what();
+    }
+    return result;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool BatchConverter::writeOutputFiles(const OverlayOptimiser& optimiser, const QString& inputFilename) const
+{
+    QFileInfo fi(inputFilename);
+    QString basePath = mSettings.outputPath + "/" + fi.completeBaseName();
+    // Converted image, using the same 32-color layout as "Save converted PNG..."
+    QVector<QRgb> colorTable = makeOutputColorTable(optimiser.palettes(), optimiser.backgroundColor(), mHardwarePalette);
+    QImage outputImage = image2DToQImage(optimiser.outputImage(), colorTable);
+    bool success = outputImage.save(basePath + ".png");
+    // Binary data, using the same filenames as "Export..."
+    ExportDataNES exportData = buildExportData(optimiser, 0xFF, mSettings.dedupFlippedSprites);
+    success &= writeBinaryFile(basePath + ".nam", exportData.nametable);
+    success &= writeBinaryFile(basePath + ".exram", exportData.exram);
+    success &= writeBinaryFile(basePath + "_bg.chr", exportData.bgCHR);
+    success &= writeBinaryFile(basePath + "_spr.chr", exportData.oamCHR);
+    success &= writeBinaryFile(basePath + ".oam", exportData.oam);
+    success &= writeBinaryFile(basePath + "_palette.dat", exportData.palette);
+    return success;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool BatchConverter::writeSequenceOutputFiles(const std::vector<std::unique_ptr<OverlayOptimiser>>& frameOptimisers,
+                                              const QStringList& inputFilenames) const
+{
+    SequenceExportDataNES exportData = buildSequenceExportData(frameOptimisers, 0xFF, mSettings.dedupFlippedSprites);
+    bool success = true;
+    for(size_t i = 0; i < frameOptimisers.size(); i++)
+    {
+        const OverlayOptimiser& optimiser = *frameOptimisers[i];
+        QString basePath = mSettings.outputPath + "/" + QFileInfo(inputFilenames[static_cast<int>(i)]).completeBaseName();
+        QVector<QRgb> colorTable = makeOutputColorTable(optimiser.palettes(), optimiser.backgroundColor(), mHardwarePalette);
+        QImage outputImage = image2DToQImage(optimiser.outputImage(), colorTable);
+        success &= outputImage.save(basePath + ".png");
+        success &= writeBinaryFile(basePath + ".nam", exportData.frames[i].nametable);
+        success &= writeBinaryFile(basePath + ".exram", exportData.frames[i].exram);
+        success &= writeBinaryFile(basePath + ".oam", exportData.frames[i].oam);
+    }
+    // CHR and palette shared by all frames
+    QString sequencePath = mSettings.outputPath + "/" + mSettings.sequenceName;
+    success &= writeBinaryFile(sequencePath + "_bg.chr", exportData.bgCHR);
+    success &= writeBinaryFile(sequencePath + "_spr.chr", exportData.oamCHR);
+    success &= writeBinaryFile(sequencePath + "_palette.dat", exportData.palette);
+    return success;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool BatchConverter::writeMapOutputFiles(const std::vector<std::unique_ptr<OverlayOptimiser>>& screenOptimisers,
+                                         size_t screensWide,
+                                         const QString& inputFilename) const
+{
+    if(screenOptimisers.empty())
+        return false;
+    QFileInfo fi(inputFilename);
+    QString basePath = mSettings.outputPath + "/" + fi.completeBaseName();
+    // All screens share their palettes, so one color table fits the whole map
+    const OverlayOptimiser& firstScreen = *screenOptimisers.front();
+    QVector<QRgb> colorTable = makeOutputColorTable(firstScreen.palettes(), firstScreen.backgroundColor(), mHardwarePalette);
+    std::vector<Image2D> screens;
+    for(const std::unique_ptr<OverlayOptimiser>& screenOptimiser : screenOptimisers)
+        screens.push_back(screenOptimiser->outputImage());
+    bool success = image2DToQImage(joinScreens(screens, screensWide), colorTable).save(basePath + ".png");
+    MapExportDataNES exportData = buildMapExportData(screenOptimisers,
+                                                     screensWide,
+                                                     mSettings.mapStreamOrder,
+                                                     0xFF,
+                                                     mSettings.dedupFlippedSprites);
+    success &= writeBinaryFile(basePath + ".nam", exportData.nametable);
+    success &= writeBinaryFile(basePath + ".exram", exportData.exram);
+    success &= writeBinaryFile(basePath + ".atr", exportData.attributes);
+    success &= writeBinaryFile(basePath + "_bg.chr", exportData.bgCHR);
+    success &= writeBinaryFile(basePath + "_spr.chr", exportData.oamCHR);
+    success &= writeBinaryFile(basePath + ".oam", exportData.oam);
+    success &= writeBinaryFile(basePath + "_palette.dat", exportData.palette);
+    return success;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool BatchConverter::writeBinaryFile(const QString& filename, const std::vector<uint8_t>& v)
+{
+    QFile file(filename);
+    if(!file.open(QFile::WriteOnly))
+        return false;
+    QByteArray a(reinterpret_cast<const char*>(v.data()), static_cast<int>(v.size()));
+    return file.write(a) == a.size();
+}
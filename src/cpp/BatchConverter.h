@@ -0,0 +1,144 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+#ifndef BATCH_CONVERTER_H
+#define BATCH_CONVERTER_H
+
+#include <vector>
+#include <functional>
+#include <memory>
+
+#include <QString>
+#include <QStringList>
+#include <QImage>
+#include <QVector>
+#include <QRgb>
+
+#include "OverlayOptimiser.h"
+#include "MilpModel.h"
+#include "ConversionCache.h"
+#include "Export.h"
+
+//
+// Settings shared by all jobs in a batch conversion
+//
+struct BatchSettings
+{
+    QString dataPath;
+    QString workPath;
+    QString outputPath;
+    QString hardwarePaletteName = "palgen";
+    bool mapInputColors = true;
+    bool uniqueColors = false;
+    bool autoShift = false;
+    int backgroundColor = -1;   // -1 = detect most common color
+    int gridCellWidth = 16;
+    int gridCellHeight = 16;
+    int spriteHeight = 16;
+    int maxBackgroundPalettes = 4;
+    int maxSpritePalettes = 4;
+    int maxSpritesPerScanline = 8;
+    int timeOut = 60;
+    OverlayOptimiser::SolverBackend solverBackend = cbcLibraryAvailable() ? OverlayOptimiser::SolverBackend::CbcLibrary
+                                                                          : OverlayOptimiser::SolverBackend::CmplProcess;
+    bool heuristicFirst = false;    // Keep the heuristic result when it meets all constraints, else use solverBackend
+    int decompositionBandHeight = 0;    // Grid rows per in-process subproblem, 0 = no decomposition
+    bool presolve = false;              // Merge grid cells of equal colors before in-process solving
+    // Race the most common background colors (unless backgroundColor is set), best shifts (with autoShift)
+    // and CBC seeds against each other when any is above 1
+    int portfolioBackgroundColors = 1;
+    int portfolioShifts = 1;
+    int portfolioSeeds = 1;
+    bool keepWorkFiles = false;
+    QString cachePath;      // Directory of cached conversion results, empty = no cache
+    bool dedupFlippedSprites = false;   // Re-use mirrored sprite tiles with OAM flip bits
+    // Convert all inputs as the frames of one animation with shared palettes and CHR, written to files starting
+    // with this name. Empty = convert each input on its own.
+    QString sequenceName;
+    // Convert each input as a map of screens (e.g. a scrolling level) exported as streamable columns / rows,
+    // instead of cropping it to one screen
+    bool convertMaps = false;
+    MapStreamOrder mapStreamOrder = MapStreamOrder::Columns;
+};
+
+//
+// Outcome of converting a single image
+//
+struct BatchResult
+{
+    QString inputFilename;
+    bool converted;
+    QString conversionError;
+    ConversionReport report;    // Of the last conversion run for this image
+};
+
+//
+// Runs OverlayOptimiser conversions for a list of images on a pool of worker threads
+//
+class BatchConverter
+{
+public:
+    explicit BatchConverter(const BatchSettings& settings);
+
+    bool loadHardwarePalette();
+
+    static QStringList collectInputFilenames(const QString& directoryOrManifest);
+
+    std::vector<BatchResult> run(const QStringList& inputFilenames,
+                                 int numJobs,
+                                 const std::function<void(const BatchResult&)>& resultCallback) const;
+
+    // Converts the inputs as the frames of the sequence named in the settings, with one result per frame.
+    // Auto-shift and portfolios are not applied, as they would differ between frames.
+    std::vector<BatchResult> runSequence(const QStringList& inputFilenames,
+                                         const std::function<void(const BatchResult&)>& resultCallback) const;
+
+    // Converts each input as a map, one after the other, as the screens of each map are converted in parallel.
+    // Auto-shift and portfolios are not applied, as for sequences.
+    std::vector<BatchResult> runMaps(const QStringList& inputFilenames,
+                                     const std::function<void(const BatchResult&)>& resultCallback) const;
+
+protected:
+    void configureOptimiser(OverlayOptimiser& optimiser) const;
+
+    BatchResult convertFile(const QString& inputFilename) const;
+    BatchResult convertMapFile(const QString& inputFilename) const;
+
+    QImage quantizeInputImage(const QImage& inputImage) const;
+
+    bool writeOutputFiles(const OverlayOptimiser& optimiser, const QString& inputFilename) const;
+    bool writeSequenceOutputFiles(const std::vector<std::unique_ptr<OverlayOptimiser>>& frameOptimisers,
+                                  const QStringList& inputFilenames) const;
+    bool writeMapOutputFiles(const std::vector<std::unique_ptr<OverlayOptimiser>>& screenOptimisers,
+                             size_t screensWide,
+                             const QString& inputFilename) const;
+
+    static bool writeBinaryFile(const QString& filename, const std::vector<uint8_t>& v);
+
+private:
+    BatchSettings mSettings;
+    std::shared_ptr<ConversionCache> mConversionCache;
+    QVector<QRgb> mHardwarePalette;
+    static const size_t HardwarePaletteSize = 64;
+    static const int GridCellColorLimit = 3;
+    static const int ScreenWidth = 256;
+    static const int ScreenHeight = 240;
+};
+
+#endif // BATCH_CONVERTER_H
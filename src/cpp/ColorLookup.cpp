@@ -0,0 +1,128 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <utility>
+
+#include "ColorLookup.h"
+
+//---------------------------------------------------------------------------------------------------------------------
+
+static int colorDistance2(uint32_t rgb0, uint32_t rgb1)
+{
+    const int dr = static_cast<int>((rgb0 >> 16) & 0xFF) - static_cast<int>((rgb1 >> 16) & 0xFF);
+    const int dg = static_cast<int>((rgb0 >> 8) & 0xFF) - static_cast<int>((rgb1 >> 8) & 0xFF);
+    const int db = static_cast<int>(rgb0 & 0xFF) - static_cast<int>(rgb1 & 0xFF);
+    return dr * dr + dg * dg + db * db;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+ClosestColorLookup::ClosestColorLookup(const std::vector<uint32_t>& colorTable, const Colors& candidates):
+    mColorTable(colorTable),
+    mCandidates(candidates & Colors::fromMask(colorTable.size() < ColorSet::MaxColors ? (uint64_t(1) << colorTable.size()) - 1 : ~uint64_t(0))),
+    mLookup(size_t(1) << (3 * CubeBits), Ambiguous)
+{
+    assert(mColorTable.size() <= ColorSet::MaxColors);
+    if(mCandidates.empty())
+        return;
+    const int CubeSize = 256 >> CubeBits;
+    const double HalfCube = 0.5 * (CubeSize - 1);
+    // Every color of a cube is within this distance of its center
+    const double HalfDiagonal = std::sqrt(3.0) * HalfCube;
+    for(size_t i = 0; i < mLookup.size(); i++)
+    {
+        const double r = ((i >> (2 * CubeBits)) & ((1 << CubeBits) - 1)) * CubeSize + HalfCube;
+        const double g = ((i >> CubeBits) & ((1 << CubeBits) - 1)) * CubeSize + HalfCube;
+        const double b = (i & ((1 << CubeBits) - 1)) * CubeSize + HalfCube;
+        double best = std::numeric_limits<double>::max();
+        double secondBest = std::numeric_limits<double>::max();
+        uint8_t bestColor = 0;
+        for(uint8_t c : mCandidates)
+        {
+            const double dr = r - ((mColorTable[c] >> 16) & 0xFF);
+            const double dg = g - ((mColorTable[c] >> 8) & 0xFF);
+            const double db = b - (mColorTable[c] & 0xFF);
+            const double d = std::sqrt(dr * dr + dg * dg + db * db);
+            if(d < best)
+            {
+                secondBest = best;
+                best = d;
+                bestColor = c;
+            }
+            else if(d < secondBest)
+            {
+                secondBest = d;
+            }
+        }
+        // By the triangle inequality, no color of the cube can then be as close to any other candidate.
+        // The margin keeps rounding from ever deciding a cube.
+        if(secondBest - best > 2.0 * HalfDiagonal + 1e-6)
+            mLookup[i] = bestColor;
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+uint8_t ClosestColorLookup::closestExact(uint32_t rgb, const Colors& candidates) const
+{
+    int bestDistance2 = std::numeric_limits<int>::max();
+    uint8_t bestColor = 0;
+    // Ascending order, so the lowest index wins ties
+    for(uint8_t c : candidates & mCandidates)
+    {
+        const int distance2 = colorDistance2(rgb, mColorTable[c]);
+        if(distance2 < bestDistance2)
+        {
+            bestDistance2 = distance2;
+            bestColor = c;
+        }
+    }
+    return bestColor;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+const Colors& ClosestColorLookup::candidates() const
+{
+    return mCandidates;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+std::shared_ptr<const ClosestColorLookup> ClosestColorLookup::shared(const std::vector<uint32_t>& colorTable, const Colors& candidates)
+{
+    // Only a handful of hardware palettes / candidate sets are ever used, so entries are never evicted
+    static std::mutex mutex;
+    static std::map<std::pair<std::vector<uint32_t>, uint64_t>, std::shared_ptr<const ClosestColorLookup>> lookups;
+    const std::pair<std::vector<uint32_t>, uint64_t> key(colorTable, candidates.mask());
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = lookups.find(key);
+        if(it != lookups.end())
+            return it->second;
+    }
+    // Build outside the lock, as it takes a few milliseconds. Concurrent builds of the same lookup are identical.
+    auto lookup = std::make_shared<const ClosestColorLookup>(colorTable, candidates);
+    std::lock_guard<std::mutex> lock(mutex);
+    return lookups.emplace(key, lookup).first->second;
+}
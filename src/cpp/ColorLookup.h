@@ -0,0 +1,75 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+#ifndef COLOR_LOOKUP_H
+#define COLOR_LOOKUP_H
+
+#include <cstdint>
+#include <vector>
+#include <memory>
+
+#include "ColorSet.h"
+
+//
+// Closest color in a hardware palette color table for any 0xAARRGGBB color, ignoring alpha.
+//
+// A 32x32x32 table holds the closest color of every RGB cube whose colors all share the same closest color,
+// so that only colors near a boundary between two hardware colors need an exact search.
+//
+class ClosestColorLookup
+{
+public:
+    // Only colors in candidates (indices into colorTable) are ever returned
+    ClosestColorLookup(const std::vector<uint32_t>& colorTable, const Colors& candidates);
+
+    uint8_t closest(uint32_t rgb) const
+    {
+        const uint8_t c = mLookup[cubeIndex(rgb)];
+        return c != Ambiguous ? c : closestExact(rgb, mCandidates);
+    }
+
+    // Exhaustive search over the given subset of the candidates, e.g. the colors not yet taken
+    uint8_t closestExact(uint32_t rgb, const Colors& candidates) const;
+
+    const Colors& candidates() const;
+
+    //
+    // Lookup shared by all callers with the same color table and candidates, built on first use. Thread-safe.
+    //
+    static std::shared_ptr<const ClosestColorLookup> shared(const std::vector<uint32_t>& colorTable, const Colors& candidates);
+
+protected:
+    static constexpr int CubeBits = 5;
+    static constexpr uint8_t Ambiguous = 0xFF;
+
+    static size_t cubeIndex(uint32_t rgb)
+    {
+        const uint32_t r = (rgb >> (24 - CubeBits)) & ((1 << CubeBits) - 1);
+        const uint32_t g = (rgb >> (16 - CubeBits)) & ((1 << CubeBits) - 1);
+        const uint32_t b = (rgb >> (8 - CubeBits)) & ((1 << CubeBits) - 1);
+        return (r << (2 * CubeBits)) | (g << CubeBits) | b;
+    }
+
+private:
+    std::vector<uint32_t> mColorTable;
+    Colors mCandidates;
+    std::vector<uint8_t> mLookup;
+};
+
+#endif // COLOR_LOOKUP_H
@@ -0,0 +1,237 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+#ifndef COLOR_SET_H
+#define COLOR_SET_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cassert>
+#include <bitset>
+#include <iterator>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+//
+// Set of NES hardware colors (0-63) stored as a single 64-bit mask.
+// Iterates in ascending color order like the std::set<uint8_t> it replaces,
+// while union / intersection / subset tests and size() are single word operations.
+//
+class ColorSet
+{
+public:
+    static const int MaxColors = 64;
+
+    class const_iterator
+    {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = uint8_t;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const uint8_t*;
+        using reference = uint8_t;
+
+        const_iterator(uint64_t bits):
+            mBits(bits)
+        {}
+
+        uint8_t operator*() const
+        {
+            return lowestColor(mBits);
+        }
+
+        const_iterator& operator++()
+        {
+            mBits &= mBits - 1;
+            return *this;
+        }
+
+        const_iterator operator++(int)
+        {
+            const_iterator it = *this;
+            ++(*this);
+            return it;
+        }
+
+        bool operator==(const const_iterator& other) const
+        {
+            return mBits == other.mBits;
+        }
+
+        bool operator!=(const const_iterator& other) const
+        {
+            return mBits != other.mBits;
+        }
+
+    private:
+        uint64_t mBits;
+    };
+
+    using iterator = const_iterator;
+    using value_type = uint8_t;
+
+    ColorSet():
+        mMask(0)
+    {}
+
+    static ColorSet fromMask(uint64_t mask)
+    {
+        ColorSet s;
+        s.mMask = mask;
+        return s;
+    }
+
+    uint64_t mask() const
+    {
+        return mMask;
+    }
+
+    const_iterator begin() const
+    {
+        return const_iterator(mMask);
+    }
+
+    const_iterator end() const
+    {
+        return const_iterator(0);
+    }
+
+    size_t size() const
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_popcountll(mMask);
+#else
+        return std::bitset<64>(mMask).count();
+#endif
+    }
+
+    bool empty() const
+    {
+        return mMask == 0;
+    }
+
+    void clear()
+    {
+        mMask = 0;
+    }
+
+    size_t count(uint8_t c) const
+    {
+        return c < MaxColors ? (mMask >> c) & 1 : 0;
+    }
+
+    void insert(uint8_t c)
+    {
+        assert(c < MaxColors && "Color outside NES hardware palette");
+        mMask |= uint64_t(1) << c;
+    }
+
+    template<typename InputIt>
+    void insert(InputIt first, InputIt last)
+    {
+        for(; first != last; ++first)
+            insert(*first);
+    }
+
+    void insert(const ColorSet& other)
+    {
+        mMask |= other.mMask;
+    }
+
+    size_t erase(uint8_t c)
+    {
+        size_t n = count(c);
+        if(n)
+            mMask &= ~(uint64_t(1) << c);
+        return n;
+    }
+
+    bool isSubSetOf(const ColorSet& other) const
+    {
+        return (mMask & ~other.mMask) == 0;
+    }
+
+    ColorSet operator|(const ColorSet& other) const
+    {
+        return fromMask(mMask | other.mMask);
+    }
+
+    ColorSet operator&(const ColorSet& other) const
+    {
+        return fromMask(mMask & other.mMask);
+    }
+
+    ColorSet& operator|=(const ColorSet& other)
+    {
+        mMask |= other.mMask;
+        return *this;
+    }
+
+    ColorSet& operator&=(const ColorSet& other)
+    {
+        mMask &= other.mMask;
+        return *this;
+    }
+
+    bool operator==(const ColorSet& other) const
+    {
+        return mMask == other.mMask;
+    }
+
+    bool operator!=(const ColorSet& other) const
+    {
+        return mMask != other.mMask;
+    }
+
+    // Position of color c among the set's colors in ascending order
+    size_t indexOf(uint8_t c) const
+    {
+        assert(count(c) && "Color not in set");
+        return fromMask(mMask & ((uint64_t(1) << c) - 1)).size();
+    }
+
+private:
+    static uint8_t lowestColor(uint64_t bits)
+    {
+        assert(bits != 0);
+#if defined(__GNUC__) || defined(__clang__)
+        return __builtin_ctzll(bits);
+#elif defined(_MSC_VER) && defined(_WIN64)
+        unsigned long index;
+        _BitScanForward64(&index, bits);
+        return index;
+#else
+        uint8_t index = 0;
+        while(!(bits & 1))
+        {
+            bits >>= 1;
+            index++;
+        }
+        return index;
+#endif
+    }
+
+    uint64_t mMask;
+};
+
+using Colors = ColorSet;
+
+#endif // COLOR_SET_H
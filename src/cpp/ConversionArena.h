@@ -0,0 +1,108 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+#ifndef CONVERSION_ARENA_H
+#define CONVERSION_ARENA_H
+
+#include <cstddef>
+#include <memory_resource>
+#include <type_traits>
+
+//
+// Monotonic memory for the temporary state of one conversion step: allocation is a pointer bump, deallocation
+// a no-op, and everything is released at once when the arena is destroyed. Not thread-safe - use one per thread.
+//
+class ConversionArena
+{
+public:
+    static const size_t DefaultBlockSize = 64 * 1024;
+
+    explicit ConversionArena(size_t initialBlockSize = DefaultBlockSize);
+
+    ConversionArena(const ConversionArena&) = delete;
+    ConversionArena& operator=(const ConversionArena&) = delete;
+
+    std::pmr::memory_resource* resource();
+
+private:
+    std::pmr::monotonic_buffer_resource mResource;
+};
+
+//
+// Allocator for containers that may live in a ConversionArena, or on the heap by default.
+//
+// Unlike std::pmr::polymorphic_allocator, copies stay in the arena of the original, so that a container of
+// arena-allocated elements can be copied around within the arena's lifetime. Assignment never changes the
+// memory resource, so assigning to a heap-allocated object always leaves it on the heap.
+//
+template<typename T>
+class ArenaAllocator
+{
+public:
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::false_type;
+    using propagate_on_container_move_assignment = std::false_type;
+    using propagate_on_container_swap = std::false_type;
+
+    ArenaAllocator(std::pmr::memory_resource* resource = std::pmr::get_default_resource()):
+        mResource(resource)
+    {}
+
+    template<typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other):
+        mResource(other.resource())
+    {}
+
+    T* allocate(size_t n)
+    {
+        return static_cast<T*>(mResource->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, size_t n)
+    {
+        mResource->deallocate(p, n * sizeof(T), alignof(T));
+    }
+
+    ArenaAllocator select_on_container_copy_construction() const
+    {
+        return *this;
+    }
+
+    std::pmr::memory_resource* resource() const
+    {
+        return mResource;
+    }
+
+    template<typename U>
+    bool operator==(const ArenaAllocator<U>& other) const
+    {
+        return *mResource == *other.resource();
+    }
+
+    template<typename U>
+    bool operator!=(const ArenaAllocator<U>& other) const
+    {
+        return !(*this == other);
+    }
+
+private:
+    std::pmr::memory_resource* mResource;
+};
+
+#endif // CONVERSION_ARENA_H
@@ -0,0 +1,432 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <system_error>
+#include <thread>
+#include <stdexcept>
+
+#include "ConversionCache.h"
+
+namespace
+{
+
+const char Magic[4] = {'O', 'P', 'C', 'C'};
+
+//
+// FNV-1a, fed field by field
+//
+class Hasher
+{
+public:
+    void add(const void* data, size_t size)
+    {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        for(size_t i = 0; i < size; i++)
+        {
+            mHash = (mHash ^ bytes[i]) * 0x100000001B3ull;
+        }
+    }
+
+    void add(int value)
+    {
+        int32_t v = value;
+        add(&v, sizeof(v));
+    }
+
+    uint64_t hash() const
+    {
+        return mHash;
+    }
+
+private:
+    uint64_t mHash = 0xCBF29CE484222325ull;
+};
+
+//
+// Raw little-endian serialisation of the result structures. Readers throw on truncated files.
+//
+class Writer
+{
+public:
+    explicit Writer(std::ostream& stream):
+        mStream(stream)
+    {}
+
+    template<typename T>
+    void value(const T& v)
+    {
+        mStream.write(reinterpret_cast<const char*>(&v), sizeof(v));
+    }
+
+    void string(const std::string& s)
+    {
+        value<uint32_t>(static_cast<uint32_t>(s.size()));
+        mStream.write(s.data(), s.size());
+    }
+
+    void palettes(const std::vector<Colors>& palettes)
+    {
+        value<uint32_t>(static_cast<uint32_t>(palettes.size()));
+        for(const Colors& palette : palettes)
+            value<uint64_t>(palette.mask());
+    }
+
+    void image(const Array2D<uint8_t>& image)
+    {
+        value<uint32_t>(static_cast<uint32_t>(image.width()));
+        value<uint32_t>(static_cast<uint32_t>(image.height()));
+        for(size_t y = 0; y < image.height(); y++)
+        {
+            if(image.width() > 0)
+                mStream.write(reinterpret_cast<const char*>(&image(0, y)), image.width());
+        }
+    }
+
+    void layer(const GridLayer& layer)
+    {
+        value<uint32_t>(static_cast<uint32_t>(layer.cellWidth()));
+        value<uint32_t>(static_cast<uint32_t>(layer.cellHeight()));
+        value<uint32_t>(static_cast<uint32_t>(layer.width()));
+        value<uint32_t>(static_cast<uint32_t>(layer.height()));
+        for(size_t y = 0; y < layer.height(); y++)
+        {
+            for(size_t x = 0; x < layer.width(); x++)
+            {
+                const GridCell& cell = layer(x, y);
+                // Counts are only meaningful for the cell's own colors
+                value<uint64_t>(cell.colors.mask());
+                for(uint8_t c : cell.colors)
+                {
+                    value(cell.pixelCount[c]);
+                    value(cell.columnCount[c]);
+                }
+            }
+        }
+    }
+
+private:
+    std::ostream& mStream;
+};
+
+class Reader
+{
+public:
+    explicit Reader(std::istream& stream):
+        mStream(stream)
+    {}
+
+    template<typename T>
+    T value()
+    {
+        T v;
+        mStream.read(reinterpret_cast<char*>(&v), sizeof(v));
+        check();
+        return v;
+    }
+
+    std::string string()
+    {
+        std::string s(size(), '\0');
+        mStream.read(&s[0], s.size());
+        check();
+        return s;
+    }
+
+    std::vector<Colors> palettes()
+    {
+        std::vector<Colors> palettes(size());
+        for(Colors& palette : palettes)
+            palette = Colors::fromMask(value<uint64_t>());
+        return palettes;
+    }
+
+    Array2D<uint8_t> image()
+    {
+        const size_t width = size();
+        const size_t height = size();
+        Array2D<uint8_t> image(width, height);
+        for(size_t y = 0; y < height; y++)
+        {
+            if(width > 0)
+                mStream.read(reinterpret_cast<char*>(&image(0, y)), width);
+            check();
+        }
+        return image;
+    }
+
+    GridLayer layer(uint8_t backgroundColor)
+    {
+        const size_t cellWidth = size();
+        const size_t cellHeight = size();
+        const size_t width = size();
+        const size_t height = size();
+        GridLayer layer(backgroundColor, cellWidth, cellHeight, width, height);
+        for(size_t y = 0; y < height; y++)
+        {
+            for(size_t x = 0; x < width; x++)
+            {
+                GridCell& cell = layer(x, y);
+                cell.colors = Colors::fromMask(value<uint64_t>());
+                for(uint8_t c : cell.colors)
+                {
+                    cell.pixelCount[c] = value<uint16_t>();
+                    cell.columnCount[c] = value<uint16_t>();
+                }
+            }
+        }
+        layer.updateCaches();
+        return layer;
+    }
+
+    // Sizes beyond any NES screen are treated as corruption rather than allocated
+    size_t size()
+    {
+        uint32_t n = value<uint32_t>();
+        if(n > (1u << 20))
+            throw std::runtime_error("Invalid size in conversion cache file");
+        return n;
+    }
+
+private:
+    void check()
+    {
+        if(!mStream)
+            throw std::runtime_error("Truncated conversion cache file");
+    }
+
+    std::istream& mStream;
+};
+
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool ConversionCacheKey::operator==(const ConversionCacheKey& other) const
+{
+    if(hash != other.hash || settings != other.settings ||
+       image.width() != other.image.width() || image.height() != other.image.height())
+    {
+        return false;
+    }
+    for(size_t y = 0; y < image.height(); y++)
+    {
+        if(!std::equal(image.row(y), image.row(y) + image.width(), other.image.row(y)))
+            return false;
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+ConversionCache::ConversionCache(const std::string& directory, size_t maxMemoryEntries):
+    mDirectory(directory),
+    mMaxMemoryEntries(maxMemoryEntries)
+{
+    if(!mDirectory.empty())
+    {
+        std::error_code ec;
+        std::filesystem::create_directories(mDirectory, ec);
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+ConversionCacheKey ConversionCache::key(const Image2D& image, const std::vector<int>& settings)
+{
+    Hasher hasher;
+    hasher.add(static_cast<int>(Version));
+    hasher.add(static_cast<int>(image.width()));
+    hasher.add(static_cast<int>(image.height()));
+    for(size_t y = 0; y < image.height(); y++)
+    {
+        if(image.width() > 0)
+            hasher.add(&image(0, y), image.width());
+    }
+    hasher.add(static_cast<int>(settings.size()));
+    for(int setting : settings)
+        hasher.add(setting);
+    return ConversionCacheKey{hasher.hash(), image, settings};
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool ConversionCache::find(const ConversionCacheKey& key, CachedConversion& conversion)
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        auto it = mEntryByKey.find(key.hash);
+        if(it != mEntryByKey.end() && it->second->first == key)
+        {
+            mEntries.splice(mEntries.begin(), mEntries, it->second);
+            conversion = it->second->second;
+            return true;
+        }
+    }
+    // File reads don't need the lock, as files are only ever replaced whole
+    if(mDirectory.empty() || !readFile(key, conversion))
+        return false;
+    std::lock_guard<std::mutex> lock(mMutex);
+    insertInMemory(key, conversion);
+    return true;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void ConversionCache::insert(const ConversionCacheKey& key, const CachedConversion& conversion)
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        insertInMemory(key, conversion);
+    }
+    if(!mDirectory.empty())
+        writeFile(key, conversion);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void ConversionCache::insertInMemory(const ConversionCacheKey& key, const CachedConversion& conversion)
+{
+    // A colliding entry is replaced, as only one entry is kept per hash
+    auto it = mEntryByKey.find(key.hash);
+    if(it != mEntryByKey.end())
+    {
+        mEntries.erase(it->second);
+        mEntryByKey.erase(it);
+    }
+    if(mMaxMemoryEntries == 0)
+        return;
+    mEntries.emplace_front(key, conversion);
+    mEntryByKey[key.hash] = mEntries.begin();
+    while(mEntries.size() > mMaxMemoryEntries)
+    {
+        mEntryByKey.erase(mEntries.back().first.hash);
+        mEntries.pop_back();
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+std::string ConversionCache::filename(uint64_t hash) const
+{
+    std::stringstream ss;
+    ss << std::hex << std::setw(16) << std::setfill('0') << hash << ".cache";
+    return (std::filesystem::path(mDirectory) / ss.str()).string();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool ConversionCache::readFile(const ConversionCacheKey& key, CachedConversion& conversion) const
+{
+    std::ifstream file(filename(key.hash), std::ifstream::in | std::ifstream::binary);
+    if(!file)
+        return false;
+    try
+    {
+        Reader reader(file);
+        char magic[4];
+        for(char& c : magic)
+            c = reader.value<char>();
+        if(!std::equal(magic, magic + 4, Magic) || reader.value<uint32_t>() != Version)
+            return false;
+        // Another version or a hash collision is a miss, to be overwritten by the next insert
+        ConversionCacheKey fileKey;
+        fileKey.hash = reader.value<uint64_t>();
+        fileKey.image = reader.image();
+        fileKey.settings.resize(reader.size());
+        for(int& setting : fileKey.settings)
+            setting = reader.value<int32_t>();
+        if(!(fileKey == key))
+            return false;
+        CachedConversion c;
+        c.conversionError = reader.string();
+        c.backgroundColor = reader.value<uint8_t>();
+        c.spriteHeight = reader.value<int32_t>();
+        c.palettes = reader.palettes();
+        c.layerBackground = reader.layer(c.backgroundColor);
+        c.layerOverlay = reader.layer(c.backgroundColor);
+        c.layerOverlayFree = reader.layer(c.backgroundColor);
+        c.paletteIndicesBackground = reader.image();
+        c.paletteIndicesOverlay = reader.image();
+        c.outputImage = reader.image();
+        c.outputImageBackground = reader.image();
+        c.outputImageOverlay = reader.image();
+        c.outputImageOverlayGrid = reader.image();
+        c.outputImageOverlayFree = reader.image();
+        conversion = c;
+        return true;
+    }
+    catch(const std::runtime_error&)
+    {
+        return false;
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void ConversionCache::writeFile(const ConversionCacheKey& key, const CachedConversion& conversion) const
+{
+    // Write to a unique temporary name and rename, so that concurrent readers never see a partial file
+    std::stringstream ss;
+    ss << filename(key.hash) << "." << std::this_thread::get_id() << ".tmp";
+    const std::string tempFilename = ss.str();
+    {
+        std::ofstream file(tempFilename, std::ofstream::out | std::ofstream::binary);
+        if(!file)
+            return;
+        Writer writer(file);
+        for(char c : Magic)
+            writer.value(c);
+        writer.value<uint32_t>(Version);
+        writer.value<uint64_t>(key.hash);
+        writer.image(key.image);
+        writer.value<uint32_t>(static_cast<uint32_t>(key.settings.size()));
+        for(int setting : key.settings)
+            writer.value<int32_t>(setting);
+        writer.string(conversion.conversionError);
+        writer.value<uint8_t>(conversion.backgroundColor);
+        writer.value<int32_t>(conversion.spriteHeight);
+        writer.palettes(conversion.palettes);
+        writer.layer(conversion.layerBackground);
+        writer.layer(conversion.layerOverlay);
+        writer.layer(conversion.layerOverlayFree);
+        writer.image(conversion.paletteIndicesBackground);
+        writer.image(conversion.paletteIndicesOverlay);
+        writer.image(conversion.outputImage);
+        writer.image(conversion.outputImageBackground);
+        writer.image(conversion.outputImageOverlay);
+        writer.image(conversion.outputImageOverlayGrid);
+        writer.image(conversion.outputImageOverlayFree);
+        if(!file)
+        {
+            file.close();
+            std::error_code ec;
+            std::filesystem::remove(tempFilename, ec);
+            return;
+        }
+    }
+    // A failed cache write only costs a future re-conversion
+    std::error_code ec;
+    std::filesystem::rename(tempFilename, filename(key.hash), ec);
+    if(ec)
+        std::filesystem::remove(tempFilename, ec);
+}
@@ -0,0 +1,109 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+#ifndef CONVERSION_CACHE_H
+#define CONVERSION_CACHE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+
+#include "Array2D.h"
+#include "GridLayer.h"
+
+//
+// Everything OverlayOptimiser keeps from a conversion
+//
+struct CachedConversion
+{
+    std::string conversionError;
+    uint8_t backgroundColor = 0;
+    int spriteHeight = 0;
+    std::vector<Colors> palettes;
+    GridLayer layerBackground;
+    GridLayer layerOverlay;
+    GridLayer layerOverlayFree;
+    Array2D<uint8_t> paletteIndicesBackground;
+    Array2D<uint8_t> paletteIndicesOverlay;
+    Image2D outputImage;
+    Image2D outputImageBackground;
+    Image2D outputImageOverlay;
+    Image2D outputImageOverlayGrid;
+    Image2D outputImageOverlayFree;
+};
+
+//
+// Everything a conversion result depends on. Results are looked up by hash and then compared in full,
+// so that a hash collision is a miss rather than another image's result.
+//
+struct ConversionCacheKey
+{
+    uint64_t hash = 0;
+    Image2D image;
+    std::vector<int> settings;
+
+    bool operator==(const ConversionCacheKey& other) const;
+};
+
+//
+// Content-addressed store of conversion results: an in-memory LRU in front of one file per result in a directory.
+// Thread-safe, so one cache can be shared by concurrent conversions.
+//
+class ConversionCache
+{
+public:
+    // Bump whenever the models or post-processing change, to invalidate all stored results
+    static constexpr uint32_t Version = 2;
+
+    // An empty directory keeps results in memory only
+    explicit ConversionCache(const std::string& directory, size_t maxMemoryEntries = 16);
+
+    ConversionCache(const ConversionCache&) = delete;
+    ConversionCache& operator=(const ConversionCache&) = delete;
+
+    //
+    // Key of the indexed image and every setting affecting the result, in a fixed order,
+    // hashed with 64-bit FNV-1a
+    //
+    static ConversionCacheKey key(const Image2D& image, const std::vector<int>& settings);
+
+    bool find(const ConversionCacheKey& key, CachedConversion& conversion);
+    void insert(const ConversionCacheKey& key, const CachedConversion& conversion);
+
+protected:
+    std::string filename(uint64_t hash) const;
+    bool readFile(const ConversionCacheKey& key, CachedConversion& conversion) const;
+    void writeFile(const ConversionCacheKey& key, const CachedConversion& conversion) const;
+    void insertInMemory(const ConversionCacheKey& key, const CachedConversion& conversion);
+
+private:
+    using Entry = std::pair<ConversionCacheKey, CachedConversion>;
+
+    std::string mDirectory;
+    size_t mMaxMemoryEntries;
+    std::mutex mMutex;
+    // Most recently used first
+    std::list<Entry> mEntries;
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> mEntryByKey;
+};
+
+#endif // CONVERSION_CACHE_H
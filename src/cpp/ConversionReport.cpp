@@ -0,0 +1,343 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <sstream>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include "ConversionReport.h"
+
+//---------------------------------------------------------------------------------------------------------------------
+
+ConversionReport::ConversionReport(const ConversionReport& other)
+{
+    *this = other;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+ConversionReport& ConversionReport::operator=(const ConversionReport& other)
+{
+    if(this == &other)
+        return *this;
+    std::scoped_lock lock(mMutex, other.mMutex);
+    mStages = other.mStages;
+    mSolves = other.mSolves;
+    mTotalSeconds = other.mTotalSeconds;
+    mFromCache = other.mFromCache;
+    mPeakMemoryBytes = other.mPeakMemoryBytes;
+    mPeakSolverProcessMemoryBytes = other.mPeakSolverProcessMemoryBytes;
+    return *this;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void ConversionReport::clear()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mStages.clear();
+    mSolves.clear();
+    mTotalSeconds = 0.0;
+    mFromCache = false;
+    mPeakMemoryBytes = 0;
+    mPeakSolverProcessMemoryBytes = 0;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void ConversionReport::addStageTime(const std::string& name, double seconds)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto stage = std::find_if(mStages.begin(), mStages.end(), [&](const Stage& s) { return s.name == name; });
+    if(stage == mStages.end())
+        stage = mStages.insert(stage, Stage{name, 0.0, 0});
+    stage->seconds += seconds;
+    stage->count++;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void ConversionReport::addSolve(const SolverStatistics& statistics)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mSolves.push_back(statistics);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void ConversionReport::finish(double totalSeconds, bool fromCache)
+{
+    const size_t peakMemoryBytes = peakResidentMemoryBytes();
+    const size_t peakSolverProcessMemoryBytes = peakChildResidentMemoryBytes();
+    std::lock_guard<std::mutex> lock(mMutex);
+    mTotalSeconds = totalSeconds;
+    mFromCache = fromCache;
+    mPeakMemoryBytes = peakMemoryBytes;
+    mPeakSolverProcessMemoryBytes = peakSolverProcessMemoryBytes;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+std::vector<ConversionReport::Stage> ConversionReport::stages() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mStages;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+std::vector<SolverStatistics> ConversionReport::solves() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mSolves;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+double ConversionReport::totalSeconds() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mTotalSeconds;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool ConversionReport::fromCache() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mFromCache;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+size_t ConversionReport::peakMemoryBytes() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mPeakMemoryBytes;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+size_t ConversionReport::peakSolverProcessMemoryBytes() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mPeakSolverProcessMemoryBytes;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+static std::string jsonString(const std::string& s)
+{
+    std::string quoted = "\"";
+    for(char c : s)
+    {
+        if(c == '"' || c == '\\')
+        {
+            quoted += '\\';
+            quoted += c;
+        }
+        else if(static_cast<unsigned char>(c) < 0x20)
+        {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            quoted += escaped;
+        }
+        else
+        {
+            quoted += c;
+        }
+    }
+    return quoted + "\"";
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+static std::string jsonNumber(double v)
+{
+    // JSON has no infinities or NaN, e.g. for the bound of a model without solution
+    if(!std::isfinite(v))
+        return "null";
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%.6g", v);
+    return buffer;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+std::string ConversionReport::toJson() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    std::ostringstream json;
+    json << "{\n";
+    json << "  \"totalSeconds\": " << jsonNumber(mTotalSeconds) << ",\n";
+    json << "  \"fromCache\": " << (mFromCache ? "true" : "false") << ",\n";
+    json << "  \"peakMemoryBytes\": " << mPeakMemoryBytes << ",\n";
+    json << "  \"peakSolverProcessMemoryBytes\": " << mPeakSolverProcessMemoryBytes << ",\n";
+    json << "  \"stages\": [";
+    for(size_t i = 0; i < mStages.size(); i++)
+    {
+        const Stage& stage = mStages[i];
+        json << (i ? ",\n" : "\n");
+        json << "    {\"name\": " << jsonString(stage.name)
+             << ", \"seconds\": " << jsonNumber(stage.seconds)
+             << ", \"count\": " << stage.count << "}";
+    }
+    json << (mStages.empty() ? "],\n" : "\n  ],\n");
+    json << "  \"solves\": [";
+    for(size_t i = 0; i < mSolves.size(); i++)
+    {
+        const SolverStatistics& solve = mSolves[i];
+        json << (i ? ",\n" : "\n");
+        json << "    {\"pass\": " << jsonString(solve.pass)
+             << ", \"method\": " << jsonString(solve.method)
+             << ", \"variables\": " << solve.numVariables
+             << ", \"constraints\": " << solve.numConstraints
+             << ", \"nonZeros\": " << solve.numNonZeros
+             << ", \"seconds\": " << jsonNumber(solve.seconds)
+             << ", \"hasSolution\": " << (solve.hasSolution ? "true" : "false")
+             << ", \"provenOptimal\": " << (solve.provenOptimal ? "true" : "false")
+             << ", \"timeLimitReached\": " << (solve.timeLimitReached ? "true" : "false")
+             << ", \"objective\": " << jsonNumber(solve.objective)
+             << ", \"bestBound\": " << jsonNumber(solve.bestBound)
+             << ", \"gap\": " << jsonNumber(solve.gap)
+             << ", \"nodes\": " << solve.numNodes << "}";
+    }
+    json << (mSolves.empty() ? "]\n" : "\n  ]\n");
+    json << "}\n";
+    return json.str();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+std::string ConversionReport::toText() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    std::string text;
+    char line[256];
+    std::snprintf(line, sizeof(line), "Total %.3f s%s, peak memory %zu MB (solver process %zu MB)\n",
+                  mTotalSeconds,
+                  mFromCache ? " (cached)" : "",
+                  mPeakMemoryBytes >> 20,
+                  mPeakSolverProcessMemoryBytes >> 20);
+    text += line;
+    for(const Stage& stage : mStages)
+    {
+        std::snprintf(line, sizeof(line), "  %-20s %8.3f s  x%d\n", stage.name.c_str(), stage.seconds, stage.count);
+        text += line;
+    }
+    for(const SolverStatistics& solve : mSolves)
+    {
+        std::snprintf(line, sizeof(line), "%s pass, %s: %.3f s, %zu vars, %zu cons, %zu nz\n",
+                      solve.pass.c_str(),
+                      solve.method.c_str(),
+                      solve.seconds,
+                      solve.numVariables,
+                      solve.numConstraints,
+                      solve.numNonZeros);
+        text += line;
+        if(solve.hasSolution)
+        {
+            std::snprintf(line, sizeof(line), "  objective %g, bound %g, gap %.1f%%, %ld nodes%s%s\n",
+                          solve.objective,
+                          solve.bestBound,
+                          100.0 * solve.gap,
+                          solve.numNodes,
+                          solve.provenOptimal ? ", optimal" : "",
+                          solve.timeLimitReached ? ", time limit reached" : "");
+        }
+        else
+        {
+            std::snprintf(line, sizeof(line), "  no solution%s\n", solve.timeLimitReached ? ", time limit reached" : "");
+        }
+        text += line;
+    }
+    return text;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+StageTimer::StageTimer(ConversionReport& report, const char* stage):
+    mReport(report),
+    mStage(stage),
+    mStart(std::chrono::steady_clock::now())
+{
+
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+StageTimer::~StageTimer()
+{
+    mReport.addStageTime(mStage, elapsedSeconds());
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+double StageTimer::elapsedSeconds() const
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - mStart).count();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+size_t peakResidentMemoryBytes()
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if(!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return 0;
+    return counters.PeakWorkingSetSize;
+#else
+    struct rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#ifdef __APPLE__
+    return static_cast<size_t>(usage.ru_maxrss);
+#else
+    // Kilobytes on Linux
+    return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+size_t peakChildResidentMemoryBytes()
+{
+#ifdef _WIN32
+    return 0;
+#else
+    struct rusage usage;
+    if(getrusage(RUSAGE_CHILDREN, &usage) != 0)
+        return 0;
+#ifdef __APPLE__
+    return static_cast<size_t>(usage.ru_maxrss);
+#else
+    return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
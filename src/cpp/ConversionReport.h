@@ -0,0 +1,123 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+#ifndef CONVERSION_REPORT_H
+#define CONVERSION_REPORT_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <chrono>
+
+//
+// Outcome of one solver call, either in-process or through the CMPL executable
+//
+struct SolverStatistics
+{
+    std::string pass;               // "first" or "second"
+    std::string method;             // "cbc", "cbc incremental", "cbc band <n>", "cbc fixed palettes" or "cmpl"
+    size_t numVariables = 0;        // Model size, 0 if unknown
+    size_t numConstraints = 0;
+    size_t numNonZeros = 0;
+    double seconds = 0.0;
+    bool hasSolution = false;
+    bool provenOptimal = false;
+    bool timeLimitReached = false;
+    double objective = 0.0;         // Incumbent objective
+    double bestBound = 0.0;         // Best possible objective, equal to objective if unknown
+    double gap = 0.0;               // Relative gap between objective and bound
+    long numNodes = 0;              // 0 if unknown
+};
+
+//
+// Structured instrumentation of one conversion: time per pipeline stage, every solver call and memory use.
+// Adding to a report is thread-safe. Stage times of work running in parallel are summed over all threads.
+// Stages may nest, e.g. each pass stage includes the model build and solver stages run for it.
+//
+class ConversionReport
+{
+public:
+    struct Stage
+    {
+        std::string name;
+        double seconds = 0.0;
+        int count = 0;
+    };
+
+    ConversionReport() = default;
+    ConversionReport(const ConversionReport& other);
+    ConversionReport& operator=(const ConversionReport& other);
+
+    void clear();
+
+    // Adds to the named stage, keeping stages in the order they first finished
+    void addStageTime(const std::string& name, double seconds);
+    void addSolve(const SolverStatistics& statistics);
+    void finish(double totalSeconds, bool fromCache);
+
+    std::vector<Stage> stages() const;
+    std::vector<SolverStatistics> solves() const;
+    double totalSeconds() const;
+    bool fromCache() const;
+    size_t peakMemoryBytes() const;
+    size_t peakSolverProcessMemoryBytes() const;
+
+    std::string toJson() const;
+    // Human-readable summary, one stage or solve per line
+    std::string toText() const;
+
+private:
+    mutable std::mutex mMutex;
+    std::vector<Stage> mStages;
+    std::vector<SolverStatistics> mSolves;
+    double mTotalSeconds = 0.0;
+    bool mFromCache = false;
+    size_t mPeakMemoryBytes = 0;
+    size_t mPeakSolverProcessMemoryBytes = 0;
+};
+
+//
+// Adds the time from construction to destruction to one stage of a report
+//
+class StageTimer
+{
+public:
+    StageTimer(ConversionReport& report, const char* stage);
+    ~StageTimer();
+
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+
+    double elapsedSeconds() const;
+
+private:
+    ConversionReport& mReport;
+    const char* mStage;
+    std::chrono::steady_clock::time_point mStart;
+};
+
+//
+// High-water marks of resident memory since the process started, 0 where the platform doesn't tell.
+// Child processes count from the largest CMPL process waited for.
+//
+size_t peakResidentMemoryBytes();
+size_t peakChildResidentMemoryBytes();
+
+#endif // CONVERSION_REPORT_H
@@ -18,19 +18,45 @@
 
 #include <functional>
 #include <unordered_map>
+#include <algorithm>
+#include <stdexcept>
+#include <string>
 
 #include "Export.h"
 
+//
+// Each tile plane is stored as a uint64_t with one byte per row, so that the plane bytes are laid out in memory
+// as NES CHR data. Rows are byte 0 (top) to 7 (bottom) in little-endian order, and pixels are bit 7 (left) to 0.
+//
+
 struct TileNES_8x8 {
     uint64_t p0;    // plane0
     uint64_t p1;    // plane1
 };
 
+// splitmix64 finalizer - unlike std::hash<uint64_t>, which is the identity on common implementations,
+// every input bit affects every output bit
+inline uint64_t mixTileBits(uint64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xBF58476D1CE4E5B9ull;
+    x ^= x >> 27;
+    x *= 0x94D049BB133111EBull;
+    x ^= x >> 31;
+    return x;
+}
+
+// Order-dependent combination, so that repeated or swapped planes do not cancel out
+inline uint64_t combineTileHash(uint64_t h, uint64_t v)
+{
+    return mixTileBits(h ^ (v + 0x9E3779B97F4A7C15ull + (h << 6) + (h >> 2)));
+}
+
 struct TileNES_8x8_hash
 {
     std::size_t operator() (const TileNES_8x8& t) const
     {
-        return std::hash<uint64_t>()(t.p0) ^ std::hash<uint64_t>()(t.p1);
+        return static_cast<std::size_t>(combineTileHash(mixTileBits(t.p0), t.p1));
     }
 };
 
@@ -53,10 +79,11 @@ struct TileNES_8x16_hash
 {
     std::size_t operator() (const TileNES_8x16& t) const
     {
-        return std::hash<uint64_t>()(t.tUp0) ^
-               std::hash<uint64_t>()(t.tUp1) ^
-               std::hash<uint64_t>()(t.tLp0) ^
-               std::hash<uint64_t>()(t.tLp1);
+        uint64_t h = mixTileBits(t.tUp0);
+        h = combineTileHash(h, t.tUp1);
+        h = combineTileHash(h, t.tLp0);
+        h = combineTileHash(h, t.tLp1);
+        return static_cast<std::size_t>(h);
     }
 };
 
@@ -69,39 +96,185 @@ struct TileNES_8x16_equal
     }
 };
 
+// OAM attribute bits mirroring a sprite tile
+static const uint8_t OamFlipHorizontal = 0x40;
+static const uint8_t OamFlipVertical = 0x80;
+static const uint8_t OamFlips[] = {OamFlipHorizontal, OamFlipVertical, OamFlipHorizontal | OamFlipVertical};
+
+//---------------------------------------------------------------------------------------------------------------------
+
+// Mirrors each row of a plane by reversing the bits of each byte
+inline uint64_t flipPlaneHorizontal(uint64_t v)
+{
+    v = ((v >> 1) & 0x5555555555555555ull) | ((v & 0x5555555555555555ull) << 1);
+    v = ((v >> 2) & 0x3333333333333333ull) | ((v & 0x3333333333333333ull) << 2);
+    v = ((v >> 4) & 0x0F0F0F0F0F0F0F0Full) | ((v & 0x0F0F0F0F0F0F0F0Full) << 4);
+    return v;
+}
+
+// Mirrors the rows of a plane by reversing its bytes
+inline uint64_t flipPlaneVertical(uint64_t v)
+{
+    v = ((v >> 8) & 0x00FF00FF00FF00FFull) | ((v & 0x00FF00FF00FF00FFull) << 8);
+    v = ((v >> 16) & 0x0000FFFF0000FFFFull) | ((v & 0x0000FFFF0000FFFFull) << 16);
+    return (v >> 32) | (v << 32);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+TileNES_8x8 flipTile(TileNES_8x8 t, uint8_t flips)
+{
+    if(flips & OamFlipHorizontal)
+    {
+        t.p0 = flipPlaneHorizontal(t.p0);
+        t.p1 = flipPlaneHorizontal(t.p1);
+    }
+    if(flips & OamFlipVertical)
+    {
+        t.p0 = flipPlaneVertical(t.p0);
+        t.p1 = flipPlaneVertical(t.p1);
+    }
+    return t;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+TileNES_8x16 flipTile(TileNES_8x16 t, uint8_t flips)
+{
+    if(flips & OamFlipHorizontal)
+    {
+        t.tUp0 = flipPlaneHorizontal(t.tUp0);
+        t.tUp1 = flipPlaneHorizontal(t.tUp1);
+        t.tLp0 = flipPlaneHorizontal(t.tLp0);
+        t.tLp1 = flipPlaneHorizontal(t.tLp1);
+    }
+    if(flips & OamFlipVertical)
+    {
+        // Flips the full 8x16 sprite, so the upper and lower tiles also swap
+        TileNES_8x16 f;
+        f.tUp0 = flipPlaneVertical(t.tLp0);
+        f.tUp1 = flipPlaneVertical(t.tLp1);
+        f.tLp0 = flipPlaneVertical(t.tUp0);
+        f.tLp1 = flipPlaneVertical(t.tUp1);
+        t = f;
+    }
+    return t;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+using TileMapNES_8x8 = std::unordered_map<TileNES_8x8, size_t, TileNES_8x8_hash, TileNES_8x8_equal>;
+using TileMapNES_8x16 = std::unordered_map<TileNES_8x16, size_t, TileNES_8x16_hash, TileNES_8x16_equal>;
+
+//
+// Index of every tile stored in the CHR so far. Shared by the frames of a sequence, so that they share CHR.
+//
+struct TileTablesNES
+{
+    TileMapNES_8x8 background;
+    TileMapNES_8x8 sprites8x8;
+    TileMapNES_8x16 sprites8x16;
+};
+
+//---------------------------------------------------------------------------------------------------------------------
+
+// Finds the index of an already stored tile, optionally also matching mirrored versions of stored tiles.
+// Returns false if t needs storing as a new tile.
+template<typename Tile, typename TileMap>
+bool findTile(const TileMap& tileDataToIndex, const Tile& t, bool dedupFlipped, size_t& tileIndex, uint8_t& flips)
+{
+    flips = 0;
+    auto it = tileDataToIndex.find(t);
+    for(size_t i = 0; dedupFlipped && it == tileDataToIndex.end() && i < sizeof(OamFlips); i++)
+    {
+        // Mirroring is its own inverse, so the stored tile is the mirrored version of t
+        flips = OamFlips[i];
+        it = tileDataToIndex.find(flipTile(t, flips));
+    }
+    if(it == tileDataToIndex.end())
+    {
+        flips = 0;
+        return false;
+    }
+    tileIndex = it->second;
+    return true;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+static const uint64_t ByteLsbs = 0x0101010101010101ull;
+static const uint64_t ByteMsbs = 0x8080808080808080ull;
+
+// Gathers bit 0 of each of the 8 bytes into a single byte, with byte 0 becoming the most significant bit
+inline uint8_t gatherByteLsbs(uint64_t v)
+{
+    return static_cast<uint8_t>(((v & ByteLsbs) * 0x8040201008040201ull) >> 56);
+}
+
+// Returns 0x80 in each byte of v that is non-zero, and 0x00 in each zero byte
+inline uint64_t nonZeroBytes(uint64_t v)
+{
+    return (((v & ~ByteMsbs) + ~ByteMsbs) | v) & ByteMsbs;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+// Encodes a row of 8 palette-indexed pixels (pixel j in byte j) into the two planes, keeping only pixels of palette p
+inline void encodeRowNES(uint64_t pixels, uint8_t p, uint8_t& p0, uint8_t& p1)
+{
+    // A pixel belongs to palette p when its palette bits (2-7) are zero after xor
+    const uint64_t otherPalette = nonZeroBytes((pixels ^ (ByteLsbs * static_cast<uint8_t>(p << 2))) & (ByteLsbs * 0xFC));
+    pixels &= ~((otherPalette >> 7) * 0xFF);
+    p0 = gatherByteLsbs(pixels);
+    p1 = gatherByteLsbs(pixels >> 1);
+}
+
 //---------------------------------------------------------------------------------------------------------------------
 
 TileNES_8x8 extractTileNES_8x8(const Image2D& image, int paletteMask, int x, int y, int w, int h, uint8_t p)
 {
+    assert(w == 8);
     TileNES_8x8 t;
     t.p0 = 0;
     t.p1 = 0;
+    if(!((1 << p) & paletteMask))
+        return t;
     uint8_t* p0 = reinterpret_cast<uint8_t*>(&t.p0);
     uint8_t* p1 = reinterpret_cast<uint8_t*>(&t.p1);
-    for(int i = 0; i < h; i++)
+    // Pixels outside the image are transparent
+    const int rows = std::min(h, static_cast<int>(image.height()) - y);
+    const int columns = std::min(w, static_cast<int>(image.width()) - x);
+    for(int i = 0; i < rows; i++)
     {
-        for(int j = 0; j < w; j++)
+        const uint8_t* row = image.row(y + i) + x;
+        uint64_t pixels = 0;
+        if(columns == 8)
         {
-            uint8_t c = image(x + j, y + i);
-            int palIndex = c >> 2;
-            bool enabled = (1 << palIndex) & paletteMask;
-            if(enabled && palIndex == p)
-            {
-                uint8_t b0 = (c >> 0) & 0x1;
-                uint8_t b1 = (c >> 1) & 0x1;
-                p0[i] |= b0 << (w - 1 - j);
-                p1[i] |= b1 << (w - 1 - j);
-            }
+            // Constant trip count, which compilers merge into a single 64-bit load
+            for(int j = 0; j < 8; j++)
+                pixels |= uint64_t(row[j]) << (8 * j);
         }
+        else
+        {
+            for(int j = 0; j < columns; j++)
+                pixels |= uint64_t(row[j]) << (8 * j);
+        }
+        encodeRowNES(pixels, p, p0[i], p1[i]);
     }
     return t;
 }
 
+// 8x8 sprite tiles an OAM tile index byte can address
+const size_t MaxSpriteTilesNES = 256;
+// Background tiles an MMC5 tile index can address: 8 bits in the nametable and 6 in exRAM
+const size_t MaxBackgroundTilesNES = 1 << 14;
+
 //---------------------------------------------------------------------------------------------------------------------
 
 void buildDataNES_BG(const Image2D& image,
                      int paletteMask,
                      const Array2D<uint8_t>& paletteIndicesBackground,
+                     TileMapNES_8x8& tileDataToIndex,
                      std::vector<uint8_t>& nametable,
                      std::vector<uint8_t>& exRAM,
                      std::vector<uint8_t>& chr)
@@ -110,8 +283,6 @@ void buildDataNES_BG(const Image2D& image,
     nametable.resize(1024);
     exRAM.clear();
     exRAM.resize(1024);
-    chr.clear();
-    std::unordered_map<TileNES_8x8, size_t, TileNES_8x8_hash, TileNES_8x8_equal> tileDataToIndex;
     int tileWidth = 8;
     int tileHeight = 8;
     int nametableGridWidth = 32;
@@ -126,16 +297,16 @@ void buildDataNES_BG(const Image2D& image,
         {
             uint8_t p = paletteIndicesBackground(x / scaleWidth, y / scaleHeight);
             TileNES_8x8 t = extractTileNES_8x8(image, paletteMask, tileWidth * x, tileHeight * y, tileWidth, tileHeight, p);
-            if(!tileDataToIndex.count(t))
+            auto inserted = tileDataToIndex.emplace(t, tileDataToIndex.size());
+            if(inserted.second)
             {
-                tileDataToIndex[t] = tileDataToIndex.size();
                 uint8_t* p = reinterpret_cast<uint8_t*>(&t.p0);
                 for(int y = 0; y < 2 * tileHeight; y++)
                 {
                     chr.push_back(p[y]);
                 }
             }
-            int tileIndex = tileDataToIndex[t];
+            int tileIndex = inserted.first->second;
             nametable[nametableGridWidth * y + x] = tileIndex & 0xFF;
             exRAM[nametableGridWidth * y + x] = (p << 6) | (tileIndex >> 8);
         }
@@ -170,18 +341,21 @@ void buildDataNES_BG(const Image2D& image,
 void buildDataNES_OAM_8x8(const Image2D& image,
                           int paletteMask,
                           const std::vector<Sprite>& sprites,
+                          bool dedupFlipped,
+                          TileMapNES_8x8& tileDataToIndex,
                           std::vector<uint8_t>& oam,
                           std::vector<uint8_t>& oamCHR)
 {
     oam.clear();
-    oamCHR.clear();
-    std::unordered_map<TileNES_8x8, size_t, TileNES_8x8_hash, TileNES_8x8_equal> tileDataToIndex;
     for(const Sprite& s : sprites )
     {
         TileNES_8x8 t = extractTileNES_8x8(image, paletteMask, s.x, s.y, 8, 8, s.p);
-        if(!tileDataToIndex.count(t))
+        size_t tileIndex;
+        uint8_t flips;
+        if(!findTile(tileDataToIndex, t, dedupFlipped, tileIndex, flips))
         {
-            tileDataToIndex[t] = tileDataToIndex.size();
+            tileIndex = tileDataToIndex.size();
+            tileDataToIndex[t] = tileIndex;
             uint8_t* p = reinterpret_cast<uint8_t*>(&t.p0);
             for(int y = 0; y < 2 * 8; y++)
             {
@@ -189,8 +363,8 @@ void buildDataNES_OAM_8x8(const Image2D& image,
             }
         }
         oam.push_back(static_cast<uint8_t>(s.y - 1));
-        oam.push_back(static_cast<uint8_t>(tileDataToIndex[t]));
-        oam.push_back(static_cast<uint8_t>(s.p));
+        oam.push_back(static_cast<uint8_t>(tileIndex));
+        oam.push_back(static_cast<uint8_t>(s.p | flips));
         oam.push_back(static_cast<uint8_t>(s.x));
     }
 }
@@ -199,13 +373,13 @@ void buildDataNES_OAM_8x8(const Image2D& image,
 
 void buildDataNES_OAM_8x16(const Image2D& image,
                            int paletteMask,
-                           const std::vector<Sprite> sprites,
+                           const std::vector<Sprite>& sprites,
+                           bool dedupFlipped,
+                           TileMapNES_8x16& tileDataToIndex,
                            std::vector<uint8_t>& oam,
                            std::vector<uint8_t>& oamCHR)
 {
     oam.clear();
-    oamCHR.clear();
-    std::unordered_map<TileNES_8x16, size_t, TileNES_8x16_hash, TileNES_8x16_equal> tileDataToIndex;
     for(const Sprite& s : sprites )
     {
         TileNES_8x8 tU = extractTileNES_8x8(image, paletteMask, s.x, s.y, 8, 8, s.p);
@@ -215,9 +389,12 @@ void buildDataNES_OAM_8x16(const Image2D& image,
         t.tUp1 = tU.p1;
         t.tLp0 = tL.p0;
         t.tLp1 = tL.p1;
-        if(!tileDataToIndex.count(t))
+        size_t tileIndex;
+        uint8_t flips;
+        if(!findTile(tileDataToIndex, t, dedupFlipped, tileIndex, flips))
         {
-            tileDataToIndex[t] = tileDataToIndex.size();
+            tileIndex = tileDataToIndex.size();
+            tileDataToIndex[t] = tileIndex;
             uint8_t* pU = reinterpret_cast<uint8_t*>(&t.tUp0);
             for(int y = 0; y < 2 * 8; y++)
             {
@@ -230,15 +407,15 @@ void buildDataNES_OAM_8x16(const Image2D& image,
             }
         }
         oam.push_back(static_cast<uint8_t>(s.y - 1));
-        oam.push_back(static_cast<uint8_t>(tileDataToIndex[t] << 1));
-        oam.push_back(static_cast<uint8_t>(s.p));
+        oam.push_back(static_cast<uint8_t>(tileIndex << 1));
+        oam.push_back(static_cast<uint8_t>(s.p | flips));
         oam.push_back(static_cast<uint8_t>(s.x));
     }
 }
 
 //---------------------------------------------------------------------------------------------------------------------
 
-void buildDataNES_palette(const std::vector<std::set<uint8_t> > &palettes, uint8_t backgroundColor, std::vector<uint8_t>& paletteOut)
+void buildDataNES_palette(const std::vector<Colors> &palettes, uint8_t backgroundColor, std::vector<uint8_t>& paletteOut)
 {
     const size_t PaletteGroupSize = 4;
     paletteOut.clear();
@@ -261,23 +438,163 @@ void buildDataNES_palette(const std::vector<std::set<uint8_t> > &palettes, uint8
 
 //---------------------------------------------------------------------------------------------------------------------
 
-ExportDataNES buildExportData(const OverlayOptimiser& optimiser, int paletteMask)
+// Nametable, exRAM and OAM of one image, adding its new tiles to tileTables and the CHR
+void buildFrameData(const OverlayOptimiser& optimiser,
+                    int paletteMask,
+                    bool dedupFlippedSprites,
+                    TileTablesNES& tileTables,
+                    ExportDataNES& exportData,
+                    std::vector<uint8_t>& bgCHR,
+                    std::vector<uint8_t>& oamCHR)
 {
-    ExportDataNES exportData;
     Image2D image = optimiser.outputImage();
     // Background nametable / CHR
     buildDataNES_BG(image,
                     paletteMask,
                     optimiser.debugPaletteIndicesBackground(),
+                    tileTables.background,
                     exportData.nametable,
                     exportData.exram,
-                    exportData.bgCHR);
+                    bgCHR);
     // Sprite OAM / CHR
     if(optimiser.spriteHeight() == 16)
-        buildDataNES_OAM_8x16(image, paletteMask, optimiser.spritesOverlay(), exportData.oam, exportData.oamCHR);
+        buildDataNES_OAM_8x16(image, paletteMask, optimiser.spritesOverlay(), dedupFlippedSprites, tileTables.sprites8x16, exportData.oam, oamCHR);
     else
-        buildDataNES_OAM_8x8(image, paletteMask, optimiser.spritesOverlay(), exportData.oam, exportData.oamCHR);
+        buildDataNES_OAM_8x8(image, paletteMask, optimiser.spritesOverlay(), dedupFlippedSprites, tileTables.sprites8x8, exportData.oam, oamCHR);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+ExportDataNES buildExportData(const OverlayOptimiser& optimiser, int paletteMask, bool dedupFlippedSprites)
+{
+    ExportDataNES exportData;
+    TileTablesNES tileTables;
+    buildFrameData(optimiser, paletteMask, dedupFlippedSprites, tileTables, exportData, exportData.bgCHR, exportData.oamCHR);
     // Palette
     buildDataNES_palette(optimiser.palettes(), optimiser.backgroundColor(), exportData.palette);
     return exportData;
 }
+
+//---------------------------------------------------------------------------------------------------------------------
+
+SequenceExportDataNES buildSequenceExportData(const std::vector<std::unique_ptr<OverlayOptimiser>>& frameOptimisers,
+                                              int paletteMask,
+                                              bool dedupFlippedSprites)
+{
+    SequenceExportDataNES exportData;
+    TileTablesNES tileTables;
+    // Tile 0 is blank, so that blank frames and screens only use tile 0
+    tileTables.background.emplace(TileNES_8x8{0, 0}, 0);
+    exportData.bgCHR.resize(ExportDataNES::TileSize, 0);
+    exportData.frames.resize(frameOptimisers.size());
+    for(size_t i = 0; i < frameOptimisers.size(); i++)
+    {
+        buildFrameData(*frameOptimisers[i],
+                       paletteMask,
+                       dedupFlippedSprites,
+                       tileTables,
+                       exportData.frames[i],
+                       exportData.bgCHR,
+                       exportData.oamCHR);
+    }
+    // The exRAM byte holds the palette above the tile index's high bits, so a larger index would corrupt it
+    const size_t numBackgroundTiles = exportData.bgCHR.size() / ExportDataNES::TileSize;
+    if(numBackgroundTiles > MaxBackgroundTilesNES)
+    {
+        throw std::runtime_error("The frames need " + std::to_string(numBackgroundTiles)
+                                 + " background tiles, more than the " + std::to_string(MaxBackgroundTilesNES)
+                                 + " MMC5 tile indices can address");
+    }
+    // OAM entries hold an 8-bit tile index, which the sprite tiles shared by all frames can outgrow. With 8x16
+    // sprites the index selects a pair of tiles, so either way the limit is 256 8x8 tiles.
+    const size_t numSpriteTiles = exportData.oamCHR.size() / ExportDataNES::TileSize;
+    if(numSpriteTiles > MaxSpriteTilesNES)
+    {
+        throw std::runtime_error("The frames need " + std::to_string(numSpriteTiles) + " sprite tiles, more than the "
+                                 + std::to_string(MaxSpriteTilesNES) + " OAM tile indices can address");
+    }
+    // Palette, the same for all frames
+    if(!frameOptimisers.empty())
+        buildDataNES_palette(frameOptimisers.front()->palettes(), frameOptimisers.front()->backgroundColor(), exportData.palette);
+    return exportData;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+MapExportDataNES buildMapExportData(const std::vector<std::unique_ptr<OverlayOptimiser>>& screenOptimisers,
+                                    size_t screensWide,
+                                    MapStreamOrder order,
+                                    int paletteMask,
+                                    bool dedupFlippedSprites)
+{
+    // Tiles and attribute bytes of one screen's nametable
+    const size_t ScreenWidthTiles = 32;
+    const size_t ScreenHeightTiles = 30;
+    const size_t AttributesOffset = ScreenWidthTiles * ScreenHeightTiles;
+    const size_t AttributesSize = 8;
+    SequenceExportDataNES screens = buildSequenceExportData(screenOptimisers, paletteMask, dedupFlippedSprites);
+    MapExportDataNES exportData;
+    exportData.bgCHR = std::move(screens.bgCHR);
+    exportData.oamCHR = std::move(screens.oamCHR);
+    exportData.palette = std::move(screens.palette);
+    screensWide = std::max<size_t>(screensWide, 1);
+    const size_t screensHigh = (screens.frames.size() + screensWide - 1) / screensWide;
+    exportData.widthTiles = ScreenWidthTiles * screensWide;
+    exportData.heightTiles = ScreenHeightTiles * screensHigh;
+    const size_t widthAttributes = AttributesSize * screensWide;
+    const size_t heightAttributes = AttributesSize * screensHigh;
+    // Screens are only missing from an incomplete last row, which is left blank with tile 0
+    auto screen = [&](size_t x, size_t y, size_t screenWidth, size_t screenHeight) -> const ExportDataNES*
+    {
+        const size_t i = screensWide * (y / screenHeight) + x / screenWidth;
+        return i < screens.frames.size() ? &screens.frames[i] : nullptr;
+    };
+    auto appendTile = [&](size_t x, size_t y)
+    {
+        const ExportDataNES* s = screen(x, y, ScreenWidthTiles, ScreenHeightTiles);
+        const size_t i = ScreenWidthTiles * (y % ScreenHeightTiles) + x % ScreenWidthTiles;
+        exportData.nametable.push_back(s ? s->nametable[i] : 0);
+        exportData.exram.push_back(s ? s->exram[i] : 0);
+    };
+    auto appendAttribute = [&](size_t x, size_t y)
+    {
+        const ExportDataNES* s = screen(x, y, AttributesSize, AttributesSize);
+        const size_t i = AttributesOffset + AttributesSize * (y % AttributesSize) + x % AttributesSize;
+        exportData.attributes.push_back(s ? s->nametable[i] : 0);
+    };
+    if(order == MapStreamOrder::Columns)
+    {
+        for(size_t x = 0; x < exportData.widthTiles; x++)
+        {
+            for(size_t y = 0; y < exportData.heightTiles; y++)
+                appendTile(x, y);
+        }
+        for(size_t x = 0; x < widthAttributes; x++)
+        {
+            for(size_t y = 0; y < heightAttributes; y++)
+                appendAttribute(x, y);
+        }
+    }
+    else
+    {
+        for(size_t y = 0; y < exportData.heightTiles; y++)
+        {
+            for(size_t x = 0; x < exportData.widthTiles; x++)
+                appendTile(x, y);
+        }
+        for(size_t y = 0; y < heightAttributes; y++)
+        {
+            for(size_t x = 0; x < widthAttributes; x++)
+                appendAttribute(x, y);
+        }
+    }
+    for(const ExportDataNES& frame : screens.frames)
+    {
+        // More than 64 sprites need multiplexing, but are still exported as for single screens
+        const size_t numSprites = frame.oam.size() / 4;
+        exportData.oam.push_back(static_cast<uint8_t>(numSprites & 0xFF));
+        exportData.oam.push_back(static_cast<uint8_t>(numSprites >> 8));
+        exportData.oam.insert(exportData.oam.end(), frame.oam.begin(), frame.oam.end());
+    }
+    return exportData;
+}
@@ -21,6 +21,7 @@
 #define EXPORT_H
 
 #include <vector>
+#include <memory>
 #include <cstdint>
 
 #include "OverlayOptimiser.h"
@@ -36,6 +37,64 @@ struct ExportDataNES
     static constexpr size_t TileSize = 16;
 };
 
-ExportDataNES buildExportData(const OverlayOptimiser& optimiser, int paletteMask);
+//
+// Frames of a sequence (see OverlayOptimiser::convertSequence), sharing one palette and one set of CHR
+//
+struct SequenceExportDataNES
+{
+    std::vector<uint8_t> bgCHR;
+    std::vector<uint8_t> oamCHR;
+    std::vector<uint8_t> palette;
+    std::vector<ExportDataNES> frames;  // Nametable, exRAM and OAM of each frame, with empty CHR and palette
+};
+
+//
+// Map of screens (see OverlayOptimiser::convertMap), laid out for streaming into the nametables while scrolling,
+// with one palette and one set of CHR for the whole map.
+//
+// With MapStreamOrder::Columns, the nametable and exRAM hold one 8-pixel column of tiles after the other, each
+// spanning the map's full height (30 tiles per screen), and the attributes one 32-pixel column of attribute
+// bytes after the other, each holding the 8 bytes of that column's attribute table in every screen, top to
+// bottom. With MapStreamOrder::Rows, they hold the rows of tiles / attribute bytes instead, each spanning the
+// map's full width. A column or row of each can thus be written to the nametable as the map scrolls in.
+//
+enum class MapStreamOrder
+{
+    Columns,
+    Rows
+};
+
+struct MapExportDataNES
+{
+    size_t widthTiles;
+    size_t heightTiles;
+    std::vector<uint8_t> nametable;     // Low byte of each tile index
+    std::vector<uint8_t> exram;         // MMC5 exRAM byte of each tile: palette in bits 6-7, tile index bits 8-13
+    std::vector<uint8_t> attributes;
+    std::vector<uint8_t> bgCHR;
+    std::vector<uint8_t> oamCHR;
+    std::vector<uint8_t> palette;
+    // For each screen in row-major order: the number of sprites as 16-bit little-endian, followed by their OAM
+    // entries relative to the screen
+    std::vector<uint8_t> oam;
+};
+
+// With dedupFlippedSprites, a sprite tile that is a horizontally and / or vertically mirrored version of an
+// earlier tile re-uses that tile with the OAM flip bits set, instead of adding another tile to the sprite CHR
+ExportDataNES buildExportData(const OverlayOptimiser& optimiser, int paletteMask, bool dedupFlippedSprites = false);
+
+// Like buildExportData for each frame, but with tiles stored once for all frames and each frame's tile indices
+// referring to the shared CHR. Throws if the shared tiles are more than OAM (sprites) or MMC5 (background)
+// tile indices can address.
+SequenceExportDataNES buildSequenceExportData(const std::vector<std::unique_ptr<OverlayOptimiser>>& frameOptimisers,
+                                              int paletteMask,
+                                              bool dedupFlippedSprites = false);
+
+// Like buildSequenceExportData for the screens of a map, screensWide per row, rearranged for streaming
+MapExportDataNES buildMapExportData(const std::vector<std::unique_ptr<OverlayOptimiser>>& screenOptimisers,
+                                    size_t screensWide,
+                                    MapStreamOrder order,
+                                    int paletteMask,
+                                    bool dedupFlippedSprites = false);
 
 #endif // EXPORT_H
@@ -87,55 +87,159 @@ size_t GridLayer::colorsPerCellSum() const
 
 //---------------------------------------------------------------------------------------------------------------------
 
-const std::set<uint8_t> &GridLayer::colors() const
+const Colors &GridLayer::colors() const
 {
     return mColors;
 }
 
 //---------------------------------------------------------------------------------------------------------------------
 
-void GridLayer::initializeFromImage(const Image2D &image)
+GridLayer GridLayer::rows(size_t y, size_t numRows) const
+{
+    assert(y + numRows <= height());
+    GridLayer layer(mBackgroundColor, mCellWidth, mCellHeight, width(), numRows);
+    for(size_t Y = 0; Y < numRows; Y++)
+    {
+        for(size_t X = 0; X < width(); X++)
+        {
+            layer(X, Y) = (*this)(X, y + Y);
+        }
+    }
+    layer.updateCaches();
+    return layer;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void GridLayer::updateCaches()
 {
-    const int imageWidth = cellWidth() * width();
-    const int imageHeight = cellHeight() * height();
     mMaxColorsPerCell = 0;
     mColorsPerCellSum = 0;
     mColors.clear();
-    for(int Y = 0; Y < height(); Y++)
+    for(size_t Y = 0; Y < height(); Y++)
     {
-        for(int X = 0; X < width(); X++)
+        for(size_t X = 0; X < width(); X++)
         {
-            GridCell cell;
-            for(int x = 0; x < cellWidth(); x++)
-            {
-                std::set<uint8_t> columnColors;
-                for(int y = 0; y < cellHeight(); y++)
-                {
-                    int srcX = X * cellWidth() + x;
-                    int srcY = Y * cellHeight() + y;
-                    if(srcX >= 0 && srcX < imageWidth && srcY >= 0 && srcY < imageHeight)
-                    {
-                        uint8_t c = image(srcX, srcY);
-                        if(c != mBackgroundColor)
-                        {
-                            cell.colors.insert(c);
-                            cell.pixelCount[c]++;
-                            columnColors.insert(c);
-                            mColors.insert(c);
-                        }
-                    }
-                }
-                for(uint8_t c : columnColors)
-                {
-                    cell.columnCount[c]++;
-                }
-            }
-            (*this)(X, Y) = cell;
-            // Update caches
-            std::set<uint8_t> colors = cell.colors;
-            size_t numColorsInCell = colors.size();
+            const GridCell& cell = (*this)(X, Y);
+            mColors |= cell.colors;
+            size_t numColorsInCell = cell.colors.size();
             mMaxColorsPerCell = std::max(mMaxColorsPerCell, numColorsInCell);
             mColorsPerCellSum += numColorsInCell;
         }
     }
 }
+
+//---------------------------------------------------------------------------------------------------------------------
+
+//
+// Counts of the cell at (x0, y0), which must lie entirely inside the image.
+// Instantiated only for the common NES geometries, so that the loops over the cell have constant trip counts
+// and are unrolled / vectorised, with rows read in order and each column's colors gathered as a bit mask.
+//
+template<size_t CellWidth, size_t CellHeight>
+static inline void countCell(const Image2D& image, size_t x0, size_t y0, uint8_t backgroundColor, GridCell& cell)
+{
+    uint64_t columnMasks[CellWidth] = {};
+    for(size_t y = 0; y < CellHeight; y++)
+    {
+        const uint8_t* row = image.row(y0 + y) + x0;
+        for(size_t x = 0; x < CellWidth; x++)
+        {
+            const uint8_t c = row[x];
+            assert(c < ColorSet::MaxColors && "Color outside NES hardware palette");
+            cell.pixelCount[c]++;
+            columnMasks[x] |= uint64_t(1) << c;
+        }
+    }
+    // Background pixels were counted unconditionally above, and are removed here instead
+    uint64_t backgroundMask = 0;
+    if(backgroundColor < ColorSet::MaxColors)
+    {
+        backgroundMask = uint64_t(1) << backgroundColor;
+        cell.pixelCount[backgroundColor] = 0;
+    }
+    uint64_t cellMask = 0;
+    for(size_t x = 0; x < CellWidth; x++)
+    {
+        const uint64_t columnMask = columnMasks[x] & ~backgroundMask;
+        cellMask |= columnMask;
+        for(uint8_t c : ColorSet::fromMask(columnMask))
+            cell.columnCount[c]++;
+    }
+    cell.colors = ColorSet::fromMask(cellMask);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+//
+// Generic version of the above for any cell size, where pixels outside the image are skipped
+//
+static void countCell(const Image2D& image, size_t x0, size_t y0, size_t cellWidth, size_t cellHeight, uint8_t backgroundColor, GridCell& cell)
+{
+    for(size_t x = x0; x < x0 + cellWidth && x < image.width(); x++)
+    {
+        Colors columnColors;
+        for(size_t y = y0; y < y0 + cellHeight && y < image.height(); y++)
+        {
+            uint8_t c = image(x, y);
+            if(c != backgroundColor)
+            {
+                cell.colors.insert(c);
+                cell.pixelCount[c]++;
+                columnColors.insert(c);
+            }
+        }
+        for(uint8_t c : columnColors)
+        {
+            cell.columnCount[c]++;
+        }
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+template<size_t CellWidth, size_t CellHeight>
+void GridLayer::initializeCells(const Image2D& image)
+{
+    for(size_t Y = 0; Y < height(); Y++)
+    {
+        for(size_t X = 0; X < width(); X++)
+        {
+            GridCell& cell = (*this)(X, Y);
+            cell = GridCell();
+            const size_t x0 = X * CellWidth;
+            const size_t y0 = Y * CellHeight;
+            // Only cells on the right / bottom edge of an image that isn't a multiple of the cell size are partial
+            if(x0 + CellWidth <= image.width() && y0 + CellHeight <= image.height())
+                countCell<CellWidth, CellHeight>(image, x0, y0, mBackgroundColor, cell);
+            else
+                countCell(image, x0, y0, CellWidth, CellHeight, mBackgroundColor, cell);
+        }
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void GridLayer::initializeFromImage(const Image2D &image)
+{
+    // Attribute cells are 16x16 or 8x8 (MMC5), and the overlay grid is 8x8 or 8x16 sprites
+    if(mCellWidth == 16 && mCellHeight == 16)
+        initializeCells<16, 16>(image);
+    else if(mCellWidth == 8 && mCellHeight == 8)
+        initializeCells<8, 8>(image);
+    else if(mCellWidth == 8 && mCellHeight == 16)
+        initializeCells<8, 16>(image);
+    else
+    {
+        for(size_t Y = 0; Y < height(); Y++)
+        {
+            for(size_t X = 0; X < width(); X++)
+            {
+                GridCell& cell = (*this)(X, Y);
+                cell = GridCell();
+                countCell(image, X * mCellWidth, Y * mCellHeight, mCellWidth, mCellHeight, mBackgroundColor, cell);
+            }
+        }
+    }
+    updateCaches();
+}
@@ -20,14 +20,12 @@
 #ifndef GRID_LAYER_H
 #define GRID_LAYER_H
 
-#include <set>
-#include <unordered_map>
+#include <array>
 #include <algorithm>
 #include <cassert>
 
 #include "Array2D.h"
-
-using Colors = std::set<uint8_t>;
+#include "ColorSet.h"
 
 //
 // Represent a grid cell for color mapping purposes.
@@ -35,12 +33,29 @@ using Colors = std::set<uint8_t>;
 struct GridCell
 {
     Colors colors;
-    std::unordered_map<uint8_t, int> pixelCount;
-    std::unordered_map<uint8_t, int> columnCount;
+    // Counts indexed by color, only meaningful for colors in the cell
+    std::array<uint16_t, ColorSet::MaxColors> pixelCount = {};
+    std::array<uint16_t, ColorSet::MaxColors> columnCount = {};
     size_t numColors() const
     {
         return colors.size();
     }
+    // Equal cells are identical to the solver models
+    bool operator==(const GridCell& other) const
+    {
+        if(colors != other.colors)
+            return false;
+        for(uint8_t c : colors)
+        {
+            if(pixelCount[c] != other.pixelCount[c] || columnCount[c] != other.columnCount[c])
+                return false;
+        }
+        return true;
+    }
+    bool operator!=(const GridCell& other) const
+    {
+        return !(*this == other);
+    }
 };
 
 //
@@ -65,18 +80,28 @@ public:
 
     size_t colorsPerCellSum() const;
 
-    const std::set<uint8_t>& colors() const;
+    const Colors& colors() const;
+
+    // Copy of numRows grid rows starting at row y, with its own colors / caches
+    GridLayer rows(size_t y, size_t numRows) const;
+
+    // Recompute colors / caches after cells were modified directly
+    void updateCaches();
 
 protected:
     void initializeFromImage(const Image2D& image);
 
+    // initializeFromImage for a cell size known at compile time
+    template<size_t CellWidth, size_t CellHeight>
+    void initializeCells(const Image2D& image);
+
 private:
     uint8_t mBackgroundColor;
     size_t mCellWidth;
     size_t mCellHeight;
     size_t mMaxColorsPerCell;
     size_t mColorsPerCellSum;
-    std::set<uint8_t> mColors;
+    Colors mColors;
 };
 
 
@@ -0,0 +1,396 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cassert>
+
+#include "HeuristicSolver.h"
+
+//---------------------------------------------------------------------------------------------------------------------
+
+namespace
+{
+
+//
+// Local search state for one pass. Colors and palettes are plain masks, as in ColorSet.
+//
+class PalettePacker
+{
+public:
+    PalettePacker(const GridLayer& layer,
+                  int gridCellColorLimit,
+                  int numPalettes,
+                  int maxSpritePalettes,
+                  int maxRowSize,
+                  bool secondPass);
+
+    // Greedily pack palettes from the heaviest cell color combinations
+    void packInitialPalettes();
+
+    // Swap palette colors while the cost improves
+    void improvePalettes(int maxRounds);
+
+    // Use the given palettes instead of packing them
+    void setPalettes(const std::vector<Colors>& palettes);
+
+    bool valid() const;
+
+    void writeSolution(std::vector<Colors>& palettes,
+                       GridLayer& layerKept,
+                       GridLayer& layerMoved,
+                       Array2D<uint8_t>& paletteIndices,
+                       uint8_t paletteIndexOffset) const;
+
+protected:
+    struct Cell
+    {
+        size_t x;
+        size_t y;
+        uint64_t colors;
+    };
+
+    int weight(const Cell& cell, uint64_t colors) const;
+    size_t bestPalette(const Cell& cell, const std::vector<uint64_t>& palettes) const;
+    double evaluate(const std::vector<uint64_t>& palettes, int& numViolations) const;
+
+private:
+    const GridLayer& mLayer;
+    size_t mColorLimit;
+    size_t mNumPalettes;
+    size_t mMaxColorsOverlay;
+    int mMaxRowSize;
+    bool mSecondPass;
+    std::vector<Cell> mCells;
+    std::vector<uint64_t> mPalettes;
+    double mCost;
+    int mNumViolations;
+    // Weight of a constraint violation, above any achievable sum of moved column counts
+    static constexpr double ViolationPenalty = 1.0e7;
+};
+
+//---------------------------------------------------------------------------------------------------------------------
+
+PalettePacker::PalettePacker(const GridLayer& layer,
+                             int gridCellColorLimit,
+                             int numPalettes,
+                             int maxSpritePalettes,
+                             int maxRowSize,
+                             bool secondPass):
+    mLayer(layer),
+    mColorLimit(gridCellColorLimit),
+    mNumPalettes(numPalettes),
+    mMaxColorsOverlay(maxSpritePalettes * gridCellColorLimit),
+    mMaxRowSize(maxRowSize),
+    mSecondPass(secondPass),
+    mPalettes(numPalettes, 0),
+    mCost(0.0),
+    mNumViolations(0)
+{
+    for(size_t y = 0; y < layer.height(); y++)
+    {
+        for(size_t x = 0; x < layer.width(); x++)
+        {
+            if(!layer(x, y).colors.empty())
+                mCells.push_back(Cell{x, y, layer(x, y).colors.mask()});
+        }
+    }
+    mCost = evaluate(mPalettes, mNumViolations);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+int PalettePacker::weight(const Cell& cell, uint64_t colors) const
+{
+    const GridCell& gridCell = mLayer(cell.x, cell.y);
+    int w = 0;
+    for(uint8_t c : ColorSet::fromMask(colors & cell.colors))
+    {
+        w += gridCell.columnCount[c];
+    }
+    return w;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+size_t PalettePacker::bestPalette(const Cell& cell, const std::vector<uint64_t>& palettes) const
+{
+    size_t bestIndex = 0;
+    int bestWeight = -1;
+    for(size_t p = 0; p < palettes.size(); p++)
+    {
+        int w = weight(cell, palettes[p]);
+        if(w > bestWeight)
+        {
+            bestWeight = w;
+            bestIndex = p;
+        }
+    }
+    return bestIndex;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+double PalettePacker::evaluate(const std::vector<uint64_t>& palettes, int& numViolations) const
+{
+    double cost = 0.0;
+    numViolations = 0;
+    uint64_t movedTotal = 0;
+    uint64_t paletteTotal = 0;
+    for(uint64_t palette : palettes)
+    {
+        paletteTotal |= palette;
+    }
+    std::vector<int> rowSize(mLayer.height(), 0);
+    for(const Cell& cell : mCells)
+    {
+        uint64_t kept = palettes.empty() ? 0 : cell.colors & palettes[bestPalette(cell, palettes)];
+        uint64_t moved = cell.colors & ~kept;
+        cost += weight(cell, moved);
+        movedTotal |= moved;
+        if(mSecondPass)
+        {
+            // Grid sprite occupancy plus one free sprite per free color
+            rowSize[cell.y] += (kept != 0) + ColorSet::fromMask(moved).size();
+        }
+        else
+        {
+            rowSize[cell.y] += (moved != 0);
+        }
+    }
+    for(int size : rowSize)
+    {
+        numViolations += std::max(0, size - mMaxRowSize);
+    }
+    numViolations += std::max<int>(0, ColorSet::fromMask(movedTotal).size() - mMaxColorsOverlay);
+    if(mSecondPass)
+    {
+        // Free colors must be in some sprite palette
+        numViolations += ColorSet::fromMask(movedTotal & ~paletteTotal).size();
+    }
+    return cost + ViolationPenalty * numViolations;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void PalettePacker::packInitialPalettes()
+{
+    // Most important colors of each cell, with the total weight of each distinct combination
+    std::unordered_map<uint64_t, int> combinationWeights;
+    for(const Cell& cell : mCells)
+    {
+        const GridCell& gridCell = mLayer(cell.x, cell.y);
+        std::vector<uint8_t> colors(gridCell.colors.begin(), gridCell.colors.end());
+        std::stable_sort(colors.begin(), colors.end(), [&](uint8_t a, uint8_t b)
+        {
+            return gridCell.columnCount[a] > gridCell.columnCount[b];
+        });
+        Colors combination;
+        for(size_t i = 0; i < colors.size() && i < mColorLimit; i++)
+        {
+            combination.insert(colors[i]);
+        }
+        combinationWeights[combination.mask()] += weight(cell, combination.mask());
+    }
+    std::vector<std::pair<uint64_t, int>> combinations(combinationWeights.begin(), combinationWeights.end());
+    std::sort(combinations.begin(), combinations.end(), [](const std::pair<uint64_t, int>& a, const std::pair<uint64_t, int>& b)
+    {
+        return a.second != b.second ? a.second > b.second : a.first < b.first;
+    });
+    std::vector<uint64_t> palettes;
+    for(const auto& combination : combinations)
+    {
+        const uint64_t colors = combination.first;
+        // Already covered, or merge into the palette needing fewest new colors, or start a new palette
+        bool covered = false;
+        size_t bestIndex = palettes.size();
+        size_t bestAdded = mColorLimit + 1;
+        for(size_t p = 0; p < palettes.size() && !covered; p++)
+        {
+            covered = (colors & ~palettes[p]) == 0;
+            size_t added = ColorSet::fromMask(colors & ~palettes[p]).size();
+            if(ColorSet::fromMask(colors | palettes[p]).size() <= mColorLimit && added < bestAdded)
+            {
+                bestAdded = added;
+                bestIndex = p;
+            }
+        }
+        if(covered)
+            continue;
+        if(bestIndex < palettes.size())
+            palettes[bestIndex] |= colors;
+        else if(palettes.size() < mNumPalettes)
+            palettes.push_back(colors);
+    }
+    palettes.resize(mNumPalettes, 0);
+    int numViolations;
+    double cost = evaluate(palettes, numViolations);
+    if(cost < mCost)
+    {
+        mPalettes = palettes;
+        mCost = cost;
+        mNumViolations = numViolations;
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void PalettePacker::improvePalettes(int maxRounds)
+{
+    const std::vector<uint8_t> layerColors(mLayer.colors().begin(), mLayer.colors().end());
+    for(int round = 0; round < maxRounds; round++)
+    {
+        bool improved = false;
+        for(size_t p = 0; p < mPalettes.size(); p++)
+        {
+            // Candidate palettes: one color added, removed or swapped
+            std::vector<uint64_t> candidates;
+            const uint64_t palette = mPalettes[p];
+            const bool full = ColorSet::fromMask(palette).size() >= mColorLimit;
+            for(uint8_t b : layerColors)
+            {
+                const uint64_t bit = uint64_t(1) << b;
+                if(palette & bit)
+                {
+                    candidates.push_back(palette & ~bit);
+                    continue;
+                }
+                if(!full)
+                    candidates.push_back(palette | bit);
+                for(uint8_t a : ColorSet::fromMask(palette))
+                {
+                    candidates.push_back((palette & ~(uint64_t(1) << a)) | bit);
+                }
+            }
+            for(uint64_t candidate : candidates)
+            {
+                std::vector<uint64_t> palettes = mPalettes;
+                palettes[p] = candidate;
+                int numViolations;
+                double cost = evaluate(palettes, numViolations);
+                if(cost < mCost - 0.5)
+                {
+                    mPalettes = palettes;
+                    mCost = cost;
+                    mNumViolations = numViolations;
+                    improved = true;
+                    break;
+                }
+            }
+        }
+        if(!improved)
+            break;
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void PalettePacker::setPalettes(const std::vector<Colors>& palettes)
+{
+    assert(palettes.size() <= mNumPalettes);
+    std::fill(mPalettes.begin(), mPalettes.end(), 0);
+    for(size_t p = 0; p < palettes.size(); p++)
+    {
+        mPalettes[p] = palettes[p].mask();
+    }
+    mCost = evaluate(mPalettes, mNumViolations);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool PalettePacker::valid() const
+{
+    return mNumViolations == 0;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void PalettePacker::writeSolution(std::vector<Colors>& palettes,
+                                  GridLayer& layerKept,
+                                  GridLayer& layerMoved,
+                                  Array2D<uint8_t>& paletteIndices,
+                                  uint8_t paletteIndexOffset) const
+{
+    palettes.clear();
+    for(size_t p = 0; p < mPalettes.size(); p++)
+    {
+        // Like a parsed solution, only list palettes up to the last one holding colors
+        if(mPalettes[p] != 0)
+            palettes.resize(p + 1);
+    }
+    for(size_t p = 0; p < palettes.size(); p++)
+    {
+        palettes[p] = ColorSet::fromMask(mPalettes[p]);
+    }
+    for(const Cell& cell : mCells)
+    {
+        size_t p = mPalettes.empty() ? 0 : bestPalette(cell, mPalettes);
+        uint64_t kept = mPalettes.empty() ? 0 : cell.colors & mPalettes[p];
+        layerKept(cell.x, cell.y).colors = ColorSet::fromMask(kept);
+        layerMoved(cell.x, cell.y).colors = ColorSet::fromMask(cell.colors & ~kept);
+        paletteIndices(cell.x, cell.y) = p + paletteIndexOffset;
+    }
+}
+
+} // namespace
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool solvePassHeuristic(const GridLayer& layer,
+                        int gridCellColorLimit,
+                        int numPalettes,
+                        int maxSpritePalettes,
+                        int maxRowSize,
+                        bool secondPass,
+                        std::vector<Colors>& palettes,
+                        GridLayer& layerKept,
+                        GridLayer& layerMoved,
+                        Array2D<uint8_t>& paletteIndices,
+                        uint8_t paletteIndexOffset)
+{
+    assert(layerKept.width() == layer.width() && layerKept.height() == layer.height());
+    assert(layerMoved.width() == layer.width() && layerMoved.height() == layer.height());
+    PalettePacker packer(layer, gridCellColorLimit, numPalettes, maxSpritePalettes, maxRowSize, secondPass);
+    packer.packInitialPalettes();
+    packer.improvePalettes(32);
+    packer.writeSolution(palettes, layerKept, layerMoved, paletteIndices, paletteIndexOffset);
+    return packer.valid();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool assignPalettesHeuristic(const GridLayer& layer,
+                             int gridCellColorLimit,
+                             const std::vector<Colors>& palettes,
+                             int maxSpritePalettes,
+                             int maxRowSize,
+                             bool secondPass,
+                             GridLayer& layerKept,
+                             GridLayer& layerMoved,
+                             Array2D<uint8_t>& paletteIndices,
+                             uint8_t paletteIndexOffset)
+{
+    assert(layerKept.width() == layer.width() && layerKept.height() == layer.height());
+    assert(layerMoved.width() == layer.width() && layerMoved.height() == layer.height());
+    PalettePacker packer(layer, gridCellColorLimit, static_cast<int>(palettes.size()), maxSpritePalettes, maxRowSize, secondPass);
+    packer.setPalettes(palettes);
+    std::vector<Colors> writtenPalettes;
+    packer.writeSolution(writtenPalettes, layerKept, layerMoved, paletteIndices, paletteIndexOffset);
+    return packer.valid();
+}
@@ -0,0 +1,66 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+#ifndef HEURISTIC_SOLVER_H
+#define HEURISTIC_SOLVER_H
+
+#include <cstdint>
+#include <vector>
+
+#include "Array2D.h"
+#include "GridLayer.h"
+
+//
+// Greedy / local-search replacement for one MILP solver pass (see OverlayModel for the exact formulation).
+//
+// Palettes are packed greedily from the most important color combinations of each cell, then improved by
+// swapping single palette colors while that lowers the cost of moved colors. Every cell keeps the colors
+// covered by its best palette and moves the rest, like the solver's kept / moved split.
+//
+// Outputs are filled in the same way as parsing a solver solution. Returns true if the result meets
+// all constraints of the pass, and false if it is only near-valid.
+//
+bool solvePassHeuristic(const GridLayer& layer,
+                        int gridCellColorLimit,
+                        int numPalettes,
+                        int maxSpritePalettes,
+                        int maxRowSize,
+                        bool secondPass,
+                        std::vector<Colors>& palettes,
+                        GridLayer& layerKept,
+                        GridLayer& layerMoved,
+                        Array2D<uint8_t>& paletteIndices,
+                        uint8_t paletteIndexOffset);
+
+//
+// Same as solvePassHeuristic, but with the palettes (indexed from 0) given instead of packed, so that
+// only the kept / moved split of each cell is chosen.
+//
+bool assignPalettesHeuristic(const GridLayer& layer,
+                             int gridCellColorLimit,
+                             const std::vector<Colors>& palettes,
+                             int maxSpritePalettes,
+                             int maxRowSize,
+                             bool secondPass,
+                             GridLayer& layerKept,
+                             GridLayer& layerMoved,
+                             Array2D<uint8_t>& paletteIndices,
+                             uint8_t paletteIndexOffset);
+
+#endif // HEURISTIC_SOLVER_H
@@ -18,9 +18,12 @@
 
 #include <vector>
 #include <unordered_map>
-#include <map>
 #include <tuple>
 #include <limits>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <cstring>
 
 #include "Array2D.h"
 #include "GridLayer.h"
@@ -64,61 +67,224 @@ Image2D shiftImage(const Image2D& image, int shiftX, int shiftY)
     const int w = image.width();
     const int h = image.height();
     Image2D shiftedImage(w, h);
+    if(w == 0 || h == 0)
+        return shiftedImage;
+    // Each destination row is the source row rotated right by shiftX, copied in two contiguous parts
+    const int sx = ((shiftX % w) + w) % w;
+    const int sy = ((shiftY % h) + h) % h;
+    for(int y = 0; y < h; y++)
+    {
+        const uint8_t* src = &image(0, (y + h - sy) % h);
+        uint8_t* dst = &shiftedImage(0, y);
+        std::memcpy(dst + sx, src, w - sx);
+        std::memcpy(dst, src + w - sx, sx);
+    }
+    return shiftedImage;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+static inline int wrap(int v, int n)
+{
+    v %= n;
+    return v < 0 ? v + n : v;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
 
+//
+// Calculates the cost of shifts (minX..maxX, shiftY) without building shifted images.
+//
+// Cells of the shifted image map to cyclic row / column ranges of the original image, so the color masks
+// of each column within a row band are OR'ed together once per shiftY and then reused for every shiftX.
+//
+static void shiftCostsForRow(const Array2D<uint64_t>& pixelMasks,
+                             int cellWidth,
+                             int cellHeight,
+                             int minX,
+                             int maxX,
+                             int shiftY,
+                             int* costs)
+{
+    const int w = pixelMasks.width();
+    const int h = pixelMasks.height();
+    const int numCellsX = (w + cellWidth - 1) / cellWidth;
+    const int numCellsY = (h + cellHeight - 1) / cellHeight;
+    Array2D<uint64_t> bandColumnMasks(w, numCellsY, 0);
     for(int y = 0; y < h; y++)
     {
+        const int srcY = wrap(y - shiftY, h);
+        const int cellY = y / cellHeight;
         for(int x = 0; x < w; x++)
         {
-            uint8_t c = image((x + w - shiftX) % w, (y + h - shiftY) % h);
-            shiftedImage(x, y) = c;
+            bandColumnMasks(x, cellY) |= pixelMasks(x, srcY);
         }
     }
-    return shiftedImage;
+    for(int shiftX = minX; shiftX <= maxX; shiftX++)
+    {
+        int cost = 0;
+        for(int cellY = 0; cellY < numCellsY; cellY++)
+        {
+            for(int cellX = 0; cellX < numCellsX; cellX++)
+            {
+                uint64_t mask = 0;
+                const int xEnd = std::min(w, (cellX + 1) * cellWidth);
+                for(int x = cellX * cellWidth; x < xEnd; x++)
+                {
+                    mask |= bandColumnMasks(wrap(x - shiftX, w), cellY);
+                }
+                cost += ColorSet::fromMask(mask).size();
+            }
+        }
+        costs[shiftX - minX] = cost;
+    }
 }
 
 //---------------------------------------------------------------------------------------------------------------------
 
-Image2D shiftImageOptimal(const Image2D& image, uint8_t backgroundColor, int cellWidth, int cellHeight, int minX, int maxX, int minY, int maxY, int& shiftX, int& shiftY)
+std::vector<std::pair<int, int>> bestShifts(const Image2D& image, uint8_t backgroundColor, int cellWidth, int cellHeight, int minX, int maxX, int minY, int maxY, size_t maxCount)
 {
     const int w = image.width();
     const int h = image.height();
-    std::map<std::pair<int, int>, int> shiftCosts;
-    auto bestCostXY = std::make_pair(minX, minY);
-    shiftCosts[bestCostXY] = std::numeric_limits<int>::max();
-    for(int y = minY; y <= maxY; y++)
+    const int numShiftsX = maxX - minX + 1;
+    const int numShiftsY = maxY - minY + 1;
+    if(w == 0 || h == 0 || numShiftsX <= 0 || numShiftsY <= 0)
+        return {{minX, minY}};
+    // Each pixel's color as a single bit, with background excluded
+    Array2D<uint64_t> pixelMasks(w, h, 0);
+    for(int y = 0; y < h; y++)
     {
-        for(int x = minX; x <= maxX; x++)
+        for(int x = 0; x < w; x++)
+        {
+            uint8_t c = image(x, y);
+            if(c != backgroundColor && c < ColorSet::MaxColors)
+                pixelMasks(x, y) = uint64_t(1) << c;
+        }
+    }
+    // Just use sum of colors per cell as cost for now.
+    // Rows of candidate shifts are independent, so spread them across threads.
+    std::vector<int> costs(numShiftsX * numShiftsY);
+    std::atomic<int> nextRow(0);
+    auto worker = [&]()
+    {
+        for(int row = nextRow++; row < numShiftsY; row = nextRow++)
         {
-            Image2D shiftedImage = shiftImage(image, x, y);
-            GridLayer layer(backgroundColor, cellWidth, cellHeight, shiftedImage);
-            // Just use sum of colors per cell as cost for now
-            int cost = layer.colorsPerCellSum();
-            auto costXY = std::make_pair(x, y);
-            shiftCosts[costXY] = cost;
-            if(cost < shiftCosts[bestCostXY])
+            shiftCostsForRow(pixelMasks, cellWidth, cellHeight, minX, maxX, minY + row, &costs[row * numShiftsX]);
+        }
+    };
+    const int numThreads = std::min<int>(numShiftsY, std::max(1u, std::thread::hardware_concurrency()));
+    std::vector<std::thread> threads;
+    for(int i = 1; i < numThreads; i++)
+    {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for(std::thread& thread : threads)
+    {
+        thread.join();
+    }
+    // Lowest costs first, ties in row-major order
+    std::vector<int> order(costs.size());
+    for(size_t i = 0; i < order.size(); i++)
+    {
+        order[i] = static_cast<int>(i);
+    }
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return costs[a] < costs[b]; });
+    order.resize(std::min(order.size(), std::max<size_t>(maxCount, 1)));
+    std::vector<std::pair<int, int>> shifts;
+    for(int i : order)
+    {
+        shifts.push_back({minX + i % numShiftsX, minY + i / numShiftsX});
+    }
+    return shifts;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+Image2D shiftImageOptimal(const Image2D& image, uint8_t backgroundColor, int cellWidth, int cellHeight, int minX, int maxX, int minY, int maxY, int& shiftX, int& shiftY)
+{
+    const std::pair<int, int> shift = bestShifts(image, backgroundColor, cellWidth, cellHeight, minX, maxX, minY, maxY, 1).front();
+    shiftX = shift.first;
+    shiftY = shift.second;
+    return shiftImage(image, shiftX, shiftY);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+std::vector<Image2D> splitIntoScreens(const Image2D& image,
+                                      uint8_t backgroundColor,
+                                      size_t screenWidth,
+                                      size_t screenHeight,
+                                      size_t& screensWide)
+{
+    screensWide = std::max<size_t>((image.width() + screenWidth - 1) / screenWidth, 1);
+    const size_t screensHigh = std::max<size_t>((image.height() + screenHeight - 1) / screenHeight, 1);
+    std::vector<Image2D> screens;
+    for(size_t sy = 0; sy < screensHigh; sy++)
+    {
+        for(size_t sx = 0; sx < screensWide; sx++)
+        {
+            Image2D screen(screenWidth, screenHeight, backgroundColor);
+            const size_t x0 = screenWidth * sx;
+            const size_t y0 = screenHeight * sy;
+            const size_t columns = std::min(screenWidth, image.width() > x0 ? image.width() - x0 : 0);
+            for(size_t y = 0; y < screenHeight && y0 + y < image.height(); y++)
             {
-                bestCostXY = costXY;
+                std::copy(image.row(y0 + y) + x0, image.row(y0 + y) + x0 + columns, screen.row(y));
             }
+            screens.push_back(std::move(screen));
         }
     }
-    shiftX = bestCostXY.first;
-    shiftY = bestCostXY.second;
-    Image2D shiftedImage = shiftImage(image, shiftX, shiftY);
-    return shiftedImage;
+    return screens;
 }
 
 //---------------------------------------------------------------------------------------------------------------------
 
-bool isSubSet(const std::set<uint8_t>& s1, const std::set<uint8_t>& s2)
+Image2D joinScreens(const std::vector<Image2D>& screens, size_t screensWide)
 {
-    for(uint8_t c : s1)
+    if(screens.empty() || screensWide == 0)
+        return Image2D();
+    const size_t screenWidth = screens.front().width();
+    const size_t screenHeight = screens.front().height();
+    const size_t screensHigh = (screens.size() + screensWide - 1) / screensWide;
+    Image2D image(screenWidth * screensWide, screenHeight * screensHigh);
+    for(size_t i = 0; i < screens.size(); i++)
     {
-        if(s2.count(c) == 0)
+        assert(screens[i].width() == screenWidth && screens[i].height() == screenHeight);
+        const size_t x0 = screenWidth * (i % screensWide);
+        const size_t y0 = screenHeight * (i / screensWide);
+        for(size_t y = 0; y < screenHeight; y++)
         {
-            return false;
+            std::copy(screens[i].row(y), screens[i].row(y) + screenWidth, image.row(y0 + y) + x0);
         }
     }
-    return true;
+    return image;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+std::vector<uint8_t> mostCommonColors(const Image2D& image, size_t maxCount)
+{
+    std::unordered_map<uint8_t, size_t> counts = colorCounts(image);
+    std::vector<std::pair<uint8_t, size_t>> sortedCounts(counts.begin(), counts.end());
+    // Most common first, ties by lowest color
+    std::sort(sortedCounts.begin(), sortedCounts.end(), [](const auto& a, const auto& b)
+    {
+        return a.second != b.second ? a.second > b.second : a.first < b.first;
+    });
+    std::vector<uint8_t> colors;
+    for(size_t i = 0; i < sortedCounts.size() && i < maxCount; i++)
+    {
+        colors.push_back(sortedCounts[i].first);
+    }
+    return colors;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool isSubSet(const Colors& s1, const Colors& s2)
+{
+    return s1.isSubSetOf(s2);
 }
 
 //---------------------------------------------------------------------------------------------------------------------
@@ -126,34 +292,39 @@ bool isSubSet(const std::set<uint8_t>& s1, const std::set<uint8_t>& s2)
 std::vector<ContinuousPaletteRange> getBestContinuousRanges(const GridLayer& layer,
                                                             size_t y,
                                                             uint8_t paletteIndicesOffset,
-                                                            const std::vector<std::set<uint8_t>>& palettes,
+                                                            const std::vector<Colors>& palettes,
                                                             uint8_t backgroundColor)
 {
     std::vector<ContinuousPaletteRange> ranges;
-    std::map<size_t, std::set<size_t>> validPaletteIndices;
+    // One bit per palette index valid for each cell in the row
+    assert(palettes.size() <= 64);
+    std::vector<uint64_t> validPaletteIndices(layer.width(), 0);
     for(size_t x = 0; x < layer.width(); x++)
     {
         for(size_t i = paletteIndicesOffset; i < palettes.size(); i++)
         {
-            const std::set<uint8_t>& cellColors = layer(x, y).colors;
+            const Colors& cellColors = layer(x, y).colors;
             if(cellColors.size() > 0 &&
                isSubSet(cellColors, palettes[i]))
             {
-                validPaletteIndices[x].insert(i);
+                validPaletteIndices[x] |= uint64_t(1) << i;
             }
         }
     }
     for(size_t x = 0; x < layer.width(); x++)
     {
-        for(size_t i : validPaletteIndices[x])
+        for(size_t i = 0; i < palettes.size(); i++)
         {
+            const uint64_t bit = uint64_t(1) << i;
+            if(!(validPaletteIndices[x] & bit))
+                continue;
             ContinuousPaletteRange r;
             r.xLeft = x;
             r.xRight = x;
             r.paletteIndex = i;
-            while(r.xLeft > 0 && validPaletteIndices[r.xLeft - 1].count(i) > 0)
+            while(r.xLeft > 0 && (validPaletteIndices[r.xLeft - 1] & bit))
                 r.xLeft--;
-            while((r.xRight < layer.width() - 1) && validPaletteIndices[r.xRight + 1].count(i) > 0)
+            while((r.xRight < layer.width() - 1) && (validPaletteIndices[r.xRight + 1] & bit))
                 r.xRight++;
             if(r.xRight - r.xLeft > 0)
             {
@@ -177,7 +348,7 @@ std::vector<ContinuousPaletteRange> getBestContinuousRanges(const GridLayer& lay
 void optimizeContinuity(const GridLayer& layer,
                         Array2D<uint8_t>& paletteIndices,
                         uint8_t paletteIndicesOffset,
-                        const std::vector<std::set<uint8_t>>& palettes,
+                        const std::vector<Colors>& palettes,
                         uint8_t backgroundColor)
 {
     int cellWidth = layer.cellWidth();
@@ -229,8 +400,7 @@ void optimizeUnnecessaryOverlayColors(GridLayer& layerBackground,
             Colors& colorsBackground = layerBackground(x, y).colors;
             Colors& colorsOverlay = layerOverlay(x, y).colors;
             // Get union
-            Colors colorsAll = colorsBackground;
-            colorsAll.insert(colorsOverlay.begin(), colorsOverlay.end());
+            Colors colorsAll = colorsBackground | colorsOverlay;
             // If any palette is a superset of all colors, use it and
             // move colors into background layer
             for(size_t i = paletteIndicesOffset; i < palettes.size(); i++)
@@ -289,8 +459,7 @@ void optimizeUnnecessaryPalettes(Array2D<uint8_t>& paletteIndices,
         for(uint8_t j = i + 1; j < palettes.size();)
         {
             Colors& colorsJ = palettes[j];
-            Colors colorsAll = colorsI;
-            colorsAll.insert(colorsJ.begin(), colorsJ.end());
+            Colors colorsAll = colorsI | colorsJ;
             if(colorsAll.size() <= maxColors)
             {
                 // Replace i with merged colors, and remove j completely
@@ -21,7 +21,8 @@
 #define IMAGE_UTILS_H
 
 #include <cstdint>
-#include <set>
+#include <utility>
+#include <vector>
 
 #include "Array2D.h"
 #include "GridLayer.h"
@@ -41,10 +42,35 @@ Image2D shiftImage(const Image2D&, int shiftX, int shiftY);
 //
 Image2D shiftImageOptimal(const Image2D& image2D, uint8_t backgroundColor, int cellWidth, int cellHeight, int minX, int maxX, int minY, int maxY, int& shiftX, int& shiftY);
 
+//
+// Up to maxCount (shiftX, shiftY) pairs within the given ranges, in order of increasing sum of colors per cell
+//
+std::vector<std::pair<int, int>> bestShifts(const Image2D& image, uint8_t backgroundColor, int cellWidth, int cellHeight, int minX, int maxX, int minY, int maxY, size_t maxCount);
+
+//
+// Splits an image into screens of screenWidth x screenHeight pixels in row-major order, extending the right and
+// bottom edges to whole screens with backgroundColor. Returns the number of screens per row in screensWide.
+//
+std::vector<Image2D> splitIntoScreens(const Image2D& image,
+                                      uint8_t backgroundColor,
+                                      size_t screenWidth,
+                                      size_t screenHeight,
+                                      size_t& screensWide);
+
+//
+// Joins equally sized screens in row-major order, screensWide per row, into one image
+//
+Image2D joinScreens(const std::vector<Image2D>& screens, size_t screensWide);
+
+//
+// Up to maxCount colors of an image, most common first
+//
+std::vector<uint8_t> mostCommonColors(const Image2D& image, size_t maxCount);
+
 //
 // Optimize palette index continuity by switching palette indices so that they are horizontally continuous where possible
 //
-void optimizeContinuity(const GridLayer& layer, Array2D<uint8_t>& paletteIndices, uint8_t paletteIndicesOffset, const std::vector<std::set<uint8_t>>& palettes, uint8_t backgroundColor);
+void optimizeContinuity(const GridLayer& layer, Array2D<uint8_t>& paletteIndices, uint8_t paletteIndicesOffset, const std::vector<Colors>& palettes, uint8_t backgroundColor);
 
 //
 // Move overlay colors back to background where possible, changing the palette index
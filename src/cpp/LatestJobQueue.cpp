@@ -0,0 +1,87 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include "LatestJobQueue.h"
+
+//---------------------------------------------------------------------------------------------------------------------
+
+LatestJobQueue::LatestJobQueue():
+    mWaitingTicket(0),
+    mLatestTicket(0),
+    mStop(false),
+    mThread(&LatestJobQueue::run, this)
+{
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+LatestJobQueue::~LatestJobQueue()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStop = true;
+        mWaitingJob = Job();
+        // Also marks the running job stale
+        mLatestTicket++;
+    }
+    mCondition.notify_one();
+    mThread.join();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+uint64_t LatestJobQueue::post(const Job& job)
+{
+    uint64_t ticket;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        ticket = ++mLatestTicket;
+        mWaitingJob = job;
+        mWaitingTicket = ticket;
+    }
+    mCondition.notify_one();
+    return ticket;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool LatestJobQueue::isLatest(uint64_t ticket) const
+{
+    return mLatestTicket == ticket;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void LatestJobQueue::run()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    while(true)
+    {
+        mCondition.wait(lock, [this]() { return mStop || mWaitingJob; });
+        if(mStop)
+            return;
+        Job job = std::move(mWaitingJob);
+        mWaitingJob = Job();
+        const uint64_t ticket = mWaitingTicket;
+        lock.unlock();
+        job([this, ticket]() { return !isLatest(ticket); });
+        // Release whatever the job holds before waiting again
+        job = Job();
+        lock.lock();
+    }
+}
@@ -0,0 +1,67 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+#ifndef LATEST_JOB_QUEUE_H
+#define LATEST_JOB_QUEUE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+//
+// Runs jobs one at a time on a worker thread, keeping only the latest: posting a job discards the one still
+// waiting, and marks the running one stale so that it can stop early. Bursts of requests thus run no more than
+// the job in flight and the last one posted.
+//
+class LatestJobQueue
+{
+public:
+    // Returns true once a newer job has been posted
+    using IsStale = std::function<bool()>;
+    using Job = std::function<void(const IsStale& isStale)>;
+
+    LatestJobQueue();
+    // Discards the waiting job and waits for the running one
+    ~LatestJobQueue();
+
+    LatestJobQueue(const LatestJobQueue&) = delete;
+    LatestJobQueue& operator=(const LatestJobQueue&) = delete;
+
+    // Returns the ticket of the job, increasing with each post
+    uint64_t post(const Job& job);
+
+    // True if no job was posted after the one with this ticket
+    bool isLatest(uint64_t ticket) const;
+
+private:
+    void run();
+
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    Job mWaitingJob;
+    uint64_t mWaitingTicket;
+    std::atomic<uint64_t> mLatestTicket;
+    bool mStop;
+    std::thread mThread;
+};
+
+#endif // LATEST_JOB_QUEUE_H
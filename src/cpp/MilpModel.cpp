@@ -0,0 +1,295 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <stdexcept>
+#include <cmath>
+#include <string>
+
+#ifdef OVERLAYPAL_CBC_LIB
+#include <Cbc_C_Interface.h>
+#endif
+
+#include "MilpModel.h"
+
+//---------------------------------------------------------------------------------------------------------------------
+
+MilpModel::MilpModel()
+{
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+int MilpModel::addVariable(double lower, double upper, double objective, bool integer)
+{
+    mColumnLower.push_back(lower);
+    mColumnUpper.push_back(upper);
+    mObjective.push_back(objective);
+    mInteger.push_back(integer);
+    return static_cast<int>(mObjective.size() - 1);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+int MilpModel::addBinaryVariable(double objective)
+{
+    return addVariable(0.0, 1.0, objective, true);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void MilpModel::setVariableBounds(int variable, double lower, double upper)
+{
+    mColumnLower[variable] = lower;
+    mColumnUpper[variable] = upper;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void MilpModel::addConstraint(const std::vector<Term>& terms, double lower, double upper)
+{
+    int row = static_cast<int>(mRowLower.size());
+    for(const Term& term : terms)
+    {
+        if(term.second != 0.0)
+        {
+            mElementRows.push_back(row);
+            mElementColumns.push_back(term.first);
+            mElementValues.push_back(term.second);
+        }
+    }
+    mRowLower.push_back(lower);
+    mRowUpper.push_back(upper);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void MilpModel::addLessOrEqual(const std::vector<Term>& terms, double upper)
+{
+    addConstraint(terms, -Infinity, upper);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void MilpModel::addGreaterOrEqual(const std::vector<Term>& terms, double lower)
+{
+    addConstraint(terms, lower, Infinity);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void MilpModel::addEqual(const std::vector<Term>& terms, double value)
+{
+    addConstraint(terms, value, value);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+size_t MilpModel::numVariables() const
+{
+    return mObjective.size();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+size_t MilpModel::numConstraints() const
+{
+    return mRowLower.size();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+size_t MilpModel::numNonZeros() const
+{
+    return mElementValues.size();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+const std::vector<double>& MilpModel::columnLower() const
+{
+    return mColumnLower;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+const std::vector<double>& MilpModel::columnUpper() const
+{
+    return mColumnUpper;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+const std::vector<double>& MilpModel::objective() const
+{
+    return mObjective;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+const std::vector<bool>& MilpModel::integer() const
+{
+    return mInteger;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+const std::vector<double>& MilpModel::rowLower() const
+{
+    return mRowLower;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+const std::vector<double>& MilpModel::rowUpper() const
+{
+    return mRowUpper;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void MilpModel::columnMajorMatrix(std::vector<int>& start, std::vector<int>& index, std::vector<double>& value) const
+{
+    const size_t numColumns = numVariables();
+    // Count elements per column, then prefix-sum into start offsets
+    start.assign(numColumns + 1, 0);
+    for(int column : mElementColumns)
+    {
+        start[column + 1]++;
+    }
+    for(size_t i = 0; i < numColumns; i++)
+    {
+        start[i + 1] += start[i];
+    }
+    index.resize(mElementValues.size());
+    value.resize(mElementValues.size());
+    std::vector<int> fill(start.begin(), start.end() - 1);
+    for(size_t i = 0; i < mElementValues.size(); i++)
+    {
+        int pos = fill[mElementColumns[i]]++;
+        index[pos] = mElementRows[i];
+        value[pos] = mElementValues[i];
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool MilpModel::isFeasible(const std::vector<double>& solution, double tolerance) const
+{
+    if(solution.size() != numVariables())
+        return false;
+    for(size_t i = 0; i < solution.size(); i++)
+    {
+        const double v = solution[i];
+        if(v < mColumnLower[i] - tolerance || v > mColumnUpper[i] + tolerance)
+            return false;
+        if(mInteger[i] && std::abs(v - std::round(v)) > tolerance)
+            return false;
+    }
+    std::vector<double> activity(numConstraints(), 0.0);
+    for(size_t i = 0; i < mElementValues.size(); i++)
+    {
+        activity[mElementRows[i]] += mElementValues[i] * solution[mElementColumns[i]];
+    }
+    for(size_t i = 0; i < activity.size(); i++)
+    {
+        if(activity[i] < mRowLower[i] - tolerance || activity[i] > mRowUpper[i] + tolerance)
+            return false;
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool cbcLibraryAvailable()
+{
+#ifdef OVERLAYPAL_CBC_LIB
+    return true;
+#else
+    return false;
+#endif
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+#ifdef OVERLAYPAL_CBC_LIB
+
+MilpSolveResult solveMilpWithCbc(const MilpModel& model, const MilpSolveOptions& options)
+{
+    std::vector<int> start;
+    std::vector<int> index;
+    std::vector<double> value;
+    model.columnMajorMatrix(start, index, value);
+    std::vector<CoinBigIndex> startCbc(start.begin(), start.end());
+    const int numColumns = static_cast<int>(model.numVariables());
+    const int numRows = static_cast<int>(model.numConstraints());
+    Cbc_Model* cbc = Cbc_newModel();
+    Cbc_loadProblem(cbc,
+                    numColumns,
+                    numRows,
+                    startCbc.data(),
+                    index.data(),
+                    value.data(),
+                    model.columnLower().data(),
+                    model.columnUpper().data(),
+                    model.objective().data(),
+                    model.rowLower().data(),
+                    model.rowUpper().data());
+    for(int i = 0; i < numColumns; i++)
+    {
+        if(model.integer()[i])
+            Cbc_setInteger(cbc, i);
+    }
+    Cbc_setObjSense(cbc, 1.0);
+    Cbc_setLogLevel(cbc, 0);
+    if(options.initialSolution.size() == model.numVariables())
+    {
+        // Start from a known feasible incumbent, so the time limit is spent improving it
+        std::vector<int> columns(numColumns);
+        for(int i = 0; i < numColumns; i++)
+            columns[i] = i;
+        Cbc_setMIPStartI(cbc, numColumns, columns.data(), options.initialSolution.data());
+    }
+    if(options.timeOut)
+        Cbc_setMaximumSeconds(cbc, options.timeOut);
+    if(options.randomSeed)
+        Cbc_setParameter(cbc, "randomCbcSeed", std::to_string(options.randomSeed).c_str());
+    Cbc_solve(cbc);
+    MilpSolveResult result;
+    const double* bestSolution = Cbc_bestSolution(cbc);
+    result.hasSolution = bestSolution != nullptr;
+    result.provenOptimal = Cbc_isProvenOptimal(cbc);
+    result.timeLimitReached = Cbc_isSecondsLimitReached(cbc);
+    result.bestBound = Cbc_getBestPossibleObjValue(cbc);
+    result.numNodes = Cbc_getNodeCount(cbc);
+    if(result.hasSolution)
+    {
+        result.objective = Cbc_getObjValue(cbc);
+        result.solution.assign(bestSolution, bestSolution + numColumns);
+    }
+    Cbc_deleteModel(cbc);
+    return result;
+}
+
+#else
+
+MilpSolveResult solveMilpWithCbc(const MilpModel&, const MilpSolveOptions&)
+{
+    throw std::runtime_error("OverlayPal was built without the CBC library solver");
+}
+
+#endif
@@ -0,0 +1,113 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+#ifndef MILP_MODEL_H
+#define MILP_MODEL_H
+
+#include <cstddef>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+
+//
+// Sparse mixed-integer linear program, built in memory and solved in-process.
+//
+// Minimises sum(objective[i] * x[i]) subject to rowLower <= A * x <= rowUpper and columnLower <= x <= columnUpper.
+//
+class MilpModel
+{
+public:
+    static constexpr double Infinity = std::numeric_limits<double>::max();
+
+    using Term = std::pair<int, double>;
+
+    MilpModel();
+
+    int addVariable(double lower, double upper, double objective, bool integer);
+    int addBinaryVariable(double objective = 0.0);
+    void setVariableBounds(int variable, double lower, double upper);
+
+    void addConstraint(const std::vector<Term>& terms, double lower, double upper);
+    void addLessOrEqual(const std::vector<Term>& terms, double upper);
+    void addGreaterOrEqual(const std::vector<Term>& terms, double lower);
+    void addEqual(const std::vector<Term>& terms, double value);
+
+    size_t numVariables() const;
+    size_t numConstraints() const;
+    size_t numNonZeros() const;
+
+    const std::vector<double>& columnLower() const;
+    const std::vector<double>& columnUpper() const;
+    const std::vector<double>& objective() const;
+    const std::vector<bool>& integer() const;
+    const std::vector<double>& rowLower() const;
+    const std::vector<double>& rowUpper() const;
+
+    // Constraint matrix in compressed sparse column format
+    void columnMajorMatrix(std::vector<int>& start, std::vector<int>& index, std::vector<double>& value) const;
+
+    // Returns true if solution satisfies all bounds, integrality and constraints within tolerance
+    bool isFeasible(const std::vector<double>& solution, double tolerance = 1e-6) const;
+
+private:
+    std::vector<double> mColumnLower;
+    std::vector<double> mColumnUpper;
+    std::vector<double> mObjective;
+    std::vector<bool> mInteger;
+    std::vector<double> mRowLower;
+    std::vector<double> mRowUpper;
+    // Constraint matrix in coordinate format
+    std::vector<int> mElementRows;
+    std::vector<int> mElementColumns;
+    std::vector<double> mElementValues;
+};
+
+//
+// Settings and outcome of solving a MilpModel
+//
+struct MilpSolveOptions
+{
+    int timeOut = 0;    // Seconds, 0 = no limit
+    std::vector<double> initialSolution;    // Optional feasible starting solution (MIP start), one value per variable
+    int randomSeed = 0;     // CBC random seed, 0 = CBC default
+};
+
+struct MilpSolveResult
+{
+    bool hasSolution = false;
+    bool provenOptimal = false;
+    bool timeLimitReached = false;
+    double objective = 0.0;
+    double bestBound = 0.0;     // Best possible objective found by the search
+    long numNodes = 0;          // Branch and bound nodes searched
+    std::vector<double> solution;
+};
+
+//
+// Returns true if OverlayPal was built with the in-process CBC solver (OVERLAYPAL_FEATURES += cbc_lib)
+//
+bool cbcLibraryAvailable();
+
+//
+// Solve model with the CBC library. Throws std::runtime_error if CBC support was not compiled in.
+//
+MilpSolveResult solveMilpWithCbc(const MilpModel& model, const MilpSolveOptions& options);
+
+#endif // MILP_MODEL_H
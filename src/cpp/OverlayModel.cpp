@@ -0,0 +1,481 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <cassert>
+#include <unordered_map>
+#include <algorithm>
+
+#include "OverlayModel.h"
+
+//---------------------------------------------------------------------------------------------------------------------
+
+OverlayModel::OverlayModel(const GridLayer& layer,
+                           int gridCellColorLimit,
+                           int numPalettes,
+                           int maxSpritePalettes,
+                           int maxRowSize,
+                           bool secondPass,
+                           bool mergeEqualCells):
+    mWidth(layer.width()),
+    mHeight(layer.height()),
+    mNumPalettes(numPalettes),
+    mSecondPass(secondPass),
+    mMergeEqualCells(mergeEqualCells),
+    mFirstCell(mWidth * mHeight),
+    mColorKept(mWidth * mHeight * MaxColors, -1),
+    mColorMoved(mWidth * mHeight * MaxColors, -1),
+    mOccupancy(mWidth * mHeight, -1),
+    mColorsMovedTotal(MaxColors, -1),
+    mPalette(mNumPalettes * MaxColors, -1),
+    mUsesPalette(mWidth * mHeight * mNumPalettes, -1)
+{
+    if(secondPass)
+        buildSecondPass(layer, gridCellColorLimit, maxSpritePalettes, maxRowSize);
+    else
+        buildFirstPass(layer, gridCellColorLimit, maxSpritePalettes, maxRowSize);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+const MilpModel& OverlayModel::milp() const
+{
+    return mMilp;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayModel::fixPalettes(const std::vector<Colors>& palettes, const Colors& movableColors)
+{
+    for(size_t c = 0; c < MaxColors; c++)
+    {
+        for(size_t p = 0; p < mNumPalettes; p++)
+        {
+            if(palette(p, c) < 0)
+                continue;
+            const double inPalette = p < palettes.size() && palettes[p].count(c) ? 1.0 : 0.0;
+            mMilp.setVariableBounds(palette(p, c), inPalette, inPalette);
+        }
+        if(mColorsMovedTotal[c] >= 0 && !movableColors.count(c))
+            mMilp.setVariableBounds(mColorsMovedTotal[c], 0.0, 0.0);
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayModel::fixCells(const std::vector<double>& solution, const Array2D<uint8_t>& fixedCells)
+{
+    assert(solution.size() == mMilp.numVariables());
+    assert(fixedCells.width() == mWidth && fixedCells.height() == mHeight);
+    auto fix = [&](int variable)
+    {
+        if(variable >= 0)
+            mMilp.setVariableBounds(variable, solution[variable], solution[variable]);
+    };
+    for(int variable : mPalette)
+        fix(variable);
+    for(size_t y = 0; y < mHeight; y++)
+    {
+        for(size_t x = 0; x < mWidth; x++)
+        {
+            if(!fixedCells(x, y))
+                continue;
+            const size_t cell = cellIndex(x, y);
+            fix(mOccupancy[cell]);
+            for(size_t c = 0; c < MaxColors; c++)
+            {
+                fix(mColorKept[MaxColors * cell + c]);
+                fix(mColorMoved[MaxColors * cell + c]);
+            }
+            for(size_t p = 0; p < mNumPalettes; p++)
+                fix(mUsesPalette[mNumPalettes * cell + p]);
+        }
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+size_t OverlayModel::cellIndex(size_t x, size_t y) const
+{
+    return mWidth * y + x;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool OverlayModel::isFirstCell(size_t x, size_t y) const
+{
+    return mFirstCell[cellIndex(x, y)] == cellIndex(x, y);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+// Sums the coefficients of variables occurring more than once, e.g. merged cells in a row
+static void combineTerms(std::vector<MilpModel::Term>& terms)
+{
+    std::sort(terms.begin(), terms.end());
+    size_t n = 0;
+    for(size_t i = 0; i < terms.size(); i++)
+    {
+        if(n > 0 && terms[n - 1].first == terms[i].first)
+            terms[n - 1].second += terms[i].second;
+        else
+            terms[n++] = terms[i];
+    }
+    terms.resize(n);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+int& OverlayModel::colorKept(size_t x, size_t y, uint8_t c)
+{
+    return mColorKept[MaxColors * cellIndex(x, y) + c];
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+int& OverlayModel::colorMoved(size_t x, size_t y, uint8_t c)
+{
+    return mColorMoved[MaxColors * cellIndex(x, y) + c];
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+int& OverlayModel::palette(size_t p, uint8_t c)
+{
+    return mPalette[MaxColors * p + c];
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+int& OverlayModel::usesPalette(size_t x, size_t y, size_t p)
+{
+    return mUsesPalette[mNumPalettes * cellIndex(x, y) + p];
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayModel::addVariables(const GridLayer& layer, double movedWeight)
+{
+    // Column counts of each first cell, summed over the cells merged into it
+    std::vector<std::array<uint32_t, MaxColors>> columnCounts(mWidth * mHeight);
+    std::unordered_map<uint64_t, size_t> firstCells;
+    for(size_t y = 0; y < mHeight; y++)
+    {
+        for(size_t x = 0; x < mWidth; x++)
+        {
+            const GridCell& cell = layer(x, y);
+            const size_t index = cellIndex(x, y);
+            mFirstCell[index] = index;
+            if(cell.colors.empty())
+                continue;
+            if(mMergeEqualCells)
+                mFirstCell[index] = firstCells.emplace(cell.colors.mask(), index).first->second;
+            for(uint8_t c : cell.colors)
+                columnCounts[mFirstCell[index]][c] += cell.columnCount[c];
+        }
+    }
+    for(size_t y = 0; y < mHeight; y++)
+    {
+        for(size_t x = 0; x < mWidth; x++)
+        {
+            const GridCell& cell = layer(x, y);
+            if(cell.colors.empty())
+                continue;
+            const size_t index = cellIndex(x, y);
+            const size_t first = mFirstCell[index];
+            if(first != index)
+            {
+                // Share the first cell's variables
+                for(uint8_t c : cell.colors)
+                {
+                    mColorKept[MaxColors * index + c] = mColorKept[MaxColors * first + c];
+                    mColorMoved[MaxColors * index + c] = mColorMoved[MaxColors * first + c];
+                }
+                mOccupancy[index] = mOccupancy[first];
+                std::copy_n(&mUsesPalette[mNumPalettes * first], mNumPalettes, &mUsesPalette[mNumPalettes * index]);
+                continue;
+            }
+            for(uint8_t c : cell.colors)
+            {
+                assert(c < MaxColors);
+                colorKept(x, y, c) = mMilp.addBinaryVariable();
+                colorMoved(x, y, c) = mMilp.addBinaryVariable(movedWeight * columnCounts[index][c]);
+                // A color must be in one-and-only-one of kept or moved
+                mMilp.addEqual({{colorKept(x, y, c), 1.0}, {colorMoved(x, y, c), 1.0}}, 1.0);
+            }
+            mOccupancy[cellIndex(x, y)] = mMilp.addBinaryVariable();
+            for(size_t p = 0; p < mNumPalettes; p++)
+            {
+                usesPalette(x, y, p) = mMilp.addBinaryVariable();
+            }
+        }
+    }
+    for(uint8_t c : layer.colors())
+    {
+        mColorsMovedTotal[c] = mMilp.addBinaryVariable();
+        for(size_t p = 0; p < mNumPalettes; p++)
+        {
+            palette(p, c) = mMilp.addBinaryVariable();
+        }
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayModel::addPaletteConstraints(const GridLayer& layer, int gridCellColorLimit)
+{
+    for(size_t y = 0; y < mHeight; y++)
+    {
+        for(size_t x = 0; x < mWidth; x++)
+        {
+            const GridCell& cell = layer(x, y);
+            if(cell.colors.empty() || !isFirstCell(x, y))
+                continue;
+            // Kept colors of a cell can be no more than the cell color limit
+            std::vector<MilpModel::Term> keptTerms;
+            for(uint8_t c : cell.colors)
+            {
+                keptTerms.push_back({colorKept(x, y, c), 1.0});
+            }
+            mMilp.addLessOrEqual(keptTerms, gridCellColorLimit);
+            // Kept colors must be a subset of the palette used by the cell
+            // (usesPalette * colorKept <= palette, linearised for binaries)
+            std::vector<MilpModel::Term> usesTerms;
+            for(size_t p = 0; p < mNumPalettes; p++)
+            {
+                for(uint8_t c : cell.colors)
+                {
+                    mMilp.addLessOrEqual({{usesPalette(x, y, p), 1.0}, {colorKept(x, y, c), 1.0}, {palette(p, c), -1.0}}, 1.0);
+                }
+                usesTerms.push_back({usesPalette(x, y, p), 1.0});
+            }
+            // Every cell uses exactly one palette
+            mMilp.addEqual(usesTerms, 1.0);
+        }
+    }
+    // Palette color limit
+    for(size_t p = 0; p < mNumPalettes; p++)
+    {
+        std::vector<MilpModel::Term> paletteTerms;
+        for(uint8_t c : layer.colors())
+        {
+            paletteTerms.push_back({palette(p, c), 1.0});
+        }
+        mMilp.addLessOrEqual(paletteTerms, gridCellColorLimit);
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayModel::buildFirstPass(const GridLayer& layer, int gridCellColorLimit, int maxSpritePalettes, int maxRowSize)
+{
+    // Goal: Minimise colors moved to overlay
+    addVariables(layer, 1.0);
+    addPaletteConstraints(layer, gridCellColorLimit);
+    std::vector<MilpModel::Term> totalTerms;
+    for(size_t y = 0; y < mHeight; y++)
+    {
+        std::vector<MilpModel::Term> rowTerms;
+        for(size_t x = 0; x < mWidth; x++)
+        {
+            const GridCell& cell = layer(x, y);
+            if(cell.colors.empty())
+                continue;
+            int occupancy = mOccupancy[cellIndex(x, y)];
+            rowTerms.push_back({occupancy, 1.0});
+            if(!isFirstCell(x, y))
+                continue;
+            // Occupancy is logical OR of all overlay colors in cell
+            std::vector<MilpModel::Term> occupancyTerms = {{occupancy, 1.0}};
+            for(uint8_t c : cell.colors)
+            {
+                occupancyTerms.push_back({colorMoved(x, y, c), -1.0});
+                mMilp.addGreaterOrEqual({{occupancy, 1.0}, {colorMoved(x, y, c), -1.0}}, 0.0);
+                // Total is 1 whenever color is anywhere in the overlay
+                mMilp.addGreaterOrEqual({{mColorsMovedTotal[c], 1.0}, {colorMoved(x, y, c), -1.0}}, 0.0);
+            }
+            mMilp.addLessOrEqual(occupancyTerms, 0.0);
+        }
+        // Limit active overlay cells per row (approximates sprites / scanline limit)
+        combineTerms(rowTerms);
+        if(!rowTerms.empty())
+            mMilp.addLessOrEqual(rowTerms, maxRowSize);
+    }
+    // Total overlay colors can't exceed overlay palettes
+    for(uint8_t c : layer.colors())
+    {
+        totalTerms.push_back({mColorsMovedTotal[c], 1.0});
+    }
+    mMilp.addLessOrEqual(totalTerms, maxSpritePalettes * gridCellColorLimit);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayModel::buildSecondPass(const GridLayer& layer, int gridCellColorLimit, int maxSpritePalettes, int maxRowSize)
+{
+    // Goal: Minimise free sprites
+    addVariables(layer, 1.0);
+    addPaletteConstraints(layer, gridCellColorLimit);
+    std::vector<std::vector<MilpModel::Term>> freeTermsPerColor(MaxColors);
+    for(size_t y = 0; y < mHeight; y++)
+    {
+        std::vector<MilpModel::Term> rowTerms;
+        for(size_t x = 0; x < mWidth; x++)
+        {
+            const GridCell& cell = layer(x, y);
+            if(cell.colors.empty())
+                continue;
+            int occupancy = mOccupancy[cellIndex(x, y)];
+            rowTerms.push_back({occupancy, 1.0});
+            for(uint8_t c : cell.colors)
+                rowTerms.push_back({colorMoved(x, y, c), 1.0});
+            if(!isFirstCell(x, y))
+                continue;
+            // Occupancy is logical OR of all grid overlay colors in cell
+            std::vector<MilpModel::Term> occupancyTerms = {{occupancy, 1.0}};
+            for(uint8_t c : cell.colors)
+            {
+                occupancyTerms.push_back({colorKept(x, y, c), -1.0});
+                mMilp.addGreaterOrEqual({{occupancy, 1.0}, {colorKept(x, y, c), -1.0}}, 0.0);
+                mMilp.addGreaterOrEqual({{mColorsMovedTotal[c], 1.0}, {colorMoved(x, y, c), -1.0}}, 0.0);
+                freeTermsPerColor[c].push_back({colorMoved(x, y, c), -1.0});
+            }
+            mMilp.addLessOrEqual(occupancyTerms, 0.0);
+        }
+        // Row size limit: grid sprites plus free sprite colors (approximates sprites / scanline limit)
+        combineTerms(rowTerms);
+        if(!rowTerms.empty())
+            mMilp.addLessOrEqual(rowTerms, maxRowSize);
+    }
+    std::vector<MilpModel::Term> totalTerms;
+    for(uint8_t c : layer.colors())
+    {
+        // Total can only be 1 if color is used by a free sprite
+        std::vector<MilpModel::Term> clampTerms = freeTermsPerColor[c];
+        clampTerms.push_back({mColorsMovedTotal[c], 1.0});
+        mMilp.addLessOrEqual(clampTerms, 0.0);
+        // Each free color must be present in at least one palette
+        std::vector<MilpModel::Term> anyPaletteTerms = {{mColorsMovedTotal[c], -1.0}};
+        for(size_t p = 0; p < mNumPalettes; p++)
+        {
+            anyPaletteTerms.push_back({palette(p, c), 1.0});
+        }
+        mMilp.addGreaterOrEqual(anyPaletteTerms, 0.0);
+        totalTerms.push_back({mColorsMovedTotal[c], 1.0});
+    }
+    mMilp.addLessOrEqual(totalTerms, maxSpritePalettes * gridCellColorLimit);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayModel::extractSolution(const std::vector<double>& solution,
+                                   std::vector<Colors>& palettes,
+                                   GridLayer& layerKept,
+                                   GridLayer& layerMoved,
+                                   Array2D<uint8_t>& paletteIndices,
+                                   uint8_t paletteIndexOffset) const
+{
+    assert(solution.size() == mMilp.numVariables());
+    auto isSet = [&](int variable) { return variable >= 0 && solution[variable] > 0.5; };
+    palettes.clear();
+    for(size_t y = 0; y < mHeight; y++)
+    {
+        for(size_t x = 0; x < mWidth; x++)
+        {
+            for(size_t c = 0; c < MaxColors; c++)
+            {
+                if(isSet(mColorKept[MaxColors * cellIndex(x, y) + c]))
+                    layerKept(x, y).colors.insert(c);
+                if(isSet(mColorMoved[MaxColors * cellIndex(x, y) + c]))
+                    layerMoved(x, y).colors.insert(c);
+            }
+            for(size_t p = 0; p < mNumPalettes; p++)
+            {
+                if(isSet(mUsesPalette[mNumPalettes * cellIndex(x, y) + p]))
+                    paletteIndices(x, y) = p + paletteIndexOffset;
+            }
+        }
+    }
+    for(size_t p = 0; p < mNumPalettes; p++)
+    {
+        for(size_t c = 0; c < MaxColors; c++)
+        {
+            if(isSet(mPalette[MaxColors * p + c]))
+            {
+                if(p >= palettes.size())
+                {
+                    palettes.resize(p + 1);
+                }
+                palettes[p].insert(c);
+            }
+        }
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+std::vector<double> OverlayModel::makeSolution(const std::vector<Colors>& palettes,
+                                               const GridLayer& layerKept,
+                                               const Array2D<uint8_t>& paletteIndices,
+                                               uint8_t paletteIndexOffset) const
+{
+    assert(layerKept.width() == mWidth && layerKept.height() == mHeight);
+    assert(paletteIndices.width() == mWidth && paletteIndices.height() == mHeight);
+    std::vector<double> solution(mMilp.numVariables(), 0.0);
+    auto set = [&](int variable) { if(variable >= 0) solution[variable] = 1.0; };
+    auto paletteColors = [&](size_t p) { return p + paletteIndexOffset < palettes.size() ? palettes[p + paletteIndexOffset] : Colors(); };
+    for(size_t p = 0; p < mNumPalettes; p++)
+    {
+        for(uint8_t c : paletteColors(p))
+            set(mPalette[MaxColors * p + c]);
+    }
+    for(size_t y = 0; y < mHeight; y++)
+    {
+        for(size_t x = 0; x < mWidth; x++)
+        {
+            const size_t cell = cellIndex(x, y);
+            // Merged cells take the split of their first cell
+            if(mOccupancy[cell] < 0 || !isFirstCell(x, y))
+                continue;
+            size_t p = paletteIndices(x, y) >= paletteIndexOffset ? paletteIndices(x, y) - paletteIndexOffset : mNumPalettes;
+            const Colors keepable = p < mNumPalettes ? layerKept(x, y).colors & paletteColors(p) : Colors();
+            set(mUsesPalette[mNumPalettes * cell + (p < mNumPalettes ? p : 0)]);
+            bool anyKept = false;
+            bool anyMoved = false;
+            for(size_t c = 0; c < MaxColors; c++)
+            {
+                if(mColorKept[MaxColors * cell + c] < 0)
+                    continue;
+                if(keepable.count(c))
+                {
+                    set(mColorKept[MaxColors * cell + c]);
+                    anyKept = true;
+                }
+                else
+                {
+                    set(mColorMoved[MaxColors * cell + c]);
+                    set(mColorsMovedTotal[c]);
+                    anyMoved = true;
+                }
+            }
+            // First pass occupancy follows the overlay (moved) colors, second pass the grid (kept) colors
+            if(mSecondPass ? anyKept : anyMoved)
+                set(mOccupancy[cell]);
+        }
+    }
+    return solution;
+}
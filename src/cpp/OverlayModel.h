@@ -0,0 +1,111 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+#ifndef OVERLAY_MODEL_H
+#define OVERLAY_MODEL_H
+
+#include <cstdint>
+#include <vector>
+
+#include "Array2D.h"
+#include "GridLayer.h"
+#include "MilpModel.h"
+
+//
+// In-memory equivalent of the FirstPass.cmpl / SecondPass.cmpl models.
+//
+// The first pass splits each cell's colors into background (kept) and overlay (moved) colors.
+// The second pass splits the overlay colors into grid-aligned sprites (kept) and free sprites (moved).
+// Variables only exist for colors actually present in a cell, as all others are fixed to zero in the CMPL models.
+//
+// With mergeEqualCells (presolve), all cells of equal colors share the variables of the first such cell, weighted by
+// their summed column counts and by the number of them in each row. This restricts them to the same split and palette:
+// every solution of the smaller model is valid for the full model, but the full model may have better solutions, or
+// solutions where the merged model has none, when equal cells need different splits to meet the row or overlay limits.
+//
+class OverlayModel
+{
+public:
+    static constexpr size_t MaxColors = 64;
+
+    OverlayModel(const GridLayer& layer,
+                 int gridCellColorLimit,
+                 int numPalettes,
+                 int maxSpritePalettes,
+                 int maxRowSize,
+                 bool secondPass,
+                 bool mergeEqualCells = false);
+
+    const MilpModel& milp() const;
+
+    // Fix the palettes (indexed from 0) and only allow moving the given colors, which leaves
+    // rows coupled by nothing but their own row size limits
+    void fixPalettes(const std::vector<Colors>& palettes, const Colors& movableColors);
+
+    // Fix the palettes and the variables of all cells marked in fixedCells to their values in solution,
+    // leaving only the unmarked cells to be solved
+    void fixCells(const std::vector<double>& solution, const Array2D<uint8_t>& fixedCells);
+
+    void extractSolution(const std::vector<double>& solution,
+                         std::vector<Colors>& palettes,
+                         GridLayer& layerKept,
+                         GridLayer& layerMoved,
+                         Array2D<uint8_t>& paletteIndices,
+                         uint8_t paletteIndexOffset) const;
+
+    // Inverse of extractSolution: builds a full variable assignment from a kept / moved split and palette
+    // assignment, e.g. from a previous conversion. Kept colors missing from the layer or the cell's palette are
+    // moved instead. The result may still be infeasible for this model and should be checked before use.
+    std::vector<double> makeSolution(const std::vector<Colors>& palettes,
+                                     const GridLayer& layerKept,
+                                     const Array2D<uint8_t>& paletteIndices,
+                                     uint8_t paletteIndexOffset) const;
+
+protected:
+    void buildFirstPass(const GridLayer& layer, int gridCellColorLimit, int maxSpritePalettes, int maxRowSize);
+    void buildSecondPass(const GridLayer& layer, int gridCellColorLimit, int maxSpritePalettes, int maxRowSize);
+
+    void addVariables(const GridLayer& layer, double movedWeight);
+    void addPaletteConstraints(const GridLayer& layer, int gridCellColorLimit);
+
+    size_t cellIndex(size_t x, size_t y) const;
+    // True for the cell owning variables, i.e. every non-merged cell
+    bool isFirstCell(size_t x, size_t y) const;
+    int& colorKept(size_t x, size_t y, uint8_t c);
+    int& colorMoved(size_t x, size_t y, uint8_t c);
+    int& palette(size_t p, uint8_t c);
+    int& usesPalette(size_t x, size_t y, size_t p);
+
+private:
+    MilpModel mMilp;
+    size_t mWidth;
+    size_t mHeight;
+    size_t mNumPalettes;
+    bool mSecondPass;
+    bool mMergeEqualCells;
+    std::vector<size_t> mFirstCell;
+    std::vector<int> mColorKept;
+    std::vector<int> mColorMoved;
+    std::vector<int> mOccupancy;
+    std::vector<int> mColorsMovedTotal;
+    std::vector<int> mPalette;
+    std::vector<int> mUsesPalette;
+};
+
+#endif // OVERLAY_MODEL_H
@@ -24,16 +24,43 @@
 #include <sstream>
 #include <cstdio>
 #include <array>
+#include <algorithm>
 #include <functional>
 #include <vector>
+#include <charconv>
+#include <thread>
+#include <exception>
+#include <memory>
+#include <optional>
+#include <chrono>
+#include <limits>
+#include <cmath>
+#include <string_view>
+#include <unordered_map>
 
 #include "SubProcess.h"
+#include "ScratchDirectory.h"
+#include "OverlayModel.h"
+#include "SolutionReader.h"
+#include "HeuristicSolver.h"
+#include "ConversionArena.h"
+#include "SpritePlacement.h"
 
 #include "OverlayOptimiser.h"
 
 //---------------------------------------------------------------------------------------------------------------------
 
 OverlayOptimiser::OverlayOptimiser():
+    mKeepWorkFiles(false),
+    mSolverBackend(cbcLibraryAvailable() ? SolverBackend::CbcLibrary : SolverBackend::CmplProcess),
+    mUseWarmStart(true),
+    mDecompositionBandHeight(0),
+    mIncremental(false),
+    mPresolve(false),
+    mRandomSeed(0),
+    mHeuristicConstraintsMet(true),
+    mTimeLimitReached(false),
+    mCancelRequested(false),
     mBackgroundColor(0),
     mSpriteHeight(16)
 {
@@ -56,6 +83,132 @@ void OverlayOptimiser::setWorkPath(const std::string& workPath)
 
 //---------------------------------------------------------------------------------------------------------------------
 
+void OverlayOptimiser::setKeepWorkFiles(bool keepWorkFiles)
+{
+    mKeepWorkFiles = keepWorkFiles;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayOptimiser::setUseWarmStart(bool useWarmStart)
+{
+    mUseWarmStart = useWarmStart;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayOptimiser::clearWarmStart()
+{
+    mWarmStartFirstPass = WarmStart();
+    mWarmStartSecondPass = WarmStart();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayOptimiser::setDecompositionBandHeight(int bandHeight)
+{
+    mDecompositionBandHeight = bandHeight;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayOptimiser::setIncremental(bool incremental)
+{
+    mIncremental = incremental;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayOptimiser::setPresolve(bool presolve)
+{
+    mPresolve = presolve;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayOptimiser::setRandomSeed(int randomSeed)
+{
+    mRandomSeed = randomSeed;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayOptimiser::setFixedPalettes(const std::vector<Colors>& fixedPalettes)
+{
+    mFixedPalettes = fixedPalettes;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+const std::vector<Colors>& OverlayOptimiser::fixedPalettes() const
+{
+    return mFixedPalettes;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayOptimiser::setProgressCallback(const ProgressCallback& progressCallback)
+{
+    mProgressCallback = progressCallback;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayOptimiser::setConversionCache(const std::shared_ptr<ConversionCache>& conversionCache)
+{
+    mConversionCache = conversionCache;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayOptimiser::requestCancel()
+{
+    mCancelRequested = true;
+    // Wakes a convertPortfolio / convertSequence waiting on its workers, to forward the cancel
+    notifyWorkers();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayOptimiser::clearCancel()
+{
+    mCancelRequested = false;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool OverlayOptimiser::cancelRequested() const
+{
+    return mCancelRequested;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+const ConversionReport& OverlayOptimiser::report() const
+{
+    return mReport;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayOptimiser::setSolverBackend(SolverBackend solverBackend)
+{
+    if(solverBackend == SolverBackend::CbcLibrary && !cbcLibraryAvailable())
+    {
+        throw Error("OverlayPal was built without the CBC library solver");
+    }
+    mSolverBackend = solverBackend;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+OverlayOptimiser::SolverBackend OverlayOptimiser::solverBackend() const
+{
+    return mSolverBackend;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
 std::string OverlayOptimiser::exePathFilename(const std::string& exeFilename) const
 {
     return mExecutablePath + "/" + exeFilename;
@@ -65,67 +218,95 @@ std::string OverlayOptimiser::exePathFilename(const std::string& exeFilename) co
 
 std::string OverlayOptimiser::workPathFilename(const std::string& workFilename) const
 {
-    return mWorkPath + "/" + workFilename;
+    return mJobPath + "/" + workFilename;
 }
 
 //---------------------------------------------------------------------------------------------------------------------
 
-void OverlayOptimiser::writeCmplLayerData(std::ofstream& f, const std::string& name, const GridLayer& layer, std::function<int(int, int, int)> const& callback)
+static void appendInt(std::string& buffer, int value)
 {
-    f << "%" << name.c_str() << "[XRANGE, YRANGE, COLORS] <\n";
+    char digits[16];
+    char* end = std::to_chars(digits, digits + sizeof(digits), value).ptr;
+    buffer.append(digits, end);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayOptimiser::writeCmplLayerData(std::string& buffer, const std::string& name, const GridLayer& layer, bool columnCounts)
+{
+    // Sparse matrix: only the colors present in each cell are listed as "x y c value" tuples, the rest default to zero
+    buffer += "%";
+    buffer += name;
+    buffer += "[XRANGE, YRANGE, COLORS] default(0) indices <\n";
     for(int x = 0; x < layer.width(); x++)
     {
         for(int y = 0; y < layer.height(); y++)
         {
-            for(auto c : layer.colors())
+            const GridCell& cell = layer(x, y);
+            for(auto c : cell.colors)
             {
-                int v = callback(x, y, c);
-                f << v << " ";
+                appendInt(buffer, x);
+                buffer += ' ';
+                appendInt(buffer, y);
+                buffer += ' ';
+                appendInt(buffer, c);
+                buffer += ' ';
+                appendInt(buffer, columnCounts ? cell.columnCount[c] : 1);
+                buffer += '\n';
             }
-            f << "\n";
         }
     }
-    f << ">\n";
+    buffer += ">\n";
 }
 
 //---------------------------------------------------------------------------------------------------------------------
 
 void OverlayOptimiser::writeCmplDataFile(const GridLayer& layer, int gridCellColorLimit, int maxBackgroundPalettes, int maxSpritePalettes, int maxRowSize, const std::string& filename)
 {
-    std::ofstream f(filename, std::ofstream::out);
+    StageTimer timer(mReport, "cmpl data file");
+    std::ofstream f(filename, std::ofstream::out | std::ofstream::binary);
     if(!f)
     {
         throw std::runtime_error(std::string("Failed to open file '") + filename + "' for writing CMPL input data.");
     }
+    std::ostringstream header;
     // Limits
-    f << "%CELL_COLOR_LIMIT < " << gridCellColorLimit << " >\n";
-    f << "%MAX_BG_PALETTES < " << maxBackgroundPalettes << " >\n";
-    f << "%BG_PALETTES set < 0.." << maxBackgroundPalettes-1 << " >\n";
-    f << "%MAX_SPR_PALETTES < " << maxSpritePalettes << " >\n";
-    f << "%SPR_PALETTES set < 0.." << maxSpritePalettes-1 << " >\n";
-    f << "%OVERLAY_ROW_SIZE_LIMIT < " << maxRowSize << " >\n";
+    header << "%CELL_COLOR_LIMIT < " << gridCellColorLimit << " >\n";
+    header << "%MAX_BG_PALETTES < " << maxBackgroundPalettes << " >\n";
+    header << "%BG_PALETTES set < 0.." << maxBackgroundPalettes-1 << " >\n";
+    header << "%MAX_SPR_PALETTES < " << maxSpritePalettes << " >\n";
+    header << "%SPR_PALETTES set < 0.." << maxSpritePalettes-1 << " >\n";
+    header << "%OVERLAY_ROW_SIZE_LIMIT < " << maxRowSize << " >\n";
     // X / Y ranges
-    f << "%XRANGE set < 0.." << layer.width()-1 << " >\n";
-    f << "%YRANGE set < 0.." << layer.height()-1 << " >\n";
+    header << "%XRANGE set < 0.." << layer.width()-1 << " >\n";
+    header << "%YRANGE set < 0.." << layer.height()-1 << " >\n";
     // All colors present in layer
-    f << "%COLORS set < ";
+    header << "%COLORS set < ";
     for(auto c : layer.colors())
     {
-        f << int(c) << " ";
+        header << int(c) << " ";
+    }
+    header << " >\n";
+    std::string buffer = header.str();
+    // Each present color takes one tuple line per matrix
+    buffer.reserve(buffer.size() + 2 * 24 * layer.colorsPerCellSum() + 256);
+    writeCmplLayerData(buffer, "layerColors", layer, false);
+    writeCmplLayerData(buffer, "layerColorColumnCount", layer, true);
+    f.write(buffer.data(), buffer.size());
+    if(!f)
+    {
+        throw std::runtime_error(std::string("Failed to write CMPL input data to '") + filename + "'.");
     }
-    f << " >\n";
-    // layerColors
-    writeCmplLayerData(f, "layerColors", layer, [&](int x, int y, uint8_t c) { return layer(x, y).colors.count(c) ? 1 : 0; });
-    writeCmplLayerData(f, "layerColorColumnCount", layer, [&](int x, int y, uint8_t c) { return layer(x, y).colors.count(c) ? layer(x, y).columnCount.at(c) : 0; });
 }
 
 //---------------------------------------------------------------------------------------------------------------------
 
-void OverlayOptimiser::runCmplProgram(const std::string& inputFilename,
-                                      const std::string& outputFilename,
-                                      const std::string& solutionCsvFilename,
-                                      int timeOut)
+double OverlayOptimiser::runCmplProgram(const std::string& inputFilename,
+                                        const std::string& outputFilename,
+                                        const std::string& solutionCsvFilename,
+                                        int timeOut)
 {
+    StageTimer timer(mReport, "cmpl process");
     // Make a copy of the original program and prepend timeOut parameter to it
     // This is an ugly work-around for there being no other way(?) to set the CBC timeout parameter :(
     std::ifstream inputFile(inputFilename, std::ifstream::in);
@@ -137,6 +318,10 @@ void OverlayOptimiser::runCmplProgram(const std::string& inputFilename,
     {
         outputFile << "%opt cbc seconds " << timeOut << "\n";
     }
+    if(mRandomSeed)
+    {
+        outputFile << "%opt cbc randomCbcSeed " << mRandomSeed << "\n";
+    }
     outputFile << inputFileStr;
     outputFile.close();
     // Execute process
@@ -146,150 +331,530 @@ void OverlayOptimiser::runCmplProgram(const std::string& inputFilename,
     params.push_back(quoteStringOnWindows(outputFilename));
     params.push_back("-solutionCsv");
     params.push_back(quoteStringOnWindows(solutionCsvFilename));
-    int exitCode = executeProcess(exePathFilename(cmplExecutable), params, timeOut, mWorkPath);
+    int exitCode = executeProcess(exePathFilename(cmplExecutable), params, timeOut, mJobPath, &mCancelRequested);
     if(exitCode != 0)
     {
         throw Error("Non-zero exit code from CMPL");
     }
+    return timer.elapsedSeconds();
 }
 
 //---------------------------------------------------------------------------------------------------------------------
 
-void OverlayOptimiser::parseSolutionValue(const std::string& line, std::vector<int>& indices, int& value)
+void OverlayOptimiser::addCmplSolve(const CmplSolutionStatistics& cmplStatistics, bool secondPass, double seconds)
 {
-    indices.clear();
-    size_t arrayStartPos = line.find("[", 0);
-    size_t arrayEndPos = line.find("]", 0);
-    size_t activityPos = line.find(";B;", 0);
-    if(activityPos == std::string::npos)
+    SolverStatistics statistics;
+    statistics.pass = secondPass ? "second" : "first";
+    statistics.method = "cmpl";
+    statistics.numVariables = cmplStatistics.numVariables;
+    statistics.numConstraints = cmplStatistics.numConstraints;
+    statistics.seconds = seconds;
+    statistics.hasSolution = true;
+    statistics.provenOptimal = cmplStatistics.objectiveStatus == "optimal";
+    statistics.timeLimitReached = cmplStatistics.objectiveStatus.find("time") != std::string::npos;
+    // The solution file holds no bound, so the gap is unknown
+    statistics.objective = cmplStatistics.objectiveValue;
+    statistics.bestBound = cmplStatistics.objectiveValue;
+    mReport.addSolve(statistics);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+OverlayModel OverlayOptimiser::buildModel(const GridLayer& layer,
+                                          int gridCellColorLimit,
+                                          int numPalettes,
+                                          int maxSpritePalettes,
+                                          int maxRowSize,
+                                          bool secondPass,
+                                          bool mergeEqualCells)
+{
+    StageTimer timer(mReport, "model build");
+    return OverlayModel(layer, gridCellColorLimit, numPalettes, maxSpritePalettes, maxRowSize, secondPass, mergeEqualCells);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+MilpSolveResult OverlayOptimiser::solveMilp(const MilpModel& milp, const MilpSolveOptions& options, bool secondPass, const std::string& method)
+{
+    StageTimer timer(mReport, "cbc solve");
+    MilpSolveResult result = solveMilpWithCbc(milp, options);
+    SolverStatistics statistics;
+    statistics.pass = secondPass ? "second" : "first";
+    statistics.method = method;
+    statistics.numVariables = milp.numVariables();
+    statistics.numConstraints = milp.numConstraints();
+    statistics.numNonZeros = milp.numNonZeros();
+    statistics.seconds = timer.elapsedSeconds();
+    statistics.hasSolution = result.hasSolution;
+    statistics.provenOptimal = result.provenOptimal;
+    statistics.timeLimitReached = result.timeLimitReached;
+    statistics.objective = result.objective;
+    statistics.bestBound = result.bestBound;
+    if(result.hasSolution)
+        statistics.gap = std::abs(result.objective - result.bestBound) / std::max(std::abs(result.objective), 1e-9);
+    statistics.numNodes = result.numNodes;
+    mReport.addSolve(statistics);
+    return result;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayOptimiser::solveInProcess(const GridLayer& layer,
+                                      int gridCellColorLimit,
+                                      int numPalettes,
+                                      int maxSpritePalettes,
+                                      int maxRowSize,
+                                      int timeOut,
+                                      bool secondPass,
+                                      const WarmStart& warmStart,
+                                      std::vector<Colors>& palettes,
+                                      GridLayer& layerKept,
+                                      GridLayer& layerMoved,
+                                      Array2D<uint8_t>& paletteIndices)
+{
+    const uint8_t paletteIndexOffset = secondPass ? NumBackgroundPalettes : 0;
+    if(!mFixedPalettes.empty())
     {
-        // For currently unknown reasons, the CMPL solution will sometimes have
-        // binary variables changed to integer.
-        // Work around this bug by re-trying a second time with 'I' instead of 'B'.
-        activityPos = line.find(";I;", 0);
+        solveInProcessFixedPalettes(layer,
+                                    gridCellColorLimit,
+                                    numPalettes,
+                                    maxSpritePalettes,
+                                    maxRowSize,
+                                    timeOut,
+                                    secondPass,
+                                    palettes,
+                                    layerKept,
+                                    layerMoved,
+                                    paletteIndices);
+        return;
     }
-    if(arrayStartPos != std::string::npos &&
-       arrayEndPos != std::string::npos &&
-       activityPos != std::string::npos)
+    if(mSolverBackend == SolverBackend::Heuristic)
     {
-        assert(arrayStartPos+1 < line.size());
-        assert(arrayEndPos+1 < line.size());
-        assert(activityPos+3 < line.size());
-        assert(arrayStartPos < arrayEndPos);
-        // Read indices
+        StageTimer timer(mReport, "heuristic");
+        mHeuristicConstraintsMet &= solvePassHeuristic(layer,
+                                                       gridCellColorLimit,
+                                                       numPalettes,
+                                                       maxSpritePalettes,
+                                                       maxRowSize,
+                                                       secondPass,
+                                                       palettes,
+                                                       layerKept,
+                                                       layerMoved,
+                                                       paletteIndices,
+                                                       paletteIndexOffset);
+        return;
+    }
+    if(mIncremental &&
+       solveInProcessIncremental(layer,
+                                 gridCellColorLimit,
+                                 numPalettes,
+                                 maxSpritePalettes,
+                                 maxRowSize,
+                                 timeOut,
+                                 secondPass,
+                                 warmStart,
+                                 palettes,
+                                 layerKept,
+                                 layerMoved,
+                                 paletteIndices))
+    {
+        return;
+    }
+    if(mDecompositionBandHeight > 0 &&
+       layer.height() > static_cast<size_t>(mDecompositionBandHeight) &&
+       solveInProcessBanded(layer,
+                            gridCellColorLimit,
+                            numPalettes,
+                            maxSpritePalettes,
+                            maxRowSize,
+                            timeOut,
+                            secondPass,
+                            palettes,
+                            layerKept,
+                            layerMoved,
+                            paletteIndices))
+    {
+        return;
+    }
+    // The presolved model first, then the full model when that has no solution
+    for(bool mergeEqualCells : {true, false})
+    {
+        if(mergeEqualCells && !mPresolve)
+            continue;
+        OverlayModel model = buildModel(layer, gridCellColorLimit, numPalettes, maxSpritePalettes, maxRowSize, secondPass, mergeEqualCells);
+        MilpSolveOptions options;
+        options.timeOut = timeOut;
+        options.randomSeed = mRandomSeed;
+        if(mUseWarmStart &&
+           warmStart.layerKept.width() == layer.width() &&
+           warmStart.layerKept.height() == layer.height())
         {
-            std::string indicesStr = line.substr(arrayStartPos + 1, arrayEndPos - arrayStartPos + 1); //arrayStartPos
-            char c;
-            int i;
-            std::stringstream ss(indicesStr);
-            while(true)
+            // Previous solution projected onto the current image, only usable if it still meets all constraints
+            std::vector<double> initialSolution = model.makeSolution(warmStart.palettes,
+                                                                     warmStart.layerKept,
+                                                                     warmStart.paletteIndices,
+                                                                     paletteIndexOffset);
+            if(model.milp().isFeasible(initialSolution))
+                options.initialSolution = initialSolution;
+        }
+        if(mUseWarmStart && options.initialSolution.empty())
+        {
+            // Otherwise start from the heuristic solution, if valid
+            StageTimer timer(mReport, "heuristic");
+            WarmStart heuristic{GridLayer(layer.width(), layer.height()), {}, Array2D<uint8_t>(layer.width(), layer.height(), paletteIndexOffset), GridLayer(), {}};
+            GridLayer heuristicMoved(layer.width(), layer.height());
+            if(solvePassHeuristic(layer,
+                                  gridCellColorLimit,
+                                  numPalettes,
+                                  maxSpritePalettes,
+                                  maxRowSize,
+                                  secondPass,
+                                  heuristic.palettes,
+                                  heuristic.layerKept,
+                                  heuristicMoved,
+                                  heuristic.paletteIndices,
+                                  paletteIndexOffset))
             {
-                ss >> i >> c;
-                indices.push_back(i);
-                if(c != ',')
-                    break;
+                // Palettes of the heuristic are indexed from 0, so shift them to match the palette indices
+                heuristic.palettes.insert(heuristic.palettes.begin(), paletteIndexOffset, Colors());
+                options.initialSolution = model.makeSolution(heuristic.palettes,
+                                                             heuristic.layerKept,
+                                                             heuristic.paletteIndices,
+                                                             paletteIndexOffset);
+                if(!model.milp().isFeasible(options.initialSolution))
+                    options.initialSolution.clear();
             }
         }
-        // Read activity
+        MilpSolveResult result = solveMilp(model.milp(), options, secondPass, mergeEqualCells ? "cbc presolved" : "cbc");
+        if(!result.hasSolution)
+            continue;
+        mTimeLimitReached |= result.timeLimitReached;
+        model.extractSolution(result.solution,
+                              palettes,
+                              layerKept,
+                              layerMoved,
+                              paletteIndices,
+                              paletteIndexOffset);
+        return;
+    }
+    throw std::runtime_error(std::string("No solution found"));
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayOptimiser::solveInProcessFixedPalettes(const GridLayer& layer,
+                                                   int gridCellColorLimit,
+                                                   int numPalettes,
+                                                   int maxSpritePalettes,
+                                                   int maxRowSize,
+                                                   int timeOut,
+                                                   bool secondPass,
+                                                   std::vector<Colors>& palettes,
+                                                   GridLayer& layerKept,
+                                                   GridLayer& layerMoved,
+                                                   Array2D<uint8_t>& paletteIndices)
+{
+    const uint8_t paletteIndexOffset = secondPass ? NumBackgroundPalettes : 0;
+    // Palettes of this pass, indexed from 0 like a solved pass
+    std::vector<Colors> passPalettes(numPalettes);
+    for(size_t p = 0; p < passPalettes.size() && paletteIndexOffset + p < mFixedPalettes.size(); p++)
+    {
+        passPalettes[p] = mFixedPalettes[paletteIndexOffset + p];
+    }
+    // The presolved model first, then the full model when that has no solution
+    for(bool mergeEqualCells : {true, false})
+    {
+        if(mSolverBackend != SolverBackend::CbcLibrary)
+            break;
+        if(mergeEqualCells && !mPresolve)
+            continue;
+        // Any color may be moved, which leaves rows coupled by nothing but their own row size limits
+        OverlayModel model = buildModel(layer, gridCellColorLimit, numPalettes, maxSpritePalettes, maxRowSize, secondPass, mergeEqualCells);
+        model.fixPalettes(passPalettes, Colors::fromMask(~uint64_t(0)));
+        MilpSolveOptions options;
+        options.timeOut = timeOut;
+        options.randomSeed = mRandomSeed;
+        MilpSolveResult result = solveMilp(model.milp(), options, secondPass, mergeEqualCells ? "cbc fixed palettes presolved" : "cbc fixed palettes");
+        if(result.hasSolution)
         {
-            std::string activityStr = line.substr(activityPos+3, line.size() - (activityPos + 3));
-            std::stringstream ss(activityStr);
-            ss >> value;
+            mTimeLimitReached |= result.timeLimitReached;
+            std::vector<Colors> solvedPalettes;
+            model.extractSolution(result.solution,
+                                  solvedPalettes,
+                                  layerKept,
+                                  layerMoved,
+                                  paletteIndices,
+                                  paletteIndexOffset);
+            palettes = passPalettes;
+            return;
         }
     }
+    // The CMPL models have no fixed palettes, and the heuristic split is still near-valid without a solution
+    StageTimer timer(mReport, "heuristic");
+    mHeuristicConstraintsMet &= assignPalettesHeuristic(layer,
+                                                        gridCellColorLimit,
+                                                        passPalettes,
+                                                        maxSpritePalettes,
+                                                        maxRowSize,
+                                                        secondPass,
+                                                        layerKept,
+                                                        layerMoved,
+                                                        paletteIndices,
+                                                        paletteIndexOffset);
+    palettes = passPalettes;
 }
 
 //---------------------------------------------------------------------------------------------------------------------
 
-bool OverlayOptimiser::parseCmplSolution(const std::string& csvFilename,
-                                         std::vector<std::set<uint8_t>>& palettes,
-                                         GridLayer& colorsBackground,
-                                         GridLayer& colorsOverlay,
-                                         Array2D<uint8_t>& paletteIndicesBackground,
-                                         bool secondPass)
+bool OverlayOptimiser::solveInProcessIncremental(const GridLayer& layer,
+                                                 int gridCellColorLimit,
+                                                 int numPalettes,
+                                                 int maxSpritePalettes,
+                                                 int maxRowSize,
+                                                 int timeOut,
+                                                 bool secondPass,
+                                                 const WarmStart& warmStart,
+                                                 std::vector<Colors>& palettes,
+                                                 GridLayer& layerKept,
+                                                 GridLayer& layerMoved,
+                                                 Array2D<uint8_t>& paletteIndices)
 {
-    std::ifstream f;
-    f.open(csvFilename, std::ifstream::in);
-    if(!f)
+    if(warmStart.conversionSettings != mConversionSettings ||
+       warmStart.layer.width() != layer.width() ||
+       warmStart.layer.height() != layer.height())
     {
-        throw std::runtime_error(std::string("Failed to open solution file: ") + csvFilename);
+        return false;
     }
-    // Read data
-    const std::string noSolutionString = "No solution has been found";
-    const std::string colorsBackgroundPrefix = secondPass ? "colorsOverlayGrid[" : "colorsBG[";
-    const std::string colorsOverlayPrefix = secondPass ? "colorsOverlayFree[" : "colorsOverlay[";
-    const std::string palettesNamePrefix = secondPass ? "palettesOverlay[" : "palettesBG[";
-    const std::string usesPalettePrefix = secondPass ? "usesPaletteOverlay[" : "usesPaletteBG[";
-    std::string line;
-    std::getline(f, line);
-    if(line.find("Problem;") == std::string::npos)
+    Array2D<uint8_t> fixedCells(layer.width(), layer.height());
+    bool anyChanged = false;
+    for(size_t y = 0; y < layer.height(); y++)
     {
-        throw std::runtime_error(std::string("Solution file header unrecognized"));
+        for(size_t x = 0; x < layer.width(); x++)
+        {
+            fixedCells(x, y) = layer(x, y) == warmStart.layer(x, y);
+            anyChanged |= !fixedCells(x, y);
+        }
     }
-    // Parse values
-    palettes.clear();
-    std::vector<int> indices;
-    int value;
-    while(true)
+    // Nothing to re-solve, e.g. when refining the same image
+    if(!anyChanged)
+        return false;
+    const uint8_t paletteIndexOffset = secondPass ? NumBackgroundPalettes : 0;
+    // Cells fixed to the previous result may no longer match their equal cells, so never merge them
+    OverlayModel model = buildModel(layer, gridCellColorLimit, numPalettes, maxSpritePalettes, maxRowSize, secondPass, false);
+    std::vector<double> previousSolution = model.makeSolution(warmStart.palettes,
+                                                              warmStart.layerKept,
+                                                              warmStart.paletteIndices,
+                                                              paletteIndexOffset);
+    model.fixCells(previousSolution, fixedCells);
+    MilpSolveOptions options;
+    options.timeOut = timeOut;
+    options.randomSeed = mRandomSeed;
+    // The changed cells' part of the previous solution rarely fits the new image, but try anyway
+    if(model.milp().isFeasible(previousSolution))
+        options.initialSolution = previousSolution;
+    MilpSolveResult result = solveMilp(model.milp(), options, secondPass, "cbc incremental");
+    if(!result.hasSolution)
+        return false;
+    mTimeLimitReached |= result.timeLimitReached;
+    model.extractSolution(result.solution,
+                          palettes,
+                          layerKept,
+                          layerMoved,
+                          paletteIndices,
+                          paletteIndexOffset);
+    return true;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+template<typename T>
+static void copyRows(const Array2D<T>& src, size_t srcY, Array2D<T>& dst, size_t dstY, size_t numRows)
+{
+    for(size_t y = 0; y < numRows; y++)
     {
-        if(!std::getline(f, line))
-            break;
-        if(line.find(noSolutionString, 0) == 0)
+        for(size_t x = 0; x < src.width(); x++)
         {
-            throw std::runtime_error(std::string("No solution found"));
+            dst(x, dstY + y) = src(x, srcY + y);
         }
-        else if(line.rfind(colorsBackgroundPrefix, 0) == 0)
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool OverlayOptimiser::solveInProcessBanded(const GridLayer& layer,
+                                            int gridCellColorLimit,
+                                            int numPalettes,
+                                            int maxSpritePalettes,
+                                            int maxRowSize,
+                                            int timeOut,
+                                            bool secondPass,
+                                            std::vector<Colors>& palettes,
+                                            GridLayer& layerKept,
+                                            GridLayer& layerMoved,
+                                            Array2D<uint8_t>& paletteIndices)
+{
+    const uint8_t paletteIndexOffset = secondPass ? NumBackgroundPalettes : 0;
+    // Palettes and the set of moved colors are the only couplings between rows besides the row size limit,
+    // so fixing them to a valid heuristic solution makes the row bands independent
+    std::vector<Colors> heuristicPalettes;
+    GridLayer heuristicKept(layer.width(), layer.height());
+    GridLayer heuristicMoved(layer.width(), layer.height());
+    Array2D<uint8_t> heuristicPaletteIndices(layer.width(), layer.height(), paletteIndexOffset);
+    bool heuristicValid;
+    {
+        StageTimer timer(mReport, "heuristic");
+        heuristicValid = solvePassHeuristic(layer,
+                                            gridCellColorLimit,
+                                            numPalettes,
+                                            maxSpritePalettes,
+                                            maxRowSize,
+                                            secondPass,
+                                            heuristicPalettes,
+                                            heuristicKept,
+                                            heuristicMoved,
+                                            heuristicPaletteIndices,
+                                            paletteIndexOffset);
+    }
+    if(!heuristicValid)
+        return false;
+    Colors movableColors;
+    for(size_t y = 0; y < heuristicMoved.height(); y++)
+    {
+        for(size_t x = 0; x < heuristicMoved.width(); x++)
         {
-            parseSolutionValue(line, indices, value);
-            assert(indices.size() == 3 && "colors background index length mismatch");
-            if(value == 1)
-            {
-                int x = indices[0];
-                int y = indices[1];
-                int c = indices[2];
-                colorsBackground(x, y).colors.insert(c);
-            }
+            movableColors |= heuristicMoved(x, y).colors;
         }
-        else if(line.rfind(colorsOverlayPrefix, 0) == 0)
+    }
+    // Palette indices of each MIP start are offset, so shift the palettes to match
+    std::vector<Colors> offsetPalettes = heuristicPalettes;
+    offsetPalettes.insert(offsetPalettes.begin(), paletteIndexOffset, Colors());
+    const size_t bandHeight = mDecompositionBandHeight;
+    const size_t numBands = (layer.height() + bandHeight - 1) / bandHeight;
+    std::vector<MilpSolveResult> results(numBands);
+    std::vector<std::unique_ptr<OverlayModel>> models(numBands);
+    std::vector<std::exception_ptr> errors(numBands);
+    // Each band is a full CBC solve, so a pool no larger than the number of cores runs them
+    std::atomic<size_t> nextBand(0);
+    auto worker = [&]()
+    {
+        for(size_t band = nextBand++; band < numBands && !mCancelRequested; band = nextBand++)
         {
-            parseSolutionValue(line, indices, value);
-            assert(indices.size() == 3 && "colors overlay index length mismatch");
-            if(value == 1)
+            try
             {
-                int x = indices[0];
-                int y = indices[1];
-                int c = indices[2];
-                colorsOverlay(x, y).colors.insert(c);
+                const size_t y = band * bandHeight;
+                const size_t numRows = std::min(bandHeight, layer.height() - y);
+                const GridLayer bandLayer = layer.rows(y, numRows);
+                models[band] = std::make_unique<OverlayModel>(buildModel(bandLayer, gridCellColorLimit, numPalettes, maxSpritePalettes, maxRowSize, secondPass, mPresolve));
+                models[band]->fixPalettes(heuristicPalettes, movableColors);
+                Array2D<uint8_t> bandPaletteIndices(layer.width(), numRows);
+                copyRows(heuristicPaletteIndices, y, bandPaletteIndices, 0, numRows);
+                MilpSolveOptions options;
+                options.timeOut = timeOut;
+                options.randomSeed = mRandomSeed;
+                options.initialSolution = models[band]->makeSolution(offsetPalettes,
+                                                                     heuristicKept.rows(y, numRows),
+                                                                     bandPaletteIndices,
+                                                                     paletteIndexOffset);
+                results[band] = solveMilp(models[band]->milp(), options, secondPass, "cbc band " + std::to_string(band));
             }
-        }
-        else if(line.rfind(palettesNamePrefix, 0) == 0)
-        {
-            parseSolutionValue(line, indices, value);
-            assert(indices.size() == 2 && "Palette index length mismatch");
-            if(value == 1)
+            catch(...)
             {
-                int p = indices[0];
-                int c = indices[1];
-                if(p >= palettes.size())
-                {
-                    palettes.resize(p + 1);
-                }
-                palettes[p].insert(c);
+                errors[band] = std::current_exception();
             }
         }
-        else if(line.rfind(usesPalettePrefix, 0) == 0)
+    };
+    const size_t numThreads = std::min<size_t>(numBands, std::max(1u, std::thread::hardware_concurrency()));
+    std::vector<std::thread> threads;
+    for(size_t i = 0; i < numThreads; i++)
+    {
+        threads.emplace_back(worker);
+    }
+    for(std::thread& thread : threads)
+    {
+        thread.join();
+    }
+    // Bands left unsolved on a cancel must not fall back to solving the whole pass
+    if(mCancelRequested)
+        throw ProcessCancelled();
+    for(size_t band = 0; band < numBands; band++)
+    {
+        if(errors[band])
+            std::rethrow_exception(errors[band]);
+        // Fall back to solving the whole pass
+        if(!results[band].hasSolution)
+            return false;
+    }
+    // Stitch bands together
+    for(size_t band = 0; band < numBands; band++)
+    {
+        const size_t y = band * bandHeight;
+        const size_t numRows = std::min(bandHeight, layer.height() - y);
+        std::vector<Colors> bandPalettes;
+        GridLayer bandKept(layer.width(), numRows);
+        GridLayer bandMoved(layer.width(), numRows);
+        Array2D<uint8_t> bandPaletteIndices(layer.width(), numRows);
+        copyRows(paletteIndices, y, bandPaletteIndices, 0, numRows);
+        models[band]->extractSolution(results[band].solution,
+                                      bandPalettes,
+                                      bandKept,
+                                      bandMoved,
+                                      bandPaletteIndices,
+                                      paletteIndexOffset);
+        copyRows(bandKept, 0, layerKept, y, numRows);
+        copyRows(bandMoved, 0, layerMoved, y, numRows);
+        copyRows(bandPaletteIndices, 0, paletteIndices, y, numRows);
+        mTimeLimitReached |= results[band].timeLimitReached;
+    }
+    palettes = heuristicPalettes;
+    return true;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool OverlayOptimiser::parseCmplSolution(const std::string& csvFilename,
+                                         std::vector<Colors>& palettes,
+                                         GridLayer& colorsBackground,
+                                         GridLayer& colorsOverlay,
+                                         Array2D<uint8_t>& paletteIndicesBackground,
+                                         bool secondPass,
+                                         CmplSolutionStatistics* statistics)
+{
+    StageTimer timer(mReport, "cmpl solution parse");
+    const std::string colorsBackgroundName = secondPass ? "colorsOverlayGrid" : "colorsBG";
+    const std::string colorsOverlayName = secondPass ? "colorsOverlayFree" : "colorsOverlay";
+    const std::string palettesName = secondPass ? "palettesOverlay" : "palettesBG";
+    const std::string usesPaletteName = secondPass ? "usesPaletteOverlay" : "usesPaletteBG";
+    const uint8_t paletteIndexOffset = secondPass ? NumBackgroundPalettes : 0;
+    palettes.clear();
+    CmplSolutionReader reader;
+    reader.addVariable(colorsBackgroundName, 3, [&](const int* indices, int value)
+    {
+        if(value == 1)
+            colorsBackground(indices[0], indices[1]).colors.insert(indices[2]);
+    });
+    reader.addVariable(colorsOverlayName, 3, [&](const int* indices, int value)
+    {
+        if(value == 1)
+            colorsOverlay(indices[0], indices[1]).colors.insert(indices[2]);
+    });
+    reader.addVariable(palettesName, 2, [&](const int* indices, int value)
+    {
+        if(value == 1)
         {
-            parseSolutionValue(line, indices, value);
-            assert(indices.size() == 3 && "Uses-palette index length mismatch");
-            if(value == 1)
+            size_t p = indices[0];
+            if(p >= palettes.size())
             {
-                int x = indices[0];
-                int y = indices[1];
-                int paletteIndex = indices[2];
-                paletteIndicesBackground(x, y) = paletteIndex + (secondPass ? NumBackgroundPalettes : 0);
+                palettes.resize(p + 1);
             }
+            palettes[p].insert(indices[1]);
         }
-    }
+    });
+    reader.addVariable(usesPaletteName, 3, [&](const int* indices, int value)
+    {
+        if(value == 1)
+            paletteIndicesBackground(indices[0], indices[1]) = indices[2] + paletteIndexOffset;
+    });
+    reader.read(csvFilename, statistics);
     return true;
 }
 
@@ -367,7 +932,7 @@ void moveOverlayColors(const Image2D& inputImage,
 
 //---------------------------------------------------------------------------------------------------------------------
 
-bool OverlayOptimiser::consistentLayers(const Image2D& image, const GridLayer& layer, const std::vector<std::set<uint8_t>>& palettes, const Array2D<uint8_t>& paletteIndices, uint8_t backgroundColor)
+bool OverlayOptimiser::consistentLayers(const Image2D& image, const GridLayer& layer, const std::vector<Colors>& palettes, const Array2D<uint8_t>& paletteIndices, uint8_t backgroundColor)
 {
     assert(layer.width() == paletteIndices.width() && layer.height() == paletteIndices.height());
     const size_t w = layer.width();
@@ -409,11 +974,11 @@ bool OverlayOptimiser::consistentLayers(const Image2D& image, const GridLayer& l
 
 //---------------------------------------------------------------------------------------------------------------------
 
-void OverlayOptimiser::fillMissingPaletteGroups(std::vector<std::set<uint8_t>>& palettes, size_t numPalettes)
+void OverlayOptimiser::fillMissingPaletteGroups(std::vector<Colors>& palettes, size_t numPalettes)
 {
     while(palettes.size() < numPalettes)
     {
-        palettes.push_back(std::set<uint8_t>());
+        palettes.push_back(Colors());
     }
 }
 
@@ -425,17 +990,17 @@ bool OverlayOptimiser::convertFirstPassNoBG(int gridCellColorLimit,
                                             const GridLayer& layer,
                                             GridLayer& layerBackground,
                                             GridLayer& layerOverlay,
-                                            std::vector<std::set<uint8_t>>& palettesBG,
+                                            std::vector<Colors>& palettesBG,
                                             Array2D<uint8_t>& paletteIndicesBackground)
 {
-    std::set<uint8_t> colors;
+    Colors colors;
     int maxCellsInRow = 0;
     for(int y = 0; y < layer.height(); y++)
     {
         int numCellsInRow = 0;
         for(int x = 0; x < layer.width(); x++)
         {
-            colors.insert(layer(x, y).colors.begin(), layer(x, y).colors.end());
+            colors |= layer(x, y).colors;
             if(layer(x, y).colors.size() > 0)
                 numCellsInRow++;
             layerOverlay(x, y) = layer(x, y);
@@ -459,9 +1024,10 @@ bool OverlayOptimiser::convertFirstPass(const Image2D& image,
                                         const GridLayer& layer,
                                         GridLayer& layerBackground,
                                         GridLayer& layerOverlay,
-                                        std::vector<std::set<uint8_t>>& palettesBG,
+                                        std::vector<Colors>& palettesBG,
                                         Array2D<uint8_t>& paletteIndicesBackground)
 {
+    StageTimer timer(mReport, "first pass");
     // Special-case for maxBackgroundPalettes = 0
     if(maxBackgroundPalettes == 0)
     {
@@ -481,26 +1047,47 @@ bool OverlayOptimiser::convertFirstPass(const Image2D& image,
             return true;
         }
     }
-    // Make layer for input image
-    writeCmplDataFile(layer,
-                      gridCellColorLimit,
-                      maxBackgroundPalettes,
-                      maxSpritePalettes,
-                      maxRowSize,
-                      workPathFilename(firstPassDataFilename));
-    //
-    runCmplProgram(exePathFilename(firstPassProgramInputFilename),
-                   workPathFilename(firstPassProgramOutputFilename),
-                   workPathFilename(firstPassSolutionFilename),
-                   timeOut);
-    if(!parseCmplSolution(workPathFilename(firstPassSolutionFilename),
-                          palettesBG,
-                          layerBackground,
-                          layerOverlay,
-                          paletteIndicesBackground,
-                          false))
-    {
-        throw Error("Failed to parse CMPL result (first pass)");
+    if(mSolverBackend != SolverBackend::CmplProcess || !mFixedPalettes.empty())
+    {
+        solveInProcess(layer,
+                       gridCellColorLimit,
+                       maxBackgroundPalettes,
+                       maxSpritePalettes,
+                       maxRowSize,
+                       timeOut,
+                       false,
+                       mWarmStartFirstPass,
+                       palettesBG,
+                       layerBackground,
+                       layerOverlay,
+                       paletteIndicesBackground);
+    }
+    else
+    {
+        // Make layer for input image
+        writeCmplDataFile(layer,
+                          gridCellColorLimit,
+                          maxBackgroundPalettes,
+                          maxSpritePalettes,
+                          maxRowSize,
+                          workPathFilename(firstPassDataFilename));
+        //
+        const double seconds = runCmplProgram(exePathFilename(firstPassProgramInputFilename),
+                                              workPathFilename(firstPassProgramOutputFilename),
+                                              workPathFilename(firstPassSolutionFilename),
+                                              timeOut);
+        CmplSolutionStatistics statistics;
+        if(!parseCmplSolution(workPathFilename(firstPassSolutionFilename),
+                              palettesBG,
+                              layerBackground,
+                              layerOverlay,
+                              paletteIndicesBackground,
+                              false,
+                              &statistics))
+        {
+            throw Error("Failed to parse CMPL result (first pass)");
+        }
+        addCmplSolve(statistics, false, seconds);
     }
     setEmptyPaletteIndices(paletteIndicesBackground, layerBackground, 0);
     return true;
@@ -515,32 +1102,54 @@ bool OverlayOptimiser::convertSecondPass(int gridCellColorLimit,
                                          const GridLayer& layer,
                                          GridLayer& layerOverlayGrid,
                                          GridLayer& layerOverlayFree,
-                                         std::vector<std::set<uint8_t>>& palettes,
+                                         std::vector<Colors>& palettes,
                                          Array2D<uint8_t>& paletteIndicesOverlay)
 {
-    writeCmplDataFile(layer,
-                      gridCellColorLimit,
-                      0,
-                      maxSpritePalettes,
-                      2 * maxSpritesPerScanline,
-                      workPathFilename(secondPassDataFilename));
-    //
-    runCmplProgram(exePathFilename(secondPassProgramInputFilename),
-                   workPathFilename(secondPassProgramOutputFilename),
-                   workPathFilename(secondPassSolutionFilename),
-                   timeOut);
-    std::vector<std::set<uint8_t>> palettesSPR;
-    if(!parseCmplSolution(workPathFilename(secondPassSolutionFilename),
-                          palettesSPR,
-                          layerOverlayGrid,
-                          layerOverlayFree,
-                          paletteIndicesOverlay,
-                          true))
-    {
-        throw Error("Failed to parse CMPL result (second pass)");
+    StageTimer timer(mReport, "second pass");
+    std::vector<Colors> palettesSPR;
+    if(mSolverBackend != SolverBackend::CmplProcess || !mFixedPalettes.empty())
+    {
+        solveInProcess(layer,
+                       gridCellColorLimit,
+                       maxSpritePalettes,
+                       maxSpritePalettes,
+                       2 * maxSpritesPerScanline,
+                       timeOut,
+                       true,
+                       mWarmStartSecondPass,
+                       palettesSPR,
+                       layerOverlayGrid,
+                       layerOverlayFree,
+                       paletteIndicesOverlay);
+    }
+    else
+    {
+        writeCmplDataFile(layer,
+                          gridCellColorLimit,
+                          0,
+                          maxSpritePalettes,
+                          2 * maxSpritesPerScanline,
+                          workPathFilename(secondPassDataFilename));
+        //
+        const double seconds = runCmplProgram(exePathFilename(secondPassProgramInputFilename),
+                                              workPathFilename(secondPassProgramOutputFilename),
+                                              workPathFilename(secondPassSolutionFilename),
+                                              timeOut);
+        CmplSolutionStatistics statistics;
+        if(!parseCmplSolution(workPathFilename(secondPassSolutionFilename),
+                              palettesSPR,
+                              layerOverlayGrid,
+                              layerOverlayFree,
+                              paletteIndicesOverlay,
+                              true,
+                              &statistics))
+        {
+            throw Error("Failed to parse CMPL result (second pass)");
+        }
+        addCmplSolve(statistics, true, seconds);
     }
     setEmptyPaletteIndices(paletteIndicesOverlay, layerOverlayGrid, NumBackgroundPalettes);
-    for(const std::set<uint8_t>& palette : palettesSPR)
+    for(const Colors& palette : palettesSPR)
     {
         palettes.push_back(palette);
     }
@@ -549,6 +1158,36 @@ bool OverlayOptimiser::convertSecondPass(int gridCellColorLimit,
 
 //---------------------------------------------------------------------------------------------------------------------
 
+std::vector<int> OverlayOptimiser::conversionSettings(uint8_t backgroundColor,
+                                                      int gridCellWidth,
+                                                      int gridCellHeight,
+                                                      int _spriteHeight,
+                                                      int gridCellColorLimit,
+                                                      int maxBackgroundPalettes,
+                                                      int maxSpritePalettes,
+                                                      int maxSpritesPerScanline)
+{
+    return {backgroundColor,
+            gridCellWidth,
+            gridCellHeight,
+            _spriteHeight,
+            gridCellColorLimit,
+            maxBackgroundPalettes,
+            maxSpritePalettes,
+            maxSpritesPerScanline};
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayOptimiser::checkTimeOut(int timeOut) const
+{
+    // Cbc_solve can only be stopped by its own time limit, see requestCancel
+    if(mSolverBackend == SolverBackend::CbcLibrary && timeOut <= 0)
+        throw Error("The CBC library solver needs a time limit");
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
 std::string OverlayOptimiser::convert(const Image2D& image,
                                       uint8_t backgroundColor,
                                       int gridCellWidth,
@@ -560,21 +1199,194 @@ std::string OverlayOptimiser::convert(const Image2D& image,
                                       int maxSpritesPerScanline,
                                       int timeOut)
 {
-    // Remove old files
-    std::array<const char*, 6> filenames = {
-        firstPassProgramOutputFilename,
-        firstPassDataFilename,
-        firstPassSolutionFilename,
-        secondPassProgramOutputFilename,
-        secondPassDataFilename,
-        secondPassSolutionFilename
+    checkTimeOut(timeOut);
+    mReport.clear();
+    const auto startTime = std::chrono::steady_clock::now();
+    auto elapsedSeconds = [&]()
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    };
+    ConversionCacheKey cacheKey;
+    if(mConversionCache)
+    {
+        StageTimer timer(mReport, "cache lookup");
+        std::vector<int> settings = {backgroundColor,
+                                     gridCellWidth,
+                                     gridCellHeight,
+                                     _spriteHeight,
+                                     gridCellColorLimit,
+                                     maxBackgroundPalettes,
+                                     maxSpritePalettes,
+                                     maxSpritesPerScanline,
+                                     timeOut,
+                                     static_cast<int>(mSolverBackend),
+                                     mDecompositionBandHeight,
+                                     mRandomSeed};
+        // Options changing the result
+        settings.push_back((mPresolve ? 1 : 0) | (mUseWarmStart ? 2 : 0));
+        for(const Colors& palette : mFixedPalettes)
+        {
+            settings.push_back(static_cast<int>(palette.mask() & 0xFFFFFFFF));
+            settings.push_back(static_cast<int>(palette.mask() >> 32));
+        }
+        cacheKey = ConversionCache::key(image, settings);
+        CachedConversion cachedConversion;
+        if(mConversionCache->find(cacheKey, cachedConversion))
+        {
+            restoreCachedResult(cachedConversion,
+                                image,
+                                gridCellWidth,
+                                gridCellHeight,
+                                conversionSettings(backgroundColor,
+                                                   gridCellWidth,
+                                                   gridCellHeight,
+                                                   _spriteHeight,
+                                                   gridCellColorLimit,
+                                                   maxBackgroundPalettes,
+                                                   maxSpritePalettes,
+                                                   maxSpritesPerScanline),
+                                maxBackgroundPalettes);
+            mReport.finish(elapsedSeconds(), true);
+            return cachedConversion.conversionError;
+        }
+    }
+    std::string conversionError = convertProgressive(image,
+                                                     backgroundColor,
+                                                     gridCellWidth,
+                                                     gridCellHeight,
+                                                     _spriteHeight,
+                                                     gridCellColorLimit,
+                                                     maxBackgroundPalettes,
+                                                     maxSpritePalettes,
+                                                     maxSpritesPerScanline,
+                                                     timeOut);
+    // A cancelled conversion's result depends on when it was cancelled, and an incremental one
+    // keeps cells fixed to the previous image's result, so neither is this image's result
+    if(mConversionCache && !mCancelRequested && !mIncremental)
+    {
+        StageTimer timer(mReport, "cache store");
+        mConversionCache->insert(cacheKey, cachedResult(conversionError));
+    }
+    mReport.finish(elapsedSeconds(), false);
+    return conversionError;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+std::string OverlayOptimiser::convertProgressive(const Image2D& image,
+                                                  uint8_t backgroundColor,
+                                                  int gridCellWidth,
+                                                  int gridCellHeight,
+                                                  int _spriteHeight,
+                                                  int gridCellColorLimit,
+                                                  int maxBackgroundPalettes,
+                                                  int maxSpritePalettes,
+                                                  int maxSpritesPerScanline,
+                                                  int timeOut)
+{
+    auto convertWith = [&](SolverBackend solverBackend, int passTimeOut)
+    {
+        const SolverBackend previousSolverBackend = mSolverBackend;
+        mSolverBackend = solverBackend;
+        try
+        {
+            std::string conversionError = convertOnce(image,
+                                                      backgroundColor,
+                                                      gridCellWidth,
+                                                      gridCellHeight,
+                                                      _spriteHeight,
+                                                      gridCellColorLimit,
+                                                      maxBackgroundPalettes,
+                                                      maxSpritePalettes,
+                                                      maxSpritesPerScanline,
+                                                      passTimeOut);
+            mSolverBackend = previousSolverBackend;
+            return conversionError;
+        }
+        catch(...)
+        {
+            mSolverBackend = previousSolverBackend;
+            throw;
+        }
     };
-    for(const char* filename : filenames)
+    if(!mProgressCallback || mSolverBackend == SolverBackend::Heuristic)
+        return convertWith(mSolverBackend, timeOut);
+    // Heuristic result first, as it only takes milliseconds. Keep the previous conversion's warm start,
+    // as it is usually a better starting point for similar images.
+    const WarmStart warmStartFirstPass = mWarmStartFirstPass;
+    const WarmStart warmStartSecondPass = mWarmStartSecondPass;
+    std::string conversionError = convertWith(SolverBackend::Heuristic, timeOut);
+    mWarmStartFirstPass = warmStartFirstPass;
+    mWarmStartSecondPass = warmStartSecondPass;
+    if(mCancelRequested)
+        return conversionError;
+    mProgressCallback(conversionError);
+    if(mCancelRequested)
+        return conversionError;
+    try
+    {
+        if(mSolverBackend != SolverBackend::CbcLibrary || !mUseWarmStart)
+        {
+            // Without a MIP start each run would start over, so solve once with the full time out
+            return convertWith(mSolverBackend, timeOut);
+        }
+        // Doubling time slices, each warm-started from the previous result, until the solver finishes
+        // within its slice or the time out is used up
+        int elapsed = 0;
+        for(int slice = 1; ; slice *= 2)
+        {
+            const int sliceTimeOut = timeOut > 0 ? std::min(slice, timeOut - elapsed) : slice;
+            conversionError = convertWith(mSolverBackend, sliceTimeOut);
+            elapsed += sliceTimeOut;
+            if(!mTimeLimitReached || (timeOut > 0 && elapsed >= timeOut) || mCancelRequested)
+                return conversionError;
+            mProgressCallback(conversionError);
+            if(mCancelRequested)
+                return conversionError;
+        }
+    }
+    catch(const ProcessCancelled&)
     {
-        remove(workPathFilename(filename).c_str());
+        // Killed solver process never replaced the last published result
+        return conversionError;
     }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+std::string OverlayOptimiser::convertOnce(const Image2D& image,
+                                          uint8_t backgroundColor,
+                                          int gridCellWidth,
+                                          int gridCellHeight,
+                                          int _spriteHeight,
+                                          int gridCellColorLimit,
+                                          int maxBackgroundPalettes,
+                                          int maxSpritePalettes,
+                                          int maxSpritesPerScanline,
+                                          int timeOut)
+{
+    // Keep CMPL's temporary files in a per-conversion directory, so that concurrent conversions sharing
+    // the same work path don't delete / overwrite each other's files. The other backends write no files.
+    std::optional<ScratchDirectory> scratchDirectory;
+    mJobPath.clear();
+    if(mSolverBackend == SolverBackend::CmplProcess)
+    {
+        scratchDirectory.emplace(mWorkPath, "conversion", mKeepWorkFiles);
+        mJobPath = scratchDirectory->path();
+    }
+    mConversionSettings = conversionSettings(backgroundColor,
+                                             gridCellWidth,
+                                             gridCellHeight,
+                                             _spriteHeight,
+                                             gridCellColorLimit,
+                                             maxBackgroundPalettes,
+                                             maxSpritePalettes,
+                                             maxSpritesPerScanline);
+    mHeuristicConstraintsMet = true;
+    mTimeLimitReached = false;
     mBackgroundColor = backgroundColor;
     mSpriteHeight = _spriteHeight;
+    invalidateSprites();
     Image2D imageBackground(image.width(), image.height());
     Image2D imageOverlay(image.width(), image.height());
     Image2D imageOverlayGrid(image.width(), image.height());
@@ -587,22 +1399,23 @@ std::string OverlayOptimiser::convert(const Image2D& image,
     const int OverlayGridCellHeight = _spriteHeight;
     const int OverlayWidth = image.width() / OverlayGridCellWidth;
     const int OverlayHeight = image.height() / OverlayGridCellHeight;
-    // Initialise output data to blank values
-    const Image2D blankImage = Image2D(image.width(), image.height(), mBackgroundColor);
-    mOutputImage = blankImage;
-    mOutputImageBackground = blankImage;
-    mOutputImageOverlay = blankImage;
-    mOutputImageOverlayGrid = blankImage;
-    mOutputImageOverlayFree = blankImage;
-    const GridLayer blankOverlay = GridLayer(mBackgroundColor, OverlayGridCellWidth, OverlayGridCellHeight, OverlayWidth, OverlayHeight);
-    mLayerOverlay = blankOverlay;
-    mLayerOverlayFree = blankOverlay;
-    mPaletteIndicesBackground = Array2D<uint8_t>(layer.width(), layer.height());
-    mPaletteIndicesOverlay = Array2D<uint8_t>(OverlayWidth, OverlayHeight);
+    // Output data is only replaced once a pass has finished, so that a cancelled conversion
+    // leaves the previous result in place
+    auto initialiseBlankOutput = [&]()
+    {
+        // Re-uses the previous conversion's buffers when the sizes match
+        for(Image2D* outputImage : {&mOutputImage, &mOutputImageBackground, &mOutputImageOverlay, &mOutputImageOverlayGrid, &mOutputImageOverlayFree})
+            outputImage->assign(image.width(), image.height(), mBackgroundColor);
+        mLayerOverlay = GridLayer(mBackgroundColor, OverlayGridCellWidth, OverlayGridCellHeight, OverlayWidth, OverlayHeight);
+        mLayerOverlayFree = GridLayer(mBackgroundColor, OverlayGridCellWidth, OverlayGridCellHeight, OverlayWidth, OverlayHeight);
+        mPaletteIndicesBackground.assign(layer.width(), layer.height(), 0);
+        mPaletteIndicesOverlay.assign(OverlayWidth, OverlayHeight, 0);
+        invalidateSprites();
+    };
     // * 4 to always get a visible solution, even if beyond constraints
     int maxRowSize = ((4 * spriteWidth()) / gridCellWidth) * maxSpritesPerScanline;
     // Execute first pass
-    std::vector<std::set<uint8_t>> palettes;
+    std::vector<Colors> palettes;
     bool successPassOne = convertFirstPass(image,
                                            gridCellColorLimit,
                                            maxBackgroundPalettes,
@@ -615,39 +1428,55 @@ std::string OverlayOptimiser::convert(const Image2D& image,
                                            palettes,
                                            paletteIndicesBackground);
     if(!successPassOne)
+    {
+        initialiseBlankOutput();
         return "First pass failed.";
-    // Optimize easily-fixable bad cases that originate from solver getting timed out
-    optimizeUnnecessaryOverlayColors(layerBackground,
-                                     layerOverlay,
-                                     paletteIndicesBackground,
-                                     0,
-                                     palettes);
-    // Merge palettes when possible
-    optimizeUnnecessaryPalettes(paletteIndicesBackground,
-                                0,
-                                palettes,
-                                gridCellColorLimit);
-    fillMissingPaletteGroups(palettes, NumBackgroundPalettes);
-    // Split image into background and overlay
-    moveOverlayColors(image, imageBackground, imageOverlay, layerOverlay, backgroundColor);
-    optimizeContinuity(layerBackground, paletteIndicesBackground, 0, palettes, backgroundColor);
+    }
+    {
+        StageTimer timer(mReport, "repair passes");
+        // Optimize easily-fixable bad cases that originate from solver getting timed out
+        optimizeUnnecessaryOverlayColors(layerBackground,
+                                         layerOverlay,
+                                         paletteIndicesBackground,
+                                         0,
+                                         palettes);
+        // Merge palettes when possible
+        if(mFixedPalettes.empty())
+        {
+            optimizeUnnecessaryPalettes(paletteIndicesBackground,
+                                        0,
+                                        palettes,
+                                        gridCellColorLimit);
+        }
+        fillMissingPaletteGroups(palettes, NumBackgroundPalettes);
+        // Split image into background and overlay
+        moveOverlayColors(image, imageBackground, imageOverlay, layerOverlay, backgroundColor);
+        optimizeContinuity(layerBackground, paletteIndicesBackground, 0, palettes, backgroundColor);
+    }
     assert(consistentLayers(imageBackground, layerBackground, palettes, paletteIndicesBackground, backgroundColor));
+    if(maxBackgroundPalettes > 0)
+        mWarmStartFirstPass = WarmStart{layerBackground, palettes, paletteIndicesBackground, layer, mConversionSettings};
     assert(!image.empty(mBackgroundColor));
     assert(!imageBackground.empty(mBackgroundColor) || maxBackgroundPalettes == 0);
-    mOutputImageBackground = imageBackground;
-    mLayerBackground = layerBackground;
     // if no colors were moved into overlay we are done
     if(imageOverlay.empty(mBackgroundColor) || maxSpritePalettes == 0)
     {
+        initialiseBlankOutput();
+        mOutputImageBackground = std::move(imageBackground);
+        mLayerBackground = std::move(layerBackground);
         mOutputImage = image;
-        mPaletteIndicesBackground = paletteIndicesBackground;
+        mPaletteIndicesBackground = std::move(paletteIndicesBackground);
         for(size_t i = 0; i < NumSpritePalettes; i++)
         {
-            std::set<uint8_t> palette;
+            // Fixed palettes are kept even where unused, so that all images converted with them agree
+            const size_t p = NumBackgroundPalettes + i;
+            Colors palette = p < mFixedPalettes.size() ? mFixedPalettes[p] : Colors();
             palettes.push_back(palette);
         }
-        mPalettes = palettes;
-        if(imageOverlay.empty(mBackgroundColor))
+        mPalettes = std::move(palettes);
+        if(!mHeuristicConstraintsMet)
+            return "Heuristic result does not meet all constraints";
+        else if(imageOverlay.empty(mBackgroundColor))
             return "";
         else
             return "Sprite palettes required.";
@@ -669,37 +1498,49 @@ std::string OverlayOptimiser::convert(const Image2D& image,
                                             paletteIndicesOverlay);
     if(!successPassTwo)
         throw Error("Second pass failed.");
-    // Optimize easily-fixable bad cases that originate from solver getting timed out
-    optimizeUnnecessaryOverlayColors(layerOverlayGrid,
-                                     layerOverlayFree,
-                                     paletteIndicesOverlay,
-                                     NumBackgroundPalettes,
-                                     palettes);
-    // Merge palettes when possible
-    optimizeUnnecessaryPalettes(paletteIndicesOverlay,
-                                NumBackgroundPalettes,
-                                palettes,
-                                gridCellColorLimit);
-    fillMissingPaletteGroups(palettes, NumBackgroundPalettes+NumSpritePalettes);
-    moveOverlayColors(imageOverlay, imageOverlayGrid, imageOverlayFree, layerOverlayFree, backgroundColor);
-    optimizeContinuity(layerOverlayGrid, paletteIndicesOverlay, NumBackgroundPalettes, palettes, backgroundColor);
+    {
+        StageTimer timer(mReport, "repair passes");
+        // Optimize easily-fixable bad cases that originate from solver getting timed out
+        optimizeUnnecessaryOverlayColors(layerOverlayGrid,
+                                         layerOverlayFree,
+                                         paletteIndicesOverlay,
+                                         NumBackgroundPalettes,
+                                         palettes);
+        // Merge palettes when possible
+        if(mFixedPalettes.empty())
+        {
+            optimizeUnnecessaryPalettes(paletteIndicesOverlay,
+                                        NumBackgroundPalettes,
+                                        palettes,
+                                        gridCellColorLimit);
+        }
+        fillMissingPaletteGroups(palettes, NumBackgroundPalettes+NumSpritePalettes);
+        moveOverlayColors(imageOverlay, imageOverlayGrid, imageOverlayFree, layerOverlayFree, backgroundColor);
+        optimizeContinuity(layerOverlayGrid, paletteIndicesOverlay, NumBackgroundPalettes, palettes, backgroundColor);
+    }
     assert(consistentLayers(imageOverlayGrid, layerOverlayGrid, palettes, paletteIndicesOverlay, backgroundColor));
-    // Copy state to persistent members
-    mLayerBackground = layerBackground;
-    mLayerOverlay = layerOverlayGrid;
-    mLayerOverlayFree = layerOverlayFree;
-    mPaletteIndicesBackground = paletteIndicesBackground;
-    mPaletteIndicesOverlay = paletteIndicesOverlay;
+    mWarmStartSecondPass = WarmStart{layerOverlayGrid, palettes, paletteIndicesOverlay, layerOverlay, mConversionSettings};
     assert(!image.empty(mBackgroundColor));
     assert(!imageBackground.empty(mBackgroundColor) || maxBackgroundPalettes == 0);
     assert(!imageOverlay.empty(mBackgroundColor));
+    // Move state to persistent members
+    initialiseBlankOutput();
+    mOutputImageBackground = std::move(imageBackground);
+    mLayerBackground = std::move(layerBackground);
+    mLayerOverlay = std::move(layerOverlayGrid);
+    mLayerOverlayFree = std::move(layerOverlayFree);
+    mPaletteIndicesBackground = std::move(paletteIndicesBackground);
+    mPaletteIndicesOverlay = std::move(paletteIndicesOverlay);
     mOutputImage = image;
-    mOutputImageOverlayGrid = imageOverlayGrid;
-    mOutputImageOverlayFree = imageOverlayFree;
+    mOutputImageOverlayGrid = std::move(imageOverlayGrid);
+    mOutputImageOverlayFree = std::move(imageOverlayFree);
     assert(!mOutputImage.empty(mBackgroundColor));
     assert(!mOutputImageBackground.empty(mBackgroundColor) || maxBackgroundPalettes == 0);
-    mPalettes = palettes;
+    mPalettes = std::move(palettes);
     // Finally, return error if maxSpritesPerScanline boundary not met
+    if(!mHeuristicConstraintsMet)
+        return "Heuristic result does not meet all constraints";
+    StageTimer timer(mReport, "sprite extraction");
     if(getMaxSpritesPerScanline(spritesOverlay()) > maxSpritesPerScanline)
         return "Too many sprites / scanline";
     else
@@ -708,6 +1549,523 @@ std::string OverlayOptimiser::convert(const Image2D& image,
 
 //---------------------------------------------------------------------------------------------------------------------
 
+std::string OverlayOptimiser::convertPortfolio(const Image2D& image,
+                                               const std::vector<PortfolioVariant>& variants,
+                                               int gridCellWidth,
+                                               int gridCellHeight,
+                                               int _spriteHeight,
+                                               int gridCellColorLimit,
+                                               int maxBackgroundPalettes,
+                                               int maxSpritePalettes,
+                                               int maxSpritesPerScanline,
+                                               int timeOut,
+                                               size_t& chosenVariant)
+{
+    if(variants.empty())
+        throw Error("Empty portfolio");
+    checkTimeOut(timeOut);
+    const size_t numVariants = variants.size();
+    std::vector<std::unique_ptr<OverlayOptimiser>> optimisers(numVariants);
+    std::vector<std::string> conversionErrors(numVariants);
+    std::vector<char> converted(numVariants, false);
+    for(size_t i = 0; i < numVariants; i++)
+    {
+        // Each variant converts in its own optimiser, and therefore in its own job directory
+        OverlayOptimiser& optimiser = *(optimisers[i] = std::make_unique<OverlayOptimiser>());
+        copySettings(optimiser);
+        optimiser.setRandomSeed(variants[i].randomSeed);
+        optimiser.mWarmStartFirstPass = mWarmStartFirstPass;
+        optimiser.mWarmStartSecondPass = mWarmStartSecondPass;
+    }
+    std::atomic<size_t> nextVariant(0);
+    std::atomic<int> winner(-1);
+    std::atomic<int> numRunning(0);
+    auto worker = [&]()
+    {
+        for(size_t i = nextVariant++; i < numVariants && winner < 0 && !mCancelRequested; i = nextVariant++)
+        {
+            const PortfolioVariant& variant = variants[i];
+            try
+            {
+                conversionErrors[i] = optimisers[i]->convert(shiftImage(image, variant.shiftX, variant.shiftY),
+                                                             variant.backgroundColor,
+                                                             gridCellWidth,
+                                                             gridCellHeight,
+                                                             _spriteHeight,
+                                                             gridCellColorLimit,
+                                                             maxBackgroundPalettes,
+                                                             maxSpritePalettes,
+                                                             maxSpritesPerScanline,
+                                                             timeOut);
+                converted[i] = true;
+                int noWinner = -1;
+                if(conversionErrors[i].empty() && winner.compare_exchange_strong(noWinner, static_cast<int>(i)))
+                    notifyWorkers();
+            }
+            catch(const std::runtime_error& error)
+            {
+                conversionErrors[i] = error.what();
+            }
+        }
+        numRunning--;
+        notifyWorkers();
+    };
+    const size_t numThreads = std::min<size_t>(numVariants, std::max(1u, std::thread::hardware_concurrency()));
+    numRunning = static_cast<int>(numThreads);
+    std::vector<std::thread> threads;
+    for(size_t i = 0; i < numThreads; i++)
+    {
+        threads.emplace_back(worker);
+    }
+    // Cancel remaining variants as soon as there is a winner, or when this conversion is cancelled
+    waitForWorkers(numRunning, [&]() { return winner >= 0; }, optimisers);
+    for(std::thread& thread : threads)
+    {
+        thread.join();
+    }
+    // Without an error-free result, pick the converted variant closest to the sprites / scanline limit
+    chosenVariant = winner >= 0 ? static_cast<size_t>(winner.load()) : numVariants;
+    int bestSpritesPerScanline = std::numeric_limits<int>::max();
+    for(size_t i = 0; i < numVariants && winner < 0; i++)
+    {
+        if(!converted[i])
+            continue;
+        const int spritesPerScanline = optimisers[i]->getMaxSpritesPerScanline(optimisers[i]->spritesOverlay());
+        if(spritesPerScanline < bestSpritesPerScanline)
+        {
+            bestSpritesPerScanline = spritesPerScanline;
+            chosenVariant = i;
+        }
+    }
+    if(chosenVariant == numVariants)
+    {
+        chosenVariant = 0;
+        if(mCancelRequested)
+            throw ProcessCancelled();
+        auto error = std::find_if(conversionErrors.begin(), conversionErrors.end(), [](const std::string& e) { return !e.empty(); });
+        throw Error(error != conversionErrors.end() ? *error : std::string("No variant converted"));
+    }
+    adoptResult(*optimisers[chosenVariant]);
+    return conversionErrors[chosenVariant];
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+std::vector<std::string> OverlayOptimiser::convertSequence(const std::vector<Image2D>& frames,
+                                                           uint8_t backgroundColor,
+                                                           int gridCellWidth,
+                                                           int gridCellHeight,
+                                                           int _spriteHeight,
+                                                           int gridCellColorLimit,
+                                                           int maxBackgroundPalettes,
+                                                           int maxSpritePalettes,
+                                                           int maxSpritesPerScanline,
+                                                           int timeOut,
+                                                           std::vector<std::unique_ptr<OverlayOptimiser>>& frameOptimisers)
+{
+    if(frames.empty())
+        throw Error("Empty sequence");
+    checkTimeOut(timeOut);
+    const size_t width = frames.front().width();
+    const size_t height = frames.front().height();
+    for(const Image2D& frame : frames)
+    {
+        if(frame.width() != width || frame.height() != height)
+            throw Error("Sequence frames differ in size");
+    }
+    std::vector<Colors> sharedPalettes = mFixedPalettes;
+    if(sharedPalettes.empty())
+    {
+        // Stack each distinct strip of grid cell / sprite rows once, as rows only constrain each other through
+        // the palettes. Frames of an animation usually share most of their strips.
+        const size_t stripHeight = std::max(gridCellHeight, _spriteHeight);
+        std::unordered_map<std::string_view, size_t> stripIndices;
+        std::vector<std::pair<const Image2D*, size_t>> strips;
+        for(const Image2D& frame : frames)
+        {
+            for(size_t y = 0; y < height; y += stripHeight)
+            {
+                const size_t numRows = std::min(stripHeight, height - y);
+                std::string_view strip(reinterpret_cast<const char*>(frame.row(y)), width * numRows);
+                if(std::all_of(strip.begin(), strip.end(), [&](char c) { return static_cast<uint8_t>(c) == backgroundColor; }))
+                    continue;
+                if(stripIndices.emplace(strip, strips.size()).second)
+                    strips.emplace_back(&frame, y);
+            }
+        }
+        if(!strips.empty())
+        {
+            Image2D stackedImage(width, stripHeight * strips.size(), backgroundColor);
+            for(size_t i = 0; i < strips.size(); i++)
+            {
+                const Image2D& frame = *strips[i].first;
+                const size_t y = strips[i].second;
+                for(size_t dy = 0; dy < stripHeight && y + dy < height; dy++)
+                {
+                    std::copy(frame.row(y + dy), frame.row(y + dy) + width, stackedImage.row(stripHeight * i + dy));
+                }
+            }
+            // The stacked image's own constraint violations don't matter, as each frame is checked on its own
+            convert(stackedImage,
+                    backgroundColor,
+                    gridCellWidth,
+                    gridCellHeight,
+                    _spriteHeight,
+                    gridCellColorLimit,
+                    maxBackgroundPalettes,
+                    maxSpritePalettes,
+                    maxSpritesPerScanline,
+                    timeOut);
+            sharedPalettes = mPalettes;
+        }
+        fillMissingPaletteGroups(sharedPalettes, NumBackgroundPalettes + NumSpritePalettes);
+    }
+    if(mCancelRequested)
+        throw ProcessCancelled();
+    const size_t numFrames = frames.size();
+    frameOptimisers.clear();
+    for(size_t i = 0; i < numFrames; i++)
+    {
+        frameOptimisers.push_back(std::make_unique<OverlayOptimiser>());
+        copySettings(*frameOptimisers.back());
+        frameOptimisers.back()->setFixedPalettes(sharedPalettes);
+    }
+    std::vector<std::string> conversionErrors(numFrames);
+    std::vector<std::exception_ptr> errors(numFrames);
+    std::atomic<size_t> nextFrame(0);
+    std::atomic<int> numRunning(0);
+    auto worker = [&]()
+    {
+        for(size_t i = nextFrame++; i < numFrames && !mCancelRequested; i = nextFrame++)
+        {
+            // The solver passes can't convert a frame without any pixels, e.g. a fade to black
+            if(frames[i].empty(backgroundColor))
+            {
+                frameOptimisers[i]->setBlankResult(frames[i], backgroundColor, gridCellWidth, gridCellHeight, _spriteHeight);
+                continue;
+            }
+            try
+            {
+                conversionErrors[i] = frameOptimisers[i]->convert(frames[i],
+                                                                  backgroundColor,
+                                                                  gridCellWidth,
+                                                                  gridCellHeight,
+                                                                  _spriteHeight,
+                                                                  gridCellColorLimit,
+                                                                  maxBackgroundPalettes,
+                                                                  maxSpritePalettes,
+                                                                  maxSpritesPerScanline,
+                                                                  timeOut);
+            }
+            catch(...)
+            {
+                errors[i] = std::current_exception();
+            }
+        }
+        numRunning--;
+        notifyWorkers();
+    };
+    const size_t numThreads = std::min<size_t>(numFrames, std::max(1u, std::thread::hardware_concurrency()));
+    numRunning = static_cast<int>(numThreads);
+    std::vector<std::thread> threads;
+    for(size_t i = 0; i < numThreads; i++)
+    {
+        threads.emplace_back(worker);
+    }
+    // Forward cancellation to the running frames
+    waitForWorkers(numRunning, []() { return false; }, frameOptimisers);
+    for(std::thread& thread : threads)
+    {
+        thread.join();
+    }
+    if(mCancelRequested)
+        throw ProcessCancelled();
+    for(const std::exception_ptr& error : errors)
+    {
+        if(error)
+            std::rethrow_exception(error);
+    }
+    return conversionErrors;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+std::vector<std::string> OverlayOptimiser::convertMap(const Image2D& map,
+                                                      uint8_t backgroundColor,
+                                                      int gridCellWidth,
+                                                      int gridCellHeight,
+                                                      int _spriteHeight,
+                                                      int gridCellColorLimit,
+                                                      int maxBackgroundPalettes,
+                                                      int maxSpritePalettes,
+                                                      int maxSpritesPerScanline,
+                                                      int timeOut,
+                                                      size_t& screensWide,
+                                                      std::vector<std::unique_ptr<OverlayOptimiser>>& screenOptimisers)
+{
+    const std::vector<Image2D> screens = splitIntoScreens(map, backgroundColor, ScreenWidth, ScreenHeight, screensWide);
+    return convertSequence(screens,
+                           backgroundColor,
+                           gridCellWidth,
+                           gridCellHeight,
+                           _spriteHeight,
+                           gridCellColorLimit,
+                           maxBackgroundPalettes,
+                           maxSpritePalettes,
+                           maxSpritesPerScanline,
+                           timeOut,
+                           screenOptimisers);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+std::vector<OverlayOptimiser::PortfolioVariant> OverlayOptimiser::makePortfolio(const Image2D& image,
+                                                                                const std::vector<uint8_t>& backgroundColors,
+                                                                                int gridCellWidth,
+                                                                                int gridCellHeight,
+                                                                                size_t numShifts,
+                                                                                size_t numSeeds)
+{
+    std::vector<PortfolioVariant> variants;
+    for(uint8_t backgroundColor : backgroundColors)
+    {
+        std::vector<std::pair<int, int>> shifts = {{0, 0}};
+        if(numShifts > 0)
+        {
+            shifts = bestShifts(image,
+                                backgroundColor,
+                                gridCellWidth,
+                                gridCellHeight,
+                                0,
+                                gridCellWidth - 1,
+                                0,
+                                gridCellHeight - 1,
+                                numShifts);
+        }
+        for(const std::pair<int, int>& shift : shifts)
+        {
+            for(size_t seed = 0; seed < std::max<size_t>(numSeeds, 1); seed++)
+            {
+                variants.push_back({backgroundColor, shift.first, shift.second, static_cast<int>(seed)});
+            }
+        }
+    }
+    return variants;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayOptimiser::waitForWorkers(const std::atomic<int>& numRunning,
+                                      const std::function<bool()>& stop,
+                                      std::vector<std::unique_ptr<OverlayOptimiser>>& optimisers)
+{
+    std::unique_lock<std::mutex> lock(mWorkersMutex);
+    mWorkersChanged.wait(lock, [&]() { return numRunning == 0 || stop() || mCancelRequested; });
+    if(numRunning == 0)
+        return;
+    for(std::unique_ptr<OverlayOptimiser>& optimiser : optimisers)
+    {
+        if(optimiser)
+            optimiser->requestCancel();
+    }
+    mWorkersChanged.wait(lock, [&]() { return numRunning == 0; });
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayOptimiser::notifyWorkers()
+{
+    // Taking the lock orders this with the waiting thread's check of its condition, so no wake-up is lost
+    {
+        std::lock_guard<std::mutex> lock(mWorkersMutex);
+    }
+    mWorkersChanged.notify_all();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayOptimiser::copySettings(OverlayOptimiser& other) const
+{
+    other.setExecutablePath(mExecutablePath);
+    other.setWorkPath(mWorkPath);
+    other.setKeepWorkFiles(mKeepWorkFiles);
+    other.mSolverBackend = mSolverBackend;
+    other.setUseWarmStart(mUseWarmStart);
+    other.setDecompositionBandHeight(mDecompositionBandHeight);
+    other.setPresolve(mPresolve);
+    other.setRandomSeed(mRandomSeed);
+    other.setFixedPalettes(mFixedPalettes);
+    other.setConversionCache(mConversionCache);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayOptimiser::adoptResult(OverlayOptimiser& other)
+{
+    mHeuristicConstraintsMet = other.mHeuristicConstraintsMet;
+    mTimeLimitReached = other.mTimeLimitReached;
+    mWarmStartFirstPass = std::move(other.mWarmStartFirstPass);
+    mWarmStartSecondPass = std::move(other.mWarmStartSecondPass);
+    mBackgroundColor = other.mBackgroundColor;
+    mSpriteHeight = other.mSpriteHeight;
+    mOutputImage = std::move(other.mOutputImage);
+    mOutputImageBackground = std::move(other.mOutputImageBackground);
+    mOutputImageOverlay = std::move(other.mOutputImageOverlay);
+    mOutputImageOverlayGrid = std::move(other.mOutputImageOverlayGrid);
+    mOutputImageOverlayFree = std::move(other.mOutputImageOverlayFree);
+    mPalettes = std::move(other.mPalettes);
+    mRemappingForward = std::move(other.mRemappingForward);
+    mLayerBackground = std::move(other.mLayerBackground);
+    mLayerOverlay = std::move(other.mLayerOverlay);
+    mLayerOverlayFree = std::move(other.mLayerOverlayFree);
+    mPaletteIndicesBackground = std::move(other.mPaletteIndicesBackground);
+    mPaletteIndicesOverlay = std::move(other.mPaletteIndicesOverlay);
+    mReport = other.mReport;
+    // The other optimiser's sprites were extracted from the adopted result
+    std::unique_ptr<std::vector<Sprite>> sprites;
+    {
+        std::lock_guard<std::mutex> lock(other.mSpritesOverlayMutex);
+        sprites = std::move(other.mSpritesOverlay);
+    }
+    std::lock_guard<std::mutex> lock(mSpritesOverlayMutex);
+    mSpritesOverlay = std::move(sprites);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayOptimiser::copyResult(const OverlayOptimiser& other)
+{
+    mHeuristicConstraintsMet = other.mHeuristicConstraintsMet;
+    mTimeLimitReached = other.mTimeLimitReached;
+    mBackgroundColor = other.mBackgroundColor;
+    mSpriteHeight = other.mSpriteHeight;
+    mOutputImage = other.mOutputImage;
+    mOutputImageBackground = other.mOutputImageBackground;
+    mOutputImageOverlay = other.mOutputImageOverlay;
+    mOutputImageOverlayGrid = other.mOutputImageOverlayGrid;
+    mOutputImageOverlayFree = other.mOutputImageOverlayFree;
+    mPalettes = other.mPalettes;
+    mRemappingForward = other.mRemappingForward;
+    mLayerBackground = other.mLayerBackground;
+    mLayerOverlay = other.mLayerOverlay;
+    mLayerOverlayFree = other.mLayerOverlayFree;
+    mPaletteIndicesBackground = other.mPaletteIndicesBackground;
+    mPaletteIndicesOverlay = other.mPaletteIndicesOverlay;
+    mReport = other.mReport;
+    // Sprites already extracted are copied, otherwise they are extracted from the copy when needed
+    std::unique_ptr<std::vector<Sprite>> sprites;
+    {
+        std::lock_guard<std::mutex> lock(other.mSpritesOverlayMutex);
+        if(other.mSpritesOverlay)
+            sprites = std::make_unique<std::vector<Sprite>>(*other.mSpritesOverlay);
+    }
+    std::lock_guard<std::mutex> lock(mSpritesOverlayMutex);
+    mSpritesOverlay = std::move(sprites);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+CachedConversion OverlayOptimiser::cachedResult(const std::string& conversionError) const
+{
+    CachedConversion conversion;
+    conversion.conversionError = conversionError;
+    conversion.backgroundColor = mBackgroundColor;
+    conversion.spriteHeight = mSpriteHeight;
+    conversion.palettes = mPalettes;
+    conversion.layerBackground = mLayerBackground;
+    conversion.layerOverlay = mLayerOverlay;
+    conversion.layerOverlayFree = mLayerOverlayFree;
+    conversion.paletteIndicesBackground = mPaletteIndicesBackground;
+    conversion.paletteIndicesOverlay = mPaletteIndicesOverlay;
+    conversion.outputImage = mOutputImage;
+    conversion.outputImageBackground = mOutputImageBackground;
+    conversion.outputImageOverlay = mOutputImageOverlay;
+    conversion.outputImageOverlayGrid = mOutputImageOverlayGrid;
+    conversion.outputImageOverlayFree = mOutputImageOverlayFree;
+    return conversion;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayOptimiser::restoreCachedResult(const CachedConversion& conversion,
+                                           const Image2D& image,
+                                           int gridCellWidth,
+                                           int gridCellHeight,
+                                           const std::vector<int>& settings,
+                                           int maxBackgroundPalettes)
+{
+    mConversionSettings = settings;
+    mHeuristicConstraintsMet = true;
+    mTimeLimitReached = false;
+    mBackgroundColor = conversion.backgroundColor;
+    mSpriteHeight = conversion.spriteHeight;
+    mPalettes = conversion.palettes;
+    mLayerBackground = conversion.layerBackground;
+    mLayerOverlay = conversion.layerOverlay;
+    mLayerOverlayFree = conversion.layerOverlayFree;
+    mPaletteIndicesBackground = conversion.paletteIndicesBackground;
+    mPaletteIndicesOverlay = conversion.paletteIndicesOverlay;
+    mOutputImage = conversion.outputImage;
+    mOutputImageBackground = conversion.outputImageBackground;
+    mOutputImageOverlay = conversion.outputImageOverlay;
+    mOutputImageOverlayGrid = conversion.outputImageOverlayGrid;
+    mOutputImageOverlayFree = conversion.outputImageOverlayFree;
+    invalidateSprites();
+    // Same warm starts as convertOnce would have left, so that following conversions of similar images still benefit.
+    // The pass inputs are rebuilt: the image's cells, and the overlay's, which was split into grid and free sprites.
+    if(maxBackgroundPalettes > 0)
+    {
+        GridLayer layer(mBackgroundColor, gridCellWidth, gridCellHeight, image);
+        // The first pass only knew the background palettes
+        const size_t numPalettes = std::min<size_t>(NumBackgroundPalettes, mPalettes.size());
+        std::vector<Colors> palettes(mPalettes.begin(), mPalettes.begin() + numPalettes);
+        mWarmStartFirstPass = WarmStart{mLayerBackground, palettes, mPaletteIndicesBackground, std::move(layer), mConversionSettings};
+    }
+    Image2D imageOverlay = mOutputImageOverlayGrid;
+    for(size_t y = 0; y < imageOverlay.height(); y++)
+    {
+        for(size_t x = 0; x < imageOverlay.width(); x++)
+        {
+            if(imageOverlay(x, y) == mBackgroundColor)
+                imageOverlay(x, y) = mOutputImageOverlayFree(x, y);
+        }
+    }
+    // The second pass only ran with overlay pixels left
+    if(!imageOverlay.empty(mBackgroundColor))
+    {
+        GridLayer layerOverlay(mBackgroundColor, spriteWidth(), spriteHeight(), imageOverlay);
+        mWarmStartSecondPass = WarmStart{mLayerOverlay, mPalettes, mPaletteIndicesOverlay, std::move(layerOverlay), mConversionSettings};
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayOptimiser::setBlankResult(const Image2D& image,
+                                      uint8_t backgroundColor,
+                                      int gridCellWidth,
+                                      int gridCellHeight,
+                                      int _spriteHeight)
+{
+    mHeuristicConstraintsMet = true;
+    mTimeLimitReached = false;
+    mBackgroundColor = backgroundColor;
+    mSpriteHeight = _spriteHeight;
+    mPalettes = mFixedPalettes;
+    fillMissingPaletteGroups(mPalettes, NumBackgroundPalettes + NumSpritePalettes);
+    for(Image2D* outputImage : {&mOutputImage, &mOutputImageBackground, &mOutputImageOverlay, &mOutputImageOverlayGrid, &mOutputImageOverlayFree})
+        outputImage->assign(image.width(), image.height(), mBackgroundColor);
+    const int overlayWidth = image.width() / spriteWidth();
+    const int overlayHeight = image.height() / _spriteHeight;
+    mLayerBackground = GridLayer(mBackgroundColor, gridCellWidth, gridCellHeight, image);
+    mLayerOverlay = GridLayer(mBackgroundColor, spriteWidth(), _spriteHeight, overlayWidth, overlayHeight);
+    mLayerOverlayFree = GridLayer(mBackgroundColor, spriteWidth(), _spriteHeight, overlayWidth, overlayHeight);
+    mPaletteIndicesBackground.assign(mLayerBackground.width(), mLayerBackground.height(), 0);
+    mPaletteIndicesOverlay.assign(overlayWidth, overlayHeight, 0);
+    invalidateSprites();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
 bool OverlayOptimiser::conversionSuccessful() const
 {
     return mConversionSuccessful;
@@ -717,7 +2075,7 @@ bool OverlayOptimiser::conversionSuccessful() const
 
 Image2D OverlayOptimiser::outputImageBackground() const
 {
-    assert(!mOutputImage.empty(mBackgroundColor));
+    assert(mOutputImage.width() > 0 && "No conversion result");
     return remapColors(mOutputImageBackground, mLayerBackground, mPalettes, mPaletteIndicesBackground);
 }
 
@@ -725,7 +2083,7 @@ Image2D OverlayOptimiser::outputImageBackground() const
 
 Image2D OverlayOptimiser::outputImageOverlayGrid() const
 {
-    assert(!mOutputImage.empty(mBackgroundColor));
+    assert(mOutputImage.width() > 0 && "No conversion result");
     return remapColors(mOutputImageOverlayGrid, mLayerOverlay, mPalettes, mPaletteIndicesOverlay);
 }
 
@@ -733,7 +2091,8 @@ Image2D OverlayOptimiser::outputImageOverlayGrid() const
 
 Image2D OverlayOptimiser::outputImageOverlayFree() const
 {
-    auto sprites = spritesOverlayFree();
+    ConversionArena arena;
+    auto sprites = spritesOverlayFree(arena.resource());
     // Write sprites to new image
     Image2D outputImage(mOutputImageOverlayFree.width(), mOutputImageOverlayFree.height());
     for(auto const& s : sprites)
@@ -757,7 +2116,7 @@ Image2D OverlayOptimiser::outputImageOverlayFree() const
 
 Image2D OverlayOptimiser::outputImage() const
 {
-    assert(!mOutputImage.empty(mBackgroundColor));
+    assert(mOutputImage.width() > 0 && "No conversion result");
     Image2D background = outputImageBackground();
     Image2D overlayGrid = outputImageOverlayGrid();
     Image2D overlayFree = outputImageOverlayFree();
@@ -799,46 +2158,37 @@ Image2D OverlayOptimiser::outputImage() const
 
 Image2D OverlayOptimiser::remapColors(const Image2D& image,
                                       const GridLayer& layer,
-                                      const std::vector<std::set<uint8_t>>& palettes,
+                                      const std::vector<Colors>& palettes,
                                       const Array2D<uint8_t>& paletteIndices) const
 {
-    // Create per-cell mapping
-    size_t gridWidth = paletteIndices.width();
-    size_t gridHeight = paletteIndices.height();
-    Array2D<std::unordered_map<uint8_t, uint8_t>> perCellMappingForward(gridWidth, gridHeight);
-    for(size_t y = 0; y < gridHeight; y++)
+    // Create one flat mapping per palette, as cells sharing a palette share its mapping
+    // Colors outside the palette map to 0, which is only valid for the background color
+    std::vector<std::array<uint8_t, Colors::MaxColors>> perPaletteMappingForward(palettes.size());
+    for(size_t p = 0; p < palettes.size(); p++)
     {
-        for(size_t x = 0; x < gridWidth; x++)
+        perPaletteMappingForward[p].fill(0);
+        size_t j = 1;
+        for(uint8_t c : palettes[p])
         {
-            uint8_t paletteIndex = paletteIndices(x, y);
-            size_t j = 1;
-            for(uint8_t c : palettes[paletteIndex])
-            {
-                perCellMappingForward(x, y)[c] = paletteIndex * PaletteGroupSize + j;
-                j++;
-            }
+            perPaletteMappingForward[p][c] = p * PaletteGroupSize + j;
+            j++;
         }
     }
     // Map each pixel
     Image2D rImage(image.width(), image.height());
     for(size_t y = 0; y < image.height(); y++)
     {
+        const size_t cellY = y / layer.cellHeight();
+        const uint8_t* src = image.row(y);
+        uint8_t* dst = rImage.row(y);
         for(size_t x = 0; x < image.width(); x++)
         {
-            size_t cellX = x / layer.cellWidth();
-            size_t cellY = y / layer.cellHeight();
-            const std::unordered_map<uint8_t, uint8_t>& m = perCellMappingForward(cellX, cellY);
-            uint8_t c = image(x, y);
-            if(m.find(c) != m.end())
-            {
-                c = m.at(c);
-                rImage(x, y) = c;
-            }
-            else
-            {
-                assert(c == mBackgroundColor);
-                rImage(x, y) = 0;
-            }
+            const size_t cellX = x / layer.cellWidth();
+            const std::array<uint8_t, Colors::MaxColors>& m = perPaletteMappingForward[paletteIndices(cellX, cellY)];
+            const uint8_t c = src[x];
+            assert(c < Colors::MaxColors);
+            dst[x] = m[c];
+            assert(dst[x] != 0 || c == mBackgroundColor);
         }
     }
     return rImage;
@@ -846,7 +2196,7 @@ Image2D OverlayOptimiser::remapColors(const Image2D& image,
 
 //---------------------------------------------------------------------------------------------------------------------
 
-const std::vector<std::set<uint8_t>> &OverlayOptimiser::palettes() const
+const std::vector<Colors> &OverlayOptimiser::palettes() const
 {
     return mPalettes;
 }
@@ -858,23 +2208,21 @@ Sprite OverlayOptimiser::extractSpriteWithBestPalette(Image2D& overlayImage,
                                                       size_t y,
                                                       size_t width,
                                                       size_t height,
-                                                      bool removePixels) const
+                                                      bool removePixels,
+                                                      std::pmr::memory_resource* resource) const
 {
-    // Try extracting sprites for each palette, and keep track of best one (the one extracting most colors)
-    size_t bestIndex = 0;
+    // Score each palette by the number of the area's colors it would extract, and keep the first best one
+    const Colors colors = regionColors(overlayImage, x, y, width, height, mBackgroundColor);
+    size_t bestIndex = NumBackgroundPalettes;
     size_t bestMaxColors = 0;
     for(size_t i = NumBackgroundPalettes; i < NumBackgroundPalettes + NumSpritePalettes; i++)
     {
-        Sprite s = extractSprite(overlayImage,
-                                 x,
-                                 y,
-                                 width,
-                                 height,
-                                 mPalettes[i],
-                                 mBackgroundColor,
-                                 false);
-        if(s.colors.size() > bestMaxColors)
+        const size_t numColors = (colors & mPalettes[i]).size();
+        if(numColors > bestMaxColors)
+        {
             bestIndex = i;
+            bestMaxColors = numColors;
+        }
     }
     // Do final extraction with (potential) pixel removal
     Sprite s = extractSprite(overlayImage,
@@ -884,19 +2232,20 @@ Sprite OverlayOptimiser::extractSpriteWithBestPalette(Image2D& overlayImage,
                              height,
                              mPalettes[bestIndex],
                              mBackgroundColor,
-                             removePixels);
+                             removePixels,
+                             resource);
     s.p = bestIndex;
     return s;
 }
 
 //---------------------------------------------------------------------------------------------------------------------
 
-std::vector<Sprite> OverlayOptimiser::spritesOverlayGrid() const
+std::vector<Sprite> OverlayOptimiser::spritesOverlayGrid(std::pmr::memory_resource* resource) const
 {
     const GridLayer& layer = mLayerOverlay;
     const Array2D<uint8_t>& paletteIndicesOverlay = mPaletteIndicesOverlay;
     std::vector<Sprite> sprites;
-    Image2D overlayImage = mOutputImageOverlayGrid;
+    const Image2D& overlayImage = mOutputImageOverlayGrid;
     for(size_t y = 0; y < layer.height(); y++)
     {
         for(size_t x = 0; x < layer.width(); x++)
@@ -911,9 +2260,9 @@ std::vector<Sprite> OverlayOptimiser::spritesOverlayGrid() const
                                          spriteHeight(),
                                          mPalettes[p],
                                          mBackgroundColor,
-                                         false);
+                                         resource);
                 s.p = p;
-                sprites.push_back(s);
+                sprites.push_back(std::move(s));
             }
         }
     }
@@ -922,17 +2271,26 @@ std::vector<Sprite> OverlayOptimiser::spritesOverlayGrid() const
 
 //---------------------------------------------------------------------------------------------------------------------
 
-std::vector<Sprite> OverlayOptimiser::spritesOverlayFree() const
+std::vector<Sprite> OverlayOptimiser::spritesOverlayFree(std::pmr::memory_resource* resource) const
 {
     Image2D overlayImage = mOutputImageOverlayFree;
     std::vector<Sprite> sprites;
-    size_t y = 0;
-    while(y < overlayImage.height())
+    // Bands are placed around the grid sprites, which share the same scanlines
+    std::vector<int> gridSpritesPerScanline(overlayImage.height(), 0);
+    for(size_t y = 0; y < mLayerOverlay.height(); y++)
     {
-        // Find first non-empty line
-        while(y < overlayImage.height() && overlayImage.emptyRow(y, mBackgroundColor))
-            y++;
-        // Start extracting sprites from this line
+        for(size_t x = 0; x < mLayerOverlay.width(); x++)
+        {
+            if(mLayerOverlay(x, y).colors.size() == 0)
+                continue;
+            for(size_t i = y * mLayerOverlay.cellHeight(); i < std::min(y * mLayerOverlay.cellHeight() + spriteHeight(), overlayImage.height()); i++)
+                gridSpritesPerScanline[i]++;
+        }
+    }
+    const std::vector<Colors> spritePalettes(mPalettes.begin() + NumBackgroundPalettes, mPalettes.begin() + NumBackgroundPalettes + NumSpritePalettes);
+    for(size_t y : chooseSpriteBands(overlayImage, mBackgroundColor, spriteWidth(), spriteHeight(), spritePalettes, gridSpritesPerScanline))
+    {
+        // Extract sprites from this band
         for(size_t x = 0; x < overlayImage.width();)
         {
             bool columnHasPixels = false;
@@ -947,10 +2305,10 @@ std::vector<Sprite> OverlayOptimiser::spritesOverlayFree() const
             if(columnHasPixels)
             {
                 // Extract pixels into sprite at (x, y)
-                Sprite s = extractSpriteWithBestPalette(overlayImage, x, y, spriteWidth(), spriteHeight(), true);
+                Sprite s = extractSpriteWithBestPalette(overlayImage, x, y, spriteWidth(), spriteHeight(), true, resource);
                 if(s.colors.size() > 0)
                 {
-                    sprites.push_back(s);
+                    sprites.push_back(std::move(s));
                 }
                 else
                 {
@@ -964,30 +2322,50 @@ std::vector<Sprite> OverlayOptimiser::spritesOverlayFree() const
                 x++;
             }
         }
-        // Advance a full sprite height at right end, as all pixels should now have been extracted into sprites
-        y += spriteHeight();
     }
     return sprites;
 }
 
 //---------------------------------------------------------------------------------------------------------------------
 
-std::vector<Sprite> OverlayOptimiser::spritesOverlay() const
+const std::vector<Sprite>& OverlayOptimiser::spritesOverlay() const
 {
-    std::vector<Sprite> sprites = spritesOverlayGrid();
-    std::vector<Sprite> spritesFree = spritesOverlayFree();
-    sprites.insert( sprites.end(), spritesFree.begin(), spritesFree.end() );
-    for(Sprite& s : sprites)
+    std::lock_guard<std::mutex> lock(mSpritesOverlayMutex);
+    if(mSpritesOverlay)
+        return *mSpritesOverlay;
+    // Intermediate sprites live in the arena, and only the final sprites are copied to the heap
+    ConversionArena arena;
+    std::vector<Sprite> sprites = spritesOverlayGrid(arena.resource());
+    std::vector<Sprite> spritesFree = spritesOverlayFree(arena.resource());
+    sprites.insert(sprites.end(), std::make_move_iterator(spritesFree.begin()), std::make_move_iterator(spritesFree.end()));
+    std::vector<Sprite> coveredSprites = coverSpriteRows(sprites, spriteWidth(), spriteHeight(), mBackgroundColor, arena.resource());
+    auto keptSprites = std::make_unique<std::vector<Sprite>>();
+    keptSprites->reserve(coveredSprites.size());
+    for(const Sprite& s : coveredSprites)
     {
-        s.numBlankPixelsLeft = getNumBlankPixelsLeft(s);
-        s.numBlankPixelsRight = getNumBlankPixelsRight(s);
+        keptSprites->push_back(Sprite{s.x,
+                                      s.y,
+                                      s.p,
+                                      s.colors,
+                                      SpritePixels(s.pixels, SpritePixels::allocator_type()),
+                                      getNumBlankPixelsLeft(s),
+                                      getNumBlankPixelsRight(s)});
     }
-    return optimizeHorizontallyAdjacentSprites(sprites);
+    mSpritesOverlay = std::move(keptSprites);
+    return *mSpritesOverlay;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayOptimiser::invalidateSprites()
+{
+    std::lock_guard<std::mutex> lock(mSpritesOverlayMutex);
+    mSpritesOverlay.reset();
 }
 
 //---------------------------------------------------------------------------------------------------------------------
 
-int OverlayOptimiser::getNumBlankPixelsLeft(Sprite sprite) const
+int OverlayOptimiser::getNumBlankPixelsLeft(const Sprite& sprite) const
 {
     assert(sprite.pixels.width() == spriteWidth());
     assert(sprite.pixels.height() == spriteHeight());
@@ -1004,7 +2382,7 @@ int OverlayOptimiser::getNumBlankPixelsLeft(Sprite sprite) const
 
 //---------------------------------------------------------------------------------------------------------------------
 
-int OverlayOptimiser::getNumBlankPixelsRight(Sprite sprite) const
+int OverlayOptimiser::getNumBlankPixelsRight(const Sprite& sprite) const
 {
     assert(sprite.pixels.width() == spriteWidth());
     assert(sprite.pixels.height() == spriteHeight());
@@ -1021,74 +2399,11 @@ int OverlayOptimiser::getNumBlankPixelsRight(Sprite sprite) const
 
 //---------------------------------------------------------------------------------------------------------------------
 
-std::vector<std::vector<Sprite>> OverlayOptimiser::getAdjacentSlices(std::vector<Sprite> sprites) const
-{
-    std::vector<std::vector<Sprite>> slices;
-    while(sprites.size() > 0)
-    {
-        bool sliceFound = false;
-        for(size_t i = 1; i < sprites.size(); i++)
-        {
-            const Sprite& previous = sprites[i-1];
-            if(sprites[i].x != previous.x + spriteWidth() ||
-               sprites[i].y != previous.y ||
-               sprites[i].p != previous.p)
-            {
-                std::vector<Sprite> slice;
-                slice.insert(slice.end(), sprites.begin(), sprites.begin() + i);
-                sprites.erase(sprites.begin(), sprites.begin() + i);
-                slices.push_back(slice);
-                sliceFound = true;
-                break;
-            }
-        }
-        if(!sliceFound)
-        {
-            slices.push_back(sprites);
-            break;
-        }
-    }
-    return slices;
-}
-
-//---------------------------------------------------------------------------------------------------------------------
-
-std::vector<Sprite> OverlayOptimiser::optimizeHorizontallyAdjacentSprites(const std::vector<Sprite>& sprites) const
-{
-    std::vector<std::vector<Sprite>> adjacentSlices = getAdjacentSlices(sprites);
-    std::vector<Sprite> newSprites;
-    for(auto& adjacentSlice : adjacentSlices)
-    {
-        for(size_t firstIndex = 0; firstIndex < adjacentSlice.size(); firstIndex++)
-        {
-            for(size_t lastIndex = firstIndex + 1; lastIndex < adjacentSlice.size(); lastIndex++)
-            {
-                Sprite& leftMostSprite = adjacentSlice[firstIndex];
-                Sprite& rightMostSprite = adjacentSlice[lastIndex];
-                if(leftMostSprite.numBlankPixelsLeft + rightMostSprite.numBlankPixelsRight >= spriteWidth())
-                {
-                    // Move entire range right by number of pixels given by left_padding
-                    for(size_t i = firstIndex; i < lastIndex; i++)
-                    {
-                        adjacentSlice[i].x += leftMostSprite.numBlankPixelsLeft;
-                    }
-                    adjacentSlice.erase(adjacentSlice.begin() + lastIndex);
-                    // Skip past processed sprites
-                    firstIndex = lastIndex;
-                }
-            }
-        }
-        newSprites.insert(newSprites.end(), adjacentSlice.begin(), adjacentSlice.end());
-    }
-    return newSprites;
-}
-
-//---------------------------------------------------------------------------------------------------------------------
-
 int OverlayOptimiser::getMaxSpritesPerScanline(const std::vector<Sprite>& sprites) const
 {
     std::vector<int> numSpritesPerScanline;
-    const Image2D image = outputImage();
+    // Only the output height is needed, so skip composing the output image
+    const Image2D& image = mOutputImage;
     const size_t spriteHeight = mLayerOverlay.cellHeight();
     numSpritesPerScanline.resize(image.height(), 0);
     for(auto const& s : sprites)
@@ -1106,16 +2421,9 @@ int OverlayOptimiser::getMaxSpritesPerScanline(const std::vector<Sprite>& sprite
 
 //---------------------------------------------------------------------------------------------------------------------
 
-uint8_t OverlayOptimiser::indexInPalette(const std::set<uint8_t>& palette, uint8_t color)
+uint8_t OverlayOptimiser::indexInPalette(const Colors& palette, uint8_t color)
 {
-    uint8_t i = 1;
-    for(uint8_t c : palette)
-    {
-        if(c == color)
-            return i;
-        i++;
-    }
-    return 0;
+    return palette.count(color) ? palette.indexOf(color) + 1 : 0;
 }
 
 //---------------------------------------------------------------------------------------------------------------------
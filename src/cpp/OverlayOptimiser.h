@@ -22,11 +22,24 @@
 
 #include <string>
 #include <stdexcept>
+#include <functional>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
 
 #include "ImageUtils.h"
 #include "GridLayer.h"
 #include "Array2D.h"
 #include "Sprite.h"
+#include "ConversionCache.h"
+#include "ConversionReport.h"
+
+class OverlayModel;
+class MilpModel;
+struct MilpSolveOptions;
+struct MilpSolveResult;
+struct CmplSolutionStatistics;
 
 class OverlayOptimiser
 {
@@ -40,10 +53,100 @@ public:
         {}
     };
 
+    enum class SolverBackend
+    {
+        CmplProcess,    // Run the .cmpl models through the CMPL executable
+        CbcLibrary,     // Build the models in memory and solve them in-process with the CBC library
+        Heuristic       // Greedy palette packing in milliseconds, valid or near-valid (see HeuristicSolver.h)
+    };
+
+    //
+    // Solution of one solver pass after the greedy repair passes, used as MIP start for the next conversion
+    //
+    struct WarmStart
+    {
+        GridLayer layerKept;
+        std::vector<Colors> palettes;
+        Array2D<uint8_t> paletteIndices;
+        GridLayer layer;                        // Input of the pass, to find the cells changed since
+        std::vector<int> conversionSettings;    // See incremental conversion
+    };
+
+    //
+    // One configuration raced by convertPortfolio
+    //
+    struct PortfolioVariant
+    {
+        uint8_t backgroundColor;
+        int shiftX;         // Shift applied to the image before conversion (see shiftImage)
+        int shiftY;
+        int randomSeed;     // CBC random seed, 0 = CBC default
+    };
+
+    //
+    // Called on the converting thread with the error string of each intermediate result of a progressive
+    // conversion. The result can be read through the usual accessors until the callback returns.
+    //
+    using ProgressCallback = std::function<void(const std::string& conversionError)>;
+
     OverlayOptimiser();
 
+    void setSolverBackend(SolverBackend solverBackend);
+    SolverBackend solverBackend() const;
+
     void setExecutablePath(const std::string& executablePath);
     void setWorkPath(const std::string& workPath);
+    void setKeepWorkFiles(bool keepWorkFiles);
+
+    // Start the in-process solver from the previous conversion's solution, or else the heuristic solution,
+    // when it is feasible
+    void setUseWarmStart(bool useWarmStart);
+    void clearWarmStart();
+
+    // Split each in-process solver pass into bands of this many grid rows, solved in parallel with the
+    // heuristic's palettes fixed. 0 = solve each pass as a single model.
+    void setDecompositionBandHeight(int bandHeight);
+
+    // Only re-solve the grid cells that changed since the previous conversion with the same settings, with the
+    // palettes and all other cells fixed to the previous result. Falls back to a full solve when that has no
+    // solution, or when no cell changed. In-process solver only.
+    void setIncremental(bool incremental);
+
+    // Presolve in-process solver passes by merging grid cells of equal colors into one weighted class, sharing
+    // a single kept / moved split and palette. Much smaller models on screens with repeated cells, but possibly
+    // a worse result - falls back to the full model when the merged model has no solution.
+    void setPresolve(bool presolve);
+
+    // CBC random seed used by convert(), 0 = CBC default
+    void setRandomSeed(int randomSeed);
+
+    // Convert with these palettes (indexed as palettes()) instead of solving them, so that only each cell's
+    // kept / moved split is solved - exactly with the in-process solver, otherwise by the heuristic.
+    // Palettes are not merged afterwards. Empty = solve palettes as usual.
+    void setFixedPalettes(const std::vector<Colors>& fixedPalettes);
+    const std::vector<Colors>& fixedPalettes() const;
+
+    // With a progress callback set, convert() first publishes the heuristic result and then refines it
+    // with the solver in growing time slices, each starting from the previous result
+    void setProgressCallback(const ProgressCallback& progressCallback);
+
+    // Look up convert() results in the cache first, and store completed (not cancelled) conversions in it.
+    // The cache may be shared with other optimisers, e.g. the variants of convertPortfolio.
+    void setConversionCache(const std::shared_ptr<ConversionCache>& conversionCache);
+
+    // Thread-safe. Kills a running CMPL process, or else stops after the running in-process solver call.
+    // A progressive conversion then returns its last published result, others throw ProcessCancelled on a kill.
+    // The CBC C API has no way to interrupt Cbc_solve, so an in-process CBC solve still runs to its time limit
+    // on its worker thread - which is why the CbcLibrary backend refuses to convert without one.
+    // A cancel stays requested until clearCancel(), so that one arriving before a conversion has started still
+    // stops it: call clearCancel() before starting a conversion that may be cancelled, not from its worker.
+    void requestCancel();
+    void clearCancel();
+    bool cancelRequested() const;
+
+    // Stage times, solver statistics and memory use of the last convert(). convertPortfolio() adopts the chosen
+    // variant's report, and convertSequence() leaves each frame's report in its frame optimiser.
+    const ConversionReport& report() const;
 
     std::string exePathFilename(const std::string& exeFilename) const;
     std::string workPathFilename(const std::string& workFilename) const;
@@ -59,6 +162,75 @@ public:
                         int maxSpritesPerScanline,
                         int timeOut);
 
+    //
+    // Converts all variants in parallel with this optimiser's settings, on at most one thread per core.
+    // The first variant converted without error wins and the others are cancelled. Otherwise the variant
+    // with the fewest sprites / scanline wins once all have finished. The winning result is kept as if
+    // from convert(), and its index returned in chosenVariant.
+    //
+    std::string convertPortfolio(const Image2D& image,
+                                 const std::vector<PortfolioVariant>& variants,
+                                 int gridCellWidth,
+                                 int gridCellHeight,
+                                 int _spriteHeight,
+                                 int gridCellColorLimit,
+                                 int maxBackgroundPalettes,
+                                 int maxSpritePalettes,
+                                 int maxSpritesPerScanline,
+                                 int timeOut,
+                                 size_t& chosenVariant);
+
+    //
+    // Converts the frames of an animation, which must all have the same size, with one shared set of palettes.
+    // Unless fixed palettes are set, the palettes are solved once by converting the distinct rows of all frames
+    // stacked into one image, which stays this optimiser's result. The frames are then converted in parallel
+    // with those palettes fixed, each in its own optimiser returned in frameOptimisers. Frames holding only the
+    // background color get a blank result without sprites. Returns the conversion error of each frame, and throws
+    // if any frame failed to convert. See buildSequenceExportData for exporting the frames with shared CHR.
+    //
+    std::vector<std::string> convertSequence(const std::vector<Image2D>& frames,
+                                             uint8_t backgroundColor,
+                                             int gridCellWidth,
+                                             int gridCellHeight,
+                                             int _spriteHeight,
+                                             int gridCellColorLimit,
+                                             int maxBackgroundPalettes,
+                                             int maxSpritePalettes,
+                                             int maxSpritesPerScanline,
+                                             int timeOut,
+                                             std::vector<std::unique_ptr<OverlayOptimiser>>& frameOptimisers);
+
+    //
+    // Converts a background larger than one screen, such as a scrolling level, as the sequence of its screens in
+    // row-major order (see convertSequence): palettes are shared by the whole map, and the screens are converted
+    // in parallel. The map is extended to whole screens with the background color, and screens left with only the
+    // background color get a blank result. Returns the number of screens per row in screensWide. See
+    // buildMapExportData for exporting the map as streamable columns or rows.
+    //
+    std::vector<std::string> convertMap(const Image2D& map,
+                                        uint8_t backgroundColor,
+                                        int gridCellWidth,
+                                        int gridCellHeight,
+                                        int _spriteHeight,
+                                        int gridCellColorLimit,
+                                        int maxBackgroundPalettes,
+                                        int maxSpritePalettes,
+                                        int maxSpritesPerScanline,
+                                        int timeOut,
+                                        size_t& screensWide,
+                                        std::vector<std::unique_ptr<OverlayOptimiser>>& screenOptimisers);
+
+    //
+    // Every combination of the given background colors, their numShifts best shifts (just the unshifted image
+    // if 0) and numSeeds CBC seeds
+    //
+    static std::vector<PortfolioVariant> makePortfolio(const Image2D& image,
+                                                       const std::vector<uint8_t>& backgroundColors,
+                                                       int gridCellWidth,
+                                                       int gridCellHeight,
+                                                       size_t numShifts,
+                                                       size_t numSeeds);
+
     bool conversionSuccessful() const;
 
     Image2D outputImageBackground() const;
@@ -71,10 +243,10 @@ public:
 
     Image2D remapColors(const Image2D& image,
                         const GridLayer& layer,
-                        const std::vector<std::set<uint8_t>>& palettes,
+                        const std::vector<Colors>& palettes,
                         const Array2D<uint8_t>& paletteIndices) const;
 
-    const std::vector<std::set<uint8_t>>& palettes() const;
+    const std::vector<Colors>& palettes() const;
 
     void setEmptyPaletteIndices(Array2D<uint8_t>& paletteIndices, const GridLayer& layer, uint8_t emptyIndex);
 
@@ -84,48 +256,177 @@ public:
 
     const GridLayer& layerOverlay() const;
 
-    std::vector<Sprite> spritesOverlayGrid() const;
-    std::vector<Sprite> spritesOverlayFree() const;
-    std::vector<Sprite> spritesOverlay() const;
+    // Sprite pixels are allocated from resource, which must outlive the returned sprites
+    std::vector<Sprite> spritesOverlayGrid(std::pmr::memory_resource* resource = std::pmr::get_default_resource()) const;
+    std::vector<Sprite> spritesOverlayFree(std::pmr::memory_resource* resource = std::pmr::get_default_resource()) const;
+    // Extracted once per result and memoised. The reference stays valid until the result changes.
+    const std::vector<Sprite>& spritesOverlay() const;
 
     int getMaxSpritesPerScanline(const std::vector<Sprite>& sprites) const;
 
-    static uint8_t indexInPalette(const std::set<uint8_t>& palette, uint8_t color);
-
-    int getNumBlankPixelsLeft(Sprite sprite) const;
-    int getNumBlankPixelsRight(Sprite sprite) const;
-
-    std::vector<std::vector<Sprite>> getAdjacentSlices(std::vector<Sprite> sprites) const;
+    static uint8_t indexInPalette(const Colors& palette, uint8_t color);
 
-    std::vector<Sprite> optimizeHorizontallyAdjacentSprites(const std::vector<Sprite>& sprites) const;
+    int getNumBlankPixelsLeft(const Sprite& sprite) const;
+    int getNumBlankPixelsRight(const Sprite& sprite) const;
 
     int spriteWidth() const;
     int spriteHeight() const;
 
     uint8_t backgroundColor() const;
 
+    // Copies the current result (not the settings or warm starts), e.g. to show it while this optimiser
+    // goes on converting. Must not run concurrently with a conversion on other.
+    void copyResult(const OverlayOptimiser& other);
+
 protected:
 
+    // Copies the solver settings (not the result) to an optimiser converting on behalf of this one
+    void copySettings(OverlayOptimiser& other) const;
+
+    void adoptResult(OverlayOptimiser& other);
+
+    // Waits until numRunning workers have finished. Cancels all optimisers as soon as stop() returns true
+    // or this optimiser is cancelled. Workers call notifyWorkers() whenever they finish or stop() may have changed.
+    void waitForWorkers(const std::atomic<int>& numRunning,
+                        const std::function<bool()>& stop,
+                        std::vector<std::unique_ptr<OverlayOptimiser>>& optimisers);
+    void notifyWorkers();
+
+    CachedConversion cachedResult(const std::string& conversionError) const;
+    // Restores a cached result of converting image with the given settings, including its warm starts
+    void restoreCachedResult(const CachedConversion& conversion,
+                             const Image2D& image,
+                             int gridCellWidth,
+                             int gridCellHeight,
+                             const std::vector<int>& settings,
+                             int maxBackgroundPalettes);
+
+    // Result of an image holding only the background color, which the solver passes can't convert:
+    // no sprites, background palette 0 and the fixed palettes
+    void setBlankResult(const Image2D& image,
+                        uint8_t backgroundColor,
+                        int gridCellWidth,
+                        int gridCellHeight,
+                        int _spriteHeight);
+
+    // Settings a warm start was solved with, see incremental conversion
+    static std::vector<int> conversionSettings(uint8_t backgroundColor,
+                                               int gridCellWidth,
+                                               int gridCellHeight,
+                                               int _spriteHeight,
+                                               int gridCellColorLimit,
+                                               int maxBackgroundPalettes,
+                                               int maxSpritePalettes,
+                                               int maxSpritesPerScanline);
+
+    // Throws if the solver backend can't run with the given time limit
+    void checkTimeOut(int timeOut) const;
+
+    std::string convertProgressive(const Image2D& image,
+                                   uint8_t backgroundColor,
+                                   int gridCellWidth,
+                                   int gridCellHeight,
+                                   int _spriteHeight,
+                                   int gridCellColorLimit,
+                                   int maxBackgroundPalettes,
+                                   int maxSpritePalettes,
+                                   int maxSpritesPerScanline,
+                                   int timeOut);
+
+    std::string convertOnce(const Image2D& image,
+                            uint8_t backgroundColor,
+                            int gridCellWidth,
+                            int gridCellHeight,
+                            int _spriteHeight,
+                            int gridCellColorLimit,
+                            int maxBackgroundPalettes,
+                            int maxSpritePalettes,
+                            int maxSpritesPerScanline,
+                            int timeOut);
+
     void writeCmplDataFile(const GridLayer& layer, int gridCellColorLimit, int maxBackgroundPalettes, int maxSpritePalettes, int maxRowSize, const std::string& filename);
-    void writeCmplLayerData(std::ofstream& f, const std::string& name, const GridLayer& layer, std::function<int(int, int, int)> const& callback);
+    void writeCmplLayerData(std::string& buffer, const std::string& name, const GridLayer& layer, bool columnCounts);
 
-    void runCmplProgram(const std::string& inputFilename,
-                        const std::string& outputFilename,
-                        const std::string& solutionCsvFilename,
-                        int timeOut);
+    // Returns the seconds spent in the CMPL process
+    double runCmplProgram(const std::string& inputFilename,
+                          const std::string& outputFilename,
+                          const std::string& solutionCsvFilename,
+                          int timeOut);
+
+    void addCmplSolve(const CmplSolutionStatistics& cmplStatistics, bool secondPass, double seconds);
 
-    static void parseSolutionValue(const std::string& line, std::vector<int>& indices, int& value);
+    OverlayModel buildModel(const GridLayer& layer,
+                            int gridCellColorLimit,
+                            int numPalettes,
+                            int maxSpritePalettes,
+                            int maxRowSize,
+                            bool secondPass,
+                            bool mergeEqualCells);
+
+    // solveMilpWithCbc, recording the solve in the report
+    MilpSolveResult solveMilp(const MilpModel& milp, const MilpSolveOptions& options, bool secondPass, const std::string& method);
+
+    void solveInProcess(const GridLayer& layer,
+                        int gridCellColorLimit,
+                        int numPalettes,
+                        int maxSpritePalettes,
+                        int maxRowSize,
+                        int timeOut,
+                        bool secondPass,
+                        const WarmStart& warmStart,
+                        std::vector<Colors>& palettes,
+                        GridLayer& layerKept,
+                        GridLayer& layerMoved,
+                        Array2D<uint8_t>& paletteIndices);
+
+    bool solveInProcessIncremental(const GridLayer& layer,
+                                   int gridCellColorLimit,
+                                   int numPalettes,
+                                   int maxSpritePalettes,
+                                   int maxRowSize,
+                                   int timeOut,
+                                   bool secondPass,
+                                   const WarmStart& warmStart,
+                                   std::vector<Colors>& palettes,
+                                   GridLayer& layerKept,
+                                   GridLayer& layerMoved,
+                                   Array2D<uint8_t>& paletteIndices);
+
+    bool solveInProcessBanded(const GridLayer& layer,
+                              int gridCellColorLimit,
+                              int numPalettes,
+                              int maxSpritePalettes,
+                              int maxRowSize,
+                              int timeOut,
+                              bool secondPass,
+                              std::vector<Colors>& palettes,
+                              GridLayer& layerKept,
+                              GridLayer& layerMoved,
+                              Array2D<uint8_t>& paletteIndices);
+
+    void solveInProcessFixedPalettes(const GridLayer& layer,
+                                     int gridCellColorLimit,
+                                     int numPalettes,
+                                     int maxSpritePalettes,
+                                     int maxRowSize,
+                                     int timeOut,
+                                     bool secondPass,
+                                     std::vector<Colors>& palettes,
+                                     GridLayer& layerKept,
+                                     GridLayer& layerMoved,
+                                     Array2D<uint8_t>& paletteIndices);
 
     bool parseCmplSolution(const std::string& csvFilename,
-                           std::vector<std::set<uint8_t>>& palettes,
+                           std::vector<Colors>& palettes,
                            GridLayer& colorsBackground,
                            GridLayer& colorsOverlay,
                            Array2D<uint8_t>& paletteIndicesBackground,
-                           bool secondPass);
+                           bool secondPass,
+                           CmplSolutionStatistics* statistics);
 
     bool consistentLayers(const Image2D& image,
                           const GridLayer& layer,
-                          const std::vector<std::set<uint8_t>>& palettes,
+                          const std::vector<Colors>& palettes,
                           const Array2D<uint8_t>& paletteIndices,
                           uint8_t backgroundColor);
 
@@ -135,7 +436,7 @@ protected:
                               const GridLayer& layer,
                               GridLayer& layerBackground,
                               GridLayer& layerOverlay,
-                              std::vector<std::set<uint8_t>>& palettesBG,
+                              std::vector<Colors>& palettesBG,
                               Array2D<uint8_t>& paletteIndicesBackground);
 
     bool convertFirstPass(const Image2D& image,
@@ -147,7 +448,7 @@ protected:
                           const GridLayer& layer,
                           GridLayer& layerBackground,
                           GridLayer& layerOverlay,
-                          std::vector<std::set<uint8_t>>& palettesBG,
+                          std::vector<Colors>& palettesBG,
                           Array2D<uint8_t>& paletteIndicesBackground);
 
     bool convertSecondPass(int gridCellColorLimit,
@@ -157,16 +458,39 @@ protected:
                            const GridLayer& layer,
                            GridLayer& layerBackground,
                            GridLayer& layerOverlay,
-                           std::vector<std::set<uint8_t>>& palettes,
+                           std::vector<Colors>& palettes,
                            Array2D<uint8_t>& paletteIndicesBackground);
 
-    void fillMissingPaletteGroups(std::vector<std::set<uint8_t>>& palettes, size_t numPalettes);
+    void fillMissingPaletteGroups(std::vector<Colors>& palettes, size_t numPalettes);
+
+    Sprite extractSpriteWithBestPalette(Image2D& overlayImage, size_t x, size_t y, size_t spriteWidth, size_t spriteHeight, bool removePixels, std::pmr::memory_resource* resource) const;
 
-    Sprite extractSpriteWithBestPalette(Image2D& overlayImage, size_t x, size_t y, size_t spriteWidth, size_t spriteHeight, bool removePixels) const;
+    // Drops the memoised spritesOverlay(), which must be done whenever the result changes
+    void invalidateSprites();
 
 private:
     std::string mExecutablePath;
     std::string mWorkPath;
+    std::string mJobPath;
+    bool mKeepWorkFiles;
+    SolverBackend mSolverBackend;
+    bool mUseWarmStart;
+    int mDecompositionBandHeight;
+    bool mIncremental;
+    bool mPresolve;
+    std::vector<int> mConversionSettings;
+    int mRandomSeed;
+    std::vector<Colors> mFixedPalettes;
+    bool mHeuristicConstraintsMet;
+    bool mTimeLimitReached;
+    ProgressCallback mProgressCallback;
+    std::shared_ptr<ConversionCache> mConversionCache;
+    ConversionReport mReport;
+    std::atomic<bool> mCancelRequested;
+    std::mutex mWorkersMutex;
+    std::condition_variable mWorkersChanged;
+    WarmStart mWarmStartFirstPass;
+    WarmStart mWarmStartSecondPass;
     bool mConversionSuccessful;
     uint8_t mBackgroundColor;
     int mSpriteHeight;
@@ -175,17 +499,22 @@ private:
     Image2D mOutputImageOverlay;
     Image2D mOutputImageOverlayGrid;
     Image2D mOutputImageOverlayFree;
-    std::vector<std::set<uint8_t>> mPalettes;
+    std::vector<Colors> mPalettes;
     std::unordered_map<uint8_t, uint8_t> mRemappingForward;
     GridLayer mLayerBackground;
     GridLayer mLayerOverlay;
     GridLayer mLayerOverlayFree;
     Array2D<uint8_t> mPaletteIndicesBackground;
     Array2D<uint8_t> mPaletteIndicesOverlay;
+    mutable std::mutex mSpritesOverlayMutex;
+    mutable std::unique_ptr<std::vector<Sprite>> mSpritesOverlay;
     const int SpriteWidth = 8;
     const size_t PaletteGroupSize = 4;
     const size_t NumBackgroundPalettes = 4;
     const size_t NumSpritePalettes = 4;
+    // NES screen in pixels, the unit convertMap splits maps into
+    const size_t ScreenWidth = 256;
+    const size_t ScreenHeight = 240;
     const char* firstPassProgramInputFilename = "FirstPass.cmpl";
     const char* firstPassProgramOutputFilename = "FirstPass_withTimeOut.cmpl";
     const char* firstPassSolutionFilename = "firstpass_output.csv";
@@ -25,68 +25,41 @@
 #include <iostream>
 #include <iomanip>
 #include <limits>
+#include <array>
+#include <cstring>
 
 #include "OverlayPalApp.h"
 #include "Export.h"
 #include "GridLayer.h"
 #include "ImageUtils.h"
 #include "OverlayOptimiser.h"
+#include "QImageUtils.h"
+#include "OverlayPalImageProvider.h"
 
 #include "OverlayPalGuiBackend.h"
 
 //---------------------------------------------------------------------------------------------------------------------
 
-Image2D OverlayPalGuiBackend::qImageToImage2D(const QImage& qImage)
-{
-    const int w = qImage.width();
-    const int h = qImage.height();
-    Image2D image(w, h);
-    for(int y = 0; y < h; y++)
-    {
-        for(int x = 0; x < w; x++)
-        {
-            uint8_t c = qImage.pixelIndex(x, y);
-            image(x, y) = c;
-        }
-    }
-    return image;
-}
-
-//---------------------------------------------------------------------------------------------------------------------
-
-QImage OverlayPalGuiBackend::image2DToQImage(const Image2D& image, const QVector<QRgb>& colorTable)
-{
-    const int w = image.width();
-    const int h = image.height();
-    QImage qImage(w, h, QImage::Format_Indexed8);
-    qImage.setColorTable(colorTable);
-    for(int y = 0; y < h; y++)
-    {
-        for(int x = 0; x < w; x++)
-        {
-            uint8_t c = image(x, y);
-            assert(c < colorTable.size());
-            qImage.setPixel(x, y, c);
-        }
-    }
-    return qImage;
-}
-
-//---------------------------------------------------------------------------------------------------------------------
-
 OverlayPalGuiBackend::OverlayPalGuiBackend(QObject *parent):
     QObject(parent),
     mUniqueColors(false),
     mTimeOut(60),
+    mDedupFlippedSprites(false),
     mTrackInputImage(false),
     mShiftX(0),
     mShiftY(0),
     mPreventBlackerThanBlack(true),
     mMapInputColors(true),
     mConversionInProgress(false),
-    mProcessingInputImage(false),
+    mConversionRestartPending(false),
+    mInputFileChangePending(false),
+    mInputImagePending(false),
+    mConversionStartPending(false),
     mHardwarePaletteName("palgen"),
     mOutputImage(ScreenWidth, ScreenHeight, QImage::Format_Indexed8),
+    mInputImageGeneration(0),
+    mOutputImageGeneration(0),
+    mResult(std::make_shared<OverlayOptimiser>()),
     mBackgroundColor(0),
     mAutoBackgroundColor(true),
     mInputImage(ScreenWidth, ScreenHeight, QImage::Format_Indexed8),
@@ -117,6 +90,9 @@ OverlayPalGuiBackend::OverlayPalGuiBackend(QObject *parent):
     // TODO: Investigate root cause of this bug.
     mOverlayOptimiser.setWorkPath(executablePath + "/" + "Cmpl/bin");
 #endif
+    // Converting an image again with the same settings returns the stored result immediately
+    QString cachePath = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/conversions";
+    mOverlayOptimiser.setConversionCache(std::make_shared<ConversionCache>(cachePath.toStdString()));
     loadHardwarePalettes(QString(executablePath.c_str()) + QString("/nespalettes"));
     // Prevent QML engine from taking ownership of and destroying models
     QQmlEngine::setObjectOwnership(&mPaletteModel, QQmlEngine::CppOwnership);
@@ -128,6 +104,9 @@ OverlayPalGuiBackend::OverlayPalGuiBackend(QObject *parent):
 
 OverlayPalGuiBackend::~OverlayPalGuiBackend()
 {
+    // Don't keep refining a conversion nobody will see. The job's results queued for this object are dropped.
+    mOverlayOptimiser.requestCancel();
+    mConversionFuture.waitForFinished();
 }
 
 //---------------------------------------------------------------------------------------------------------------------
@@ -145,6 +124,10 @@ void OverlayPalGuiBackend::setHardwarePaletteName(const QString& hardwarePalette
     if(hardwarePaletteName != mHardwarePaletteName)
     {
         mHardwarePaletteName = hardwarePaletteName;
+        // Show the current result in the new hardware colors until it is converted again
+        if(!mResult->palettes().empty())
+            mOutputImage.setColorTable(makeColorTable());
+        invalidateResultViews();
         quantizeInputImage();
     }
 }
@@ -158,6 +141,7 @@ void OverlayPalGuiBackend::loadHardwarePalette(const QFileInfo& fileInfo)
         return;
     QByteArray palData = palFile.readAll();
     QVariantList hardwarePalette;
+    QVector<QRgb> colorTable;
     for(int i = 0; i < HardwarePaletteSize; i++)
     {
         uint8_t r = palData[3 * i + 0];
@@ -168,10 +152,16 @@ void OverlayPalGuiBackend::loadHardwarePalette(const QFileInfo& fileInfo)
         rgbList.push_back(int(g));
         rgbList.push_back(int(b));
         hardwarePalette.push_back(rgbList);
+        colorTable.append(qRgb(r, g, b));
     }
     mHardwarePalettes[fileInfo.baseName()] = hardwarePalette;
     mHardwarePaletteNames.append(fileInfo.baseName());
     palFile.close();
+    // Build color lookups in the background, so that switching palettes doesn't wait for them
+    QtConcurrent::run([colorTable]()
+    {
+        prepareRemapColorsToNES(colorTable);
+    });
 }
 
 //---------------------------------------------------------------------------------------------------------------------
@@ -199,141 +189,148 @@ void OverlayPalGuiBackend::handleInputFileChanged(const QString& filename)
 {
     if(mTrackInputImage)
     {
-        if(!mProcessingInputImage)
-        {
-            mProcessingInputImage = true;
-            mInputImageFilename = filename;
-            if(mInputImage.load(mInputImageFilename))
-            {
-                assert(mInputImage.width() > 0 && mInputImage.height() > 0);
-                quantizeInputImage();
-            }
-            mProcessingInputImage = false;
-        }
+        mInputImageFilename = filename;
+        mInputImageFilenameToLoad = filename;
+        // Paint-and-check edits usually touch a few cells, so only those need solving again
+        mInputFileChangePending = true;
+        quantizeInputImage();
     }
 }
 
 //---------------------------------------------------------------------------------------------------------------------
 
-QImage OverlayPalGuiBackend::cropOrExtendImage(const QImage& image, uint8_t backgroundColor)
+Q_INVOKABLE QVariant OverlayPalGuiBackend::detectBackgroundColor() const
 {
-    QImage copy(ScreenWidth, ScreenHeight, QImage::Format_Indexed8);
-    copy.setColorTable(image.colorTable());
-    size_t colorTableSize = image.colorTable().size();
-    assert(backgroundColor < colorTableSize);
-    for(int y = 0; y < ScreenHeight; y++)
-    {
-        for(int x = 0; x < ScreenWidth; x++)
-        {
-            if(x < image.width() && y < image.height())
-            {
-                // Use source pixel
-                uint8_t pixelIndex = image.pixelIndex(x, y);
-                copy.setPixel(x, y, pixelIndex);
-            }
-            else
-            {
-                // Out-of-range - use background color
-                copy.setPixel(x, y, backgroundColor);
-            }
-        }
-    }
-    return copy;
+    return QVariant(static_cast<uint>(::detectBackgroundColor(mInputImageIndexed)));
 }
 
 //---------------------------------------------------------------------------------------------------------------------
 
-bool OverlayPalGuiBackend::colorInImage(const QImage& image, uint8_t color) const
+void OverlayPalGuiBackend::quantizeInputImage()
 {
-    for(int y = 0; y < image.height(); y++)
+    InputImageJob job;
+    job.filenameToLoad = mInputImageFilenameToLoad;
+    job.image = mInputImage;
+    job.hardwareColorTable = makeColorTableFromHardwarePalette();
+    job.mapInputColors = mMapInputColors;
+    job.uniqueColors = mUniqueColors;
+    job.preventBlackerThanBlack = mPreventBlackerThanBlack;
+    job.backgroundColor = mBackgroundColor;
+    job.shiftX = mShiftX;
+    job.shiftY = mShiftY;
+    mInputImagePending = true;
+    mInputImageQueue.post([this, job](const LatestJobQueue::IsStale& isStale)
     {
-        for(int x = 0; x < image.width(); x++)
+        ProcessedInputImage result;
+        result.processed = processInputImage(job, isStale, result);
+        if(isStale())
+            return;
+        QMetaObject::invokeMethod(this, [this, isStale, result]()
         {
-            if(image.pixelIndex(x, y) == color)
-            {
-                return true;
-            }
-        }
-    }
-    return false;
+            // Superseded results are never shown
+            if(!isStale())
+                applyInputImage(result);
+        }, Qt::QueuedConnection);
+    });
 }
 
 //---------------------------------------------------------------------------------------------------------------------
 
-uint8_t OverlayPalGuiBackend::detectBackgroundColor(const QImage& image)
+bool OverlayPalGuiBackend::processInputImage(const InputImageJob& job,
+                                             const LatestJobQueue::IsStale& isStale,
+                                             ProcessedInputImage& result)
 {
-    assert(image.width() > 0 && image.height() > 0);
-    std::unordered_map<uint8_t, size_t> colors = colorCounts(qImageToImage2D(image));
-    assert(colors.size() > 0);
-    uint8_t mostCommonColor = 0x3F;
-    size_t mostCommonCount = 0;
-    for (auto& [color, count]: colors)
+    result.image = job.image;
+    if(!job.filenameToLoad.isEmpty())
     {
-        if(count > mostCommonCount)
-        {
-            mostCommonCount = count;
-            mostCommonColor = color;
-        }
+        if(!result.image.load(job.filenameToLoad))
+            return false;
     }
-    return mostCommonColor;
-}
-
-//---------------------------------------------------------------------------------------------------------------------
-
-Q_INVOKABLE QVariant OverlayPalGuiBackend::detectBackgroundColor() const
-{
-    return QVariant(static_cast<uint>(detectBackgroundColor(mInputImageIndexed)));
-}
-
-//---------------------------------------------------------------------------------------------------------------------
-
-void OverlayPalGuiBackend::quantizeInputImage()
-{
-    if(potentialHardwarePaletteIndexedImage() && !mMapInputColors)
+    if(result.image.isNull() || isStale())
+        return false;
+    result.mapInputColors = job.mapInputColors;
+    QImage indexed;
+    if(::potentialHardwarePaletteIndexedImage(result.image, HardwarePaletteSize) && !job.mapInputColors)
     {
         // Input is hardware palette values - just use as-s
-        mInputImageIndexed = mInputImage;
-        mInputImageIndexed.setColorTable(makeColorTableFromHardwarePalette());
+        indexed = result.image;
+        indexed.setColorTable(job.hardwareColorTable);
     }
     else
     {
         // If attempt to not map failed, this must be an RGB image
-        if(!mMapInputColors)
-        {
-            mMapInputColors = true;
-            emit mapInputColorsChanged();
-        }
-        // Input image is either RGB or unrelated indexed-colors - need to quantize
-        // First quantize to 256 colors for simplicity
-        QImage inputImageQuantized = mInputImage.convertToFormat(QImage::Format_Indexed8, Qt::ThresholdDither);
-        // Then remap to NES palette values
-        mInputImageIndexed = remapColorsToNES(inputImageQuantized);
+        result.mapInputColors = true;
+        // Input image is either RGB or unrelated indexed-colors - need to remap to NES palette values
+        indexed = ::remapColorsToNES(result.image, job.hardwareColorTable, job.uniqueColors, job.preventBlackerThanBlack);
     }
-    assert(mInputImageIndexed.width() > 0 && mInputImageIndexed.height() > 0);
-    mInputImageHardwareColorsModel.setHardwarePalette(mHardwarePalettes[mHardwarePaletteName]);
+    assert(indexed.width() > 0 && indexed.height() > 0);
+    if(isStale())
+        return false;
     // Collect hardware palette values from input image
-    std::set<uint8_t> colors;
-    for(int y = 0; y < mInputImageIndexed.height(); y++)
+    std::array<bool, 256> used = {};
+    ConstImage2DView inputView = qImageView(indexed);
+    for(size_t y = 0; y < inputView.height(); y++)
     {
-        for(int x = 0; x < mInputImageIndexed.width(); x++)
-        {
-            uint8_t c = mInputImageIndexed.pixelIndex(x, y);
-            colors.insert(c);
-        }
+        const uint8_t* row = inputView.row(y);
+        for(size_t x = 0; x < inputView.width(); x++)
+            used[row[x]] = true;
+    }
+    for(size_t c = 0; c < used.size(); c++)
+    {
+        if(used[c])
+            result.colors.insert(c);
     }
-    mInputImageHardwareColorsModel.setColors(colors);
     // crop image
-    mInputImageIndexedBeforeShift = cropOrExtendImage(mInputImageIndexed, mBackgroundColor);
+    result.indexedBeforeShift = cropOrExtendImage(indexed, job.backgroundColor, ScreenWidth, ScreenHeight);
     // Shift image by current shift values
-    mInputImageIndexed = shiftQImage(mInputImageIndexedBeforeShift);
+    Image2D shiftedImage = shiftImage(qImageToImage2D(result.indexedBeforeShift), job.shiftX, job.shiftY);
+    result.indexed = image2DToQImage(shiftedImage, result.indexedBeforeShift.colorTable());
+    result.shownColors = {};
+    for(size_t y = 0; y < shiftedImage.height(); y++)
+    {
+        for(size_t x = 0; x < shiftedImage.width(); x++)
+            result.shownColors[shiftedImage(x, y)] = true;
+    }
+    result.detectedBackgroundColor = ::detectBackgroundColor(result.indexed);
+    return !isStale();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayPalGuiBackend::applyInputImage(const ProcessedInputImage& result)
+{
+    mInputImagePending = false;
+    const bool startConversion = mConversionStartPending;
+    mConversionStartPending = false;
+    // E.g. a tracked file caught while being written - keep the previous image until it changes again
+    mInputImageFilenameToLoad.clear();
+    if(!result.processed)
+    {
+        if(startConversion && !mConversionInProgress)
+            startImageConversion();
+        return;
+    }
+    mInputImage = result.image;
+    if(result.mapInputColors != mMapInputColors)
+    {
+        mMapInputColors = result.mapInputColors;
+        emit mapInputColorsChanged();
+    }
+    mInputImageHardwareColorsModel.setHardwarePalette(mHardwarePalettes[mHardwarePaletteName]);
+    mInputImageHardwareColorsModel.setColors(result.colors);
+    mInputImageIndexedBeforeShift = result.indexedBeforeShift;
+    mInputImageIndexed = result.indexed;
+    invalidateInputImageViews();
     emit inputImageChanged();
     // Make sure backgroundColorChanged is set and emitted once more after inputImageChanged
-    bool backgroundColorInImage = colorInImage(mInputImageIndexed, mBackgroundColor);
-    if(mAutoBackgroundColor || !backgroundColorInImage)
+    if(mAutoBackgroundColor || !result.shownColors[mBackgroundColor])
     {
-        mBackgroundColor = detectBackgroundColor(mInputImageIndexed);
+        mBackgroundColor = result.detectedBackgroundColor;
         emit backgroundColorChanged();
     }
+    // Unless inputImageChanged already started it
+    if(startConversion && !mConversionInProgress)
+        startImageConversion();
 }
 
 //---------------------------------------------------------------------------------------------------------------------
@@ -357,7 +354,7 @@ void OverlayPalGuiBackend::setInputImageFilename(const QString& inputImageFilena
         mInputFileWatcher.addPath(inputImageFilename);
     }
     mInputImageFilename = inputImageFilename;
-    mInputImage = QImage(mInputImageFilename);
+    mInputImageFilenameToLoad = inputImageFilename;
     quantizeInputImage();
 }
 
@@ -390,23 +387,7 @@ void OverlayPalGuiBackend::setTrackInputImage(bool trackInputImage)
 
 bool OverlayPalGuiBackend::potentialHardwarePaletteIndexedImage() const
 {
-    // Image must be indexed
-    if(mInputImage.format() != QImage::Format_Indexed8)
-        return false;
-    // ...and have no color indices above the hardware palette size
-    int w = mInputImage.width();
-    int h = mInputImage.height();
-    for(int y = 0; y < h; y++)
-    {
-        for(int x = 0; x < w; x++)
-        {
-            if(mInputImage.pixelIndex(x, y) >= HardwarePaletteSize)
-            {
-                return false;
-            }
-        }
-    }
-    return true;
+    return ::potentialHardwarePaletteIndexedImage(mInputImage, HardwarePaletteSize);
 }
 
 //---------------------------------------------------------------------------------------------------------------------
@@ -601,6 +582,27 @@ void OverlayPalGuiBackend::setTimeOut(int timeOut)
 
 //---------------------------------------------------------------------------------------------------------------------
 
+int OverlayPalGuiBackend::minTimeOut() const
+{
+    return mOverlayOptimiser.solverBackend() == OverlayOptimiser::SolverBackend::CbcLibrary ? 1 : 0;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool OverlayPalGuiBackend::dedupFlippedSprites() const
+{
+    return mDedupFlippedSprites;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayPalGuiBackend::setDedupFlippedSprites(bool dedupFlippedSprites)
+{
+    mDedupFlippedSprites = dedupFlippedSprites;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
 bool OverlayPalGuiBackend::conversionSuccessful() const
 {
     return mConversionError.size() == 0;
@@ -615,6 +617,20 @@ const QString &OverlayPalGuiBackend::conversionError() const
 
 //---------------------------------------------------------------------------------------------------------------------
 
+QString OverlayPalGuiBackend::conversionReport() const
+{
+    return QString::fromStdString(mResult->report().toText());
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool OverlayPalGuiBackend::conversionInProgress() const
+{
+    return mConversionInProgress;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
 void OverlayPalGuiBackend::findOptimalShift()
 {
     Image2D image = qImageToImage2D(mInputImageIndexedBeforeShift);
@@ -644,82 +660,212 @@ QImage OverlayPalGuiBackend::shiftQImage(const QImage& qImage) const
 
 void OverlayPalGuiBackend::startImageConversion()
 {
-    // Prevent re-attempted conversion if multiple signals are emitted
+    // Changed settings supersede a running conversion - cancel it and start over once it has stopped
     if(mConversionInProgress)
+    {
+        mConversionRestartPending = true;
+        mOverlayOptimiser.requestCancel();
         return;
+    }
+    // Convert the image being processed, not the one it replaces
+    if(mInputImagePending)
+    {
+        mConversionStartPending = true;
+        return;
+    }
     mConversionInProgress = true;
+    // Cleared here rather than in the worker, so that a restart or Accept from now on is never lost
+    mOverlayOptimiser.clearCancel();
     mImagePendingConversion = qImageToImage2D(mInputImageIndexed);
+    mOverlayOptimiser.setIncremental(mInputFileChangePending);
+    mInputFileChangePending = false;
+
+    // Intermediate results are shown while the solver refines them
+    mOverlayOptimiser.setProgressCallback([this](const std::string& conversionError)
+    {
+        // A cancelled conversion's result is superseded or about to be final
+        if(mOverlayOptimiser.cancelRequested())
+            return;
+        // Copied here, as the next solver run overwrites the result while the GUI thread shows it. Queued rather
+        // than blocking, so that the destructor can wait for this job, and still shown in order.
+        std::shared_ptr<const OverlayOptimiser> result = snapshotResult();
+        QMetaObject::invokeMethod(this, [this, result, conversionError]()
+        {
+            if(mConversionRestartPending)
+                return;
+            showResult(result, conversionError);
+            emit outputImageChanged();
+        }, Qt::QueuedConnection);
+    });
 
     // Start conversion in separate thread
-    QFuture<void> future = QtConcurrent::run([=]()
+    mConversionFuture = QtConcurrent::run([=]()
     {
+        std::shared_ptr<const OverlayOptimiser> result;
+        std::string conversionError;
+        bool failed = false;
         try {
-            std::string conversionError = mOverlayOptimiser.convert(mImagePendingConversion,
-                                                                    mBackgroundColor,
-                                                                    mGridCellWidth,
-                                                                    mGridCellHeight,
-                                                                    mSpriteHeight,
-                                                                    GridCellColorLimit,
-                                                                    mMaxBackgroundPalettes,
-                                                                    mMaxSpritePalettes,
-                                                                    mMaxSpritesPerScanline,
-                                                                    mTimeOut);
+            conversionError = mOverlayOptimiser.convert(mImagePendingConversion,
+                                                        mBackgroundColor,
+                                                        mGridCellWidth,
+                                                        mGridCellHeight,
+                                                        mSpriteHeight,
+                                                        GridCellColorLimit,
+                                                        mMaxBackgroundPalettes,
+                                                        mMaxSpritePalettes,
+                                                        mMaxSpritesPerScanline,
+                                                        mTimeOut);
             // successful
-            QVector<QRgb> colorTable = makeColorTable();
-            Image2D remappedImage = mOverlayOptimiser.outputImage();
-            mOutputImage = image2DToQImage(remappedImage, colorTable);
-            //
-            const std::vector<std::set<uint8_t>>& palettes = mOverlayOptimiser.palettes();
-            mPaletteModel.setPalette(palettes, mBackgroundColor);
-            mConversionError = QString(conversionError.c_str());
-            emit outputImageChanged();
+            result = snapshotResult();
         }
         catch (const std::runtime_error& error)
         {
-            mConversionError = error.what();
-            // Make dummy image
-            QVector<QRgb> colorTable;
-            colorTable.append(0x00000000);
-            mOutputImage.fill(0);
-            mOutputImage.setColorTable(colorTable);
-            mOutputImageOverlay.fill(0);
-            mOutputImageOverlay.setColorTable(colorTable);
-            emit outputImageChanged();
+            conversionError = error.what();
+            failed = true;
         }
-        mConversionInProgress = false;
+        // The result is shown on the GUI thread, where QML reads it
+        QMetaObject::invokeMethod(this, [this, result, conversionError, failed]()
+        {
+            finishImageConversion(result, conversionError, failed);
+        }, Qt::QueuedConnection);
     });
 }
 
 //---------------------------------------------------------------------------------------------------------------------
 
-QVector<QRgb> OverlayPalGuiBackend::makeColorTable() const
+void OverlayPalGuiBackend::finishImageConversion(const std::shared_ptr<const OverlayOptimiser>& result,
+                                                 const std::string& conversionError,
+                                                 bool failed)
 {
-    const auto& rgbPalette = mHardwarePalettes[hardwarePaletteName()];
-    const std::vector<std::set<uint8_t>>& palettes = mOverlayOptimiser.palettes();
-    QVector<QRgb> colorTable;
-    for(size_t i = 0; i < palettes.size(); i++)
+    mConversionInProgress = false;
+    // Superseded result is never shown, so that Export can't write it either
+    if(mConversionRestartPending.exchange(false))
     {
-        // Background color
-        uint8_t c = mBackgroundColor;
-        QVariantList rgb = rgbPalette[c].toList();
-        colorTable.append(qRgb(rgb[0].toInt(), rgb[1].toInt(), rgb[2].toInt()));
-        size_t j = 1;
-        for(uint8_t c : palettes[i])
-        {
-            // Non-background color
-            assert(c <= 0x3F && "NES palette value must be 0x00 - 0x3F");
-            QVariantList rgb = rgbPalette[c].toList();
-            colorTable.append(qRgb(rgb[0].toInt(), rgb[1].toInt(), rgb[2].toInt()));
-            j++;
-        }
-        // Fill unused entries
-        while(j != PaletteGroupSize)
-        {
-            colorTable.append(0);
-            j++;
-        }
+        startImageConversion();
+        return;
     }
-    return colorTable;
+    if(failed)
+    {
+        mConversionError = QString::fromStdString(conversionError);
+        // Make dummy image
+        QVector<QRgb> colorTable;
+        colorTable.append(0x00000000);
+        mOutputImage.fill(0);
+        mOutputImage.setColorTable(colorTable);
+        mOutputImageOverlay.fill(0);
+        mOutputImageOverlay.setColorTable(colorTable);
+        invalidateResultViews();
+    }
+    else
+    {
+        showResult(result, conversionError);
+    }
+    emit outputImageChanged();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayPalGuiBackend::acceptConversion()
+{
+    mOverlayOptimiser.requestCancel();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+std::shared_ptr<const OverlayOptimiser> OverlayPalGuiBackend::snapshotResult() const
+{
+    auto result = std::make_shared<OverlayOptimiser>();
+    result->copyResult(mOverlayOptimiser);
+    return result;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayPalGuiBackend::showResult(const std::shared_ptr<const OverlayOptimiser>& result, const std::string& conversionError)
+{
+    mResult = result;
+    updateOutputImage(conversionError);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayPalGuiBackend::updateOutputImage(const std::string& conversionError)
+{
+    QVector<QRgb> colorTable = makeColorTable();
+    Image2D remappedImage = mResult->outputImage();
+    mOutputImage = image2DToQImage(remappedImage, colorTable);
+    //
+    const std::vector<Colors>& palettes = mResult->palettes();
+    mPaletteModel.setPalette(palettes, mBackgroundColor);
+    mConversionError = QString(conversionError.c_str());
+    invalidateResultViews();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+const OverlayPalGuiBackend::ResultViews& OverlayPalGuiBackend::resultViews() const
+{
+    if(!mResultViews.valid)
+    {
+        const GridLayer& layer = mResult->layerBackground();
+        const Array2D<uint8_t>& paletteIndices = mResult->debugPaletteIndicesBackground();
+        mResultViews.paletteIndicesBackground = debugPaletteIndices(paletteIndices);
+        mResultViews.numSourceColorsBackground = debugNumSourceColors(layer);
+        mResultViews.sourceColorsBackground = debugColors(layer, paletteIndices, false);
+        mResultViews.destinationColorsBackground = debugColors(layer, paletteIndices, true);
+        mResultViews.spritesOverlay = debugSpritesOverlayFromOptimiser();
+        ExportDataNES exportData = buildExportData(*mResult, 0xFF);
+        mResultViews.numBackgroundTiles = exportData.bgCHR.size() / ExportDataNES::TileSize;
+        mResultViews.valid = true;
+    }
+    return mResultViews;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayPalGuiBackend::invalidateResultViews()
+{
+    mResultViews = ResultViews();
+    if(OverlayPalImageProvider* provider = imageProvider())
+        provider->removeImages(QString("output/%1/").arg(mOutputImageGeneration));
+    mOutputImageGeneration++;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayPalGuiBackend::invalidateInputImageViews()
+{
+    if(OverlayPalImageProvider* provider = imageProvider())
+        provider->removeImages(QString("input/%1").arg(mInputImageGeneration));
+    mInputImageGeneration++;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+OverlayPalImageProvider* OverlayPalGuiBackend::imageProvider() const
+{
+    // Registered with the engine in main()
+    QQmlEngine* engine = qmlEngine(this);
+    return engine ? dynamic_cast<OverlayPalImageProvider*>(engine->imageProvider(OverlayPalImageProvider::Id)) : nullptr;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+QString OverlayPalGuiBackend::imageUrl(const QString& id, const std::function<QImage()>& render) const
+{
+    OverlayPalImageProvider* provider = imageProvider();
+    if(!provider)
+        return imageAsBase64(render());
+    if(!provider->contains(id))
+        provider->setImage(id, render());
+    return OverlayPalImageProvider::url(id);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+QVector<QRgb> OverlayPalGuiBackend::makeColorTable() const
+{
+    return makeOutputColorTable(mResult->palettes(), mBackgroundColor, makeColorTableFromHardwarePalette());
 }
 
 //---------------------------------------------------------------------------------------------------------------------
@@ -727,7 +873,7 @@ QVector<QRgb> OverlayPalGuiBackend::makeColorTable() const
 QVector<QRgb> OverlayPalGuiBackend::makeColorTableFromHardwarePalette() const
 {
     const QVariantList& rgbPalette = mHardwarePalettes[hardwarePaletteName()];
-    const std::vector<std::set<uint8_t>>& palettes = mOverlayOptimiser.palettes();
+    const std::vector<Colors>& palettes = mResult->palettes();
     QVector<QRgb> colorTable;
     for(size_t i = 0; i < HardwarePaletteSize; i++)
     {
@@ -753,22 +899,18 @@ QImage OverlayPalGuiBackend::outputImage(int paletteMask) const
     const int h = mOutputImage.height();
     QImage maskedImage(w, h, QImage::Format_Indexed8);
     maskedImage.setColorTable(mOutputImage.colorTable());
+    // Test each index against mask once
+    std::array<uint8_t, 256> maskedIndex;
+    for(size_t i = 0; i < maskedIndex.size(); i++)
+        maskedIndex[i] = ((1 << (i / PaletteGroupSize)) & paletteMask) ? i : 0;
+    ConstImage2DView src = qImageView(mOutputImage);
+    Image2DView dst = mutableQImageView(maskedImage);
     for(int y = 0; y < h; y++)
     {
+        const uint8_t* srcRow = src.row(y);
+        uint8_t* dstRow = dst.row(y);
         for(int x = 0; x < w; x++)
-        {
-            int pixelIndex = mOutputImage.pixelIndex(x, y);
-            // Test against mask
-            int palIndex = pixelIndex / PaletteGroupSize;
-            if((1 << palIndex) & paletteMask)
-            {
-                maskedImage.setPixel(x, y, pixelIndex);
-            }
-            else
-            {
-                maskedImage.setPixel(x, y, 0);
-            }
-        }
+            dstRow[x] = maskedIndex[srcRow[x]];
     }
     return maskedImage;
 }
@@ -781,29 +923,25 @@ QImage OverlayPalGuiBackend::outputImageRGBA(int paletteMask, bool transparentBG
     const int w = img.width();
     const int h = img.height();
     QImage imgRGBA(w, h, QImage::Format_RGBA8888);
+    // RGBA bytes of each index
+    const QVector<QRgb> colorTable = img.colorTable();
+    std::array<std::array<uchar, 4>, 256> rgba = {};
+    for(int i = 0; i < colorTable.size(); i++)
+    {
+        const QRgb c = colorTable[i];
+        if(i % PaletteGroupSize == 0 && !transparentBG0)
+            rgba[i] = {uchar(qRed(c)), uchar(qGreen(c)), uchar(qBlue(c)), 255};
+        else if(i % PaletteGroupSize != 0)
+            rgba[i] = {uchar(qRed(c)), uchar(qGreen(c)), uchar(qBlue(c)), uchar(qAlpha(c))};
+        // else transparency
+    }
+    ConstImage2DView src = qImageView(img);
     for(int y = 0; y < h; y++)
     {
+        const uint8_t* srcRow = src.row(y);
+        uchar* dstRow = imgRGBA.scanLine(y);
         for(int x = 0; x < w; x++)
-        {
-            int pixelIndex = img.pixelIndex(x, y);
-            // Test against mask
-            if((pixelIndex % PaletteGroupSize == 0) && !transparentBG0)
-            {
-                QColor c = img.pixelColor(x, y);
-                c.setAlpha(255);
-                imgRGBA.setPixelColor(x, y, c);
-            }
-            else if(pixelIndex % PaletteGroupSize != 0)
-            {
-                // Indexed -> RGBA
-                imgRGBA.setPixelColor(x, y, img.pixelColor(x, y));
-            }
-            else
-            {
-                // transparency
-                imgRGBA.setPixelColor(x, y, QColor(0, 0, 0, 0));
-            }
-        }
+            std::copy(rgba[srcRow[x]].begin(), rgba[srcRow[x]].end(), dstRow + 4 * x);
     }
     return imgRGBA;
 }
@@ -838,94 +976,38 @@ QString OverlayPalGuiBackend::outputImageDataRGBA(int paletteMask, bool transpar
 
 //---------------------------------------------------------------------------------------------------------------------
 
-QObject *OverlayPalGuiBackend::paletteModel()
+QString OverlayPalGuiBackend::inputImageUrl() const
 {
-    return &mPaletteModel;
+    return imageUrl(QString("input/%1").arg(mInputImageGeneration), [this]() { return mInputImageIndexed; });
 }
 
 //---------------------------------------------------------------------------------------------------------------------
 
-QObject *OverlayPalGuiBackend::hardwarePaletteNamesModel()
+QString OverlayPalGuiBackend::outputImageUrlRGBA(int paletteMask, bool transparentBG0) const
 {
-    return &mHardwarePaletteNamesModel;
+    const QString id = QString("output/%1/%2/%3").arg(mOutputImageGeneration).arg(paletteMask).arg(int(transparentBG0));
+    return imageUrl(id, [=]() { return outputImageRGBA(paletteMask, transparentBG0); });
 }
 
 //---------------------------------------------------------------------------------------------------------------------
 
-uint8_t OverlayPalGuiBackend::findClosestColorIndex(const QVector<QRgb>& colorTable, QRgb rgb, std::vector<bool>& availableColors) const
+QObject *OverlayPalGuiBackend::paletteModel()
 {
-    QColor color(rgb);
-    color.setAlpha(0);
-    double bestDistance2 = std::numeric_limits<double>::max();
-    size_t bestIndex = 0;
-    for(size_t i = 0; i < colorTable.size(); i++)
-    {
-        QColor c(colorTable[i]);
-        c.setAlpha(0);
-        qreal dr = (color.redF() - c.redF());
-        qreal dg = (color.greenF() - c.greenF());
-        qreal db = (color.blueF() - c.blueF());
-        double distance2 = dr * dr + dg * dg + db * db;
-        if(distance2 < bestDistance2 && availableColors[i])
-        {
-            bestDistance2 = distance2;
-            bestIndex = i;
-        }
-    }
-    if(mUniqueColors)
-        availableColors[bestIndex] = false;
-    return static_cast<uint8_t>(bestIndex);
+    return &mPaletteModel;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+QObject *OverlayPalGuiBackend::hardwarePaletteNamesModel()
+{
+    return &mHardwarePaletteNamesModel;
 }
 
 //---------------------------------------------------------------------------------------------------------------------
 
 QImage OverlayPalGuiBackend::remapColorsToNES(const QImage& inputImage) const
 {
-    // Find all colors in image
-    std::set<QRgb> colorsInImage;
-    for(int y = 0; y < inputImage.height(); y++)
-    {
-        for(int x = 0; x < inputImage.width(); x++)
-        {
-            QRgb rgbColor = inputImage.pixel(x, y);
-            colorsInImage.insert(rgbColor);
-        }
-    }
-    // Remap every RGB color to color in chosen hardware palette
-    QVector<QRgb> hwColorTable = makeColorTableFromHardwarePalette();
-    std::unordered_map<QRgb, uint8_t> remapping;
-    std::vector<bool> availableColors;
-    availableColors.resize(HardwarePaletteSize, true);
-    availableColors[0x0E] = false;
-    availableColors[0x1E] = false;
-    availableColors[0x2E] = false;
-    availableColors[0x3E] = false;
-    availableColors[0x0F] = false;
-    availableColors[0x1F] = false;
-    availableColors[0x2F] = false;
-    availableColors[0x3F] = false;
-    if(mPreventBlackerThanBlack)
-        availableColors[0x0D] = false;
-    for(QRgb rgbColor : colorsInImage)
-    {
-        if(!colorsInImage.count(rgbColor) > 0)
-            continue;
-        uint8_t c = findClosestColorIndex(hwColorTable, rgbColor, availableColors);
-        remapping[rgbColor] = c;
-    }
-    QImage outputImage(inputImage.width(), inputImage.height(), QImage::Format_Indexed8);
-    outputImage.setColorTable(hwColorTable);
-    // Remap  image
-    for(int y = 0; y < inputImage.height(); y++)
-    {
-        for(int x = 0; x < inputImage.width(); x++)
-        {
-            QRgb rgbColor = inputImage.pixel(x, y);
-            uint8_t c = remapping[rgbColor];
-            outputImage.setPixel(x, y, c);
-        }
-    }
-    return outputImage;
+    return ::remapColorsToNES(inputImage, makeColorTableFromHardwarePalette(), mUniqueColors, mPreventBlackerThanBlack);
 }
 
 //---------------------------------------------------------------------------------------------------------------------
@@ -1041,32 +1123,28 @@ QVariantList OverlayPalGuiBackend::debugColors(const GridLayer& layer,
 
 QVariantList OverlayPalGuiBackend::debugPaletteIndicesBackground() const
 {
-    const Array2D<uint8_t>& paletteIndices = mOverlayOptimiser.debugPaletteIndicesBackground();
-    return debugPaletteIndices(paletteIndices);
+    return resultViews().paletteIndicesBackground;
 }
 
 //---------------------------------------------------------------------------------------------------------------------
 
 QVariantList OverlayPalGuiBackend::debugNumSourceColorsBackground() const
 {
-    const GridLayer& layer = mOverlayOptimiser.layerBackground();
-    return debugNumSourceColors(layer);
+    return resultViews().numSourceColorsBackground;
 }
 
 //---------------------------------------------------------------------------------------------------------------------
 
 QVariantList OverlayPalGuiBackend::debugSourceColorsBackground() const
 {
-    const GridLayer& layer = mOverlayOptimiser.layerBackground();
-    return debugColors(layer, mOverlayOptimiser.debugPaletteIndicesBackground(), false);
+    return resultViews().sourceColorsBackground;
 }
 
 //---------------------------------------------------------------------------------------------------------------------
 
 QVariantList OverlayPalGuiBackend::debugDestinationColorsBackground() const
 {
-    const GridLayer& layer = mOverlayOptimiser.layerBackground();
-    return debugColors(layer, mOverlayOptimiser.debugPaletteIndicesBackground(), true);
+    return resultViews().destinationColorsBackground;
 }
 
 //---------------------------------------------------------------------------------------------------------------------
@@ -1080,8 +1158,15 @@ QString OverlayPalGuiBackend::urlToLocal(const QString &url)
 
 QVariantList OverlayPalGuiBackend::debugSpritesOverlay() const
 {
-    const std::vector<std::set<uint8_t>>& palettes = mOverlayOptimiser.palettes();
-    std::vector<Sprite> sprites = mOverlayOptimiser.spritesOverlay();
+    return resultViews().spritesOverlay;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+QVariantList OverlayPalGuiBackend::debugSpritesOverlayFromOptimiser() const
+{
+    const std::vector<Colors>& palettes = mResult->palettes();
+    const std::vector<Sprite>& sprites = mResult->spritesOverlay();
     QVariantList spritesQML;
     for(auto& s : sprites)
     {
@@ -1092,19 +1177,19 @@ QVariantList OverlayPalGuiBackend::debugSpritesOverlay() const
         m["p"] = s.p - 4;
         m["numColors"] = int(s.colors.size());
         // Get current sprite width / height from optimiser
-        m["w"] = mOverlayOptimiser.spriteWidth();
-        m["h"] = mOverlayOptimiser.spriteHeight();
+        m["w"] = mResult->spriteWidth();
+        m["h"] = mResult->spriteHeight();
         std::vector<uint8_t> srcColors;
         std::vector<uint8_t> dstColors;
         uint8_t i = 1;
         for(uint8_t c : s.colors)
         {
             srcColors.push_back(c);
-            uint8_t dstColor = mOverlayOptimiser.indexInPalette(palettes[s.p], c);
+            uint8_t dstColor = OverlayOptimiser::indexInPalette(palettes[s.p], c);
             dstColors.push_back((s.p << 2) | dstColor);
             i++;
         }
-        int valuesPerLine = (mOverlayOptimiser.spriteHeight() == 8) ? 2 : 1;
+        int valuesPerLine = (mResult->spriteHeight() == 8) ? 2 : 1;
         m["srcColors"] = colorsToQString(srcColors, valuesPerLine);
         m["dstColors"] = colorsToQString(dstColors, valuesPerLine);
         spritesQML.push_back(m);
@@ -1127,7 +1212,7 @@ void OverlayPalGuiBackend::exportOutputImage(QString filename, int paletteMask)
 {
     filename = urlToLocal(filename);
     QFileInfo fi(filename);
-    ExportDataNES exportData = buildExportData(mOverlayOptimiser, paletteMask);
+    ExportDataNES exportData = buildExportData(*mResult, paletteMask, mDedupFlippedSprites);
     // Create filename suffixes based on selected .nam file
     QString nametableFilename = fi.path() + "/" + fi.baseName() + ".nam";
     QString exramFilename = fi.path() + "/" + fi.baseName() + ".exram";
@@ -1171,6 +1256,5 @@ bool OverlayPalGuiBackend::writeBinaryFile(const QString& filename, const std::v
 
 int OverlayPalGuiBackend::numBackgroundTiles() const
 {
-    ExportDataNES exportData = buildExportData(mOverlayOptimiser, 0xFF);
-    return exportData.bgCHR.size() / ExportDataNES::TileSize;
+    return resultViews().numBackgroundTiles;
 }
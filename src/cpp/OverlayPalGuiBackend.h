@@ -20,6 +20,12 @@
 #ifndef OVERLAYPAL_GUI_BACKEND_H
 #define OVERLAYPAL_GUI_BACKEND_H
 
+#include <array>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <set>
+
 #include <QObject>
 #include <QString>
 #include <qqml.h>
@@ -29,11 +35,15 @@
 #include <QVector>
 #include <QRgb>
 #include <QFileSystemWatcher>
+#include <QFuture>
 
 #include "Array2D.h"
 #include "OverlayOptimiser.h"
 #include "SimplePaletteModel.h"
 #include "HardwareColorsModel.h"
+#include "LatestJobQueue.h"
+
+class OverlayPalImageProvider;
 
 class OverlayPalGuiBackend : public QObject
 {
@@ -53,10 +63,14 @@ class OverlayPalGuiBackend : public QObject
     Q_PROPERTY(int maxSpritePalettes READ maxSpritePalettes WRITE setMaxSpritePalettes)
     Q_PROPERTY(int maxSpritesPerScanline READ maxSpritesPerScanline WRITE setMaxSpritesPerScanline)
     Q_PROPERTY(int timeOut READ timeOut WRITE setTimeOut)
+    Q_PROPERTY(int minTimeOut READ minTimeOut CONSTANT)
     Q_PROPERTY(QString hardwarePaletteName READ hardwarePaletteName WRITE setHardwarePaletteName)
     Q_PROPERTY(bool conversionSuccessful READ conversionSuccessful)
+    Q_PROPERTY(bool conversionInProgress READ conversionInProgress)
     Q_PROPERTY(QString conversionError READ conversionError)
+    Q_PROPERTY(QString conversionReport READ conversionReport)
     Q_PROPERTY(int numBackgroundTiles READ numBackgroundTiles)
+    Q_PROPERTY(bool dedupFlippedSprites READ dedupFlippedSprites WRITE setDedupFlippedSprites)
 
 public:
     explicit OverlayPalGuiBackend(QObject *parent = nullptr);
@@ -98,11 +112,23 @@ public:
 
     int timeOut() const;
     void setTimeOut(int timeOut);
+    // Lowest time out the solver backend accepts: 0 (none) unless it can't be interrupted
+    int minTimeOut() const;
+
+    // Re-use mirrored sprite tiles with OAM flip bits when exporting
+    bool dedupFlippedSprites() const;
+    void setDedupFlippedSprites(bool dedupFlippedSprites);
 
     bool conversionSuccessful() const;
 
     const QString& conversionError() const;
 
+    // Stage times, solver statistics and memory use of the last conversion, as text
+    QString conversionReport() const;
+
+    // True while a conversion is running, including while intermediate results are shown
+    bool conversionInProgress() const;
+
     int numBackgroundTiles() const;
 
     static QString imageAsBase64(const QImage& image);
@@ -113,6 +139,10 @@ public:
     Q_INVOKABLE QString outputImageData(int paletteMask) const;
     Q_INVOKABLE QString outputImageDataRGBA(int paletteMask, bool transparentBG0) const;
 
+    // URLs of the images above, served by OverlayPalImageProvider and rendered once per input image / result
+    Q_INVOKABLE QString inputImageUrl() const;
+    Q_INVOKABLE QString outputImageUrlRGBA(int paletteMask, bool transparentBG0) const;
+
     Q_INVOKABLE QObject* paletteModel();
 
     Q_INVOKABLE QObject* hardwarePaletteNamesModel();
@@ -141,8 +171,13 @@ public slots:
 
     void startImageConversion();
 
+    // Stop refining the running conversion and keep its current result
+    void acceptConversion();
+
     void handleInputFileChanged(const QString& filename);
 
+    // Processes the input image with the current settings on a worker thread, superseding any processing
+    // still running. inputImageChanged is emitted once the latest request has finished.
     void quantizeInputImage();
 
 signals:
@@ -157,14 +192,70 @@ signals:
 
 protected:
 
+    // Settings the processed input image depends on, copied for the worker thread
+    struct InputImageJob
+    {
+        QString filenameToLoad; // Empty = process image
+        QImage image;
+        QVector<QRgb> hardwareColorTable;
+        bool mapInputColors;
+        bool uniqueColors;
+        bool preventBlackerThanBlack;
+        uint8_t backgroundColor;
+        int shiftX;
+        int shiftY;
+    };
+
+    struct ProcessedInputImage
+    {
+        bool processed = false;
+        QImage image;
+        QImage indexedBeforeShift;
+        QImage indexed;
+        bool mapInputColors;
+        std::set<uint8_t> colors;
+        std::array<bool, 256> shownColors;
+        uint8_t detectedBackgroundColor;
+    };
+
+    // Returns false if the image failed to load, or the job went stale before finishing
+    static bool processInputImage(const InputImageJob& job,
+                                  const LatestJobQueue::IsStale& isStale,
+                                  ProcessedInputImage& result);
+    void applyInputImage(const ProcessedInputImage& result);
+
+    // Debug grids of the current result, built on first read and dropped with the result
+    struct ResultViews
+    {
+        bool valid = false;
+        QVariantList paletteIndicesBackground;
+        QVariantList numSourceColorsBackground;
+        QVariantList sourceColorsBackground;
+        QVariantList destinationColorsBackground;
+        QVariantList spritesOverlay;
+        int numBackgroundTiles = 0;
+    };
+
+    const ResultViews& resultViews() const;
+    void invalidateResultViews();
+    void invalidateInputImageViews();
+    OverlayPalImageProvider* imageProvider() const;
+    QString imageUrl(const QString& id, const std::function<QImage()>& render) const;
+
+    QVariantList debugSpritesOverlayFromOptimiser() const;
     QVariantList debugPaletteIndices(const Array2D<uint8_t>& paletteIndices) const;
     QVariantList debugNumSourceColors(const GridLayer& layer) const;
     QVariantList debugColors(const GridLayer& layer,
                              const Array2D<uint8_t>& paletteIndices,
                              bool remapped) const;
 
-    static Image2D qImageToImage2D(const QImage& qImage);
-    static QImage image2DToQImage(const Image2D& image, const QVector<QRgb>& colorTable);
+    // Copy of mOverlayOptimiser's current result, to be shown while it goes on converting
+    std::shared_ptr<const OverlayOptimiser> snapshotResult() const;
+    void showResult(const std::shared_ptr<const OverlayOptimiser>& result, const std::string& conversionError);
+    void finishImageConversion(const std::shared_ptr<const OverlayOptimiser>& result,
+                               const std::string& conversionError,
+                               bool failed);
+    void updateOutputImage(const std::string& conversionError);
 
     QVector<QRgb> makeColorTable() const;
     QVector<QRgb> makeColorTableFromHardwarePalette() const;
@@ -173,20 +264,16 @@ protected:
     void setHardwarePaletteName(const QString& hardwarePaletteName);
     void loadHardwarePalette(const QFileInfo& fileInfo);
     void loadHardwarePalettes(const QString& palettesPath);
-    uint8_t findClosestColorIndex(const QVector<QRgb>& colorTable, QRgb rgb, std::vector<bool>& availableColors) const;
     QImage remapColorsToNES(const QImage& inputImage) const;
 
-    static QImage cropOrExtendImage(const QImage& image, uint8_t backgroundColor);
-    bool colorInImage(const QImage& image, uint8_t color) const;
-    static uint8_t detectBackgroundColor(const QImage& image);
-
-    static uint8_t indexInPalette(const std::set<uint8_t>& palette, uint8_t color);
+    static uint8_t indexInPalette(const Colors& palette, uint8_t color);
 
     static QString urlToLocal(const QString& url);
 
 private:
     bool mUniqueColors;
     int mTimeOut;
+    bool mDedupFlippedSprites;
     bool mTrackInputImage;
     int mShiftX;
     int mShiftY;
@@ -200,7 +287,13 @@ private:
     bool mPreventBlackerThanBlack;
     bool mInputImagePaletteMapping;
     bool mConversionInProgress;
-    bool mProcessingInputImage;
+    std::atomic<bool> mConversionRestartPending;
+    bool mInputFileChangePending;
+    // Input image processing requested, and not applied yet
+    bool mInputImagePending;
+    // Conversion requested while the input image was pending, started once it is applied
+    bool mConversionStartPending;
+    QString mInputImageFilenameToLoad;
     QString mConversionError;
     QString mHardwarePaletteName;
     QString mInputImageFilename;
@@ -209,6 +302,9 @@ private:
     QImage mInputImageIndexed;
     QImage mOutputImage;
     QImage mOutputImageOverlay;
+    mutable ResultViews mResultViews;
+    int mInputImageGeneration;
+    int mOutputImageGeneration;
     Image2D mImagePendingConversion;
     QMap<QString, QVariantList> mHardwarePalettes;
     QStringList mHardwarePaletteNames;
@@ -217,6 +313,10 @@ private:
     HardwareColorsModel mInputImageHardwareColorsModel;
 
     OverlayOptimiser mOverlayOptimiser;
+    // Result shown by the GUI, only replaced on the GUI thread, so that QML never reads a result being converted
+    std::shared_ptr<const OverlayOptimiser> mResult;
+    // Conversion job, which the destructor waits for as it uses this and mOverlayOptimiser
+    QFuture<void> mConversionFuture;
     QFileSystemWatcher mInputFileWatcher;
 
     const size_t PaletteGroupSize = 4;
@@ -227,6 +327,9 @@ private:
     static const size_t HardwarePaletteSize = 64;
     static const int ScreenWidth = 256;
     static const int ScreenHeight = 240;
+
+    // Last member, so that its worker has stopped before anything it reports to is destroyed
+    LatestJobQueue mInputImageQueue;
 };
 
 #endif // OVERLAYPAL_GUI_BACKEND_H
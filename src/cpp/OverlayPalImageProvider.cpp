@@ -0,0 +1,80 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <QMutexLocker>
+
+#include "OverlayPalImageProvider.h"
+
+const char* const OverlayPalImageProvider::Id = "overlaypal";
+
+//---------------------------------------------------------------------------------------------------------------------
+
+OverlayPalImageProvider::OverlayPalImageProvider():
+    QQuickImageProvider(QQuickImageProvider::Image)
+{
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+QImage OverlayPalImageProvider::requestImage(const QString& id, QSize* size, const QSize& requestedSize)
+{
+    // Pixel art is scaled by the canvas, so requestedSize is ignored
+    Q_UNUSED(requestedSize);
+    QMutexLocker locker(&mMutex);
+    QImage image = mImages.value(id);
+    if(size)
+        *size = image.size();
+    return image;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool OverlayPalImageProvider::contains(const QString& id) const
+{
+    QMutexLocker locker(&mMutex);
+    return mImages.contains(id);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayPalImageProvider::setImage(const QString& id, const QImage& image)
+{
+    QMutexLocker locker(&mMutex);
+    mImages[id] = image;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void OverlayPalImageProvider::removeImages(const QString& prefix)
+{
+    QMutexLocker locker(&mMutex);
+    for(auto it = mImages.begin(); it != mImages.end();)
+    {
+        if(it.key().startsWith(prefix))
+            it = mImages.erase(it);
+        else
+            ++it;
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+QString OverlayPalImageProvider::url(const QString& id)
+{
+    return QString("image://%1/%2").arg(Id, id);
+}
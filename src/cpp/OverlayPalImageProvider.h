@@ -0,0 +1,57 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+#ifndef OVERLAYPAL_IMAGE_PROVIDER_H
+#define OVERLAYPAL_IMAGE_PROVIDER_H
+
+#include <QHash>
+#include <QImage>
+#include <QMutex>
+#include <QQuickImageProvider>
+#include <QString>
+
+//
+// Serves images rendered by OverlayPalGuiBackend to QML as image://overlaypal/<id> URLs, without encoding them.
+// Ids carry a generation number, so that QML never shows an image cached under a URL that has since been reused.
+// Thread-safe, as QML may load images from its own threads.
+//
+class OverlayPalImageProvider : public QQuickImageProvider
+{
+public:
+    static const char* const Id;
+
+    OverlayPalImageProvider();
+
+    QImage requestImage(const QString& id, QSize* size, const QSize& requestedSize) override;
+
+    bool contains(const QString& id) const;
+    void setImage(const QString& id, const QImage& image);
+
+    // Removes all images with ids starting with prefix
+    void removeImages(const QString& prefix);
+
+    // image://overlaypal/<id>
+    static QString url(const QString& id);
+
+private:
+    mutable QMutex mMutex;
+    QHash<QString, QImage> mImages;
+};
+
+#endif // OVERLAYPAL_IMAGE_PROVIDER_H
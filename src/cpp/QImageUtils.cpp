@@ -0,0 +1,298 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <algorithm>
+#include <array>
+#include <map>
+#include <memory>
+#include <cassert>
+
+#include <QFile>
+
+#include "ImageUtils.h"
+#include "ColorLookup.h"
+
+#include "QImageUtils.h"
+
+//---------------------------------------------------------------------------------------------------------------------
+
+ConstImage2DView qImageView(const QImage& qImage)
+{
+    assert(qImage.format() == QImage::Format_Indexed8);
+    return ConstImage2DView(qImage.constBits(), qImage.width(), qImage.height(), qImage.bytesPerLine());
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+Image2DView mutableQImageView(QImage& qImage)
+{
+    assert(qImage.format() == QImage::Format_Indexed8);
+    return Image2DView(qImage.bits(), qImage.width(), qImage.height(), qImage.bytesPerLine());
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+Image2D qImageToImage2D(const QImage& qImage)
+{
+    Image2D image(qImage.width(), qImage.height());
+    copyArray2D(image, qImageView(qImage));
+    return image;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+QImage image2DToQImage(const Image2D& image, const QVector<QRgb>& colorTable)
+{
+    QImage qImage(image.width(), image.height(), QImage::Format_Indexed8);
+    qImage.setColorTable(colorTable);
+#ifndef NDEBUG
+    for(size_t y = 0; y < image.height() && image.width() > 0; y++)
+        assert(*std::max_element(image.row(y), image.row(y) + image.width()) < colorTable.size());
+#endif
+    copyArray2D(mutableQImageView(qImage), image);
+    return qImage;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+QImage cropOrExtendImage(const QImage& image, uint8_t backgroundColor, int width, int height)
+{
+    QImage copy(width, height, QImage::Format_Indexed8);
+    copy.setColorTable(image.colorTable());
+    size_t colorTableSize = image.colorTable().size();
+    assert(backgroundColor < colorTableSize);
+    ConstImage2DView src = qImageView(image);
+    Image2DView dst = mutableQImageView(copy);
+    const int copyWidth = std::min(width, image.width());
+    for(int y = 0; y < height; y++)
+    {
+        uchar* dstRow = dst.row(y);
+        int x = 0;
+        if(y < image.height())
+        {
+            // Use source pixels
+            std::copy(src.row(y), src.row(y) + copyWidth, dstRow);
+            x = copyWidth;
+        }
+        // Out-of-range - use background color
+        std::fill(dstRow + x, dstRow + width, backgroundColor);
+    }
+    return copy;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+uint8_t detectBackgroundColor(const QImage& image)
+{
+    assert(image.width() > 0 && image.height() > 0);
+    std::array<size_t, 256> counts = {};
+    ConstImage2DView view = qImageView(image);
+    for(size_t y = 0; y < view.height(); y++)
+    {
+        const uint8_t* row = view.row(y);
+        for(size_t x = 0; x < view.width(); x++)
+            counts[row[x]]++;
+    }
+    uint8_t mostCommonColor = 0x3F;
+    size_t mostCommonCount = 0;
+    for(size_t color = 0; color < counts.size(); color++)
+    {
+        if(counts[color] > mostCommonCount)
+        {
+            mostCommonCount = counts[color];
+            mostCommonColor = color;
+        }
+    }
+    return mostCommonColor;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+bool potentialHardwarePaletteIndexedImage(const QImage& image, size_t hardwarePaletteSize)
+{
+    // Image must be indexed
+    if(image.format() != QImage::Format_Indexed8)
+        return false;
+    // ...and have no color indices above the hardware palette size
+    ConstImage2DView view = qImageView(image);
+    for(size_t y = 0; y < view.height(); y++)
+    {
+        const uint8_t* row = view.row(y);
+        if(std::any_of(row, row + view.width(), [&](uint8_t c) { return c >= hardwarePaletteSize; }))
+            return false;
+    }
+    return true;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+static std::shared_ptr<const ClosestColorLookup> remapLookup(const QVector<QRgb>& hwColorTable, bool preventBlackerThanBlack)
+{
+    // Never map to the blacks in the unused columns, nor blacker-than-black if asked to
+    Colors candidates = Colors::fromMask(~uint64_t(0));
+    for(uint8_t c : {0x0E, 0x1E, 0x2E, 0x3E, 0x0F, 0x1F, 0x2F, 0x3F})
+        candidates.erase(c);
+    if(preventBlackerThanBlack)
+        candidates.erase(0x0D);
+    return ClosestColorLookup::shared(std::vector<uint32_t>(hwColorTable.begin(), hwColorTable.end()), candidates);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void prepareRemapColorsToNES(const QVector<QRgb>& hwColorTable)
+{
+    remapLookup(hwColorTable, false);
+    remapLookup(hwColorTable, true);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+QImage remapColorsToNES(const QImage& inputImage,
+                        const QVector<QRgb>& hwColorTable,
+                        bool uniqueColors,
+                        bool preventBlackerThanBlack)
+{
+    std::shared_ptr<const ClosestColorLookup> lookup = remapLookup(hwColorTable, preventBlackerThanBlack);
+    QImage outputImage(inputImage.width(), inputImage.height(), QImage::Format_Indexed8);
+    outputImage.setColorTable(hwColorTable);
+    // Unique colors take hardware colors greedily in input color order, so they need a bounded number of input colors
+    const QImage image = inputImage.format() == QImage::Format_Indexed8 || !uniqueColors ? inputImage :
+                         inputImage.convertToFormat(QImage::Format_Indexed8, Qt::ThresholdDither);
+    if(image.format() == QImage::Format_Indexed8)
+    {
+        // Remap the used color table entries, then the indices
+        const QVector<QRgb> colorTable = image.colorTable();
+        std::vector<bool> used(256, false);
+        ConstImage2DView src = qImageView(image);
+        for(size_t y = 0; y < src.height(); y++)
+        {
+            const uint8_t* row = src.row(y);
+            for(size_t x = 0; x < src.width(); x++)
+                used[row[x]] = true;
+        }
+        std::vector<uint8_t> remapping(256, 0);
+        if(uniqueColors)
+        {
+            // Entries sharing a color share its hardware color
+            std::map<QRgb, uint8_t> remappingByColor;
+            for(int i = 0; i < colorTable.size(); i++)
+            {
+                if(used[i])
+                    remappingByColor[colorTable[i]] = 0;
+            }
+            Colors available = lookup->candidates();
+            for(auto& [rgb, c] : remappingByColor)
+            {
+                c = lookup->closestExact(rgb, available);
+                available.erase(c);
+            }
+            for(int i = 0; i < colorTable.size(); i++)
+            {
+                if(used[i])
+                    remapping[i] = remappingByColor[colorTable[i]];
+            }
+        }
+        else
+        {
+            for(int i = 0; i < colorTable.size(); i++)
+                remapping[i] = lookup->closest(colorTable[i]);
+        }
+        Image2DView dst = mutableQImageView(outputImage);
+        for(size_t y = 0; y < src.height(); y++)
+        {
+            const uint8_t* srcRow = src.row(y);
+            uint8_t* dstRow = dst.row(y);
+            for(size_t x = 0; x < src.width(); x++)
+                dstRow[x] = remapping[srcRow[x]];
+        }
+    }
+    else
+    {
+        // Raw 0xAARRGGBB scanlines. Neighbouring pixels mostly share a color, so remember the last one.
+        const QImage rgbImage = image.convertToFormat(QImage::Format_ARGB32);
+        QRgb lastColor = 0;
+        uint8_t lastRemapped = lookup->closest(lastColor);
+        for(int y = 0; y < rgbImage.height(); y++)
+        {
+            const QRgb* src = reinterpret_cast<const QRgb*>(rgbImage.constScanLine(y));
+            uchar* dst = outputImage.scanLine(y);
+            for(int x = 0; x < rgbImage.width(); x++)
+            {
+                if(src[x] != lastColor)
+                {
+                    lastColor = src[x];
+                    lastRemapped = lookup->closest(lastColor);
+                }
+                dst[x] = lastRemapped;
+            }
+        }
+    }
+    return outputImage;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+QVector<QRgb> makeOutputColorTable(const std::vector<Colors>& palettes,
+                                   uint8_t backgroundColor,
+                                   const QVector<QRgb>& hwColorTable)
+{
+    const size_t PaletteGroupSize = 4;
+    QVector<QRgb> colorTable;
+    for(size_t i = 0; i < palettes.size(); i++)
+    {
+        // Background color
+        colorTable.append(hwColorTable[backgroundColor]);
+        size_t j = 1;
+        for(uint8_t c : palettes[i])
+        {
+            // Non-background color
+            assert(c <= 0x3F && "NES palette value must be 0x00 - 0x3F");
+            colorTable.append(hwColorTable[c]);
+            j++;
+        }
+        // Fill unused entries
+        while(j != PaletteGroupSize)
+        {
+            colorTable.append(0);
+            j++;
+        }
+    }
+    return colorTable;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+QVector<QRgb> readHardwarePaletteFile(const QString& filename)
+{
+    const int HardwarePaletteSize = 64;
+    QVector<QRgb> colorTable;
+    QFile palFile(filename);
+    if(!palFile.open(QIODevice::ReadOnly))
+        return colorTable;
+    QByteArray palData = palFile.readAll();
+    if(palData.size() != 3 * HardwarePaletteSize)
+        return colorTable;
+    for(int i = 0; i < HardwarePaletteSize; i++)
+    {
+        uint8_t r = palData[3 * i + 0];
+        uint8_t g = palData[3 * i + 1];
+        uint8_t b = palData[3 * i + 2];
+        colorTable.append(qRgb(r, g, b));
+    }
+    return colorTable;
+}
@@ -0,0 +1,92 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+#ifndef QIMAGE_UTILS_H
+#define QIMAGE_UTILS_H
+
+#include <cstdint>
+#include <vector>
+
+#include <QImage>
+#include <QVector>
+#include <QRgb>
+#include <QString>
+
+#include "Array2D.h"
+#include "ColorSet.h"
+
+//
+// View of an indexed QImage's pixels, without copying. Only valid while the image is alive and unmodified.
+// The const view never detaches the image, while the mutable view detaches it up front like QImage::bits().
+//
+ConstImage2DView qImageView(const QImage& qImage);
+Image2DView mutableQImageView(QImage& qImage);
+
+//
+// Convert an indexed QImage to an Image2D of the same size
+//
+Image2D qImageToImage2D(const QImage& qImage);
+
+//
+// Convert an Image2D to an indexed QImage using the given color table
+//
+QImage image2DToQImage(const Image2D& image, const QVector<QRgb>& colorTable);
+
+//
+// Crop or extend an indexed image to width x height, filling new pixels with backgroundColor
+//
+QImage cropOrExtendImage(const QImage& image, uint8_t backgroundColor, int width, int height);
+
+//
+// Detect background color as the most common color in an indexed image
+//
+uint8_t detectBackgroundColor(const QImage& image);
+
+//
+// Returns true if image is indexed and only uses indices inside the hardware palette
+//
+bool potentialHardwarePaletteIndexedImage(const QImage& image, size_t hardwarePaletteSize);
+
+//
+// Remap an RGB / indexed image to the closest colors in a hardware palette color table.
+// With uniqueColors, RGB images are first quantized to 256 colors, which then each take a different hardware color.
+//
+QImage remapColorsToNES(const QImage& inputImage,
+                        const QVector<QRgb>& hwColorTable,
+                        bool uniqueColors,
+                        bool preventBlackerThanBlack);
+
+//
+// Build the color lookups used by remapColorsToNES for a hardware palette ahead of time. Thread-safe.
+//
+void prepareRemapColorsToNES(const QVector<QRgb>& hwColorTable);
+
+//
+// Build the 32-entry color table for a converted image from its palettes
+//
+QVector<QRgb> makeOutputColorTable(const std::vector<Colors>& palettes,
+                                   uint8_t backgroundColor,
+                                   const QVector<QRgb>& hwColorTable);
+
+//
+// Read a 192-byte .pal file into a 64-entry color table. Returns an empty table on failure.
+//
+QVector<QRgb> readHardwarePaletteFile(const QString& filename);
+
+#endif // QIMAGE_UTILS_H
@@ -0,0 +1,90 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <atomic>
+#include <filesystem>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+#include "ScratchDirectory.h"
+
+//---------------------------------------------------------------------------------------------------------------------
+
+static std::string uniqueDirectoryName(const std::string& prefix)
+{
+    static std::atomic<unsigned> counter(0);
+    static thread_local std::mt19937 rng(std::random_device{}());
+    std::stringstream ss;
+    ss << prefix << "-" << getpid() << "-" << counter++ << "-" << std::hex << (rng() & 0xFFFF);
+    return ss.str();
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+ScratchDirectory::ScratchDirectory(const std::string& parentPath, const std::string& prefix, bool keepFiles):
+    mKeepFiles(keepFiles)
+{
+    std::filesystem::path parent(parentPath);
+    std::error_code ec;
+    std::filesystem::create_directories(parent, ec);
+    // create_directory returns false if the directory already existed - retry with a new name
+    for(int attempt = 0; attempt < 100; attempt++)
+    {
+        std::filesystem::path candidate = parent / uniqueDirectoryName(prefix);
+        if(std::filesystem::create_directory(candidate, ec))
+        {
+            mPath = candidate.string();
+            return;
+        }
+    }
+    throw std::runtime_error(std::string("Failed to create work directory in '") + parentPath + "'");
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+ScratchDirectory::~ScratchDirectory()
+{
+    if(!mKeepFiles)
+    {
+        std::error_code ec;
+        std::filesystem::remove_all(mPath, ec);
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+const std::string& ScratchDirectory::path() const
+{
+    return mPath;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+std::string ScratchDirectory::filename(const std::string& name) const
+{
+    return mPath + "/" + name;
+}
@@ -0,0 +1,47 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+#ifndef SCRATCH_DIRECTORY_H
+#define SCRATCH_DIRECTORY_H
+
+#include <string>
+
+//
+// Uniquely-named temporary directory, created on construction and removed with all its contents on destruction.
+// Allows several conversions to share one work path without overwriting each other's temporary files.
+//
+class ScratchDirectory
+{
+public:
+    ScratchDirectory(const std::string& parentPath, const std::string& prefix, bool keepFiles = false);
+    ~ScratchDirectory();
+
+    ScratchDirectory(const ScratchDirectory&) = delete;
+    ScratchDirectory& operator=(const ScratchDirectory&) = delete;
+
+    const std::string& path() const;
+
+    std::string filename(const std::string& name) const;
+
+private:
+    std::string mPath;
+    bool mKeepFiles;
+};
+
+#endif // SCRATCH_DIRECTORY_H
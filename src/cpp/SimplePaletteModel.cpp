@@ -40,7 +40,7 @@ SimplePaletteModel::~SimplePaletteModel()
 
 //---------------------------------------------------------------------------------------------------------------------
 
-void SimplePaletteModel::setPalette(const std::vector<std::set<uint8_t> > &palettes, uint8_t backgroundColor)
+void SimplePaletteModel::setPalette(const std::vector<Colors> &palettes, uint8_t backgroundColor)
 {
     std::vector<std::vector<uint8_t>> newPalettes;
     for(size_t i = 0; i < palettes.size(); i++)
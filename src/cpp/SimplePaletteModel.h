@@ -27,7 +27,7 @@
 #include <cstdint>
 #include <cassert>
 #include <vector>
-#include <set>
+#include "ColorSet.h"
 
 //
 // Model used for providing overlay optimisation's palettes
@@ -42,7 +42,7 @@ public:
 
     ~SimplePaletteModel() override;
 
-    void setPalette(const std::vector<std::set<uint8_t>>& palettes, uint8_t backgroundColor);
+    void setPalette(const std::vector<Colors>& palettes, uint8_t backgroundColor);
 
     int rowCount(const QModelIndex &parent = QModelIndex()) const override;
 
@@ -0,0 +1,325 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <stdexcept>
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+#include <algorithm>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "SolutionReader.h"
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string& filename):
+    mData(nullptr),
+    mSize(0),
+    mFileHandle(INVALID_HANDLE_VALUE),
+    mMappingHandle(nullptr)
+{
+    std::wstring filenameW(filename.begin(), filename.end());
+    mFileHandle = CreateFileW(filenameW.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if(mFileHandle == INVALID_HANDLE_VALUE)
+    {
+        throw std::runtime_error(std::string("Failed to open solution file: ") + filename);
+    }
+    LARGE_INTEGER fileSize;
+    if(!GetFileSizeEx(mFileHandle, &fileSize))
+    {
+        CloseHandle(mFileHandle);
+        throw std::runtime_error(std::string("Failed to read size of solution file: ") + filename);
+    }
+    mSize = static_cast<size_t>(fileSize.QuadPart);
+    if(mSize == 0)
+        return;
+    mMappingHandle = CreateFileMappingW(mFileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if(mMappingHandle)
+    {
+        mData = static_cast<const char*>(MapViewOfFile(mMappingHandle, FILE_MAP_READ, 0, 0, 0));
+    }
+    if(!mData)
+    {
+        if(mMappingHandle)
+            CloseHandle(mMappingHandle);
+        CloseHandle(mFileHandle);
+        throw std::runtime_error(std::string("Failed to map solution file: ") + filename);
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+MappedFile::~MappedFile()
+{
+    if(mData)
+        UnmapViewOfFile(mData);
+    if(mMappingHandle)
+        CloseHandle(mMappingHandle);
+    if(mFileHandle != INVALID_HANDLE_VALUE)
+        CloseHandle(mFileHandle);
+}
+
+#else
+
+MappedFile::MappedFile(const std::string& filename):
+    mData(nullptr),
+    mSize(0)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    if(fd < 0)
+    {
+        throw std::runtime_error(std::string("Failed to open solution file: ") + filename);
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0)
+    {
+        close(fd);
+        throw std::runtime_error(std::string("Failed to read size of solution file: ") + filename);
+    }
+    mSize = static_cast<size_t>(st.st_size);
+    if(mSize > 0)
+    {
+        void* data = mmap(nullptr, mSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(data == MAP_FAILED)
+        {
+            close(fd);
+            throw std::runtime_error(std::string("Failed to map solution file: ") + filename);
+        }
+        madvise(data, mSize, MADV_SEQUENTIAL);
+        mData = static_cast<const char*>(data);
+    }
+    // The mapping stays valid after closing the descriptor
+    close(fd);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+MappedFile::~MappedFile()
+{
+    if(mData)
+        munmap(const_cast<char*>(mData), mSize);
+}
+
+#endif
+
+//---------------------------------------------------------------------------------------------------------------------
+
+const char* MappedFile::begin() const
+{
+    return mData;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+const char* MappedFile::end() const
+{
+    return mData + mSize;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+size_t MappedFile::size() const
+{
+    return mSize;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+void CmplSolutionReader::addVariable(const std::string& name, size_t numIndices, Handler handler)
+{
+    if(numIndices > MaxIndices)
+    {
+        throw std::runtime_error(std::string("Too many indices for solution variable: ") + name);
+    }
+    mVariables.push_back(Variable{name, numIndices, handler});
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+const CmplSolutionReader::Variable* CmplSolutionReader::findVariable(const char* name, size_t nameLength) const
+{
+    for(const Variable& variable : mVariables)
+    {
+        if(variable.name.size() == nameLength && std::memcmp(variable.name.data(), name, nameLength) == 0)
+            return &variable;
+    }
+    return nullptr;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+size_t CmplSolutionReader::read(const std::string& csvFilename, CmplSolutionStatistics* statistics) const
+{
+    MappedFile file(csvFilename);
+    return read(file.begin(), file.end(), statistics);
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+static bool startsWith(const char* p, const char* end, const char* prefix, size_t prefixLength)
+{
+    return size_t(end - p) >= prefixLength && std::memcmp(p, prefix, prefixLength) == 0;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+static const char* parseInt(const char* p, const char* end, int& value)
+{
+    bool negative = false;
+    if(p < end && (*p == '-' || *p == '+'))
+    {
+        negative = (*p == '-');
+        p++;
+    }
+    const char* digitsStart = p;
+    int v = 0;
+    while(p < end && *p >= '0' && *p <= '9')
+    {
+        v = v * 10 + (*p - '0');
+        p++;
+    }
+    if(p == digitsStart)
+        return nullptr;
+    value = negative ? -v : v;
+    return p;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+// Header rows have the form "key;value;..."
+static void parseHeaderRow(const char* p, const char* end, CmplSolutionStatistics& statistics)
+{
+    static const char numVariablesString[] = "Nr. of variables;";
+    static const char numConstraintsString[] = "Nr. of constraints;";
+    static const char objectiveStatusString[] = "Objective status;";
+    static const char objectiveValueString[] = "Objective value;";
+    int value;
+    if(startsWith(p, end, numVariablesString, sizeof(numVariablesString) - 1))
+    {
+        if(parseInt(p + sizeof(numVariablesString) - 1, end, value))
+            statistics.numVariables = value;
+    }
+    else if(startsWith(p, end, numConstraintsString, sizeof(numConstraintsString) - 1))
+    {
+        if(parseInt(p + sizeof(numConstraintsString) - 1, end, value))
+            statistics.numConstraints = value;
+    }
+    else if(startsWith(p, end, objectiveStatusString, sizeof(objectiveStatusString) - 1))
+    {
+        const char* valueStart = p + sizeof(objectiveStatusString) - 1;
+        const char* valueEnd = std::find(valueStart, end, ';');
+        statistics.objectiveStatus.assign(valueStart, valueEnd);
+        while(!statistics.objectiveStatus.empty() && std::isspace(static_cast<unsigned char>(statistics.objectiveStatus.back())))
+            statistics.objectiveStatus.pop_back();
+    }
+    else if(startsWith(p, end, objectiveValueString, sizeof(objectiveValueString) - 1))
+    {
+        const std::string valueString(p + sizeof(objectiveValueString) - 1, end);
+        statistics.objectiveValue = std::strtod(valueString.c_str(), nullptr);
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+size_t CmplSolutionReader::read(const char* begin, const char* end, CmplSolutionStatistics* statistics) const
+{
+    static const char headerString[] = "Problem;";
+    static const char noSolutionString[] = "No solution has been found";
+    const char* p = begin;
+    // Header
+    const char* lineEnd = p ? static_cast<const char*>(std::memchr(p, '\n', end - p)) : nullptr;
+    if(!lineEnd)
+        lineEnd = end;
+    bool headerFound = false;
+    for(const char* q = p; q < lineEnd && !headerFound; q++)
+    {
+        headerFound = startsWith(q, lineEnd, headerString, sizeof(headerString) - 1);
+    }
+    if(!headerFound)
+    {
+        throw std::runtime_error(std::string("Solution file header unrecognized"));
+    }
+    // Variable rows
+    size_t numRows = 0;
+    int indices[MaxIndices];
+    for(p = lineEnd; p < end; p = lineEnd)
+    {
+        // Skip the newline ending the previous line
+        p++;
+        lineEnd = static_cast<const char*>(std::memchr(p, '\n', end - p));
+        if(!lineEnd)
+            lineEnd = end;
+        if(startsWith(p, lineEnd, noSolutionString, sizeof(noSolutionString) - 1))
+        {
+            throw std::runtime_error(std::string("No solution found"));
+        }
+        // Name
+        const char* nameStart = p;
+        while(p < lineEnd && *p != '[' && *p != ';')
+            p++;
+        if(p == lineEnd || *p != '[')
+        {
+            if(statistics)
+                parseHeaderRow(nameStart, lineEnd, *statistics);
+            continue;
+        }
+        const Variable* variable = findVariable(nameStart, p - nameStart);
+        if(!variable)
+            continue;
+        // Indices
+        size_t numIndices = 0;
+        do
+        {
+            p++;
+            int index;
+            p = parseInt(p, lineEnd, index);
+            if(!p || numIndices == MaxIndices)
+                break;
+            indices[numIndices++] = index;
+        } while(p < lineEnd && *p == ',');
+        if(!p || p == lineEnd || *p != ']' || numIndices != variable->numIndices)
+        {
+            throw std::runtime_error(std::string("Malformed solution row for variable: ") + variable->name);
+        }
+        p++;
+        // Type
+        // For currently unknown reasons, the CMPL solution will sometimes have
+        // binary variables changed to integer. Accept both.
+        if(!startsWith(p, lineEnd, ";B;", 3) && !startsWith(p, lineEnd, ";I;", 3))
+            continue;
+        p += 3;
+        // Activity
+        int activity;
+        if(!parseInt(p, lineEnd, activity))
+        {
+            throw std::runtime_error(std::string("Malformed activity for variable: ") + variable->name);
+        }
+        variable->handler(indices, activity);
+        numRows++;
+    }
+    return numRows;
+}
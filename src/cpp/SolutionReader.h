@@ -0,0 +1,99 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+#ifndef SOLUTION_READER_H
+#define SOLUTION_READER_H
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstddef>
+
+//
+// Read-only memory mapping of a whole file. An empty file maps to a null range.
+//
+class MappedFile
+{
+public:
+    MappedFile(const std::string& filename);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* begin() const;
+    const char* end() const;
+    size_t size() const;
+
+private:
+    const char* mData;
+    size_t mSize;
+#ifdef _WIN32
+    void* mFileHandle;
+    void* mMappingHandle;
+#endif
+};
+
+//
+// Statistics from the header of a CMPL solution file, left at 0 / empty where missing
+//
+struct CmplSolutionStatistics
+{
+    size_t numVariables = 0;
+    size_t numConstraints = 0;
+    std::string objectiveStatus;
+    double objectiveValue = 0.0;
+};
+
+//
+// Single-pass reader for CMPL's CSV solution files.
+//
+// Each variable row has the form "name[i0,i1,...];type;activity;...". Rows are dispatched on their
+// variable name through a table of registered handlers, with the indices and integer activity parsed
+// in place from the mapped file. Rows for unregistered variables and non-variable rows are skipped.
+//
+class CmplSolutionReader
+{
+public:
+    using Handler = std::function<void(const int* indices, int activity)>;
+
+    void addVariable(const std::string& name, size_t numIndices, Handler handler);
+
+    // Throws std::runtime_error if the file cannot be read, is not a CMPL solution or holds no solution.
+    // Returns the number of variable rows dispatched to handlers. Header statistics are stored in statistics if given.
+    size_t read(const std::string& csvFilename, CmplSolutionStatistics* statistics = nullptr) const;
+
+    size_t read(const char* begin, const char* end, CmplSolutionStatistics* statistics = nullptr) const;
+
+protected:
+    struct Variable
+    {
+        std::string name;
+        size_t numIndices;
+        Handler handler;
+    };
+
+    const Variable* findVariable(const char* name, size_t nameLength) const;
+
+private:
+    std::vector<Variable> mVariables;
+    static constexpr size_t MaxIndices = 8;
+};
+
+#endif // SOLUTION_READER_H
@@ -15,41 +15,122 @@
 // You should have received a copy of the GNU General Public License
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
 //
+#include <algorithm>
+
 #include "Sprite.h"
 
 //---------------------------------------------------------------------------------------------------------------------
 
-Sprite extractSprite(Image2D& image,
+Colors regionColors(const Image2D& image,
+                    size_t xPos,
+                    size_t yPos,
+                    size_t width,
+                    size_t height,
+                    uint8_t backgroundColor)
+{
+    Colors colors;
+    const size_t xEnd = std::min(xPos + width, image.width());
+    const size_t yEnd = std::min(yPos + height, image.height());
+    for(size_t y = yPos; y < yEnd; y++)
+    {
+        const uint8_t* row = image.row(y);
+        for(size_t x = xPos; x < xEnd; x++)
+            colors.insert(row[x]);
+    }
+    colors.erase(backgroundColor);
+    return colors;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+//
+// Copies the pixels of the given colors from a sprite lying entirely inside the image.
+// Instantiated for 8x8 and 8x16 sprites, so that each row is a constant-length loop over the color mask.
+//
+template<size_t Width, size_t Height>
+static inline uint64_t extractSpritePixels(const Image2D& image, size_t xPos, size_t yPos, uint64_t colorMask, SpritePixels& pixels)
+{
+    uint64_t spriteMask = 0;
+    for(size_t y = 0; y < Height; y++)
+    {
+        const uint8_t* row = image.row(yPos + y) + xPos;
+        uint8_t* spriteRow = pixels.row(y);
+        for(size_t x = 0; x < Width; x++)
+        {
+            const uint8_t c = row[x];
+            const uint64_t bit = c < ColorSet::MaxColors ? (colorMask >> c) & 1 : 0;
+            spriteRow[x] = bit ? c : spriteRow[x];
+            spriteMask |= bit << (c & (ColorSet::MaxColors - 1));
+        }
+    }
+    return spriteMask;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+Sprite extractSprite(const Image2D& image,
                      size_t xPos,
                      size_t yPos,
                      size_t width,
                      size_t height,
-                     const std::set<uint8_t>& colors,
+                     const Colors& colors,
                      uint8_t backgroundColor,
-                     bool removePixels)
+                     std::pmr::memory_resource* resource)
 {
-    Sprite s;
-    s.pixels = Image2D(width, height);
-    s.x = xPos;
-    s.y = yPos;
-    for(size_t y = 0; y < height; y++)
+    Sprite s{static_cast<int>(xPos), static_cast<int>(yPos), 0, Colors(), SpritePixels(width, height, backgroundColor, resource), 0, 0};
+    if(width == 8 && xPos + width <= image.width() && yPos + height <= image.height())
+    {
+        if(height == 8)
+        {
+            s.colors = Colors::fromMask(extractSpritePixels<8, 8>(image, xPos, yPos, colors.mask(), s.pixels));
+            return s;
+        }
+        if(height == 16)
+        {
+            s.colors = Colors::fromMask(extractSpritePixels<8, 16>(image, xPos, yPos, colors.mask(), s.pixels));
+            return s;
+        }
+    }
+    const size_t xEnd = std::min(width, xPos < image.width() ? image.width() - xPos : 0);
+    const size_t yEnd = std::min(height, yPos < image.height() ? image.height() - yPos : 0);
+    for(size_t y = 0; y < yEnd; y++)
     {
-        for(size_t x = 0; x < width; x++)
+        const uint8_t* row = image.row(yPos + y) + xPos;
+        uint8_t* spriteRow = s.pixels.row(y);
+        for(size_t x = 0; x < xEnd; x++)
         {
-            uint8_t c = image(xPos + x, yPos + y);
-            bool insideImage = xPos + x < image.width() && yPos + y < image.height();
-            if(colors.count(c) > 0 && insideImage)
+            const uint8_t c = row[x];
+            if(colors.count(c) > 0)
             {
-                s.pixels(x, y) = c;
+                spriteRow[x] = c;
                 s.colors.insert(c);
-                if(removePixels)
-                {
-                    image(xPos + x, yPos + y) = backgroundColor;
-                }
             }
-            else
+        }
+    }
+    return s;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+Sprite extractSprite(Image2D& image,
+                     size_t xPos,
+                     size_t yPos,
+                     size_t width,
+                     size_t height,
+                     const Colors& colors,
+                     uint8_t backgroundColor,
+                     bool removePixels,
+                     std::pmr::memory_resource* resource)
+{
+    Sprite s = extractSprite(static_cast<const Image2D&>(image), xPos, yPos, width, height, colors, backgroundColor, resource);
+    if(removePixels)
+    {
+        for(size_t y = 0; y < height; y++)
+        {
+            for(size_t x = 0; x < width; x++)
             {
-                s.pixels(x, y) = backgroundColor;
+                if(s.pixels(x, y) != backgroundColor)
+                    image(xPos + x, yPos + y) = backgroundColor;
             }
         }
     }
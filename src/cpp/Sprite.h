@@ -18,28 +18,50 @@
 #ifndef SPRITE_H
 #define SPRITE_H
 
-#include <set>
-
 #include "Array2D.h"
+#include "ColorSet.h"
+#include "ConversionArena.h"
+
+// Heap-allocated unless extracted into a ConversionArena
+using SpritePixels = Array2D<uint8_t, ArenaAllocator<uint8_t>>;
 
 struct Sprite
 {
     int x;
     int y;
     int p;
-    std::set<uint8_t> colors;
-    Image2D pixels;
+    Colors colors;
+    SpritePixels pixels;
     int numBlankPixelsLeft;
     int numBlankPixelsRight;
 };
 
+// Colors of all non-background pixels in the given area, where pixels outside the image count as background
+Colors regionColors(const Image2D& image,
+                    size_t xPos,
+                    size_t yPos,
+                    size_t width,
+                    size_t height,
+                    uint8_t backgroundColor);
+
+Sprite extractSprite(const Image2D& image,
+                     size_t xPos,
+                     size_t yPos,
+                     size_t width,
+                     size_t height,
+                     const Colors& colors,
+                     uint8_t backgroundColor,
+                     std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+
+// As above, but with removePixels also clears the extracted pixels from image
 Sprite extractSprite(Image2D& image,
                      size_t xPos,
                      size_t yPos,
                      size_t width,
                      size_t height,
-                     const std::set<uint8_t>& colors,
+                     const Colors& colors,
                      uint8_t backgroundColor,
-                     bool removePixels);
+                     bool removePixels,
+                     std::pmr::memory_resource* resource = std::pmr::get_default_resource());
 
 #endif // SPRITE_H
@@ -0,0 +1,228 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <algorithm>
+#include <limits>
+#include <utility>
+
+#include "SpritePlacement.h"
+
+//---------------------------------------------------------------------------------------------------------------------
+
+int countBandSprites(const Image2D& overlayImage,
+                     uint8_t backgroundColor,
+                     size_t y,
+                     size_t spriteWidth,
+                     size_t spriteHeight,
+                     const std::vector<Colors>& spritePalettes)
+{
+    // Colors of each column in the band, with extracted colors removed as the sweep goes
+    const size_t width = overlayImage.width();
+    const size_t yEnd = std::min(y + spriteHeight, overlayImage.height());
+    std::vector<uint64_t> columnColors(width, 0);
+    for(size_t i = y; i < yEnd; i++)
+    {
+        const uint8_t* row = overlayImage.row(i);
+        for(size_t x = 0; x < width; x++)
+            columnColors[x] |= uint64_t(1) << row[x];
+    }
+    const uint64_t backgroundMask = ~(uint64_t(1) << backgroundColor);
+    for(uint64_t& colors : columnColors)
+        colors &= backgroundMask;
+    int numSprites = 0;
+    for(size_t x = 0; x < width;)
+    {
+        if(columnColors[x] == 0)
+        {
+            x++;
+            continue;
+        }
+        const size_t xEnd = std::min(x + spriteWidth, width);
+        uint64_t regionColors = 0;
+        for(size_t j = x; j < xEnd; j++)
+            regionColors |= columnColors[j];
+        // Same choice as OverlayOptimiser::extractSpriteWithBestPalette
+        size_t bestIndex = 0;
+        int bestMaxColors = 0;
+        for(size_t i = 0; i < spritePalettes.size(); i++)
+        {
+            const int numColors = Colors::fromMask(regionColors & spritePalettes[i].mask()).size();
+            if(numColors > bestMaxColors)
+            {
+                bestIndex = i;
+                bestMaxColors = numColors;
+            }
+        }
+        if(bestMaxColors == 0)
+        {
+            // No sprite can be extracted here
+            x++;
+            continue;
+        }
+        numSprites++;
+        for(size_t j = x; j < xEnd; j++)
+            columnColors[j] &= ~spritePalettes[bestIndex].mask();
+    }
+    return numSprites;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+std::vector<size_t> chooseSpriteBands(const Image2D& overlayImage,
+                                      uint8_t backgroundColor,
+                                      size_t spriteWidth,
+                                      size_t spriteHeight,
+                                      const std::vector<Colors>& spritePalettes,
+                                      const std::vector<int>& fixedSpritesPerScanline)
+{
+    const size_t height = overlayImage.height();
+    assert(fixedSpritesPerScanline.size() == height);
+    const int Infinite = std::numeric_limits<int>::max();
+    // Band costs for each start row: free sprites, and the resulting peak sprites on its scanlines
+    std::vector<int> bandSprites(height, 0);
+    std::vector<int> bandPeak(height, 0);
+    std::vector<bool> rowEmpty(height);
+    for(size_t y = 0; y < height; y++)
+        rowEmpty[y] = overlayImage.emptyRow(y, backgroundColor);
+    for(size_t y = 0; y < height; y++)
+    {
+        bandSprites[y] = countBandSprites(overlayImage, backgroundColor, y, spriteWidth, spriteHeight, spritePalettes);
+        if(bandSprites[y] > 0)
+        {
+            const size_t yEnd = std::min(y + spriteHeight, height);
+            bandPeak[y] = bandSprites[y] + *std::max_element(fixedSpritesPerScanline.begin() + y, fixedSpritesPerScanline.begin() + yEnd);
+        }
+    }
+    // Rows from y onwards as either an empty row that is skipped, or the start of a band
+    auto next = [&](size_t y)
+    {
+        return std::min(y + spriteHeight, height);
+    };
+    // Lowest achievable peak from each row onwards
+    std::vector<int> peak(height + 1, 0);
+    for(size_t y = height; y-- > 0;)
+    {
+        const int skipped = rowEmpty[y] ? peak[y + 1] : Infinite;
+        const int banded = std::max(bandPeak[y], peak[next(y)]);
+        peak[y] = std::min(skipped, banded);
+    }
+    // Fewest sprites from each row onwards, without any band exceeding that peak
+    const int maxPeak = peak[0];
+    std::vector<int> total(height + 1, 0);
+    std::vector<bool> skip(height, false);
+    for(size_t y = height; y-- > 0;)
+    {
+        const int skipped = rowEmpty[y] ? total[y + 1] : Infinite;
+        const int banded = (bandPeak[y] <= maxPeak && total[next(y)] != Infinite) ? bandSprites[y] + total[next(y)] : Infinite;
+        // Ties start bands at the first non-empty row, like a plain top-down sweep
+        skip[y] = skipped <= banded;
+        total[y] = std::min(skipped, banded);
+    }
+    std::vector<size_t> bands;
+    for(size_t y = 0; y < height;)
+    {
+        if(skip[y])
+        {
+            y++;
+        }
+        else
+        {
+            bands.push_back(y);
+            y = next(y);
+        }
+    }
+    return bands;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+std::vector<Sprite> coverSpriteRows(const std::vector<Sprite>& sprites,
+                                    size_t spriteWidth,
+                                    size_t spriteHeight,
+                                    uint8_t backgroundColor,
+                                    std::pmr::memory_resource* resource)
+{
+    // Group sprites by row and palette in order of first appearance
+    std::vector<std::pair<int, int>> groupKeys;
+    std::vector<std::vector<const Sprite*>> groups;
+    for(const Sprite& s : sprites)
+    {
+        auto key = std::make_pair(s.y, s.p);
+        auto it = std::find(groupKeys.begin(), groupKeys.end(), key);
+        if(it == groupKeys.end())
+        {
+            groupKeys.push_back(key);
+            groups.emplace_back();
+            it = groupKeys.end() - 1;
+        }
+        groups[it - groupKeys.begin()].push_back(&s);
+    }
+    std::vector<Sprite> coveredSprites;
+    for(size_t g = 0; g < groups.size(); g++)
+    {
+        // Combine the group's pixels into one band, wide enough for a sprite starting at its rightmost pixel
+        int xMin = std::numeric_limits<int>::max();
+        int xMax = std::numeric_limits<int>::min();
+        for(const Sprite* s : groups[g])
+        {
+            xMin = std::min(xMin, s->x);
+            xMax = std::max(xMax, s->x + static_cast<int>(spriteWidth));
+        }
+        const size_t bandWidth = xMax - xMin + spriteWidth;
+        SpritePixels band(bandWidth, spriteHeight, backgroundColor, resource);
+        std::vector<bool> columnUsed(bandWidth, false);
+        for(const Sprite* s : groups[g])
+        {
+            for(size_t y = 0; y < spriteHeight; y++)
+            {
+                for(size_t x = 0; x < spriteWidth; x++)
+                {
+                    const uint8_t c = s->pixels(x, y);
+                    if(c != backgroundColor)
+                    {
+                        band(s->x - xMin + x, y) = c;
+                        columnUsed[s->x - xMin + x] = true;
+                    }
+                }
+            }
+        }
+        // Each sprite starts at the leftmost column still uncovered, which needs the fewest sprites
+        for(size_t x = 0; x < bandWidth;)
+        {
+            if(!columnUsed[x])
+            {
+                x++;
+                continue;
+            }
+            Sprite s{xMin + static_cast<int>(x), groupKeys[g].first, groupKeys[g].second, Colors(), SpritePixels(spriteWidth, spriteHeight, backgroundColor, resource), 0, 0};
+            for(size_t y = 0; y < spriteHeight; y++)
+            {
+                for(size_t i = 0; i < spriteWidth; i++)
+                {
+                    const uint8_t c = band(x + i, y);
+                    s.pixels(i, y) = c;
+                    if(c != backgroundColor)
+                        s.colors.insert(c);
+                }
+            }
+            coveredSprites.push_back(std::move(s));
+            x += spriteWidth;
+        }
+    }
+    return coveredSprites;
+}
@@ -0,0 +1,67 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#pragma once
+#ifndef SPRITE_PLACEMENT_H
+#define SPRITE_PLACEMENT_H
+
+#include <cstdint>
+#include <vector>
+#include <memory_resource>
+
+#include "Array2D.h"
+#include "ColorSet.h"
+#include "Sprite.h"
+
+//
+// Placement of the sprites covering the overlay layers, minimising the number of sprites per scanline.
+//
+// Free overlay pixels are extracted in bands of one sprite height, swept left to right like extractSprite
+// placements with the best palette at each occupied column. As covering columns with fixed-width intervals
+// is solved optimally by that sweep, what remains is placing the bands themselves: chooseSpriteBands
+// does that by dynamic programming over the rows, first minimising the peak sprites on any scanline and
+// then the total number of sprites.
+//
+
+// Start rows of the bands to extract free sprites from, with every non-empty row of overlayImage covered by
+// exactly one band. fixedSpritesPerScanline holds the sprites already placed on each scanline, e.g. the grid
+// sprites, and spritePalettes the candidate palettes of each free sprite.
+std::vector<size_t> chooseSpriteBands(const Image2D& overlayImage,
+                                      uint8_t backgroundColor,
+                                      size_t spriteWidth,
+                                      size_t spriteHeight,
+                                      const std::vector<Colors>& spritePalettes,
+                                      const std::vector<int>& fixedSpritesPerScanline);
+
+// Number of free sprites the left-to-right sweep extracts from the band of rows [y, y + spriteHeight)
+int countBandSprites(const Image2D& overlayImage,
+                     uint8_t backgroundColor,
+                     size_t y,
+                     size_t spriteWidth,
+                     size_t spriteHeight,
+                     const std::vector<Colors>& spritePalettes);
+
+// Re-covers the pixels of all sprites sharing a row and palette with the fewest sprites, placing each sprite
+// at the leftmost pixel column not yet covered. Sprites keep the order of each row / palette's first sprite.
+std::vector<Sprite> coverSpriteRows(const std::vector<Sprite>& sprites,
+                                    size_t spriteWidth,
+                                    size_t spriteHeight,
+                                    uint8_t backgroundColor,
+                                    std::pmr::memory_resource* resource = std::pmr::get_default_resource());
+
+#endif // SPRITE_PLACEMENT_H
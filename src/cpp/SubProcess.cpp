@@ -19,18 +19,51 @@
 #include <stdexcept>
 #include <string>
 #include <vector>
+#include <chrono>
+#include <thread>
 
 #ifdef _WIN32
 #define NOMINMAX
 #include <windows.h>
 #else
 #include <stdlib.h>
+#include <errno.h>
+#include <signal.h>
 #include <unistd.h>
 #include <sys/wait.h>
 #endif
 
 #include "SubProcess.h"
 
+// How often a running process is checked for cancellation / timeout
+static const int PollIntervalMs = 20;
+
+//
+// Tracks the 10x timeOut wait limit of executeProcess
+//
+class ProcessDeadline
+{
+public:
+    explicit ProcessDeadline(int timeOut):
+        mEnabled(timeOut > 0),
+        mDeadline(std::chrono::steady_clock::now() + std::chrono::seconds(10 * timeOut))
+    {}
+
+    bool expired() const
+    {
+        return mEnabled && std::chrono::steady_clock::now() >= mDeadline;
+    }
+
+private:
+    bool mEnabled;
+    std::chrono::steady_clock::time_point mDeadline;
+};
+
+static bool cancelled(const std::atomic<bool>* cancelRequested)
+{
+    return cancelRequested && *cancelRequested;
+}
+
 #ifdef _WIN32
 
 std::string quoteStringOnWindows(const std::string& s)
@@ -54,7 +87,8 @@ std::wstring mergedParams(std::vector<std::string>& params)
 int executeProcess(std::string exeFilename,
                    std::vector<std::string> params,
                    int timeOut,
-                   std::string startingDirectory)
+                   std::string startingDirectory,
+                   const std::atomic<bool>* cancelRequested)
 {
     // Create structures
     STARTUPINFO si;
@@ -69,38 +103,65 @@ int executeProcess(std::string exeFilename,
     std::wstring paramsW = mergedParams(params);
     // Attempt to execute
     std::wstring startingDirectoryW(startingDirectory.begin(), startingDirectory.end());
+    // Job object to kill the solver processes started by CMPL together with it
+    HANDLE job = CreateJobObject(nullptr, nullptr);
+    if(job == nullptr)
+    {
+        throw std::runtime_error("Failed to create job object");
+    }
+    JOBOBJECT_EXTENDED_LIMIT_INFORMATION jobLimits;
+    ZeroMemory( &jobLimits, sizeof(jobLimits) );
+    jobLimits.BasicLimitInformation.LimitFlags = JOB_OBJECT_LIMIT_KILL_ON_JOB_CLOSE;
+    SetInformationJobObject(job, JobObjectExtendedLimitInformation, &jobLimits, sizeof(jobLimits));
 
-    if( CreateProcessW( exeFilenameW.c_str(),
-                        &paramsW[0],
-                        nullptr,                    // Don't inherit process handle
-                        nullptr,                    // Don't inherit thread handle
-                        0,                          // Handle inheritance off
-                        0,                          // Flags
-                        nullptr,                    // Parent environment block
-                        startingDirectoryW.c_str(), // Parent starting directory
-                        &si,
-                        &pi ))
+    if( !CreateProcessW( exeFilenameW.c_str(),
+                         &paramsW[0],
+                         nullptr,                    // Don't inherit process handle
+                         nullptr,                    // Don't inherit thread handle
+                         0,                          // Handle inheritance off
+                         CREATE_SUSPENDED,           // Flags - resumed once in job
+                         nullptr,                    // Parent environment block
+                         startingDirectoryW.c_str(), // Parent starting directory
+                         &si,
+                         &pi ))
     {
-        // Wait until process is finished - but no longer than 10x timeOut value
-        // Or a ridiculously long time if timeOut is 0 (=disabled)
-        int timeOutMs = timeOut ? 1000 * timeOut : 200000000;
-        uint32_t eventType = WaitForSingleObject(pi.hProcess, 10 * timeOutMs);
-        if(eventType == WAIT_OBJECT_0)
+        // Process invocation failed
+        CloseHandle(job);
+        throw std::runtime_error("Failed to invoke process");
+    }
+    // Can fail if OverlayPal itself runs in a job that doesn't allow nesting - then only the process is killed
+    bool inJob = AssignProcessToJobObject(job, pi.hProcess);
+    ResumeThread(pi.hThread);
+    CloseHandle(pi.hThread);
+    // Wait until process is finished - but no longer than 10x timeOut value
+    ProcessDeadline deadline(timeOut);
+    DWORD exitCode = 0xFFFFFFFF;
+    bool finished = false;
+    while(!cancelled(cancelRequested) && !deadline.expired())
+    {
+        if(WaitForSingleObject(pi.hProcess, PollIntervalMs) == WAIT_OBJECT_0)
         {
-            DWORD exitCode = 0xFFFFFFFF;
             GetExitCodeProcess(pi.hProcess, &exitCode);
-            return int(exitCode);
-        }
-        else
-        {
-            throw std::runtime_error("Waited too long on process.");
+            finished = true;
+            break;
         }
     }
-    else
+    if(!finished)
     {
-        // Process invocation failed
-        throw std::runtime_error("Failed to invoke process");
+        if(inJob)
+            TerminateJobObject(job, exitCode);
+        else
+            TerminateProcess(pi.hProcess, exitCode);
+        WaitForSingleObject(pi.hProcess, INFINITE);
     }
+    CloseHandle(pi.hProcess);
+    CloseHandle(job);
+    if(finished)
+        return int(exitCode);
+    else if(cancelled(cancelRequested))
+        throw ProcessCancelled();
+    else
+        throw std::runtime_error("Waited too long on process.");
 }
 #else
 
@@ -124,7 +185,8 @@ std::vector<char*> splitParams(std::vector<std::string>& params)
 int executeProcess(std::string exeFilename,
                    std::vector<std::string> params,
                    int timeOut,
-                   std::string startingDirectory)
+                   std::string startingDirectory,
+                   const std::atomic<bool>* cancelRequested)
 {
     // Split space-separated parameters into individual asciiz strings to create argv
     std::vector<char*> ptrs = splitParams(params);
@@ -139,15 +201,43 @@ int executeProcess(std::string exeFilename,
     }
     else if(pid == 0)
     {
-        // Run program in forked process - new process also terminates here
+        // Run program in forked process, in its own process group so that the solver processes
+        // started by CMPL can be killed together with it
+        setpgid(0, 0);
+        if(!startingDirectory.empty() && chdir(startingDirectory.c_str()) != 0)
+            _exit(127);
         execv(exeFilename.c_str(), argv);
+        // Only reached if execv failed - must not return into the parent's code
+        _exit(127);
     }
-    else
+    // Also set in parent, as the child may not have run yet when it needs to be killed
+    setpgid(pid, pid);
+    // Wait for forked process to finish - but no longer than 10x timeOut value
+    ProcessDeadline deadline(timeOut);
+    int status = 0;
+    while(true)
     {
-        // Wait for forked process to finish
-        int exitCode = -1;
-        waitpid(pid, &exitCode, 0);
-        return exitCode;
+        pid_t waitResult = waitpid(pid, &status, WNOHANG);
+        if(waitResult == pid)
+        {
+            return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+        }
+        else if(waitResult == -1 && errno != EINTR)
+        {
+            throw std::runtime_error("waitpid() failed in executeProcess");
+        }
+        if(cancelled(cancelRequested) || deadline.expired())
+        {
+            kill(-pid, SIGKILL);
+            while(waitpid(pid, &status, 0) == -1 && errno == EINTR)
+            {
+            }
+            if(cancelled(cancelRequested))
+                throw ProcessCancelled();
+            else
+                throw std::runtime_error("Waited too long on process.");
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(PollIntervalMs));
     }
 }
 #endif
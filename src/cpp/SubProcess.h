@@ -21,8 +21,31 @@
 #define SUB_PROCESS_H
 
 #include <string>
+#include <vector>
+#include <atomic>
+#include <stdexcept>
 
-int executeProcess(std::string exeFilename, std::vector<std::string> params, int timeOut, std::string startingDirectory);
+//
+// Thrown by executeProcess when the process was killed because cancellation was requested
+//
+class ProcessCancelled: public std::runtime_error
+{
+public:
+    ProcessCancelled():
+        std::runtime_error("Process cancelled")
+    {}
+};
+
+//
+// Runs exeFilename in startingDirectory and returns its exit code. The process and all its child processes are
+// killed after waiting 10x timeOut seconds (throwing std::runtime_error), or as soon as *cancelRequested is set
+// (throwing ProcessCancelled). A timeOut of 0 disables the timeout.
+//
+int executeProcess(std::string exeFilename,
+                   std::vector<std::string> params,
+                   int timeOut,
+                   std::string startingDirectory,
+                   const std::atomic<bool>* cancelRequested = nullptr);
 
 std::string quoteStringOnWindows(const std::string& s);
 
@@ -0,0 +1,235 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QThread>
+#include <QDir>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include <iostream>
+
+#include "BatchConverter.h"
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("OverlayPalBatch");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Headless batch conversion of images to NES background / sprite overlays.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("input", "Directory of images, or manifest file listing one image per line.");
+    QCommandLineOption outputOption({"o", "output"}, "Output directory.", "dir", ".");
+    QCommandLineOption jobsOption({"j", "jobs"}, "Number of conversions to run in parallel.", "n", QString::number(QThread::idealThreadCount()));
+    QCommandLineOption workPathOption("work-path", "Directory for temporary solver files.", "dir", QDir::tempPath() + "/OverlayPalBatch");
+    QCommandLineOption dataPathOption("data-path", "Directory containing Cmpl/, nespalettes/ and the .cmpl models.", "dir", QCoreApplication::applicationDirPath());
+    QCommandLineOption paletteOption("palette", "Hardware palette used for color mapping.", "name", "palgen");
+    QCommandLineOption noColorMappingOption("no-color-mapping", "Use indexed images as NES hardware colors directly.");
+    QCommandLineOption uniqueColorsOption("unique-colors", "Keep unique input colors unique after color mapping.");
+    QCommandLineOption autoShiftOption("auto-shift", "Shift each image by the guessed optimal shift.");
+    QCommandLineOption backgroundColorOption("background-color", "Background color as hex NES color, or 'auto'.", "color", "auto");
+    QCommandLineOption cellSizeOption("cell-size", "Background grid cell size (16 or 8).", "size", "16");
+    QCommandLineOption spriteHeightOption("sprite-height", "Sprite height (16 or 8).", "height", "16");
+    QCommandLineOption maxBackgroundPalettesOption("max-bg-palettes", "Maximum number of background palettes.", "n", "4");
+    QCommandLineOption maxSpritePalettesOption("max-spr-palettes", "Maximum number of sprite palettes.", "n", "4");
+    QCommandLineOption maxSpritesPerScanlineOption("max-sprites-per-scanline", "Maximum number of sprites per scanline.", "n", "8");
+    QCommandLineOption solverOption("solver", "Solver backend: 'cmpl' (external process), 'cbc' (in-process library) or 'heuristic' (fast, may not meet all constraints).", "solver", cbcLibraryAvailable() ? "cbc" : "cmpl");
+    QCommandLineOption heuristicFirstOption("heuristic-first", "Try the heuristic first, and only run the solver when its result does not meet all constraints.");
+    QCommandLineOption bandHeightOption("band-height", "Solve each pass as independent bands of this many grid rows in parallel, with palettes fixed by the heuristic (cbc solver only, 0 = off).", "rows", "0");
+    QCommandLineOption presolveOption("presolve", "Merge grid cells of equal colors into one weighted cell before solving (cbc solver only).");
+    QCommandLineOption portfolioBackgroundColorsOption("portfolio-bg-colors", "Race the n most common colors as background color (without --background-color).", "n", "1");
+    QCommandLineOption portfolioShiftsOption("portfolio-shifts", "Race the n best shifts (with --auto-shift).", "n", "1");
+    QCommandLineOption portfolioSeedsOption("portfolio-seeds", "Race n CBC random seeds.", "n", "1");
+    QCommandLineOption keepWorkFilesOption("keep-work-files", "Keep each conversion's solver data and solution files below the work path.");
+    QCommandLineOption cachePathOption("cache-path", "Directory for cached conversion results, re-used when an image is converted again with the same settings.", "dir");
+    QCommandLineOption dedupFlippedSpritesOption("dedup-flipped-sprites", "Store horizontally / vertically mirrored sprite tiles once, using the OAM flip bits.");
+    QCommandLineOption sequenceOption("sequence", "Convert all input images, in order, as the frames of one animation sharing palettes and CHR, written as <name>_bg.chr, <name>_spr.chr and <name>_palette.dat.", "name");
+    QCommandLineOption mapOption("map", "Convert each input image as a map of screens, e.g. a scrolling level, with palettes and CHR shared by all its screens. The nametable, exRAM and attributes are written as streamable tile 'columns' or 'rows' to <name>.nam, <name>.exram and <name>.atr.", "order");
+    QCommandLineOption reportOption("report", "Write the stage times, solver statistics and memory use of each conversion to this JSON file.", "file");
+    QCommandLineOption timeOutOption("timeout", "Solver timeout in seconds per pass (0 = no timeout).", "seconds", "60");
+    parser.addOptions({outputOption,
+                       jobsOption,
+                       workPathOption,
+                       dataPathOption,
+                       paletteOption,
+                       noColorMappingOption,
+                       uniqueColorsOption,
+                       autoShiftOption,
+                       backgroundColorOption,
+                       cellSizeOption,
+                       spriteHeightOption,
+                       maxBackgroundPalettesOption,
+                       maxSpritePalettesOption,
+                       maxSpritesPerScanlineOption,
+                       solverOption,
+                       heuristicFirstOption,
+                       bandHeightOption,
+                       presolveOption,
+                       portfolioBackgroundColorsOption,
+                       portfolioShiftsOption,
+                       portfolioSeedsOption,
+                       keepWorkFilesOption,
+                       cachePathOption,
+                       dedupFlippedSpritesOption,
+                       sequenceOption,
+                       mapOption,
+                       reportOption,
+                       timeOutOption});
+    parser.process(app);
+
+    const QStringList positionalArguments = parser.positionalArguments();
+    if(positionalArguments.size() != 1)
+    {
+        parser.showHelp(1);
+    }
+
+    BatchSettings settings;
+    settings.dataPath = parser.value(dataPathOption);
+    settings.workPath = parser.value(workPathOption);
+    settings.outputPath = parser.value(outputOption);
+    settings.hardwarePaletteName = parser.value(paletteOption);
+    settings.mapInputColors = !parser.isSet(noColorMappingOption);
+    settings.uniqueColors = parser.isSet(uniqueColorsOption);
+    settings.autoShift = parser.isSet(autoShiftOption);
+    if(parser.value(backgroundColorOption) != "auto")
+        settings.backgroundColor = parser.value(backgroundColorOption).toInt(nullptr, 16);
+    settings.gridCellWidth = parser.value(cellSizeOption).toInt();
+    settings.gridCellHeight = settings.gridCellWidth;
+    settings.spriteHeight = parser.value(spriteHeightOption).toInt();
+    settings.maxBackgroundPalettes = parser.value(maxBackgroundPalettesOption).toInt();
+    settings.maxSpritePalettes = parser.value(maxSpritePalettesOption).toInt();
+    settings.maxSpritesPerScanline = parser.value(maxSpritesPerScanlineOption).toInt();
+    settings.timeOut = parser.value(timeOutOption).toInt();
+    const QString solverName = parser.value(solverOption);
+    settings.heuristicFirst = parser.isSet(heuristicFirstOption);
+    settings.decompositionBandHeight = parser.value(bandHeightOption).toInt();
+    settings.presolve = parser.isSet(presolveOption);
+    settings.portfolioBackgroundColors = parser.value(portfolioBackgroundColorsOption).toInt();
+    settings.portfolioShifts = parser.value(portfolioShiftsOption).toInt();
+    settings.portfolioSeeds = parser.value(portfolioSeedsOption).toInt();
+    settings.keepWorkFiles = parser.isSet(keepWorkFilesOption);
+    settings.cachePath = parser.value(cachePathOption);
+    settings.dedupFlippedSprites = parser.isSet(dedupFlippedSpritesOption);
+    settings.sequenceName = parser.value(sequenceOption);
+    settings.convertMaps = parser.isSet(mapOption);
+
+    if((settings.gridCellWidth != 8 && settings.gridCellWidth != 16) ||
+       (settings.spriteHeight != 8 && settings.spriteHeight != 16))
+    {
+        std::cerr << "Cell size and sprite height must be 8 or 16." << std::endl;
+        return 1;
+    }
+    if(settings.convertMaps)
+    {
+        if(parser.value(mapOption) == "columns")
+            settings.mapStreamOrder = MapStreamOrder::Columns;
+        else if(parser.value(mapOption) == "rows")
+            settings.mapStreamOrder = MapStreamOrder::Rows;
+        else
+        {
+            std::cerr << "Map order must be 'columns' or 'rows'." << std::endl;
+            return 1;
+        }
+        if(!settings.sequenceName.isEmpty())
+        {
+            std::cerr << "--map and --sequence cannot be combined." << std::endl;
+            return 1;
+        }
+    }
+    if(solverName == "cmpl")
+    {
+        settings.solverBackend = OverlayOptimiser::SolverBackend::CmplProcess;
+    }
+    else if(solverName == "cbc")
+    {
+        if(!cbcLibraryAvailable())
+        {
+            std::cerr << "This build does not include the CBC library solver - use --solver cmpl." << std::endl;
+            return 1;
+        }
+        if(settings.timeOut <= 0)
+        {
+            std::cerr << "The CBC library solver can't be interrupted, and needs a --timeout above 0." << std::endl;
+            return 1;
+        }
+        settings.solverBackend = OverlayOptimiser::SolverBackend::CbcLibrary;
+    }
+    else if(solverName == "heuristic")
+    {
+        settings.solverBackend = OverlayOptimiser::SolverBackend::Heuristic;
+    }
+    else
+    {
+        std::cerr << "Unknown solver '" << solverName.toStdString() << "'." << std::endl;
+        return 1;
+    }
+
+    BatchConverter converter(settings);
+    if(!converter.loadHardwarePalette())
+    {
+        std::cerr << "Failed to load hardware palette '" << settings.hardwarePaletteName.toStdString() << "'." << std::endl;
+        return 1;
+    }
+
+    QStringList inputFilenames = BatchConverter::collectInputFilenames(positionalArguments[0]);
+    if(inputFilenames.isEmpty())
+    {
+        std::cerr << "No input images found." << std::endl;
+        return 1;
+    }
+
+    int numFailed = 0;
+    QJsonArray reports;
+    auto printResult = [&](const BatchResult& result)
+    {
+        QJsonObject report;
+        report["input"] = result.inputFilename;
+        report["report"] = QJsonDocument::fromJson(QByteArray::fromStdString(result.report.toJson())).object();
+        reports.append(report);
+        if(result.converted && result.conversionError.isEmpty())
+        {
+            std::cout << "OK      " << result.inputFilename.toStdString() << std::endl;
+        }
+        else
+        {
+            std::cout << "FAILED  " << result.inputFilename.toStdString() << ": " << result.conversionError.toStdString() << std::endl;
+            numFailed++;
+        }
+    };
+    if(!settings.sequenceName.isEmpty())
+        converter.runSequence(inputFilenames, printResult);
+    else if(settings.convertMaps)
+        converter.runMaps(inputFilenames, printResult);
+    else
+        converter.run(inputFilenames, parser.value(jobsOption).toInt(), printResult);
+    std::cout << (inputFilenames.size() - numFailed) << " / " << inputFilenames.size() << " images converted." << std::endl;
+    if(parser.isSet(reportOption))
+    {
+        QFile reportFile(parser.value(reportOption));
+        if(!reportFile.open(QIODevice::WriteOnly) || reportFile.write(QJsonDocument(reports).toJson()) < 0)
+        {
+            std::cerr << "Failed to write report '" << reportFile.fileName().toStdString() << "'." << std::endl;
+            return 1;
+        }
+    }
+    return numFailed > 0 ? 1 : 0;
+}
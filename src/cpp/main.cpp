@@ -25,6 +25,7 @@
 
 #include "OverlayPalGuiBackend.h"
 #include "OverlayPalApp.h"
+#include "OverlayPalImageProvider.h"
 
 int main(int argc, char *argv[])
 {
@@ -34,6 +35,8 @@ int main(int argc, char *argv[])
 
     qmlRegisterType<OverlayPalGuiBackend>("nes.overlay.optimiser",1,0,"OverlayPalGuiBackend");
     QQmlApplicationEngine engine;
+    // Owned by the engine
+    engine.addImageProvider(OverlayPalImageProvider::Id, new OverlayPalImageProvider);
     engine.load(QUrl(QStringLiteral("qrc:/main.qml")));
     if (engine.rootObjects().isEmpty())
         return -1;
@@ -113,7 +113,7 @@ Window {
         onShiftXChanged: xShiftSpinBox.value = shiftX
         onShiftYChanged: yShiftSpinBox.value = shiftY
         onInputImageChanged: {
-            var img = Qt.resolvedUrl(optimiser.inputImageData());
+            var img = optimiser.inputImageUrl();
             srcImageCanvas.paletteGroupImages[0] = img;
             srcImageCanvas.inputImageUpdated();
             if(optimiser.potentialHardwarePaletteIndexedImage)
@@ -128,36 +128,46 @@ Window {
             }
         }
         onOutputImageChanged: {
-            conversionBusy.running = false
-            // Re-enable optimisation input controls
-            convertImageButton.enabled = !autoConversionCheckBox.checked;
-            inputImageGroupBox.enabled = true;
-            shiftGroupBox.enabled = true;
-            optimisationSettingsGroupBox.enabled = true;
-            spriteModeComboBox.enabled = true;
-            bgModeComboBox.enabled = true;
-            // Set groupbox title to either success message or error string
-            if(optimiser.conversionSuccessful)
+            if(optimiser.conversionInProgress)
             {
-                var numBackgroundTiles = optimiser.numBackgroundTiles;
-                var sprites = optimiser.debugSpritesOverlay();
-                dstImageGroupBox.title = "Conversion successful." +
-                                         "    BG tiles: " + numBackgroundTiles +
-                                         "    Sprites: " + sprites.length;
+                // Intermediate result - solver is still refining it
+                acceptConversionButton.enabled = true;
+                dstImageGroupBox.title = "Refining... (Accept to keep current result)";
             }
             else
             {
-                dstImageGroupBox.title = "Conversion FAILED! Error: " + optimiser.conversionError;
+                conversionBusy.running = false
+                acceptConversionButton.enabled = false;
+                // Re-enable optimisation input controls
+                convertImageButton.enabled = !autoConversionCheckBox.checked;
+                inputImageGroupBox.enabled = true;
+                shiftGroupBox.enabled = true;
+                optimisationSettingsGroupBox.enabled = true;
+                spriteModeComboBox.enabled = true;
+                bgModeComboBox.enabled = true;
+                // Set groupbox title to either success message or error string
+                if(optimiser.conversionSuccessful)
+                {
+                    var numBackgroundTiles = optimiser.numBackgroundTiles;
+                    var sprites = optimiser.debugSpritesOverlay();
+                    dstImageGroupBox.title = "Conversion successful." +
+                                             "    BG tiles: " + numBackgroundTiles +
+                                             "    Sprites: " + sprites.length;
+                }
+                else
+                {
+                    dstImageGroupBox.title = "Conversion FAILED! Error: " + optimiser.conversionError;
+                }
             }
 
             // Get each palette as a layer using masks
             for(var i = 0; i < dstImageCanvas.showPaletteGroup.length; i++)
             {
-                var img = Qt.resolvedUrl(optimiser.outputImageDataRGBA(1 << i, true));
+                var img = optimiser.outputImageUrlRGBA(1 << i, true);
                 dstImageCanvas.paletteGroupImages[i] = img;
             }
             // Get backdrop
-            dstImageCanvas.backdropImage = Qt.resolvedUrl(optimiser.outputImageDataRGBA(0x00, false));
+            dstImageCanvas.backdropImage = optimiser.outputImageUrlRGBA(0x00, false);
             // Get debugging data
             dstImageCanvas.debugNumSourceColorsBackground = optimiser.debugNumSourceColorsBackground();
             dstImageCanvas.debugSourceColorsBackground = optimiser.debugSourceColorsBackground();
@@ -174,6 +184,9 @@ Window {
             // Enable save/export now that output image is valid
             saveImageButton.enabled = true;
             exportImageButton.enabled = true;
+            conversionReportButton.enabled = !optimiser.conversionInProgress;
+            if(conversionReportPopup.visible)
+                conversionReportPopup.openPopup();
         }
 
         function startImageConversionWrapper()
@@ -935,29 +948,58 @@ Window {
                 title: qsTr("Output")
                 enabled: false
 
-                Button {
-                    id: saveImageButton
+                RowLayout {
                     x: 0
                     y: 88
                     width: 206
                     height: 32
-                    text: qsTr("Save converted PNG...")
-                    Component.onCompleted: {
-                        saveImageButton.onClicked.connect(saveConvertedDialog.openDialog);
+                    spacing: 8
+
+                    Button {
+                        id: saveImageButton
+                        text: qsTr("Save PNG...")
+                        Layout.preferredHeight: 32
+                        Layout.preferredWidth: 103
+                        Component.onCompleted: {
+                            saveImageButton.onClicked.connect(saveConvertedDialog.openDialog);
+                        }
+                        enabled: false
+                    }
+
+                    Button {
+                        id: conversionReportButton
+                        text: qsTr("Report...")
+                        Layout.preferredHeight: 32
+                        Layout.preferredWidth: 95
+                        onClicked: conversionReportPopup.openPopup()
+                        enabled: false
                     }
-                    enabled: false
                 }
-                Button {
-                    id: exportImageButton
+                RowLayout {
                     x: 0
                     y: 124
                     width: 206
                     height: 32
-                    text: qsTr("Export...")
-                    Component.onCompleted: {
-                        exportImageButton.onClicked.connect(exportConvertedDialog.openDialog);
+                    spacing: 8
+
+                    Button {
+                        id: exportImageButton
+                        text: qsTr("Export...")
+                        Layout.preferredHeight: 32
+                        Layout.preferredWidth: 103
+                        Component.onCompleted: {
+                            exportImageButton.onClicked.connect(exportConvertedDialog.openDialog);
+                        }
+                        enabled: false
+                    }
+
+                    CheckBox {
+                        id: dedupFlippedSpritesCheckBox
+                        text: qsTr("Flip tiles")
+                        leftPadding: 0
+                        checked: false
+                        onCheckStateChanged: optimiser.dedupFlippedSprites = checked
                     }
-                    enabled: false
                 }
                 RowLayout {
                     x: 0
@@ -973,6 +1015,7 @@ Window {
 
                     SpinBox {
                         id: timeOutSpinBox
+                        from: optimiser.minTimeOut
                         to: 999
                         value: 30
                         width: 140
@@ -1003,6 +1046,21 @@ Window {
                         }
                     }
 
+                    Button {
+                        id: acceptConversionButton
+                        y: 0
+                        height: 32
+                        text: qsTr("Accept")
+                        enabled: false
+                        Layout.preferredHeight: 36
+                        Layout.preferredWidth: 80
+                        onClicked: {
+                            // Stop refining and keep the current result
+                            enabled = false;
+                            optimiser.acceptConversion();
+                        }
+                    }
+
                     CheckBox {
                         id: autoConversionCheckBox
                         height: 32
@@ -1056,6 +1114,44 @@ Window {
                 visible = false;
             }
         }
+        // Stage times and solver statistics of the last conversion
+        Popup {
+            id: conversionReportPopup
+            x: (window.width - width) / 2
+            y: (window.height - height) / 2
+            width: 640
+            height: 480
+            modal: false
+            closePolicy: Popup.CloseOnEscape | Popup.CloseOnPressOutside
+            ColumnLayout {
+                anchors.fill: parent
+                Label {
+                    text: qsTr("Conversion report")
+                    font.bold: true
+                }
+                ScrollView {
+                    Layout.fillWidth: true
+                    Layout.fillHeight: true
+                    TextArea {
+                        id: conversionReportTextArea
+                        readOnly: true
+                        selectByMouse: true
+                        font.family: "Courier"
+                        wrapMode: TextEdit.NoWrap
+                    }
+                }
+                Button {
+                    text: qsTr("Close")
+                    Layout.alignment: Qt.AlignRight
+                    onClicked: conversionReportPopup.close()
+                }
+            }
+            function openPopup()
+            {
+                conversionReportTextArea.text = optimiser.conversionReport;
+                open();
+            }
+        }
         // Load input image dialog
         FileDialog {
             id: loadImageDialog
@@ -0,0 +1,50 @@
+# Checks that sequence / map export refuses shared CHR beyond what NES tile indices can address,
+# instead of writing corrupt nametables or OAM. Exits with a non-zero code if a check fails.
+TEMPLATE = app
+CONFIG += console c++17
+CONFIG -= app_bundle qt
+
+TARGET = ExportLimitsTest
+
+win32: LIBS += -lpsapi
+
+SOURCES += \
+    export_limits_test.cpp \
+    ../src/cpp/ColorLookup.cpp \
+    ../src/cpp/ConversionArena.cpp \
+    ../src/cpp/ConversionReport.cpp \
+    ../src/cpp/ConversionCache.cpp \
+    ../src/cpp/Export.cpp \
+    ../src/cpp/GridLayer.cpp \
+    ../src/cpp/HeuristicSolver.cpp \
+    ../src/cpp/ImageUtils.cpp \
+    ../src/cpp/MilpModel.cpp \
+    ../src/cpp/OverlayModel.cpp \
+    ../src/cpp/OverlayOptimiser.cpp \
+    ../src/cpp/ScratchDirectory.cpp \
+    ../src/cpp/SolutionReader.cpp \
+    ../src/cpp/Sprite.cpp \
+    ../src/cpp/SpritePlacement.cpp \
+    ../src/cpp/SubProcess.cpp
+
+HEADERS += \
+    ../src/cpp/Array2D.h \
+    ../src/cpp/ColorLookup.h \
+    ../src/cpp/ColorSet.h \
+    ../src/cpp/ConversionArena.h \
+    ../src/cpp/ConversionReport.h \
+    ../src/cpp/ConversionCache.h \
+    ../src/cpp/Export.h \
+    ../src/cpp/GridLayer.h \
+    ../src/cpp/HeuristicSolver.h \
+    ../src/cpp/ImageUtils.h \
+    ../src/cpp/MilpModel.h \
+    ../src/cpp/OverlayModel.h \
+    ../src/cpp/OverlayOptimiser.h \
+    ../src/cpp/ScratchDirectory.h \
+    ../src/cpp/SolutionReader.h \
+    ../src/cpp/Sprite.h \
+    ../src/cpp/SpritePlacement.h \
+    ../src/cpp/SubProcess.h
+
+INCLUDEPATH += ../src/cpp
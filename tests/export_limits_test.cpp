@@ -0,0 +1,117 @@
+//
+// This file is part of OverlayPal ( https://github.com/michel-iwaniec/OverlayPal )
+// Copyright (c) 2021 Michel Iwaniec.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+//
+
+#include <cstdio>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "OverlayOptimiser.h"
+#include "Export.h"
+
+static const int ScreenWidth = 256;
+static const int ScreenHeight = 240;
+static const int TileSize = 8;
+static const uint8_t BackgroundColor = 0x0F;
+
+//---------------------------------------------------------------------------------------------------------------------
+
+// Screens in which no two background tiles are the same, each tile's top two rows spelling out its number
+std::vector<Image2D> uniqueTileScreens(size_t numScreens)
+{
+    const int tilesWide = ScreenWidth / TileSize;
+    const int tilesHigh = ScreenHeight / TileSize;
+    std::vector<Image2D> screens;
+    for(size_t i = 0; i < numScreens; i++)
+    {
+        Image2D screen(ScreenWidth, ScreenHeight, 0x2A);
+        for(int ty = 0; ty < tilesHigh; ty++)
+        {
+            for(int tx = 0; tx < tilesWide; tx++)
+            {
+                const size_t tileNumber = tilesWide * tilesHigh * i + tilesWide * ty + tx;
+                for(int bit = 0; bit < 2 * TileSize; bit++)
+                {
+                    if((tileNumber >> bit) & 1)
+                        screen(TileSize * tx + bit % TileSize, TileSize * ty + bit / TileSize) = 0x16;
+                }
+            }
+        }
+        screens.push_back(std::move(screen));
+    }
+    return screens;
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+// Exports numScreens screens of unique tiles as a sequence, returning the export error or "" on success
+std::string exportUniqueTileScreens(size_t numScreens, size_t& numBackgroundTiles, bool& palettesIntact)
+{
+    OverlayOptimiser optimiser;
+    optimiser.setSolverBackend(OverlayOptimiser::SolverBackend::Heuristic);
+    std::vector<std::unique_ptr<OverlayOptimiser>> frameOptimisers;
+    optimiser.convertSequence(uniqueTileScreens(numScreens), BackgroundColor, 16, 16, 16, 3, 4, 4, 8, 10, frameOptimisers);
+    numBackgroundTiles = 0;
+    palettesIntact = true;
+    try
+    {
+        SequenceExportDataNES exportData = buildSequenceExportData(frameOptimisers, 0xFF);
+        numBackgroundTiles = exportData.bgCHR.size() / ExportDataNES::TileSize;
+        // The exRAM palette bits must match the optimiser's palette indices
+        for(size_t i = 0; i < frameOptimisers.size(); i++)
+        {
+            const Array2D<uint8_t>& paletteIndices = frameOptimisers[i]->debugPaletteIndicesBackground();
+            const std::vector<uint8_t>& exram = exportData.frames[i].exram;
+            for(size_t t = 0; t < 32 * 30; t++)
+            {
+                const size_t x = (t % 32) * paletteIndices.width() / 32;
+                const size_t y = (t / 32) * paletteIndices.height() / 30;
+                palettesIntact &= (exram[t] >> 6) == paletteIndices(x, y);
+            }
+        }
+        return "";
+    }
+    catch(const std::runtime_error& error)
+    {
+        return error.what();
+    }
+}
+
+//---------------------------------------------------------------------------------------------------------------------
+
+int main()
+{
+    int numFailed = 0;
+    auto check = [&](bool passed, const std::string& description)
+    {
+        std::printf("%s  %s\n", passed ? "PASS" : "FAIL", description.c_str());
+        numFailed += passed ? 0 : 1;
+    };
+    // 17 screens use 16320 tiles plus the blank tile 0, just within the 16384 MMC5 tile indices
+    size_t numBackgroundTiles = 0;
+    bool palettesIntact = false;
+    std::string error = exportUniqueTileScreens(17, numBackgroundTiles, palettesIntact);
+    check(error.empty(), "17 screens of unique tiles export" + (error.empty() ? "" : ": " + error));
+    check(numBackgroundTiles == 17 * 960 + 1, "17 screens use " + std::to_string(numBackgroundTiles) + " background tiles");
+    check(palettesIntact, "exRAM palette bits survive 14-bit tile indices");
+    // 18 screens use 17281 tiles, which would overwrite the exRAM palette bits
+    error = exportUniqueTileScreens(18, numBackgroundTiles, palettesIntact);
+    check(error.find("background tiles") != std::string::npos, "18 screens of unique tiles are refused: " + error);
+    return numFailed == 0 ? 0 : 1;
+}